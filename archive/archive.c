@@ -0,0 +1,432 @@
+/*
+ * zip and tar member access without extracting to disk.
+ *
+ * zip: the central directory is read once and members are located through
+ * their local headers; stored and deflate entries are supported, including
+ * zip64 sizes and offsets. tar: ustar headers with GNU long names and pax
+ * "path" records.
+ */
+
+#include <string.h>
+
+#include "archive.h"
+
+#define ZIP_EOCD_SIZE      22
+#define ZIP_EOCD_MAX_SCAN  (ZIP_EOCD_SIZE + 0xFFFF)
+#define ZIP64_EOCD_SIZE    56
+#define ZIP64_LOCATOR_SIZE 20
+#define ZIP_CDIR_SIZE      46
+#define ZIP_LOCAL_SIZE     30
+#define ZIP_MAX_CDIR_SIZE  (256 * 1024 * 1024)
+
+#define TAR_BLOCK_SIZE     512
+
+static uint16_t Get16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t Get32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t Get64(const uint8_t* p)
+{
+    return (uint64_t)Get32(p) | ((uint64_t)Get32(p + 4) << 32);
+}
+
+static bool SeekTo(FILE* fp, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(fp, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static bool ReadAt(FILE* fp, uint64_t offset, void* dst, size_t size)
+{
+    return SeekTo(fp, offset) && fread(dst, 1, size, fp) == size;
+}
+
+static bool GetSize(FILE* fp, uint64_t* size)
+{
+#ifdef _WIN32
+    if (_fseeki64(fp, 0, SEEK_END) != 0) {
+        return false;
+    }
+    __int64 pos = _ftelli64(fp);
+#else
+    if (fseeko(fp, 0, SEEK_END) != 0) {
+        return false;
+    }
+    off_t pos = ftello(fp);
+#endif
+    if (pos < 0) {
+        return false;
+    }
+    *size = (uint64_t)pos;
+    return true;
+}
+
+static bool HasSuffix(const char* name, size_t len, const char* suffix)
+{
+    size_t n = strlen(suffix);
+    if (len < n) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        char c = name[len - n + i];
+        if (c >= 'A' && c <= 'Z') {
+            c = (char)(c - 'A' + 'a');
+        }
+        if (c != suffix[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ArchiveType GetArchiveType(const char* path)
+{
+    size_t len = strlen(path);
+    if (HasSuffix(path, len, ".zip")) {
+        return ARCHIVE_ZIP;
+    }
+    if (HasSuffix(path, len, ".tar")) {
+        return ARCHIVE_TAR;
+    }
+    return ARCHIVE_NONE;
+}
+
+static bool AddMember(ArchiveIndex* index, const char* name, size_t name_len, const ArchiveMember* m)
+{
+    if (index->count == index->cap) {
+        size_t cap = index->cap ? index->cap * 2 : 64;
+        ArchiveMember* p = (ArchiveMember*)realloc(index->members, cap * sizeof(ArchiveMember));
+        if (p == NULL) {
+            return false;
+        }
+        index->members = p;
+        index->cap = cap;
+    }
+    char* s = (char*)malloc(name_len + 1);
+    if (s == NULL) {
+        return false;
+    }
+    memcpy(s, name, name_len);
+    s[name_len] = '\0';
+
+    ArchiveMember* dst = &index->members[index->count++];
+    *dst = *m;
+    dst->name = s;
+    return true;
+}
+
+static bool ReadZipIndex(FILE* fp, ArchiveIndex* index)
+{
+    uint64_t file_size;
+    if (!GetSize(fp, &file_size) || file_size < ZIP_EOCD_SIZE) {
+        return false;
+    }
+
+    // End of central directory record, possibly followed by a comment
+    size_t tail_size = file_size < ZIP_EOCD_MAX_SCAN ? (size_t)file_size : ZIP_EOCD_MAX_SCAN;
+    uint64_t tail_pos = file_size - tail_size;
+    uint8_t* tail = (uint8_t*)malloc(tail_size);
+    if (tail == NULL || !ReadAt(fp, tail_pos, tail, tail_size)) {
+        free(tail);
+        return false;
+    }
+    size_t eocd = tail_size - ZIP_EOCD_SIZE + 1;
+    while (eocd-- > 0) {
+        if (memcmp(tail + eocd, "PK\x05\x06", 4) == 0) {
+            break;
+        }
+    }
+    if (eocd == (size_t)-1) {
+        free(tail);
+        return false;
+    }
+    uint64_t entry_count = Get16(tail + eocd + 10);
+    uint64_t cdir_size = Get32(tail + eocd + 12);
+    uint64_t cdir_pos = Get32(tail + eocd + 16);
+    uint64_t eocd_pos = tail_pos + eocd;
+    free(tail);
+
+    if (entry_count == 0xFFFF || cdir_size == 0xFFFFFFFF || cdir_pos == 0xFFFFFFFF) {
+        uint8_t loc[ZIP64_LOCATOR_SIZE];
+        uint8_t rec[ZIP64_EOCD_SIZE];
+        if (eocd_pos < ZIP64_LOCATOR_SIZE
+            || !ReadAt(fp, eocd_pos - ZIP64_LOCATOR_SIZE, loc, sizeof(loc))
+            || memcmp(loc, "PK\x06\x07", 4) != 0
+            || !ReadAt(fp, Get64(loc + 8), rec, sizeof(rec))
+            || memcmp(rec, "PK\x06\x06", 4) != 0
+        ) {
+            return false;
+        }
+        entry_count = Get64(rec + 32);
+        cdir_size = Get64(rec + 40);
+        cdir_pos = Get64(rec + 48);
+    }
+    if (cdir_size > ZIP_MAX_CDIR_SIZE || cdir_pos + cdir_size > file_size) {
+        return false;
+    }
+
+    uint8_t* cdir = (uint8_t*)malloc(cdir_size ? (size_t)cdir_size : 1);
+    if (cdir == NULL || !ReadAt(fp, cdir_pos, cdir, (size_t)cdir_size)) {
+        free(cdir);
+        return false;
+    }
+
+    bool ok = true;
+    size_t pos = 0;
+    for (uint64_t i = 0; i < entry_count && ok; i++) {
+        if (pos + ZIP_CDIR_SIZE > cdir_size || memcmp(cdir + pos, "PK\x01\x02", 4) != 0) {
+            ok = false;
+            break;
+        }
+        const uint8_t* e = cdir + pos;
+        uint16_t flags = Get16(e + 8);
+        size_t name_len = Get16(e + 28);
+        size_t extra_len = Get16(e + 30);
+        size_t comment_len = Get16(e + 32);
+        size_t next = pos + ZIP_CDIR_SIZE + name_len + extra_len + comment_len;
+        if (next > cdir_size) {
+            ok = false;
+            break;
+        }
+
+        ArchiveMember m = {0};
+        m.method = Get16(e + 10);
+        m.crc32 = Get32(e + 16);
+        m.compSize = Get32(e + 20);
+        m.size = Get32(e + 24);
+        m.offset = Get32(e + 42);
+
+        // zip64 extended information: only the fields that overflowed, in order
+        const uint8_t* x = e + ZIP_CDIR_SIZE + name_len;
+        const uint8_t* x_end = x + extra_len;
+        while (x + 4 <= x_end) {
+            uint16_t id = Get16(x);
+            size_t len = Get16(x + 2);
+            const uint8_t* f = x + 4;
+            const uint8_t* f_end = f + len <= x_end ? f + len : x_end;
+            if (id == 0x0001) {
+                if (m.size == 0xFFFFFFFF && f + 8 <= f_end) {
+                    m.size = Get64(f);
+                    f += 8;
+                }
+                if (m.compSize == 0xFFFFFFFF && f + 8 <= f_end) {
+                    m.compSize = Get64(f);
+                    f += 8;
+                }
+                if (m.offset == 0xFFFFFFFF && f + 8 <= f_end) {
+                    m.offset = Get64(f);
+                }
+            }
+            x += 4 + len;
+        }
+
+        const char* name = (const char*)e + ZIP_CDIR_SIZE;
+        bool is_encrypted = (flags & 1) != 0;
+        if (!is_encrypted && HasSuffix(name, name_len, ".nes")) {
+            ok = AddMember(index, name, name_len, &m);
+        }
+        pos = next;
+    }
+    free(cdir);
+    return ok;
+}
+
+static uint64_t ParseTarNumber(const uint8_t* p, size_t len)
+{
+    uint64_t value = 0;
+
+    // GNU base-256 for values that don't fit in octal
+    if (p[0] & 0x80) {
+        value = p[0] & 0x7F;
+        for (size_t i = 1; i < len; i++) {
+            value = (value << 8) | p[i];
+        }
+        return value;
+    }
+    for (size_t i = 0; i < len && (p[i] == ' ' || (p[i] >= '0' && p[i] <= '7')); i++) {
+        if (p[i] != ' ') {
+            value = value * 8 + (p[i] - '0');
+        }
+    }
+    return value;
+}
+
+// Reads a long-name ('L') or pax ('x') payload; returns a malloc'ed, terminated copy
+static char* ReadTarPayload(FILE* fp, uint64_t size)
+{
+    if (size > ZIP_MAX_CDIR_SIZE) {
+        return NULL;
+    }
+    char* data = (char*)malloc((size_t)size + 1);
+    if (data == NULL || fread(data, 1, (size_t)size, fp) != size) {
+        free(data);
+        return NULL;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+// "<len> path=<value>\n" records
+static char* GetPaxPath(const char* pax, size_t size)
+{
+    size_t pos = 0;
+    while (pos < size) {
+        const char* rec = pax + pos;
+        size_t len = (size_t)strtoul(rec, NULL, 10);
+        if (len == 0 || pos + len > size) {
+            break;
+        }
+        const char* key = memchr(rec, ' ', len);
+        if (key != NULL && (size_t)(rec + len - key) > 6 && strncmp(key + 1, "path=", 5) == 0) {
+            size_t value_len = rec + len - (key + 6) - 1;
+            char* path = (char*)malloc(value_len + 1);
+            if (path != NULL) {
+                memcpy(path, key + 6, value_len);
+                path[value_len] = '\0';
+            }
+            return path;
+        }
+        pos += len;
+    }
+    return NULL;
+}
+
+static bool ReadTarIndex(FILE* fp, ArchiveIndex* index)
+{
+    uint8_t h[TAR_BLOCK_SIZE];
+    uint64_t pos = 0;
+    char* long_name = NULL;
+    bool ok = true;
+
+    if (!SeekTo(fp, 0)) {
+        return false;
+    }
+    while (ok && fread(h, 1, sizeof(h), fp) == sizeof(h)) {
+        pos += TAR_BLOCK_SIZE;
+        if (h[0] == '\0') {
+            break;      // End-of-archive block
+        }
+        uint64_t size = ParseTarNumber(h + 124, 12);
+        uint64_t padded = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+        char type = (char)h[156];
+
+        if (type == 'L' || type == 'x') {
+            char* payload = ReadTarPayload(fp, size);
+            if (payload == NULL) {
+                ok = false;
+                break;
+            }
+            free(long_name);
+            long_name = type == 'L' ? payload : GetPaxPath(payload, (size_t)size);
+            if (type == 'x') {
+                free(payload);
+            }
+        }
+        else if (type == '0' || type == '\0') {
+            char name[256 + 1];
+            size_t name_len;
+            const char* member_name = long_name;
+            if (member_name == NULL) {
+                // ustar: prefix "/" name
+                size_t prefix_len = memcmp(h + 257, "ustar", 5) == 0 ? strnlen((const char*)h + 345, 155) : 0;
+                size_t base_len = strnlen((const char*)h, 100);
+                name_len = 0;
+                if (prefix_len != 0) {
+                    memcpy(name, h + 345, prefix_len);
+                    name[prefix_len] = '/';
+                    name_len = prefix_len + 1;
+                }
+                memcpy(name + name_len, h, base_len);
+                name_len += base_len;
+                name[name_len] = '\0';
+                member_name = name;
+            }
+            name_len = strlen(member_name);
+            if (HasSuffix(member_name, name_len, ".nes")) {
+                ArchiveMember m = {0};
+                m.offset = pos;
+                m.compSize = size;
+                m.size = size;
+                ok = AddMember(index, member_name, name_len, &m);
+            }
+            free(long_name);
+            long_name = NULL;
+        }
+        else {
+            free(long_name);
+            long_name = NULL;
+        }
+
+        pos += padded;
+        if (!SeekTo(fp, pos)) {
+            ok = false;
+        }
+    }
+    free(long_name);
+    return ok;
+}
+
+bool ReadArchiveIndex(FILE* fp, ArchiveType type, ArchiveIndex* index)
+{
+    memset(index, 0, sizeof(*index));
+    index->type = type;
+    bool ok = false;
+    if (type == ARCHIVE_ZIP) {
+        ok = ReadZipIndex(fp, index);
+    }
+    else if (type == ARCHIVE_TAR) {
+        ok = ReadTarIndex(fp, index);
+    }
+    if (!ok) {
+        FreeArchiveIndex(index);
+    }
+    return ok;
+}
+
+void FreeArchiveIndex(ArchiveIndex* index)
+{
+    for (size_t i = 0; i < index->count; i++) {
+        free(index->members[i].name);
+    }
+    free(index->members);
+    memset(index, 0, sizeof(*index));
+}
+
+bool ReadArchiveMember(FILE* fp, ArchiveType type, const ArchiveMember* member, uint8_t* dst, void* scratch)
+{
+    if (member->size > ARCHIVE_MAX_MEMBER_SIZE) {
+        return false;
+    }
+    uint64_t data_pos = member->offset;
+    if (type == ARCHIVE_ZIP) {
+        uint8_t local[ZIP_LOCAL_SIZE];
+        if (!ReadAt(fp, member->offset, local, sizeof(local))
+            || memcmp(local, "PK\x03\x04", 4) != 0
+        ) {
+            return false;
+        }
+        data_pos += ZIP_LOCAL_SIZE + Get16(local + 26) + Get16(local + 28);
+    }
+    if (!SeekTo(fp, data_pos)) {
+        return false;
+    }
+
+    size_t size = (size_t)member->size;
+    bool ok = false;
+    if (type == ARCHIVE_TAR || member->method == 0) {
+        ok = member->compSize == member->size && fread(dst, 1, size, fp) == size;
+    }
+    else if (member->method == 8) {
+        ok = InflateFile(fp, member->compSize, dst, size, scratch);
+    }
+    return ok;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// Largest member that is decompressed into memory
+#define ARCHIVE_MAX_MEMBER_SIZE (64 * 1024 * 1024)
+// Inflate state and input buffer, see ReadArchiveMember()
+#define ARCHIVE_SCRATCH_SIZE (72 * 1024)
+
+typedef enum {
+    ARCHIVE_NONE,
+    ARCHIVE_ZIP,
+    ARCHIVE_TAR,
+} ArchiveType;
+
+typedef struct {
+    char* name;             // Path inside the archive, UTF-8
+    uint64_t offset;        // zip: local header, tar: member data
+    uint64_t compSize;
+    uint64_t size;
+    uint32_t crc32;         // zip: from the central directory
+    uint16_t method;        // zip: 0 = stored, 8 = deflate
+} ArchiveMember;
+
+typedef struct {
+    ArchiveType type;
+    ArchiveMember* members;
+    size_t count;
+    size_t cap;
+} ArchiveIndex;
+
+ArchiveType GetArchiveType(const char* path);
+
+// Lists the .nes members; only the directory (zip) or headers (tar) are read
+bool ReadArchiveIndex(FILE* fp, ArchiveType type, ArchiveIndex* index);
+void FreeArchiveIndex(ArchiveIndex* index);
+
+// Reads or inflates one member into dst[member->size]. scratch: NULL, or
+// ARCHIVE_SCRATCH_SIZE bytes reused by the caller across members.
+bool ReadArchiveMember(FILE* fp, ArchiveType type, const ArchiveMember* member, uint8_t* dst, void* scratch);
+
+// Raw DEFLATE stream of comp_size bytes at the current position -> dst[size]
+bool InflateFile(FILE* fp, uint64_t comp_size, uint8_t* dst, size_t size, void* scratch);
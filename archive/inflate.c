@@ -0,0 +1,391 @@
+/*
+ * Raw DEFLATE (RFC 1951) decoder.
+ *
+ * Reads the compressed stream from a FILE in small chunks and writes into
+ * a caller-provided buffer of the exact uncompressed size, which doubles as
+ * the LZ77 window. Huffman decoding is canonical, after Mark Adler's puff.c,
+ * with a root table: codes of up to FAST_BITS bits (almost all literals and
+ * lengths) take one lookup, longer ones go on bit by bit as in puff.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+
+#define MAXBITS   15
+#define MAXLCODES 286
+#define MAXDCODES 30
+#define MAXCODES  (MAXLCODES + MAXDCODES)
+#define FIXLCODES 288
+#define FAST_BITS 9
+#define FAST_SIZE (1 << FAST_BITS)
+
+#define INFLATE_IN_SIZE (64 * 1024)
+
+typedef struct {
+    FILE* fp;
+    uint64_t inLeft;        // Compressed bytes not yet read from fp
+    uint8_t in[INFLATE_IN_SIZE];
+    size_t inPos;
+    size_t inLen;
+    uint32_t bitBuf;
+    int bitCount;
+
+    uint8_t* out;
+    size_t outLen;
+    size_t outPos;
+    bool error;
+} InflateState;
+
+_Static_assert(sizeof(InflateState) <= ARCHIVE_SCRATCH_SIZE, "ARCHIVE_SCRATCH_SIZE is too small");
+
+typedef struct {
+    short count[MAXBITS + 1]; // Number of codes of each length
+    short symbol[FIXLCODES];  // Symbols ordered by code
+    uint16_t fast[FAST_SIZE]; // By the next FAST_BITS input bits: symbol << 4 | length, 0 if longer
+} Huffman;
+
+static const short LengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const short LengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const short DistBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static const short DistExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const short CodeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static int NextByte(InflateState* s)
+{
+    if (s->inPos == s->inLen) {
+        size_t want = s->inLeft < INFLATE_IN_SIZE ? (size_t)s->inLeft : INFLATE_IN_SIZE;
+        if (want == 0) {
+            s->error = true;
+            return 0;
+        }
+        s->inLen = fread(s->in, 1, want, s->fp);
+        s->inPos = 0;
+        s->inLeft -= s->inLen;
+        if (s->inLen == 0) {
+            s->error = true;
+            return 0;
+        }
+    }
+    return s->in[s->inPos++];
+}
+
+static int Bits(InflateState* s, int need)
+{
+    uint32_t val = s->bitBuf;
+    while (s->bitCount < need) {
+        val |= (uint32_t)NextByte(s) << s->bitCount;
+        s->bitCount += 8;
+    }
+    s->bitBuf = val >> need;
+    s->bitCount -= need;
+    return (int)(val & ((1u << need) - 1));
+}
+
+// Adds whole bytes to bitBuf while there are fewer than need bits, as far as
+// the input goes
+static void Fill(InflateState* s, int need)
+{
+    while (s->bitCount < need && (s->inPos < s->inLen || s->inLeft != 0)) {
+        s->bitBuf |= (uint32_t)NextByte(s) << s->bitCount;
+        s->bitCount += 8;
+    }
+}
+
+static int Decode(InflateState* s, const Huffman* h)
+{
+    Fill(s, FAST_BITS);
+    if (s->bitCount >= FAST_BITS) {
+        unsigned entry = h->fast[s->bitBuf & (FAST_SIZE - 1)];
+        if (entry != 0) {
+            s->bitBuf >>= entry & 15;
+            s->bitCount -= entry & 15;
+            return (int)(entry >> 4);
+        }
+    }
+
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len <= MAXBITS && !s->error; len++) {
+        code |= Bits(s, 1);
+        int count = h->count[len];
+        if (code - count < first) {
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    s->error = true;
+    return 0;
+}
+
+// Returns < 0 if over-subscribed, 0 if complete, > 0 if incomplete
+static int Construct(Huffman* h, const short* length, int n)
+{
+    short offs[MAXBITS + 1];
+
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+    for (int symbol = 0; symbol < n; symbol++) {
+        h->count[length[symbol]]++;
+    }
+    if (h->count[0] == n) {
+        return 0;
+    }
+    int left = 1;
+    for (int len = 1; len <= MAXBITS; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) {
+            return left;
+        }
+    }
+    offs[1] = 0;
+    for (int len = 1; len < MAXBITS; len++) {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+    for (int symbol = 0; symbol < n; symbol++) {
+        if (length[symbol] != 0) {
+            h->symbol[offs[length[symbol]]++] = (short)symbol;
+        }
+    }
+
+    // Canonical codes in symbol order; the stream holds them bit-reversed
+    int code = 0;
+    int index = 0;
+    for (int len = 1; len <= FAST_BITS; len++) {
+        for (int i = 0; i < h->count[len]; i++, index++, code++) {
+            int reversed = 0;
+            for (int b = 0; b < len; b++) {
+                reversed |= ((code >> b) & 1) << (len - 1 - b);
+            }
+            uint16_t entry = (uint16_t)(h->symbol[index] << 4 | len);
+            for (int k = reversed; k < FAST_SIZE; k += 1 << len) {
+                h->fast[k] = entry;
+            }
+        }
+        code <<= 1;
+    }
+    return left;
+}
+
+static void Stored(InflateState* s)
+{
+    // To the byte boundary; whole bytes Decode() read ahead are used first
+    Bits(s, s->bitCount & 7);
+    unsigned len = (unsigned)Bits(s, 16);
+    unsigned nlen = (unsigned)Bits(s, 16);
+    if (s->error || len != (~nlen & 0xFFFF) || len > s->outLen - s->outPos) {
+        s->error = true;
+        return;
+    }
+    while (len != 0 && s->bitCount >= 8) {
+        s->out[s->outPos++] = (uint8_t)Bits(s, 8);
+        len--;
+    }
+    while (len != 0 && !s->error) {
+        if (s->inPos == s->inLen) {
+            s->out[s->outPos++] = (uint8_t)NextByte(s);
+            len--;
+            continue;
+        }
+        size_t n = s->inLen - s->inPos < len ? s->inLen - s->inPos : len;
+        memcpy(s->out + s->outPos, s->in + s->inPos, n);
+        s->inPos += n;
+        s->outPos += n;
+        len -= (unsigned)n;
+    }
+}
+
+static void Codes(InflateState* s, const Huffman* lencode, const Huffman* distcode)
+{
+    for (;;) {
+        int symbol = Decode(s, lencode);
+        if (s->error) {
+            return;
+        }
+        if (symbol < 256) {
+            if (s->outPos == s->outLen) {
+                s->error = true;
+                return;
+            }
+            s->out[s->outPos++] = (uint8_t)symbol;
+        }
+        else if (symbol == 256) {
+            return;
+        }
+        else {
+            symbol -= 257;
+            if (symbol >= 29) {
+                s->error = true;
+                return;
+            }
+            size_t len = LengthBase[symbol] + Bits(s, LengthExtra[symbol]);
+            symbol = Decode(s, distcode);
+            if (s->error || symbol >= 30) {
+                s->error = true;
+                return;
+            }
+            size_t dist = DistBase[symbol] + Bits(s, DistExtra[symbol]);
+            if (dist > s->outPos || len > s->outLen - s->outPos) {
+                s->error = true;
+                return;
+            }
+            uint8_t* dst = s->out + s->outPos;
+            const uint8_t* src = dst - dist;
+            s->outPos += len;
+            while (len--) {
+                *dst++ = *src++;
+            }
+        }
+    }
+}
+
+static void Fixed(InflateState* s)
+{
+    // Rebuilt per block rather than cached in statics so workers never share it
+    Huffman lencode, distcode;
+    short lengths[FIXLCODES];
+    int symbol = 0;
+
+    for (; symbol < 144; symbol++) lengths[symbol] = 8;
+    for (; symbol < 256; symbol++) lengths[symbol] = 9;
+    for (; symbol < 280; symbol++) lengths[symbol] = 7;
+    for (; symbol < FIXLCODES; symbol++) lengths[symbol] = 8;
+    Construct(&lencode, lengths, FIXLCODES);
+    for (symbol = 0; symbol < MAXDCODES; symbol++) lengths[symbol] = 5;
+    Construct(&distcode, lengths, MAXDCODES);
+    Codes(s, &lencode, &distcode);
+}
+
+static void Dynamic(InflateState* s)
+{
+    short lengths[MAXCODES];
+    Huffman lencode, distcode;
+
+    int nlen = Bits(s, 5) + 257;
+    int ndist = Bits(s, 5) + 1;
+    int ncode = Bits(s, 4) + 4;
+    if (s->error || nlen > MAXLCODES || ndist > MAXDCODES) {
+        s->error = true;
+        return;
+    }
+
+    int index;
+    for (index = 0; index < ncode; index++) {
+        lengths[CodeLengthOrder[index]] = (short)Bits(s, 3);
+    }
+    for (; index < 19; index++) {
+        lengths[CodeLengthOrder[index]] = 0;
+    }
+    if (Construct(&lencode, lengths, 19) != 0) {
+        s->error = true;
+        return;
+    }
+
+    index = 0;
+    while (index < nlen + ndist && !s->error) {
+        int symbol = Decode(s, &lencode);
+        if (symbol < 16) {
+            lengths[index++] = (short)symbol;
+            continue;
+        }
+        short len = 0;
+        if (symbol == 16) {
+            if (index == 0) {
+                s->error = true;
+                return;
+            }
+            len = lengths[index - 1];
+            symbol = 3 + Bits(s, 2);
+        }
+        else if (symbol == 17) {
+            symbol = 3 + Bits(s, 3);
+        }
+        else {
+            symbol = 11 + Bits(s, 7);
+        }
+        if (index + symbol > nlen + ndist) {
+            s->error = true;
+            return;
+        }
+        while (symbol--) {
+            lengths[index++] = len;
+        }
+    }
+    if (s->error || lengths[256] == 0) {
+        s->error = true;
+        return;
+    }
+
+    int err = Construct(&lencode, lengths, nlen);
+    if (err < 0 || (err > 0 && nlen - lencode.count[0] != 1)) {
+        s->error = true;
+        return;
+    }
+    err = Construct(&distcode, lengths + nlen, ndist);
+    if (err < 0 || (err > 0 && ndist - distcode.count[0] != 1)) {
+        s->error = true;
+        return;
+    }
+    Codes(s, &lencode, &distcode);
+}
+
+bool InflateFile(FILE* fp, uint64_t comp_size, uint8_t* dst, size_t size, void* scratch)
+{
+    InflateState* s = (InflateState*)(scratch != NULL ? scratch : malloc(sizeof(InflateState)));
+    if (s == NULL) {
+        return false;
+    }
+    // Everything but the input buffer, which is refilled before use
+    s->fp = fp;
+    s->inLeft = comp_size;
+    s->inPos = 0;
+    s->inLen = 0;
+    s->bitBuf = 0;
+    s->bitCount = 0;
+    s->out = dst;
+    s->outLen = size;
+    s->outPos = 0;
+    s->error = false;
+
+    int last;
+    do {
+        last = Bits(s, 1);
+        int type = Bits(s, 2);
+        if (s->error) {
+            break;
+        }
+        switch (type) {
+        case 0: Stored(s); break;
+        case 1: Fixed(s); break;
+        case 2: Dynamic(s); break;
+        default: s->error = true; break;
+        }
+    } while (!last && !s->error);
+
+    bool ok = !s->error && s->outPos == s->outLen;
+    if (scratch == NULL) {
+        free(s);
+    }
+    return ok;
+}
@@ -0,0 +1,441 @@
+// Microbenchmarks for the hash kernels, nes20db.xml search and header decoding.
+//
+// usage: bench.exe [--quick] [--reps=N] [--filter=substr] [--out=file] [--compare=file]
+//
+// Every line written to --out is one JSON object, so two runs (e.g. two
+// commits) can be diffed or fed to --compare.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "../hash/crc32.h"
+#include "../hash/md5.h"
+#include "../hash/sha1.h"
+#include "../nesinfo.h"
+#include "synth.h"
+
+#ifndef BENCH_REV
+#define BENCH_REV "unknown"
+#endif
+
+#define MAX_SAMPLES    101
+#define MIN_SAMPLE_NS  (10 * 1000 * 1000)
+#define HEADER_COUNT   4096
+#define XML_GAMES      16384
+
+uint64_t NowNs(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    const uint8_t* headers;   // HEADER_COUNT * 16
+    const uint8_t* sha1;      // Search key
+} BenchInput;
+
+typedef struct {
+    const char* name;
+    void (*fn)(const BenchInput* in);
+    int kind;                 // BENCH_*
+} Bench;
+
+enum {
+    BENCH_BUFFER,             // Runs over each ROM buffer size
+    BENCH_XML,                // Runs over the synthetic nes20db.xml
+    BENCH_HEADERS             // One op = one header
+};
+
+// Keeps results alive so the compiler can't drop the work
+volatile uint32_t g_sink;
+
+void BenchCRC32(const BenchInput* in)
+{
+    g_sink ^= CRC32(in->data, in->size);
+}
+
+void BenchMD5(const BenchInput* in)
+{
+    MD5Context ctx;
+    md5Init(&ctx);
+    md5Update(&ctx, in->data, in->size);
+    md5Finalize(&ctx);
+    g_sink ^= ctx.digest[0];
+}
+
+void BenchSHA1(const BenchInput* in)
+{
+    SHA1_CTX ctx;
+    uint8_t digest[20];
+    SHA1Init(&ctx);
+    SHA1Update(&ctx, in->data, (uint32_t)in->size);
+    SHA1Final(digest, &ctx);
+    g_sink ^= digest[0];
+}
+
+void BenchByteSum(const BenchInput* in)
+{
+    g_sink ^= (uint32_t)ByteSum(0, in->data, in->size);
+}
+
+void BenchAllHashes(const BenchInput* in)
+{
+    HashResult hr;
+    ComputeHashes(in->data, in->size, HASH_ALL, &hr);
+    g_sink ^= hr.crc;
+}
+
+// The SHA-1 is not in the XML: worst case, a full scan
+void BenchBytesFind(const BenchInput* in)
+{
+    g_sink ^= bytes_find(in->data, in->size, in->sha1, 40) != NULL;
+}
+
+void BenchDBIndexBuild(const BenchInput* in)
+{
+    (void)in;
+    free(g_db.entries);
+    free(g_db.bySHA1);
+    free(g_db.games);
+    memset(&g_db, 0, sizeof(g_db));
+    BuildNES20DBIndex();
+    g_sink ^= (uint32_t)g_db.entryCount;
+}
+
+void BenchDBLookupSHA1(const BenchInput* in)
+{
+    g_sink ^= (uint32_t)FindDBEntrySHA1(in->sha1);
+}
+
+void BenchGetNESInfo(const BenchInput* in)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < HEADER_COUNT; i++) {
+        NESInfo info = GetNESInfo(in->headers + i * 16);
+        sum += info.PRGSize + info.CHRSize + info.mapper;
+    }
+    g_sink ^= (uint32_t)sum;
+}
+
+NESInfoColumns g_cols;
+
+void BenchGetNESInfoBatch(const BenchInput* in)
+{
+    GetNESInfoBatch(in->headers, HEADER_COUNT, &g_cols);
+    g_sink ^= g_cols.mapper[HEADER_COUNT - 1];
+}
+
+bool AllocColumns(NESInfoColumns* cols, size_t count)
+{
+    cols->mapper = (uint16_t*)malloc(count * sizeof(uint16_t));
+    cols->submapper = (uint8_t*)malloc(count);
+    cols->PRGSize = (uint64_t*)malloc(count * sizeof(uint64_t));
+    cols->CHRSize = (uint64_t*)malloc(count * sizeof(uint64_t));
+    cols->flags = (uint16_t*)malloc(count * sizeof(uint16_t));
+    cols->frameTiming = (uint8_t*)malloc(count);
+    cols->consoleType = (uint8_t*)malloc(count);
+    cols->consoleExt = (uint8_t*)malloc(count);
+    cols->expansion = (uint8_t*)malloc(count);
+    return cols->mapper && cols->submapper && cols->PRGSize && cols->CHRSize && cols->flags
+        && cols->frameTiming && cols->consoleType && cols->consoleExt && cols->expansion;
+}
+
+// GetNESInfoBatch() must agree with GetNESInfo() on every field
+bool CheckNESInfoBatch(const uint8_t* headers, size_t count)
+{
+    GetNESInfoBatch(headers, count, &g_cols);
+    for (size_t i = 0; i < count; i++) {
+        NESInfo info = GetNESInfo(headers + i * 16);
+        uint16_t flags = (info.isVertMirroring ? NESINFO_F_VERT_MIRRORING : 0)
+                       | (info.isBattery ? NESINFO_F_BATTERY : 0)
+                       | (info.isTrainer ? NESINFO_F_TRAINER : 0)
+                       | (info.is4Screen ? NESINFO_F_4SCREEN : 0)
+                       | (info.isExtended ? NESINFO_F_EXTENDED : 0)
+                       | (!info.isExtended && info.isPAL_iNES ? NESINFO_F_PAL_INES : 0)
+                       | info.miscROMs << NESINFO_F_MISC_SHIFT;
+        if (g_cols.mapper[i] != info.mapper || g_cols.submapper[i] != info.submapper
+            || g_cols.PRGSize[i] != info.PRGSize || g_cols.CHRSize[i] != info.CHRSize
+            || g_cols.flags[i] != flags || g_cols.frameTiming[i] != info.frameTiming
+            || g_cols.consoleType[i] != info.consoleType1
+            || g_cols.consoleExt[i] != (info.consoleType2 | info.consoleType3 << 4)
+            || g_cols.expansion[i] != info.expansion
+        ) {
+            fprintf(stderr, "Error: GetNESInfoBatch() differs from GetNESInfo() at header %u\n", (unsigned)i);
+            return false;
+        }
+    }
+    return true;
+}
+
+const Bench g_benches[] = {
+    { "crc32",               BenchCRC32,            BENCH_BUFFER  },
+    { "md5",                 BenchMD5,              BENCH_BUFFER  },
+    { "sha1",                BenchSHA1,             BENCH_BUFFER  },
+    { "hashes_all",          BenchAllHashes,        BENCH_BUFFER  },
+    { "byte_sum",            BenchByteSum,          BENCH_BUFFER  },
+    { "bytes_find_xml",      BenchBytesFind,        BENCH_XML     },
+    { "db_index_build",      BenchDBIndexBuild,     BENCH_XML     },
+    { "db_lookup_sha1",      BenchDBLookupSHA1,     BENCH_XML     },
+    { "get_nes_info",        BenchGetNESInfo,       BENCH_HEADERS },
+    { "get_nes_info_batch",  BenchGetNESInfoBatch,  BENCH_HEADERS },
+};
+
+int CompareU64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : (x > y);
+}
+
+typedef struct {
+    char name[64];
+    uint64_t bytes;           // Per op, 0 if not a throughput benchmark
+    uint64_t iters;           // Ops per sample
+    int reps;
+    double medianNs;          // Per op
+    double p99Ns;
+} BenchResult;
+
+// One warmup call, then enough iterations per sample to reach MIN_SAMPLE_NS
+BenchResult RunBench(const char* name, void (*fn)(const BenchInput*), const BenchInput* in,
+                     uint64_t bytes, uint64_t ops_per_call, int reps)
+{
+    BenchResult r;
+    uint64_t samples[MAX_SAMPLES];
+
+    memset(&r, 0, sizeof(r));
+    snprintf(r.name, sizeof(r.name), "%s", name);
+    r.bytes = bytes;
+    r.reps = reps;
+
+    uint64_t t0 = NowNs();
+    fn(in);
+    uint64_t once = NowNs() - t0;
+    r.iters = once >= MIN_SAMPLE_NS ? 1 : MIN_SAMPLE_NS / (once ? once : 1) + 1;
+
+    for (int i = 0; i < reps; i++) {
+        t0 = NowNs();
+        for (uint64_t j = 0; j < r.iters; j++) {
+            fn(in);
+        }
+        samples[i] = NowNs() - t0;
+    }
+    qsort(samples, reps, sizeof(uint64_t), CompareU64);
+
+    double div = (double)(r.iters * ops_per_call);
+    r.medianNs = samples[reps / 2] / div;
+    // Nearest rank
+    int p99 = (99 * reps + 99) / 100 - 1;
+    r.p99Ns = samples[p99 < 0 ? 0 : p99] / div;
+    r.iters *= ops_per_call;
+    return r;
+}
+
+double GBps(const BenchResult* r)
+{
+    return r->bytes ? (double)r->bytes / r->medianNs : 0.0;
+}
+
+void PrintResult(FILE* out, const BenchResult* r)
+{
+    printf("%-30s %12.1f %12.1f %9.3f\n", r->name, r->medianNs, r->p99Ns, GBps(r));
+    if (out != NULL) {
+        fprintf(out, "{\"rev\":\"%s\",\"bench\":\"%s\",\"bytes\":%" PRIu64 ",\"iters\":%" PRIu64
+            ",\"reps\":%d,\"ns_op_median\":%.3f,\"ns_op_p99\":%.3f,\"gbps_median\":%.4f}\n",
+            BENCH_REV, r->name, r->bytes, r->iters, r->reps, r->medianNs, r->p99Ns, GBps(r));
+    }
+}
+
+// Prints the median change against a previous --out file
+void CompareResult(const char* path, const BenchResult* r)
+{
+    FILE* fp = path ? fopen(path, "r") : NULL;
+    char line[512];
+    char key[80];
+
+    if (fp == NULL) {
+        return;
+    }
+    snprintf(key, sizeof(key), "\"bench\":\"%s\",", r->name);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        const char* m = strstr(line, "\"ns_op_median\":");
+        if (strstr(line, key) == NULL || m == NULL) {
+            continue;
+        }
+        double old = atof(m + 15);
+        if (old > 0) {
+            printf("%-30s %+11.1f%% vs %s\n", "", (r->medianNs - old) * 100.0 / old, path);
+        }
+        break;
+    }
+    fclose(fp);
+}
+
+int main(int argc, char* argv[])
+{
+    int reps = 15;
+    bool quick = false;
+    const char* filter = NULL;
+    const char* out_path = NULL;
+    const char* compare_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+            reps = 5;
+        }
+        else if (strncmp(argv[i], "--reps=", 7) == 0) {
+            reps = atoi(argv[i] + 7);
+        }
+        else if (strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+        }
+        else if (strncmp(argv[i], "--out=", 6) == 0) {
+            out_path = argv[i] + 6;
+        }
+        else if (strncmp(argv[i], "--compare=", 10) == 0) {
+            compare_path = argv[i] + 10;
+        }
+        else {
+            fprintf(stderr, "usage: %s [--quick] [--reps=N] [--filter=substr] [--out=file] [--compare=file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (reps < 1 || reps > MAX_SAMPLES) {
+        fprintf(stderr, "Error: --reps must be 1..%d\n", MAX_SAMPLES);
+        return 1;
+    }
+
+    const size_t sizes[] = { 16 * 1024, 256 * 1024, 4 * 1024 * 1024, 64 * 1024 * 1024 };
+    const size_t size_count = quick ? 3 : 4;
+    const size_t max_size = sizes[size_count - 1];
+
+    uint64_t rng = 0x4E45531A;
+    uint8_t* rom = (uint8_t*)malloc(max_size);
+    uint8_t* headers = (uint8_t*)malloc(HEADER_COUNT * 16);
+    if (rom == NULL || headers == NULL) {
+        fprintf(stderr, "Error: malloc()\n");
+        return 1;
+    }
+    SynthFill(&rng, rom, max_size);
+    SynthHeader(&rng, rom, false, max_size / 2, max_size / 2 - 16, false);
+    for (size_t i = 0; i < HEADER_COUNT; i++) {
+        uint64_t prg = (SynthRand(&rng) % 64 + 1) * 0x4000;
+        uint64_t chr = (SynthRand(&rng) % 32) * 0x2000;
+        if (i % 8 == 7) {
+            prg = (uint64_t)3 << (SynthRand(&rng) % 20 + 10); // Exponent-multiplier form
+        }
+        SynthHeader(&rng, headers + i * 16, i % 2 == 1, prg, chr, false);
+    }
+
+    uint8_t* noise = (uint8_t*)malloc(HEADER_COUNT * 16);
+    if (noise == NULL || !AllocColumns(&g_cols, HEADER_COUNT)) {
+        fprintf(stderr, "Error: malloc()\n");
+        return 1;
+    }
+    SynthFill(&rng, noise, HEADER_COUNT * 16);
+    if (!CheckNESInfoBatch(headers, HEADER_COUNT) || !CheckNESInfoBatch(noise, HEADER_COUNT)
+        || !CheckNESInfoBatch(noise + 16, HEADER_COUNT - 7)
+    ) {
+        return 1;
+    }
+    free(noise);
+
+    SynthBuf xml = {0};
+    char name[64];
+    uint8_t sha1_key[20];
+    SynthAppend(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<nes20db>\n");
+    for (size_t i = 0; i < XML_GAMES; i++) {
+        snprintf(name, sizeof(name), "Synthetic Game %05u (World)", (unsigned)i);
+        SynthXMLFakeGame(&rng, &xml, name, (SynthRand(&rng) % 32 + 1) * 0x4000,
+                         (SynthRand(&rng) % 16) * 0x2000, (uint32_t)(SynthRand(&rng) % 256));
+    }
+    SynthAppend(&xml, "</nes20db>\n");
+    g_nes20db = (uint8_t*)xml.data;
+    g_nes20db_size = xml.size;
+    BuildNES20DBIndex();
+    memset(sha1_key, 0xA5, sizeof(sha1_key));
+
+    FILE* out = NULL;
+    if (out_path != NULL) {
+        out = fopen(out_path, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Can't open: %s\n", out_path);
+            return 1;
+        }
+    }
+
+    printf("nesinfo bench, rev %s, %d reps\n", BENCH_REV, reps);
+    printf("%-30s %12s %12s %9s\n", "benchmark", "median ns/op", "p99 ns/op", "GB/s");
+    for (size_t b = 0; b < sizeof(g_benches) / sizeof(g_benches[0]); b++) {
+        const Bench* bench = &g_benches[b];
+        BenchInput in = { rom, 0, headers, sha1_key };
+        BenchResult r;
+        char full_name[64];
+
+        if (filter != NULL && strstr(bench->name, filter) == NULL) {
+            continue;
+        }
+        switch (bench->kind) {
+        case BENCH_BUFFER:
+            for (size_t s = 0; s < size_count; s++) {
+                in.size = sizes[s];
+                snprintf(full_name, sizeof(full_name), "%s/%uK", bench->name, (unsigned)(sizes[s] / 1024));
+                r = RunBench(full_name, bench->fn, &in, sizes[s], 1, reps);
+                PrintResult(out, &r);
+                CompareResult(compare_path, &r);
+            }
+            break;
+        case BENCH_XML:
+            in.data = (const uint8_t*)xml.data;
+            in.size = xml.size;
+            if (bench->fn == BenchDBLookupSHA1) {
+                // Existing key: the middle SHA-1 of the index, a full-depth search
+                in.sha1 = g_db.entries[g_db.bySHA1[g_db.entryCount / 2]].sha1;
+            }
+            else {
+                // 40 hex digits that are not in the XML
+                in.sha1 = (const uint8_t*)"0000000000000000000000000000000000000000";
+            }
+            r = RunBench(bench->name, bench->fn, &in,
+                         bench->fn == BenchDBLookupSHA1 ? 0 : xml.size, 1, reps);
+            PrintResult(out, &r);
+            CompareResult(compare_path, &r);
+            break;
+        case BENCH_HEADERS:
+            r = RunBench(bench->name, bench->fn, &in, 0, HEADER_COUNT, reps);
+            PrintResult(out, &r);
+            CompareResult(compare_path, &r);
+            break;
+        }
+    }
+
+    if (out != NULL) {
+        fclose(out);
+    }
+    CloseNES20DB();
+    free(headers);
+    free(rom);
+    return 0;
+}
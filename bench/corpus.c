@@ -0,0 +1,442 @@
+// End-to-end benchmark: synthetic ROM collection + full nesinfo runs.
+//
+// corpus.exe gen --dir=DIR [--seed=N] [--count=N] [--max-size=BYTES]
+//     Writes DIR/roms/XXX/NNNNNN.nes, DIR/nes20db.xml (about 3/4 of the ROMs)
+//     and DIR/files.txt. The same seed always gives the same collection.
+//
+// corpus.exe run --dir=DIR [--nesinfo=PATH] [--cold] [--phases=LIST] [--out=FILE] [-- nesinfo args]
+//     Runs nesinfo over DIR/files.txt once per phase (header-only, tiered,
+//     full) and reports files/s, MB/s, wall/user/sys time and peak RSS, then
+//     the time nesinfo spent in each of its own phases (open, read, crc32,
+//     ...), taken from its --stats output.
+//     --cold drops each file from the page cache before every phase.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "synth.h"
+
+#define MAX_PHASES 8
+#define MAX_STATS_PHASES 32
+
+typedef struct {
+    const char* name;
+    const char* args;   // Extra nesinfo option, or NULL
+} Phase;
+
+const Phase g_phases[] = {
+    { "header-only", "--header-only" },
+    { "tiered",      "--tiered"      },
+    { "full",        NULL            },
+};
+#define PHASE_COUNT (sizeof(g_phases) / sizeof(g_phases[0]))
+
+// 24 KiB .. 32 MiB, weighted towards small carts like a real collection
+void PickSizes(uint64_t* rng, uint64_t max_size, uint64_t* prg, uint64_t* chr)
+{
+    uint64_t r = SynthRand(rng) % 100;
+    uint64_t total;
+    if (r < 60) {
+        total = (uint64_t)(SynthRand(rng) % 5 + 1) * 0x8000 - 0x2000;  // 24..152 KiB
+    }
+    else if (r < 90) {
+        total = (uint64_t)0x40000 << (SynthRand(rng) % 3);             // 256 KiB..1 MiB
+    }
+    else if (r < 99) {
+        total = (uint64_t)0x200000 << (SynthRand(rng) % 2);            // 2..4 MiB
+    }
+    else {
+        total = (uint64_t)0x800000 << (SynthRand(rng) % 3);            // 8..32 MiB
+    }
+    if (total > max_size) {
+        total = max_size;
+    }
+    if (total < 0x6000) {
+        total = 0x6000;
+    }
+    // CHR ROM: none, 8 KiB or a quarter of the cart
+    uint64_t c = SynthRand(rng) % 3;
+    *chr = c == 0 ? 0 : (c == 1 ? 0x2000 : (total / 4) & ~(uint64_t)0x1FFF);
+    *prg = (total - *chr) & ~(uint64_t)0x3FFF;
+    if (*prg == 0) {
+        *prg = 0x4000;
+    }
+}
+
+#ifndef _WIN32
+
+uint64_t NowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int MakeDirs(const char* path)
+{
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char* p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(tmp, 0755);
+            *p = '/';
+        }
+    }
+    return mkdir(tmp, 0755) == 0 || errno == EEXIST;
+}
+
+int Generate(const char* dir, uint64_t seed, unsigned count, uint64_t max_size)
+{
+    char path[4096];
+    uint64_t rng = seed;
+    SynthBuf xml = {0};
+    FILE* list;
+    uint64_t total_bytes = 0;
+
+    snprintf(path, sizeof(path), "%s/files.txt", dir);
+    list = fopen(path, "w");
+    if (list == NULL) {
+        fprintf(stderr, "Can't create: %s\n", path);
+        return 1;
+    }
+    SynthAppend(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<nes20db>\n");
+
+    uint8_t* file = NULL;
+    size_t file_cap = 0;
+    for (unsigned i = 0; i < count; i++) {
+        uint64_t prg, chr;
+        PickSizes(&rng, max_size, &prg, &chr);
+        uint64_t r = SynthRand(&rng);
+        bool nes20 = (r & 0xFF) < 100;              // ~40% NES 2.0
+        bool trainer = ((r >> 8) & 0xFF) < 5;       // ~2%
+        bool nintendo = ((r >> 16) & 0xFF) < 50;    // ~20% with a Nintendo header
+        bool in_db = ((r >> 24) & 0xFF) < 192;      // ~75% known to the DB
+        size_t misc = ((r >> 32) & 0xFF) < 8 ? 128 : 0;
+        size_t size = 16 + (trainer ? 512 : 0) + (size_t)prg + (size_t)chr + misc;
+
+        if (size > file_cap) {
+            free(file);
+            file = (uint8_t*)malloc(size);
+            file_cap = size;
+            if (file == NULL) {
+                fprintf(stderr, "Error: malloc()\n");
+                return 1;
+            }
+        }
+        SynthFill(&rng, file, size);
+        SynthHeader(&rng, file, nes20, prg, chr, trainer);
+        if (nintendo) {
+            SynthNintendoHeader(&rng, file + 16 + (trainer ? 512 : 0) + prg - 0x20);
+        }
+
+        char rel[64];
+        snprintf(rel, sizeof(rel), "roms/%03u", i / 1000);
+        snprintf(path, sizeof(path), "%s/%s", dir, rel);
+        MakeDirs(path);
+        snprintf(rel, sizeof(rel), "roms/%03u/%06u.nes", i / 1000, i);
+        snprintf(path, sizeof(path), "%s/%s", dir, rel);
+        FILE* fp = fopen(path, "wb");
+        if (fp == NULL || fwrite(file, 1, size, fp) != size) {
+            fprintf(stderr, "Can't write: %s\n", path);
+            return 1;
+        }
+        fclose(fp);
+        fprintf(list, "%s\n", rel);
+        total_bytes += size;
+
+        if (in_db) {
+            char name[64];
+            uint32_t mapper = ((file[6] >> 4) | (file[7] & 0xF0));
+            snprintf(name, sizeof(name), "Synthetic %06u (World)", i);
+            SynthXMLGame(&xml, name, file, size - misc, prg, chr, trainer, mapper);
+        }
+    }
+    free(file);
+    fclose(list);
+
+    SynthAppend(&xml, "</nes20db>\n");
+    snprintf(path, sizeof(path), "%s/nes20db.xml", dir);
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL || fwrite(xml.data, 1, xml.size, fp) != xml.size) {
+        fprintf(stderr, "Can't write: %s\n", path);
+        return 1;
+    }
+    fclose(fp);
+    free(xml.data);
+
+    printf("generated %u files, %.1f MiB, seed %" PRIu64 "\n",
+        count, total_bytes / 1048576.0, seed);
+    return 0;
+}
+
+// Reads DIR/files.txt; drops each file from the page cache if `drop`
+int ScanList(const char* dir, bool drop, uint64_t* files, uint64_t* bytes)
+{
+    char path[8192];
+    char line[4096];
+
+    snprintf(path, sizeof(path), "%s/files.txt", dir);
+    FILE* list = fopen(path, "r");
+    if (list == NULL) {
+        fprintf(stderr, "Can't open: %s\n", path);
+        return 1;
+    }
+    *files = 0;
+    *bytes = 0;
+    while (fgets(line, sizeof(line), list) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        snprintf(path, sizeof(path), "%s/%s", dir, line);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            *bytes += (uint64_t)st.st_size;
+        }
+        if (drop) {
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+        close(fd);
+        (*files)++;
+    }
+    fclose(list);
+    return 0;
+}
+
+typedef struct {
+    char name[32];
+    double ms;
+    double share;       // Percent of the summed phase time
+} StatsPhase;
+
+// The phase table of nesinfo --stats from its stderr; other lines before the
+// statistics (errors) are passed on
+size_t ReadStatsPhases(FILE* err, StatsPhase* out, size_t max)
+{
+    char line[1024];
+    size_t count = 0;
+    bool is_stats = false, is_table = false;
+    rewind(err);
+    while (fgets(line, sizeof(line), err) != NULL) {
+        if (strncmp(line, "--stats:", 8) == 0) {
+            is_stats = true;
+        }
+        else if (!is_stats) {
+            // Not the blank line before the statistics
+            if (line[0] != '\n') {
+                fputs(line, stderr);
+            }
+        }
+        else if (strncmp(line, "phase ", 6) == 0) {
+            is_table = true;
+        }
+        else if (is_table && count < max
+            && sscanf(line, "%31s %lf %lf%%", out[count].name, &out[count].ms, &out[count].share) == 3
+        ) {
+            count++;
+        }
+        else {
+            is_table = false;
+        }
+    }
+    return count;
+}
+
+int Run(const char* dir, const char* nesinfo, bool cold, const char* phases,
+        const char* out_path, char** extra, int extra_count)
+{
+    char exe[PATH_MAX];
+    if (realpath(nesinfo, exe) == NULL) {
+        fprintf(stderr, "Can't find: %s\n", nesinfo);
+        return 1;
+    }
+    FILE* out = NULL;
+    if (out_path != NULL && (out = fopen(out_path, "a")) == NULL) {
+        fprintf(stderr, "Can't open: %s\n", out_path);
+        return 1;
+    }
+
+    printf("%-12s %5s %9s %10s %9s %9s %9s %9s %10s\n",
+        "phase", "cache", "files", "files/s", "MB/s", "wall s", "user s", "sys s", "peak RSS");
+    for (size_t p = 0; p < PHASE_COUNT; p++) {
+        const Phase* phase = &g_phases[p];
+        uint64_t files, bytes;
+        if (phases != NULL && strstr(phases, phase->name) == NULL) {
+            continue;
+        }
+        if (ScanList(dir, cold, &files, &bytes)) {
+            return 1;
+        }
+
+        char* args[MAX_PHASES + 64];
+        int n = 0;
+        args[n++] = exe;
+        args[n++] = "--stats";
+        if (phase->args != NULL) {
+            args[n++] = (char*)phase->args;
+        }
+        for (int i = 0; i < extra_count && n < MAX_PHASES + 60; i++) {
+            args[n++] = extra[i];
+        }
+        args[n++] = "--files-from=files.txt";
+        args[n] = NULL;
+
+        FILE* err = tmpfile();
+        if (err == NULL) {
+            fprintf(stderr, "Error: tmpfile()\n");
+            return 1;
+        }
+        fflush(stdout);
+        uint64_t t0 = NowNs();
+        pid_t pid = fork();
+        if (pid == 0) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            if (chdir(dir) != 0 || null_fd < 0) {
+                _exit(127);
+            }
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(fileno(err), STDERR_FILENO);
+            execv(exe, args);
+            _exit(127);
+        }
+        if (pid < 0) {
+            fprintf(stderr, "Error: fork()\n");
+            fclose(err);
+            return 1;
+        }
+        int status = 0;
+        struct rusage ru;
+        if (wait4(pid, &status, 0, &ru) < 0) {
+            fprintf(stderr, "Error: wait4()\n");
+            fclose(err);
+            return 1;
+        }
+        StatsPhase stats[MAX_STATS_PHASES];
+        size_t stats_count = ReadStatsPhases(err, stats, MAX_STATS_PHASES);
+        fclose(err);
+        double wall = (NowNs() - t0) / 1e9;
+        double user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+        double sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+            fprintf(stderr, "Error: %s failed in phase %s\n", exe, phase->name);
+            return 1;
+        }
+
+        const char* cache = cold ? "cold" : "warm";
+        double files_s = files / wall;
+        double mb_s = bytes / 1e6 / wall;
+        printf("%-12s %5s %9" PRIu64 " %10.0f %9.1f %9.3f %9.3f %9.3f %7ld KiB\n",
+            phase->name, cache, files, files_s, mb_s, wall, user, sys, ru.ru_maxrss);
+        // nesinfo's own phases that took any time
+        size_t shown = 0;
+        for (size_t i = 0; i < stats_count; i++) {
+            if (stats[i].ms >= 0.0005) {
+                printf("%s %s %.1f ms (%.1f%%)", shown++ == 0 ? "  nesinfo:" : ",",
+                    stats[i].name, stats[i].ms, stats[i].share);
+            }
+        }
+        if (shown != 0) {
+            printf("\n");
+        }
+        if (out != NULL) {
+            fprintf(out, "{\"phase\":\"%s\",\"cache\":\"%s\",\"files\":%" PRIu64 ",\"bytes\":%" PRIu64
+                ",\"files_per_s\":%.1f,\"mb_per_s\":%.2f,\"wall_s\":%.4f,\"user_s\":%.4f,\"sys_s\":%.4f"
+                ",\"peak_rss_kib\":%ld,\"exit\":%d,\"nesinfo_ms\":{",
+                phase->name, cache, files, bytes, files_s, mb_s, wall, user, sys,
+                ru.ru_maxrss, WEXITSTATUS(status));
+            for (size_t i = 0; i < stats_count; i++) {
+                fprintf(out, "%s\"%s\":%.3f", i == 0 ? "" : ",", stats[i].name, stats[i].ms);
+            }
+            fprintf(out, "}}\n");
+        }
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+    return 0;
+}
+
+#endif
+
+void PrintUsage(const char* exe)
+{
+    printf("usage: %s gen --dir=DIR [--seed=N] [--count=N] [--max-size=BYTES]\n", exe);
+    printf("       %s run --dir=DIR [--nesinfo=PATH] [--cold] [--phases=LIST] [--out=FILE] [-- nesinfo args]\n", exe);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* dir = NULL;
+    const char* nesinfo = "./nesinfo.exe";
+    const char* phases = NULL;
+    const char* out_path = NULL;
+    uint64_t seed = 1;
+    unsigned count = 2000;
+    uint64_t max_size = 32 * 1024 * 1024;
+    bool cold = false;
+    int extra = argc;
+
+    if (argc < 2) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            extra = i + 1;
+            break;
+        }
+        else if (strncmp(argv[i], "--dir=", 6) == 0) dir = argv[i] + 6;
+        else if (strncmp(argv[i], "--seed=", 7) == 0) seed = strtoull(argv[i] + 7, NULL, 0);
+        else if (strncmp(argv[i], "--count=", 8) == 0) count = (unsigned)strtoul(argv[i] + 8, NULL, 0);
+        else if (strncmp(argv[i], "--max-size=", 11) == 0) max_size = strtoull(argv[i] + 11, NULL, 0);
+        else if (strncmp(argv[i], "--nesinfo=", 10) == 0) nesinfo = argv[i] + 10;
+        else if (strncmp(argv[i], "--phases=", 9) == 0) phases = argv[i] + 9;
+        else if (strncmp(argv[i], "--out=", 6) == 0) out_path = argv[i] + 6;
+        else if (strcmp(argv[i], "--cold") == 0) cold = true;
+        else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (dir == NULL) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+#ifndef _WIN32
+    if (strcmp(argv[1], "gen") == 0) {
+        if (!MakeDirs(dir)) {
+            fprintf(stderr, "Can't create: %s\n", dir);
+            return 1;
+        }
+        return Generate(dir, seed, count, max_size);
+    }
+    if (strcmp(argv[1], "run") == 0) {
+        return Run(dir, nesinfo, cold, phases, out_path, argv + extra, argc - extra);
+    }
+#else
+    (void)nesinfo; (void)phases; (void)out_path; (void)cold; (void)extra;
+    (void)seed; (void)count; (void)max_size;
+    fprintf(stderr, "Error: corpus benchmark needs a POSIX system\n");
+    return 1;
+#endif
+    PrintUsage(argv[0]);
+    return 1;
+}
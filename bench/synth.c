@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../hash/crc32.h"
+#include "../hash/sha1.h"
+#include "synth.h"
+
+uint64_t SynthRand(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+void SynthFill(uint64_t* state, uint8_t* dst, size_t size)
+{
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t r = SynthRand(state);
+        memcpy(dst + i, &r, 8);
+    }
+    if (i < size) {
+        uint64_t r = SynthRand(state);
+        memcpy(dst + i, &r, size - i);
+    }
+}
+
+// NES 2.0 size field: units of `unit` in 12 bits, or exponent-multiplier
+static void SynthSizeField(uint64_t size, uint64_t unit, uint8_t* lsb, uint8_t* msb)
+{
+    if (size % unit == 0 && size / unit < 0xF00) {
+        *lsb = (uint8_t)(size / unit);
+        *msb = (uint8_t)((size / unit) >> 8);
+        return;
+    }
+    // size = 2^E * (M * 2 + 1)
+    uint8_t E = 0;
+    while ((size & 1) == 0 && E < 63) {
+        size >>= 1;
+        E++;
+    }
+    *lsb = (uint8_t)((E << 2) | ((size - 1) / 2 & 3));
+    *msb = 0x0F;
+}
+
+void SynthHeader(uint64_t* state, uint8_t header[16], bool nes20,
+                 uint64_t prg_size, uint64_t chr_size, bool trainer)
+{
+    uint64_t r = SynthRand(state);
+    uint32_t mapper = (uint32_t)(r & (nes20 ? 0x1FF : 0xFF));
+
+    memset(header, 0, 16);
+    memcpy(header, "NES\x1A", 4);
+    header[6] = (uint8_t)(((mapper & 0x0F) << 4) | ((r >> 12) & 0x0B));
+    header[7] = (uint8_t)(mapper & 0xF0);
+    if (trainer) {
+        header[6] |= 0x04;
+    }
+    if (!nes20) {
+        header[4] = (uint8_t)(prg_size / 0x4000);
+        header[5] = (uint8_t)(chr_size / 0x2000);
+        header[8] = (uint8_t)((r >> 16) & 1);
+        header[9] = (uint8_t)((r >> 17) & 1);
+        return;
+    }
+    uint8_t prg_msb, chr_msb;
+    header[7] |= 0x08;
+    SynthSizeField(prg_size, 0x4000, &header[4], &prg_msb);
+    SynthSizeField(chr_size, 0x2000, &header[5], &chr_msb);
+    header[8] = (uint8_t)(((mapper >> 8) & 0x0F) | (((r >> 20) & 0x0F) << 4));
+    header[9] = (uint8_t)((prg_msb & 0x0F) | ((chr_msb & 0x0F) << 4));
+    header[10] = (uint8_t)((r >> 24) & 0x77);
+    header[11] = (uint8_t)((r >> 32) & 0x77);
+    header[12] = (uint8_t)((r >> 40) & 0x03);
+    header[13] = (uint8_t)((r >> 42) & 0xFF);
+    header[14] = (uint8_t)((r >> 50) & 0x03);
+    header[15] = (uint8_t)((r >> 52) % 60);
+}
+
+void SynthNintendoHeader(uint64_t* state, uint8_t* nh)
+{
+    static const char* titles[] = {
+        "SUPER MARIO     ", "ZELDA           ", "METROID         ", "KID ICARUS      "
+    };
+    uint64_t r = SynthRand(state);
+    memcpy(nh, titles[r & 3], 16);
+    nh[0x10] = (uint8_t)(r >> 8);
+    nh[0x11] = (uint8_t)(r >> 16);
+    nh[0x12] = (uint8_t)(r >> 24);
+    nh[0x13] = (uint8_t)(r >> 32);
+    nh[0x14] = (uint8_t)((r >> 40) & 0x7F);
+    nh[0x15] = (uint8_t)((r >> 48) & 0x84);
+    nh[0x16] = 1;
+    nh[0x17] = 15;
+    nh[0x18] = (uint8_t)(1 + (r >> 56) % 0xFE);
+    uint8_t sum = 0;
+    for (int i = 0x12; i < 0x19; i++) {
+        sum += nh[i];
+    }
+    nh[0x19] = (uint8_t)(0 - sum);
+}
+
+void SynthAppend(SynthBuf* buf, const char* str)
+{
+    size_t len = strlen(str);
+    if (buf->size + len + 1 > buf->cap) {
+        size_t cap = buf->cap ? buf->cap * 2 : 1 << 16;
+        while (cap < buf->size + len + 1) {
+            cap *= 2;
+        }
+        char* p = (char*)realloc(buf->data, cap);
+        if (p == NULL) {
+            fprintf(stderr, "Error: realloc()\n");
+            exit(1);
+        }
+        buf->data = p;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->size, str, len + 1);
+    buf->size += len;
+}
+
+static void SynthXMLRom(SynthBuf* xml, const char* tag, const uint8_t* src, size_t size)
+{
+    char line[256];
+    char sha1_hex[41];
+    uint8_t sha1[20];
+    uint32_t sum16 = 0;
+
+    SHA1_CTX ctx;
+    SHA1Init(&ctx);
+    SHA1Update(&ctx, src, (uint32_t)size);
+    SHA1Final(sha1, &ctx);
+    for (int i = 0; i < 20; i++) {
+        snprintf(sha1_hex + i * 2, 3, "%02X", sha1[i]);
+    }
+    for (size_t i = 0; i < size; i++) {
+        sum16 += src[i];
+    }
+    snprintf(line, sizeof(line),
+        "\t\t<%s size=\"%lu\" crc32=\"%08X\" sha1=\"%s\" sum16=\"%04X\"/>\n",
+        tag, (unsigned long)size, CRC32(src, size), sha1_hex, sum16 & 0xFFFF);
+    SynthAppend(xml, line);
+}
+
+void SynthXMLGame(SynthBuf* xml, const char* name, const uint8_t* file, size_t file_size,
+                  uint64_t prg_size, uint64_t chr_size, bool trainer, uint32_t mapper)
+{
+    char line[512];
+    size_t pos = 16;
+
+    snprintf(line, sizeof(line), "\t<game>\n\t\t<!-- %s -->\n", name);
+    SynthAppend(xml, line);
+    SynthXMLRom(xml, "rom", file + 16, file_size - 16);
+    if (trainer) {
+        SynthXMLRom(xml, "trainer", file + pos, 512);
+        pos += 512;
+    }
+    SynthXMLRom(xml, "prgrom", file + pos, (size_t)prg_size);
+    pos += (size_t)prg_size;
+    if (chr_size != 0) {
+        SynthXMLRom(xml, "chrrom", file + pos, (size_t)chr_size);
+    }
+    snprintf(line, sizeof(line),
+        "\t\t<pcb mapper=\"%u\" submapper=\"0\" mirroring=\"%c\" battery=\"0\"/>\n"
+        "\t\t<console type=\"0\" region=\"0\"/>\n"
+        "\t\t<expansion type=\"1\"/>\n"
+        "\t</game>\n",
+        mapper, (mapper & 1) ? 'V' : 'H');
+    SynthAppend(xml, line);
+}
+
+static void SynthXMLFakeRom(uint64_t* state, SynthBuf* xml, const char* tag, uint64_t size)
+{
+    char line[256];
+    uint64_t r[3] = { SynthRand(state), SynthRand(state), SynthRand(state) };
+    snprintf(line, sizeof(line),
+        "\t\t<%s size=\"%lu\" crc32=\"%08X\" sha1=\"%016llX%016llX%08X\" sum16=\"%04X\"/>\n",
+        tag, (unsigned long)size, (uint32_t)r[2], (unsigned long long)r[0], (unsigned long long)r[1],
+        (uint32_t)(r[2] >> 32), (unsigned)(r[2] >> 16) & 0xFFFF);
+    SynthAppend(xml, line);
+}
+
+void SynthXMLFakeGame(uint64_t* state, SynthBuf* xml, const char* name,
+                      uint64_t prg_size, uint64_t chr_size, uint32_t mapper)
+{
+    char line[512];
+
+    snprintf(line, sizeof(line), "\t<game>\n\t\t<!-- %s -->\n", name);
+    SynthAppend(xml, line);
+    SynthXMLFakeRom(state, xml, "rom", prg_size + chr_size);
+    SynthXMLFakeRom(state, xml, "prgrom", prg_size);
+    if (chr_size != 0) {
+        SynthXMLFakeRom(state, xml, "chrrom", chr_size);
+    }
+    snprintf(line, sizeof(line),
+        "\t\t<pcb mapper=\"%u\" submapper=\"0\" mirroring=\"%c\" battery=\"0\"/>\n"
+        "\t\t<console type=\"0\" region=\"0\"/>\n"
+        "\t\t<expansion type=\"1\"/>\n"
+        "\t</game>\n",
+        mapper, (mapper & 1) ? 'V' : 'H');
+    SynthAppend(xml, line);
+}
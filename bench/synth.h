@@ -0,0 +1,33 @@
+#pragma once
+
+// Synthetic ROMs and nes20db.xml for benchmarks
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// splitmix64: reproducible from a seed on every platform
+uint64_t SynthRand(uint64_t* state);
+void SynthFill(uint64_t* state, uint8_t* dst, size_t size);
+
+// iNES or NES 2.0 header for the given PRG/CHR sizes.
+// NES 2.0 sizes that don't fit 12 bits use the exponent-multiplier form.
+void SynthHeader(uint64_t* state, uint8_t header[16], bool nes20,
+                 uint64_t prg_size, uint64_t chr_size, bool trainer);
+
+// Valid Nintendo header ($FFE0-$FFF9) in the last 32 bytes of PRG
+void SynthNintendoHeader(uint64_t* state, uint8_t* prg_end32);
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t cap;
+} SynthBuf;
+
+void SynthAppend(SynthBuf* buf, const char* str);
+// <game> element in nes20db.xml layout for one ROM
+void SynthXMLGame(SynthBuf* xml, const char* name, const uint8_t* file, size_t file_size,
+                  uint64_t prg_size, uint64_t chr_size, bool trainer, uint32_t mapper);
+// Same layout with random hashes, for index/search benchmarks
+void SynthXMLFakeGame(uint64_t* state, SynthBuf* xml, const char* name,
+                      uint64_t prg_size, uint64_t chr_size, uint32_t mapper);
@@ -0,0 +1,397 @@
+/*
+ * Scan catalogue.
+ *
+ * The catalogue is small next to the ROMs it describes (about 100 bytes per
+ * file plus the path), so it is rewritten as a whole after each scan: the
+ * kept old rows and the new ones are gathered in memory, the header columns
+ * are decoded from the stored iNES headers with GetNESInfoBatch(), the
+ * indexes are sorted, and the file is swapped in with rename().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "catalog.h"
+
+// Sections in file order
+enum {
+    SECTION_HEADERS,
+    SECTION_MAPPER,
+    SECTION_SUBMAPPER,
+    SECTION_PRG,
+    SECTION_CHR,
+    SECTION_FLAGS,
+    SECTION_FRAME_TIMING,
+    SECTION_CONSOLE_TYPE,
+    SECTION_CONSOLE_EXT,
+    SECTION_EXPANSION,
+    SECTION_FILE_SIZE,
+    SECTION_DIGESTS,
+    SECTION_FILE_CRC32,
+    SECTION_ROM_CRC32,
+    SECTION_FILE_SHA1,
+    SECTION_ROM_SHA1,
+    SECTION_PATH_OFFSET,
+    SECTION_INDEX,          // CATALOG_INDEX_COUNT of them
+    SECTION_PATHS = SECTION_INDEX + CATALOG_INDEX_COUNT,
+    SECTION_COUNT
+};
+
+static const size_t RowSizes[SECTION_INDEX] = {
+    HEADER_SIZE, 2, 1, 8, 8, 2, 1, 1, 1, 1, 8, 1, 4, 4, 20, 20, 8
+};
+
+typedef struct {
+    uint64_t offset[SECTION_COUNT];
+    uint64_t size[SECTION_COUNT];
+    uint64_t end;
+} CatalogLayout;
+
+static void GetLayout(const CatalogHeader* h, CatalogLayout* l)
+{
+    uint64_t pos = (sizeof(CatalogHeader) + 7) & ~(uint64_t)7;
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        if (s < SECTION_INDEX) {
+            l->size[s] = RowSizes[s] * h->rowCount;
+        }
+        else if (s < SECTION_PATHS) {
+            l->size[s] = h->indexCount[s - SECTION_INDEX] * sizeof(CatalogIndexEntry);
+        }
+        else {
+            l->size[s] = h->pathsSize;
+        }
+        l->offset[s] = pos;
+        pos = (pos + l->size[s] + 7) & ~(uint64_t)7;
+    }
+    l->end = l->offset[SECTION_PATHS] + l->size[SECTION_PATHS];
+}
+
+bool CatalogOpen(Catalog* catalog, const char* path, bool is_missing_ok)
+{
+    memset(catalog, 0, sizeof(*catalog));
+    if (!IndexFileOpen(&catalog->file, path, is_missing_ok)) {
+        return false;
+    }
+    if (catalog->file.size == 0) {
+        return true;
+    }
+
+    const uint8_t* data = (const uint8_t*)catalog->file.data;
+    size_t size = catalog->file.size;
+    CatalogHeader h;
+    if (size < sizeof(h)) {
+        CatalogClose(catalog);
+        return false;
+    }
+    memcpy(&h, data, sizeof(h));
+    bool ok = memcmp(h.magic, CATALOG_MAGIC, sizeof(h.magic)) == 0
+        && h.version == CATALOG_VERSION
+        && h.fileSize == size
+        && h.rowCount <= size / HEADER_SIZE
+        && h.pathsSize <= size
+        && (h.shardCount == 0 ? h.shardIndex == 0 : h.shardIndex >= 1 && h.shardIndex <= h.shardCount)
+        && memchr(h.shardRoot, '\0', sizeof(h.shardRoot)) != NULL
+        && (h.shardCount != 0 || h.shardRoot[0] == '\0');
+    for (int i = 0; ok && i < CATALOG_INDEX_COUNT; i++) {
+        ok = h.indexCount[i] <= size / sizeof(CatalogIndexEntry);
+    }
+    CatalogLayout l;
+    if (ok) {
+        GetLayout(&h, &l);
+        ok = l.end == size && (h.pathsSize == 0 ? h.rowCount == 0 : data[l.end - 1] == '\0');
+    }
+    if (!ok) {
+        CatalogClose(catalog);
+        return false;
+    }
+
+    catalog->rowCount = h.rowCount;
+    catalog->headers = data + l.offset[SECTION_HEADERS];
+    catalog->cols.mapper = (uint16_t*)(data + l.offset[SECTION_MAPPER]);
+    catalog->cols.submapper = (uint8_t*)(data + l.offset[SECTION_SUBMAPPER]);
+    catalog->cols.PRGSize = (uint64_t*)(data + l.offset[SECTION_PRG]);
+    catalog->cols.CHRSize = (uint64_t*)(data + l.offset[SECTION_CHR]);
+    catalog->cols.flags = (uint16_t*)(data + l.offset[SECTION_FLAGS]);
+    catalog->cols.frameTiming = (uint8_t*)(data + l.offset[SECTION_FRAME_TIMING]);
+    catalog->cols.consoleType = (uint8_t*)(data + l.offset[SECTION_CONSOLE_TYPE]);
+    catalog->cols.consoleExt = (uint8_t*)(data + l.offset[SECTION_CONSOLE_EXT]);
+    catalog->cols.expansion = (uint8_t*)(data + l.offset[SECTION_EXPANSION]);
+    catalog->fileSize = (const uint64_t*)(data + l.offset[SECTION_FILE_SIZE]);
+    catalog->digests = data + l.offset[SECTION_DIGESTS];
+    catalog->fileCRC32 = (const uint32_t*)(data + l.offset[SECTION_FILE_CRC32]);
+    catalog->romCRC32 = (const uint32_t*)(data + l.offset[SECTION_ROM_CRC32]);
+    catalog->fileSHA1 = data + l.offset[SECTION_FILE_SHA1];
+    catalog->romSHA1 = data + l.offset[SECTION_ROM_SHA1];
+    catalog->pathOffset = (const uint64_t*)(data + l.offset[SECTION_PATH_OFFSET]);
+    for (int i = 0; i < CATALOG_INDEX_COUNT; i++) {
+        catalog->index[i] = (const CatalogIndexEntry*)(data + l.offset[SECTION_INDEX + i]);
+        catalog->indexCount[i] = (size_t)h.indexCount[i];
+        for (size_t k = 0; k < catalog->indexCount[i]; k++) {
+            if (catalog->index[i][k].row >= h.rowCount) {
+                CatalogClose(catalog);
+                return false;
+            }
+        }
+    }
+    catalog->paths = (const char*)(data + l.offset[SECTION_PATHS]);
+    catalog->pathsSize = (size_t)h.pathsSize;
+    catalog->shardIndex = h.shardIndex;
+    catalog->shardCount = h.shardCount;
+    memcpy(catalog->shardRoot, h.shardRoot, sizeof(h.shardRoot));
+    for (size_t r = 0; r < catalog->rowCount; r++) {
+        if (catalog->pathOffset[r] >= h.pathsSize) {
+            CatalogClose(catalog);
+            return false;
+        }
+    }
+    return true;
+}
+
+void CatalogClose(Catalog* catalog)
+{
+    IndexFileClose(&catalog->file);
+    memset(catalog, 0, sizeof(*catalog));
+}
+
+const char* CatalogPath(const Catalog* catalog, size_t row)
+{
+    return catalog->paths + catalog->pathOffset[row];
+}
+
+void CatalogGetEntry(const Catalog* catalog, size_t row, CatalogEntry* entry)
+{
+    memcpy(entry->header, catalog->headers + row * HEADER_SIZE, HEADER_SIZE);
+    entry->fileSize = catalog->fileSize[row];
+    entry->digests = catalog->digests[row];
+    entry->fileCRC32 = catalog->fileCRC32[row];
+    entry->romCRC32 = catalog->romCRC32[row];
+    memcpy(entry->fileSHA1, catalog->fileSHA1 + row * 20, 20);
+    memcpy(entry->romSHA1, catalog->romSHA1 + row * 20, 20);
+}
+
+// First entry with key >= key
+static size_t LowerBound(const CatalogIndexEntry* index, size_t count, uint64_t key)
+{
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index[mid].key < key) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+size_t CatalogFindRange(const Catalog* catalog, CatalogIndexType type, uint64_t lo, uint64_t hi,
+    const CatalogIndexEntry** first)
+{
+    const CatalogIndexEntry* index = catalog->index[type];
+    size_t count = catalog->indexCount[type];
+    size_t begin = LowerBound(index, count, lo);
+    size_t end = hi == UINT64_MAX ? count : LowerBound(index, count, hi + 1);
+    *first = index + begin;
+    return end > begin ? end - begin : 0;
+}
+
+static int CompareIndexEntries(const void* a, const void* b)
+{
+    const CatalogIndexEntry* x = (const CatalogIndexEntry*)a;
+    const CatalogIndexEntry* y = (const CatalogIndexEntry*)b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return (x->row > y->row) - (x->row < y->row);
+}
+
+static int ComparePaths(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+static uint64_t SHA1Key(const uint8_t* sha1)
+{
+    uint64_t key = 0;
+    for (int i = 0; i < 8; i++) {
+        key = key << 8 | sha1[i];
+    }
+    return key;
+}
+
+static void AddIndexEntry(CatalogIndexEntry* index, uint64_t* count, uint64_t key, size_t row)
+{
+    CatalogIndexEntry* e = &index[(*count)++];
+    e->key = key;
+    e->row = (uint32_t)row;
+    e->reserved = 0;
+}
+
+static void WriteSection(IndexWriter* w, const void* data, uint64_t size, uint64_t offset)
+{
+    static const uint8_t zero[8] = {0};
+    long pos = ftell(w->fp);
+    if (pos < 0 || (uint64_t)pos > offset) {
+        w->ok = false;
+        return;
+    }
+    IndexWriterWrite(w, zero, (size_t)(offset - (uint64_t)pos));
+    IndexWriterWrite(w, data, (size_t)size);
+}
+
+bool CatalogWrite(const Catalog* old, const CatalogEntry* added, const char* const* added_paths,
+    size_t added_count, uint32_t shard_index, uint32_t shard_count, const char* shard_root, const char* path)
+{
+    // Old rows scanned again are dropped; the others keep their order
+    const char** sorted = (const char**)malloc((added_count ? added_count : 1) * sizeof(char*));
+    bool* is_repeated = (bool*)malloc((added_count ? added_count : 1) * sizeof(bool));
+    size_t max_rows = old->rowCount + added_count;
+    CatalogEntry* rows = (CatalogEntry*)malloc((max_rows ? max_rows : 1) * sizeof(CatalogEntry));
+    const char** paths = (const char**)malloc((max_rows ? max_rows : 1) * sizeof(char*));
+    if (sorted == NULL || is_repeated == NULL || rows == NULL || paths == NULL
+        || !FindRepeatedPaths(added_paths, added_count, is_repeated)
+    ) {
+        free((void*)sorted);
+        free(is_repeated);
+        free(rows);
+        free((void*)paths);
+        return false;
+    }
+    memcpy((void*)sorted, added_paths, added_count * sizeof(char*));
+    qsort((void*)sorted, added_count, sizeof(char*), ComparePaths);
+    size_t n = 0;
+    for (size_t r = 0; r < old->rowCount; r++) {
+        const char* p = CatalogPath(old, r);
+        if (bsearch(&p, sorted, added_count, sizeof(char*), ComparePaths) == NULL) {
+            CatalogGetEntry(old, r, &rows[n]);
+            paths[n++] = p;
+        }
+    }
+    // ... and so are added rows of a path that comes again later
+    for (size_t i = 0; i < added_count; i++) {
+        if (!is_repeated[i]) {
+            rows[n] = added[i];
+            paths[n++] = added_paths[i];
+        }
+    }
+    free((void*)sorted);
+    free(is_repeated);
+
+    CatalogHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CATALOG_MAGIC, sizeof(h.magic));
+    h.version = CATALOG_VERSION;
+    h.rowCount = (uint32_t)n;
+    h.shardIndex = shard_index;
+    h.shardCount = shard_count;
+    snprintf(h.shardRoot, sizeof(h.shardRoot), "%s", shard_root);
+    for (size_t r = 0; r < n; r++) {
+        h.pathsSize += strlen(paths[r]) + 1;
+    }
+
+    // Columns: one block, cut in the section order
+    CatalogLayout l;
+    GetLayout(&h, &l);
+    uint64_t columns_size = l.offset[SECTION_INDEX] - l.offset[SECTION_HEADERS];
+    uint8_t* columns = (uint8_t*)calloc(columns_size ? (size_t)columns_size : 1, 1);
+    CatalogIndexEntry* index[CATALOG_INDEX_COUNT];
+    bool ok = columns != NULL;
+    for (int i = 0; i < CATALOG_INDEX_COUNT; i++) {
+        size_t per_row = i == CATALOG_INDEX_CRC32 || i == CATALOG_INDEX_SHA1 ? 2 : 1;
+        index[i] = (CatalogIndexEntry*)malloc((n ? n : 1) * per_row * sizeof(CatalogIndexEntry));
+        ok &= index[i] != NULL;
+    }
+    char* path_data = (char*)malloc(h.pathsSize ? (size_t)h.pathsSize : 1);
+    ok &= path_data != NULL;
+
+    if (ok) {
+#define COLUMN(s) (columns + (l.offset[s] - l.offset[SECTION_HEADERS]))
+        NESInfoColumns cols;
+        cols.mapper = (uint16_t*)COLUMN(SECTION_MAPPER);
+        cols.submapper = COLUMN(SECTION_SUBMAPPER);
+        cols.PRGSize = (uint64_t*)COLUMN(SECTION_PRG);
+        cols.CHRSize = (uint64_t*)COLUMN(SECTION_CHR);
+        cols.flags = (uint16_t*)COLUMN(SECTION_FLAGS);
+        cols.frameTiming = COLUMN(SECTION_FRAME_TIMING);
+        cols.consoleType = COLUMN(SECTION_CONSOLE_TYPE);
+        cols.consoleExt = COLUMN(SECTION_CONSOLE_EXT);
+        cols.expansion = COLUMN(SECTION_EXPANSION);
+        uint8_t* headers = COLUMN(SECTION_HEADERS);
+        uint64_t* file_size = (uint64_t*)COLUMN(SECTION_FILE_SIZE);
+        uint8_t* digests = COLUMN(SECTION_DIGESTS);
+        uint32_t* file_crc = (uint32_t*)COLUMN(SECTION_FILE_CRC32);
+        uint32_t* rom_crc = (uint32_t*)COLUMN(SECTION_ROM_CRC32);
+        uint8_t* file_sha1 = COLUMN(SECTION_FILE_SHA1);
+        uint8_t* rom_sha1 = COLUMN(SECTION_ROM_SHA1);
+        uint64_t* path_offset = (uint64_t*)COLUMN(SECTION_PATH_OFFSET);
+        uint64_t pos = 0;
+        for (size_t r = 0; r < n; r++) {
+            const CatalogEntry* e = &rows[r];
+            memcpy(headers + r * HEADER_SIZE, e->header, HEADER_SIZE);
+            file_size[r] = e->fileSize;
+            digests[r] = e->digests;
+            file_crc[r] = e->fileCRC32;
+            rom_crc[r] = e->romCRC32;
+            memcpy(file_sha1 + r * 20, e->fileSHA1, 20);
+            memcpy(rom_sha1 + r * 20, e->romSHA1, 20);
+            size_t len = strlen(paths[r]) + 1;
+            memcpy(path_data + pos, paths[r], len);
+            path_offset[r] = pos;
+            pos += len;
+        }
+        GetNESInfoBatch(headers, n, &cols);
+#undef COLUMN
+
+        for (size_t r = 0; r < n; r++) {
+            const CatalogEntry* e = &rows[r];
+            AddIndexEntry(index[CATALOG_INDEX_MAPPER], &h.indexCount[CATALOG_INDEX_MAPPER],
+                (uint64_t)cols.mapper[r] << 8 | cols.submapper[r], r);
+            AddIndexEntry(index[CATALOG_INDEX_SUBMAPPER], &h.indexCount[CATALOG_INDEX_SUBMAPPER],
+                (uint64_t)cols.submapper[r] << 16 | cols.mapper[r], r);
+            AddIndexEntry(index[CATALOG_INDEX_PRG], &h.indexCount[CATALOG_INDEX_PRG], cols.PRGSize[r], r);
+            AddIndexEntry(index[CATALOG_INDEX_CHR], &h.indexCount[CATALOG_INDEX_CHR], cols.CHRSize[r], r);
+            if (e->digests & CATALOG_D_FILE_CRC32) {
+                AddIndexEntry(index[CATALOG_INDEX_CRC32], &h.indexCount[CATALOG_INDEX_CRC32], e->fileCRC32, r);
+            }
+            if ((e->digests & CATALOG_D_ROM_CRC32) && !((e->digests & CATALOG_D_FILE_CRC32)
+                && e->romCRC32 == e->fileCRC32)
+            ) {
+                AddIndexEntry(index[CATALOG_INDEX_CRC32], &h.indexCount[CATALOG_INDEX_CRC32], e->romCRC32, r);
+            }
+            if (e->digests & CATALOG_D_FILE_SHA1) {
+                AddIndexEntry(index[CATALOG_INDEX_SHA1], &h.indexCount[CATALOG_INDEX_SHA1],
+                    SHA1Key(e->fileSHA1), r);
+            }
+            if (e->digests & CATALOG_D_ROM_SHA1) {
+                AddIndexEntry(index[CATALOG_INDEX_SHA1], &h.indexCount[CATALOG_INDEX_SHA1],
+                    SHA1Key(e->romSHA1), r);
+            }
+        }
+        for (int i = 0; i < CATALOG_INDEX_COUNT; i++) {
+            qsort(index[i], (size_t)h.indexCount[i], sizeof(CatalogIndexEntry), CompareIndexEntries);
+        }
+    }
+    free(rows);
+    free((void*)paths);
+
+    IndexWriter w;
+    ok = ok && IndexWriterOpen(&w, path, sizeof(h), false);
+    if (ok) {
+        GetLayout(&h, &l);
+        h.fileSize = l.end;
+        WriteSection(&w, columns, columns_size, l.offset[SECTION_HEADERS]);
+        for (int i = 0; i < CATALOG_INDEX_COUNT; i++) {
+            WriteSection(&w, index[i], l.size[SECTION_INDEX + i], l.offset[SECTION_INDEX + i]);
+        }
+        WriteSection(&w, path_data, h.pathsSize, l.offset[SECTION_PATHS]);
+        ok = IndexWriterCommit(&w, &h, path);
+    }
+    free(columns);
+    for (int i = 0; i < CATALOG_INDEX_COUNT; i++) {
+        free(index[i]);
+    }
+    free(path_data);
+    return ok;
+}
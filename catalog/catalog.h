@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../nesinfo.h"
+#include "../io/indexfile.h"
+
+// On-disk scan catalogue (--catalog) and its secondary indexes (nesinfo query).
+//
+// File layout, native byte order, every section 8-byte aligned:
+//   CatalogHeader                      section offsets below are from the file start
+//   uint8_t headers[rowCount][16]      iNES header of each file
+//   NESInfoColumns                     mapper, submapper, PRG/CHR size, flags, ... (GetNESInfoBatch)
+//   uint64_t fileSize[rowCount]
+//   uint8_t digests[rowCount]          CATALOG_D_* bits: which digests below are valid
+//   uint32_t fileCRC32[rowCount], romCRC32[rowCount]
+//   uint8_t fileSHA1[rowCount][20], romSHA1[rowCount][20]
+//   uint64_t pathOffset[rowCount]      into paths
+//   CatalogIndexEntry index[CATALOG_INDEX_COUNT][...]   sorted by key, row
+//   char paths[pathsSize]              NUL-terminated
+//
+// An index is a sorted array of (key, row) pairs, so a lookup is two binary
+// searches for the [lo, hi] key range; the rows are then checked against the
+// remaining conditions through the columns.
+//
+// A catalogue written by a `--shard i/N` scan records i, N and the name of the
+// shard root; `nesinfo merge` checks that the catalogues it combines are of
+// one root and cover every shard exactly once.
+
+#define CATALOG_MAGIC   "NESCAT01"
+#define CATALOG_VERSION 3
+#define CATALOG_ROOT_SIZE 64
+
+enum {
+    CATALOG_D_FILE_CRC32 = 1 << 0,
+    CATALOG_D_ROM_CRC32  = 1 << 1,
+    CATALOG_D_FILE_SHA1  = 1 << 2,
+    CATALOG_D_ROM_SHA1   = 1 << 3
+};
+
+typedef enum {
+    CATALOG_INDEX_MAPPER,       // mapper << 8 | submapper
+    CATALOG_INDEX_SUBMAPPER,    // submapper << 16 | mapper
+    CATALOG_INDEX_PRG,          // PRG ROM size
+    CATALOG_INDEX_CHR,          // CHR ROM size
+    CATALOG_INDEX_CRC32,        // File and ROM CRC32, one entry each
+    CATALOG_INDEX_SHA1,         // First 8 bytes of the File and ROM SHA-1, big-endian
+    CATALOG_INDEX_COUNT
+} CatalogIndexType;
+
+typedef struct {
+    uint64_t key;
+    uint32_t row;
+    uint32_t reserved;
+} CatalogIndexEntry;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;           // Also tells the byte order
+    uint32_t rowCount;
+    uint64_t pathsSize;
+    uint64_t indexCount[CATALOG_INDEX_COUNT];
+    uint32_t shardIndex;        // 1..shardCount
+    uint32_t shardCount;        // 0: not a shard
+    char shardRoot[CATALOG_ROOT_SIZE];  // Last component of the shard root, "" if not a shard
+    uint64_t fileSize;          // Of the whole catalogue, checked on open
+} CatalogHeader;
+
+// One scanned file, as gathered during the scan
+typedef struct {
+    uint8_t header[HEADER_SIZE];
+    uint64_t fileSize;
+    uint8_t digests;            // CATALOG_D_*
+    uint32_t fileCRC32;
+    uint32_t romCRC32;
+    uint8_t fileSHA1[20];
+    uint8_t romSHA1[20];
+} CatalogEntry;
+
+typedef struct {
+    size_t rowCount;
+    const uint8_t* headers;
+    NESInfoColumns cols;
+    const uint64_t* fileSize;
+    const uint8_t* digests;
+    const uint32_t* fileCRC32;
+    const uint32_t* romCRC32;
+    const uint8_t* fileSHA1;
+    const uint8_t* romSHA1;
+    const uint64_t* pathOffset;
+    const CatalogIndexEntry* index[CATALOG_INDEX_COUNT];
+    size_t indexCount[CATALOG_INDEX_COUNT];
+    const char* paths;
+    size_t pathsSize;
+    uint32_t shardIndex;
+    uint32_t shardCount;
+    char shardRoot[CATALOG_ROOT_SIZE];
+    IndexFile file;             // Whole file
+} Catalog;
+
+// A missing file opens as an empty catalogue if is_missing_ok
+bool CatalogOpen(Catalog* catalog, const char* path, bool is_missing_ok);
+void CatalogClose(Catalog* catalog);
+
+const char* CatalogPath(const Catalog* catalog, size_t row);
+void CatalogGetEntry(const Catalog* catalog, size_t row, CatalogEntry* entry);
+
+// Index entries with lo <= key <= hi; returns the count
+size_t CatalogFindRange(const Catalog* catalog, CatalogIndexType type, uint64_t lo, uint64_t hi,
+    const CatalogIndexEntry** first);
+
+// Writes old + added as a new catalogue at path (via path.tmp), recording the
+// shard (0/0 and "": none) and the name of its root. Rows of the old catalogue whose path is among added_paths
+// are replaced; of a path repeated in added_paths, the last row is kept.
+bool CatalogWrite(const Catalog* old, const CatalogEntry* added, const char* const* added_paths,
+    size_t added_count, uint32_t shard_index, uint32_t shard_count, const char* shard_root, const char* path);
@@ -0,0 +1,191 @@
+/*
+ * Bank fingerprint index.
+ *
+ * The index is rewritten as a whole after each scan: the old records (read
+ * through the mapping) and the sorted new ones are merged in one streaming
+ * pass into an IndexWriter, which fills the fanout table on the way and
+ * swaps the file in with rename(). Readers only ever see a complete index.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bankindex.h"
+
+int CompareBankRecords(const void* a, const void* b)
+{
+    const BankRecord* x = (const BankRecord*)a;
+    const BankRecord* y = (const BankRecord*)b;
+    if (x->fp != y->fp) {
+        return x->fp < y->fp ? -1 : 1;
+    }
+    if (x->kind != y->kind) {
+        return x->kind < y->kind ? -1 : 1;
+    }
+    if (x->file != y->file) {
+        return x->file < y->file ? -1 : 1;
+    }
+    return (x->bank > y->bank) - (x->bank < y->bank);
+}
+
+bool BankIndexOpen(BankIndex* index, const char* path)
+{
+    memset(index, 0, sizeof(*index));
+    if (!IndexFileOpen(&index->file, path, true)) {
+        return false;
+    }
+    if (index->file.size == 0) {
+        return true;
+    }
+
+    const uint8_t* data = (const uint8_t*)index->file.data;
+    size_t size = index->file.size;
+    BankIndexHeader h;
+    if (size < sizeof(h) + INDEX_FANOUT_SIZE) {
+        BankIndexClose(index);
+        return false;
+    }
+    memcpy(&h, data, sizeof(h));
+    size_t records_pos = sizeof(h) + INDEX_FANOUT_SIZE;
+    if (memcmp(h.magic, BANK_INDEX_MAGIC, sizeof(h.magic)) != 0
+        || h.version != BANK_INDEX_VERSION
+        || h.bankCount > (size - records_pos) / sizeof(BankRecord)
+        || h.pathsSize != size - records_pos - h.bankCount * sizeof(BankRecord)
+    ) {
+        BankIndexClose(index);
+        return false;
+    }
+    index->fanout = (const uint64_t*)(data + sizeof(h));
+    index->records = (const BankRecord*)(data + records_pos);
+    index->count = (size_t)h.bankCount;
+    const char* paths = (const char*)(data + records_pos + h.bankCount * sizeof(BankRecord));
+    if (!FanoutIsValid(index->fanout, h.bankCount) || !ReadPathTable(paths, h.pathsSize, h.fileCount, &index->paths)) {
+        BankIndexClose(index);
+        return false;
+    }
+    for (size_t i = 0; i < index->count; i++) {
+        if (index->records[i].file >= h.fileCount) {
+            BankIndexClose(index);
+            return false;
+        }
+    }
+    index->fileCount = h.fileCount;
+    return true;
+}
+
+void BankIndexClose(BankIndex* index)
+{
+    IndexFileClose(&index->file);
+    free((void*)index->paths);
+    memset(index, 0, sizeof(*index));
+}
+
+size_t BankIndexFind(const BankIndex* index, uint64_t fp, const BankRecord** first)
+{
+    size_t lo;
+    size_t count = FanoutFind(index->fanout, index->records, sizeof(BankRecord), index->count, fp, &lo);
+    *first = index->records + lo;
+    return count;
+}
+
+bool BankIndexFindReplaced(const BankIndex* index, const char* const* paths, size_t count, bool* is_replaced)
+{
+    return FindReplacedPaths(index->paths, index->fileCount, paths, count, is_replaced);
+}
+
+typedef struct {
+    IndexWriter out;
+    BankIndexTotals* totals;
+    uint64_t count;
+    BankRecord last;        // Previous record, valid if count != 0
+} RecordWriter;
+
+static void WriteRecord(RecordWriter* w, const BankRecord* r)
+{
+    w->totals->banks[r->kind]++;
+    if (w->count == 0 || w->last.fp != r->fp || w->last.kind != r->kind) {
+        w->totals->unique[r->kind]++;
+    }
+    IndexWriterAddRecord(&w->out, r, sizeof(*r), r->fp);
+    w->last = *r;
+    w->count++;
+}
+
+bool BankIndexWrite(const BankIndex* old, const bool* is_replaced, const BankRecord* added, size_t added_count,
+    const char* const* added_paths, size_t added_files, const char* path, BankIndexTotals* totals)
+{
+    memset(totals, 0, sizeof(*totals));
+
+    // Old files scanned again are dropped; the others keep their order
+    uint32_t* remap = (uint32_t*)malloc((old->fileCount ? old->fileCount : 1) * sizeof(uint32_t));
+    if (remap == NULL) {
+        return false;
+    }
+    uint32_t kept = 0;
+    for (size_t i = 0; i < old->fileCount; i++) {
+        remap[i] = is_replaced[i] ? UINT32_MAX : kept++;
+    }
+
+    RecordWriter w;
+    memset(&w, 0, sizeof(w));
+    w.totals = totals;
+    BankIndexHeader h;
+    if (!IndexWriterOpen(&w.out, path, sizeof(h), true)) {
+        free(remap);
+        return false;
+    }
+    memset(&h, 0, sizeof(h));
+
+    // Old and added records are both sorted; old file ids only move down,
+    // added ones go after all kept files, so the merged order stays valid
+    BankRecord a, b;
+    size_t i = 0, j = 0;
+    bool has_a = false;
+    while (w.out.ok) {
+        while (!has_a && i < old->count) {
+            a = old->records[i++];
+            if (remap[a.file] != UINT32_MAX) {
+                a.file = remap[a.file];
+                has_a = true;
+            }
+        }
+        bool has_b = j < added_count;
+        if (has_b) {
+            b = added[j];
+            b.file += kept;
+        }
+        if (!has_a && !has_b) {
+            break;
+        }
+        if (has_a && (!has_b || CompareBankRecords(&a, &b) <= 0)) {
+            WriteRecord(&w, &a);
+            has_a = false;
+        }
+        else {
+            WriteRecord(&w, &b);
+            j++;
+        }
+    }
+    h.bankCount = w.count;
+
+    for (size_t f = 0; f < old->fileCount; f++) {
+        if (remap[f] != UINT32_MAX) {
+            size_t len = strlen(old->paths[f]) + 1;
+            IndexWriterWrite(&w.out, old->paths[f], len);
+            h.pathsSize += len;
+            h.fileCount++;
+        }
+    }
+    for (size_t f = 0; f < added_files; f++) {
+        size_t len = strlen(added_paths[f]) + 1;
+        IndexWriterWrite(&w.out, added_paths[f], len);
+        h.pathsSize += len;
+        h.fileCount++;
+    }
+    totals->files = h.fileCount;
+    free(remap);
+
+    memcpy(h.magic, BANK_INDEX_MAGIC, sizeof(h.magic));
+    h.version = BANK_INDEX_VERSION;
+    return IndexWriterCommit(&w.out, &h, path);
+}
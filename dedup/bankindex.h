@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../io/indexfile.h"
+
+// On-disk index of PRG/CHR bank fingerprints across scans (--bank-index).
+//
+// File layout, native byte order:
+//   BankIndexHeader
+//   uint64_t fanout[BANK_FANOUT + 1]   first record whose fingerprint >> 48 is >= i
+//   BankRecord records[bankCount]      sorted by fp, kind, file, bank
+//   char paths[pathsSize]              fileCount NUL-terminated paths, by file id
+//
+// A lookup is one fanout step plus a binary search in a bucket of about
+// bankCount / 65536 records; the file is mmap()'ed where possible.
+
+#define BANK_INDEX_MAGIC   "NESBANK1"
+#define BANK_INDEX_VERSION 1
+#define BANK_FANOUT        INDEX_FANOUT
+#define BANK_MAX_BANKS     65536    // Per region and kind
+
+enum {
+    BANK_KIND_PRG,          // 8 KiB
+    BANK_KIND_CHR,          // 8 KiB
+    BANK_KIND_CHR1K,        // 1 KiB
+    BANK_KIND_COUNT
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;       // Also tells the byte order
+    uint32_t fileCount;
+    uint64_t bankCount;
+    uint64_t pathsSize;
+} BankIndexHeader;
+
+typedef struct {
+    uint64_t fp;            // XXH64 of the bank
+    uint32_t file;
+    uint16_t bank;          // Bank number in its region
+    uint8_t kind;           // BANK_KIND_*
+    uint8_t reserved;
+} BankRecord;
+
+typedef struct {
+    const BankRecord* records;
+    size_t count;
+    const uint64_t* fanout;
+    const char** paths;     // By file id
+    size_t fileCount;
+    IndexFile file;         // Whole file
+} BankIndex;
+
+int CompareBankRecords(const void* a, const void* b);
+
+// A missing file opens as an empty index
+bool BankIndexOpen(BankIndex* index, const char* path);
+void BankIndexClose(BankIndex* index);
+
+// All records of fp, of any kind and file; returns the count
+size_t BankIndexFind(const BankIndex* index, uint64_t fp, const BankRecord** first);
+
+// is_replaced[file] = the path of the index file is among paths[count]
+bool BankIndexFindReplaced(const BankIndex* index, const char* const* paths, size_t count, bool* is_replaced);
+
+typedef struct {
+    uint64_t banks[BANK_KIND_COUNT];
+    uint64_t unique[BANK_KIND_COUNT];
+    uint64_t files;
+} BankIndexTotals;
+
+// Writes old + added as a new index at path (via path.tmp). Files of the old
+// index with is_replaced[file] (BankIndexFindReplaced() on added_paths) are
+// dropped. added[].file indexes added_paths; added must be sorted with
+// CompareBankRecords().
+bool BankIndexWrite(const BankIndex* old, const bool* is_replaced, const BankRecord* added, size_t added_count,
+    const char* const* added_paths, size_t added_files, const char* path, BankIndexTotals* totals);
@@ -0,0 +1,256 @@
+/*
+ * MinHash sketches and the LSH catalog.
+ *
+ * The K hash functions are multiply-shift hashes of the shingle fingerprint,
+ * which is already a well-mixed 64-bit value; their constants come from
+ * SplitMix64 so every build computes the same sketches. The catalog is
+ * rewritten as a whole like the bank index: old records (through the
+ * mapping, minus the rescanned files) and the sorted new ones are merged in
+ * one pass into an IndexWriter, which swaps the file in with rename().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../hash/xxh64.h"
+#include "minhash.h"
+
+static uint64_t SplitMix64(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+void MinHashInit(MinHashSketch* sketch)
+{
+    memset(sketch->mins, 0xFF, sizeof(sketch->mins));
+}
+
+void MinHashAdd(MinHashSketch* sketch, const uint64_t* shingles, size_t count)
+{
+    uint64_t mul[MINHASH_K];
+    uint64_t add[MINHASH_K];
+    uint64_t state = 0x4E455348494E464Full;     // "NESHINFO"
+    for (int k = 0; k < MINHASH_K; k++) {
+        mul[k] = SplitMix64(&state) | 1;
+        add[k] = SplitMix64(&state);
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint64_t x = shingles[i];
+        // Independent lanes: the compiler vectorizes this loop
+        for (int k = 0; k < MINHASH_K; k++) {
+            uint32_t h = (uint32_t)((x * mul[k] + add[k]) >> 32);
+            sketch->mins[k] = h < sketch->mins[k] ? h : sketch->mins[k];
+        }
+    }
+}
+
+bool MinHashIsEmpty(const MinHashSketch* sketch)
+{
+    for (int k = 0; k < MINHASH_K; k++) {
+        if (sketch->mins[k] != UINT32_MAX) {
+            return false;
+        }
+    }
+    return true;
+}
+
+double MinHashSimilarity(const MinHashSketch* a, const MinHashSketch* b)
+{
+    if (MinHashIsEmpty(a) || MinHashIsEmpty(b)) {
+        return 0.0;
+    }
+    int equal = 0;
+    for (int k = 0; k < MINHASH_K; k++) {
+        equal += a->mins[k] == b->mins[k];
+    }
+    return (double)equal / MINHASH_K;
+}
+
+void MinHashBandKeys(const MinHashSketch* sketch, uint64_t keys[MINHASH_BANDS])
+{
+    for (int b = 0; b < MINHASH_BANDS; b++) {
+        keys[b] = XXH64(sketch->mins + b * MINHASH_ROWS, MINHASH_ROWS * sizeof(uint32_t), (uint64_t)b);
+    }
+}
+
+int CompareSketchRecords(const void* a, const void* b)
+{
+    const SketchRecord* x = (const SketchRecord*)a;
+    const SketchRecord* y = (const SketchRecord*)b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return (x->file > y->file) - (x->file < y->file);
+}
+
+bool SketchCatalogOpen(SketchCatalog* catalog, const char* path)
+{
+    memset(catalog, 0, sizeof(*catalog));
+    if (!IndexFileOpen(&catalog->file, path, true)) {
+        return false;
+    }
+    if (catalog->file.size == 0) {
+        return true;
+    }
+
+    const uint8_t* data = (const uint8_t*)catalog->file.data;
+    SketchCatalogHeader h;
+    if (catalog->file.size < sizeof(h) + INDEX_FANOUT_SIZE) {
+        SketchCatalogClose(catalog);
+        return false;
+    }
+    memcpy(&h, data, sizeof(h));
+    size_t records_pos = sizeof(h) + INDEX_FANOUT_SIZE;
+    size_t rest = catalog->file.size - records_pos;
+    if (memcmp(h.magic, SKETCH_CATALOG_MAGIC, sizeof(h.magic)) != 0
+        || h.version != SKETCH_CATALOG_VERSION
+        || h.hashCount != MINHASH_K || h.bandCount != MINHASH_BANDS
+        || h.recordCount > rest / sizeof(SketchRecord)
+        || h.fileCount > (rest - h.recordCount * sizeof(SketchRecord)) / sizeof(MinHashSketch)
+        || h.pathsSize != rest - h.recordCount * sizeof(SketchRecord) - h.fileCount * sizeof(MinHashSketch)
+    ) {
+        SketchCatalogClose(catalog);
+        return false;
+    }
+    catalog->fanout = (const uint64_t*)(data + sizeof(h));
+    catalog->records = (const SketchRecord*)(data + records_pos);
+    catalog->count = (size_t)h.recordCount;
+    if (!FanoutIsValid(catalog->fanout, h.recordCount)) {
+        SketchCatalogClose(catalog);
+        return false;
+    }
+    for (size_t i = 0; i < catalog->count; i++) {
+        if (catalog->records[i].file >= h.fileCount) {
+            SketchCatalogClose(catalog);
+            return false;
+        }
+    }
+    size_t sketches_pos = records_pos + h.recordCount * sizeof(SketchRecord);
+    catalog->sketches = (const MinHashSketch*)(data + sketches_pos);
+    const char* paths = (const char*)(data + sketches_pos + h.fileCount * sizeof(MinHashSketch));
+    if (!ReadPathTable(paths, h.pathsSize, h.fileCount, &catalog->paths)) {
+        SketchCatalogClose(catalog);
+        return false;
+    }
+    catalog->fileCount = h.fileCount;
+    return true;
+}
+
+void SketchCatalogClose(SketchCatalog* catalog)
+{
+    IndexFileClose(&catalog->file);
+    free((void*)catalog->paths);
+    memset(catalog, 0, sizeof(*catalog));
+}
+
+size_t SketchCatalogFind(const SketchCatalog* catalog, uint64_t key, const SketchRecord** first)
+{
+    size_t lo;
+    size_t count = FanoutFind(catalog->fanout, catalog->records, sizeof(SketchRecord), catalog->count, key, &lo);
+    *first = catalog->records + lo;
+    return count;
+}
+
+bool SketchCatalogFindReplaced(const SketchCatalog* catalog, const char* const* paths, size_t count,
+    bool* is_replaced)
+{
+    return FindReplacedPaths(catalog->paths, catalog->fileCount, paths, count, is_replaced);
+}
+
+bool SketchCatalogWrite(const SketchCatalog* old, const bool* is_replaced, const MinHashSketch* added,
+    const char* const* added_paths, size_t added_files, const char* path)
+{
+    // Old files scanned again are dropped; the others keep their order
+    uint32_t* remap = (uint32_t*)malloc((old->fileCount ? old->fileCount : 1) * sizeof(uint32_t));
+    SketchRecord* records = (SketchRecord*)malloc((added_files ? added_files : 1) * MINHASH_BANDS
+        * sizeof(SketchRecord));
+    SketchCatalogHeader h;
+    IndexWriter w;
+    if (remap == NULL || records == NULL || !IndexWriterOpen(&w, path, sizeof(h), true)) {
+        free(remap);
+        free(records);
+        return false;
+    }
+    memset(&h, 0, sizeof(h));
+
+    uint32_t kept = 0;
+    for (size_t i = 0; i < old->fileCount; i++) {
+        remap[i] = is_replaced[i] ? UINT32_MAX : kept++;
+    }
+    size_t added_count = 0;
+    for (size_t f = 0; f < added_files; f++) {
+        if (MinHashIsEmpty(&added[f])) {
+            continue;
+        }
+        uint64_t keys[MINHASH_BANDS];
+        MinHashBandKeys(&added[f], keys);
+        for (int b = 0; b < MINHASH_BANDS; b++) {
+            SketchRecord* r = &records[added_count++];
+            r->key = keys[b];
+            r->file = kept + (uint32_t)f;
+            r->reserved = 0;
+        }
+    }
+    qsort(records, added_count, sizeof(SketchRecord), CompareSketchRecords);
+
+    // Kept old file ids only move down and added ones go after them, so
+    // both inputs stay sorted and a plain merge keeps the order
+    SketchRecord a;
+    size_t i = 0, j = 0;
+    bool has_a = false;
+    while (w.ok) {
+        while (!has_a && i < old->count) {
+            a = old->records[i++];
+            if (remap[a.file] != UINT32_MAX) {
+                a.file = remap[a.file];
+                has_a = true;
+            }
+        }
+        bool has_b = j < added_count;
+        if (!has_a && !has_b) {
+            break;
+        }
+        const SketchRecord* r;
+        if (has_a && (!has_b || CompareSketchRecords(&a, &records[j]) <= 0)) {
+            r = &a;
+            has_a = false;
+        }
+        else {
+            r = &records[j++];
+        }
+        IndexWriterAddRecord(&w, r, sizeof(*r), r->key);
+        h.recordCount++;
+    }
+
+    for (size_t f = 0; f < old->fileCount; f++) {
+        if (remap[f] != UINT32_MAX) {
+            IndexWriterWrite(&w, &old->sketches[f], sizeof(MinHashSketch));
+        }
+    }
+    IndexWriterWrite(&w, added, added_files * sizeof(MinHashSketch));
+    for (size_t f = 0; f < old->fileCount; f++) {
+        if (remap[f] != UINT32_MAX) {
+            size_t len = strlen(old->paths[f]) + 1;
+            IndexWriterWrite(&w, old->paths[f], len);
+            h.pathsSize += len;
+            h.fileCount++;
+        }
+    }
+    for (size_t f = 0; f < added_files; f++) {
+        size_t len = strlen(added_paths[f]) + 1;
+        IndexWriterWrite(&w, added_paths[f], len);
+        h.pathsSize += len;
+        h.fileCount++;
+    }
+    free(remap);
+    free(records);
+
+    memcpy(h.magic, SKETCH_CATALOG_MAGIC, sizeof(h.magic));
+    h.version = SKETCH_CATALOG_VERSION;
+    h.hashCount = MINHASH_K;
+    h.bandCount = MINHASH_BANDS;
+    return IndexWriterCommit(&w, &h, path);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../io/indexfile.h"
+
+// MinHash sketches of ROM contents and an on-disk LSH catalog of them
+// (--similar). The shingles are the XXH64 fingerprints of every 1 KiB block
+// of PRG and CHR, so a hack or translation that rewrites a few blocks keeps
+// most of its parent's shingles.
+//
+// File layout, native byte order:
+//   SketchCatalogHeader
+//   uint64_t fanout[SKETCH_FANOUT + 1] first record whose key >> 48 is >= i
+//   SketchRecord records[recordCount]  sorted by key, file
+//   MinHashSketch sketches[fileCount]  by file id
+//   char paths[pathsSize]              fileCount NUL-terminated paths, by file id
+//
+// Each sketch is cut into MINHASH_BANDS bands of MINHASH_ROWS values; files
+// whose sketches agree on a whole band share its record key. A query looks up
+// its MINHASH_BANDS keys, then compares the full sketches of the candidates:
+// files with similarity s become candidates with probability
+// 1 - (1 - s^MINHASH_ROWS)^MINHASH_BANDS (0.64 at s = 0.5, 0.98 at s = 0.7).
+
+#define MINHASH_K           64
+#define MINHASH_BANDS       16
+#define MINHASH_ROWS        (MINHASH_K / MINHASH_BANDS)
+
+#define SKETCH_CATALOG_MAGIC   "NESSIM01"
+#define SKETCH_CATALOG_VERSION 1
+#define SKETCH_FANOUT          INDEX_FANOUT
+
+typedef struct {
+    uint32_t mins[MINHASH_K];
+} MinHashSketch;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;       // Also tells the byte order
+    uint32_t fileCount;
+    uint32_t hashCount;     // MINHASH_K
+    uint32_t bandCount;     // MINHASH_BANDS
+    uint64_t recordCount;
+    uint64_t pathsSize;
+} SketchCatalogHeader;
+
+typedef struct {
+    uint64_t key;           // Band number and values, hashed
+    uint32_t file;
+    uint32_t reserved;
+} SketchRecord;
+
+typedef struct {
+    const SketchRecord* records;
+    size_t count;
+    const uint64_t* fanout;
+    const MinHashSketch* sketches;  // By file id
+    const char** paths;
+    size_t fileCount;
+    IndexFile file;         // Whole file
+} SketchCatalog;
+
+void MinHashInit(MinHashSketch* sketch);
+void MinHashAdd(MinHashSketch* sketch, const uint64_t* shingles, size_t count);
+bool MinHashIsEmpty(const MinHashSketch* sketch);
+// Estimated Jaccard similarity of the shingle sets, 0..1
+double MinHashSimilarity(const MinHashSketch* a, const MinHashSketch* b);
+void MinHashBandKeys(const MinHashSketch* sketch, uint64_t keys[MINHASH_BANDS]);
+
+int CompareSketchRecords(const void* a, const void* b);
+
+// A missing file opens as an empty catalog
+bool SketchCatalogOpen(SketchCatalog* catalog, const char* path);
+void SketchCatalogClose(SketchCatalog* catalog);
+
+// All records of key; returns the count
+size_t SketchCatalogFind(const SketchCatalog* catalog, uint64_t key, const SketchRecord** first);
+
+// is_replaced[file] = the path of the catalog file is among paths[count]
+bool SketchCatalogFindReplaced(const SketchCatalog* catalog, const char* const* paths, size_t count,
+    bool* is_replaced);
+
+// Writes old + added as a new catalog at path (via path.tmp). Files of the old
+// catalog with is_replaced[file] (SketchCatalogFindReplaced() on added_paths)
+// are dropped. Empty sketches (no PRG/CHR) are kept but get no band records.
+bool SketchCatalogWrite(const SketchCatalog* old, const bool* is_replaced, const MinHashSketch* added,
+    const char* const* added_paths, size_t added_files, const char* path);
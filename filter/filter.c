@@ -0,0 +1,353 @@
+/*
+ * Header filter expressions.
+ *
+ * A recursive-descent parser emits the program directly: there is no syntax
+ * tree. Each && / || chain leaves a list of forward jumps that are patched
+ * to the end of the chain once it is parsed; `!term` flips the comparison of
+ * the term's test instead of emitting FILTER_OP_NOT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "filter.h"
+
+#define FILTER_MAX_DEPTH 64
+
+// In FilterField order
+static const char* FilterFieldNames[FILTER_FIELD_COUNT] = {
+    "mapper", "submapper", "prg", "chr", "size", "console", "timing", "expansion",
+    "battery", "trainer", "4screen", "vertical", "nes20",
+    "prgram", "prgnvram", "chrram", "chrnvram", "misc", "nh", "maker"
+};
+
+typedef struct {
+    const char* expr;
+    size_t pos;
+    FilterInsn* code;
+    size_t count;
+    size_t capacity;
+    uint32_t fields;
+    int depth;
+    char* error;
+    size_t errorSize;
+    bool isFailed;
+} FilterParser;
+
+static bool ParseOr(FilterParser* p);
+
+static void SetError(FilterParser* p, const char* what)
+{
+    if (!p->isFailed) {
+        snprintf(p->error, p->errorSize, "%s at offset %zu", what, p->pos);
+        p->isFailed = true;
+    }
+}
+
+static bool Emit(FilterParser* p, FilterOp op, uint8_t field, uint8_t cmp, uint64_t value)
+{
+    if (p->count == p->capacity) {
+        size_t capacity = p->capacity != 0 ? p->capacity * 2 : 16;
+        FilterInsn* code = (FilterInsn*)realloc(p->code, capacity * sizeof(FilterInsn));
+        if (code == NULL) {
+            SetError(p, "out of memory");
+            return false;
+        }
+        p->code = code;
+        p->capacity = capacity;
+    }
+    FilterInsn* insn = &p->code[p->count++];
+    insn->op = (uint8_t)op;
+    insn->field = field;
+    insn->cmp = cmp;
+    insn->reserved = 0;
+    insn->target = 0;
+    insn->value = value;
+    return true;
+}
+
+static void SkipSpaces(FilterParser* p)
+{
+    while (p->expr[p->pos] == ' ' || p->expr[p->pos] == '\t') {
+        p->pos++;
+    }
+}
+
+static bool IsWordChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Consumes tok if it comes next
+static bool Accept(FilterParser* p, const char* tok)
+{
+    SkipSpaces(p);
+    size_t len = strlen(tok);
+    if (strncmp(p->expr + p->pos, tok, len) != 0) {
+        return false;
+    }
+    p->pos += len;
+    return true;
+}
+
+static size_t ScanWord(FilterParser* p)
+{
+    SkipSpaces(p);
+    size_t len = 0;
+    while (IsWordChar(p->expr[p->pos + len])) {
+        len++;
+    }
+    return len;
+}
+
+// Decimal or 0x hex, with an optional K/KiB/M/MiB multiplier
+static bool ParseNumber(const char* word, size_t len, uint64_t* value)
+{
+    char buf[32];
+    if (len == 0 || len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, word, len);
+    buf[len] = '\0';
+
+    char* end;
+    errno = 0;
+    unsigned long long v = strtoull(buf, &end, 0);
+    if (end == buf || errno != 0) {
+        return false;
+    }
+    uint64_t scale = 1;
+    if (*end == 'K' || *end == 'k') {
+        scale = 1024;
+    }
+    else if (*end == 'M' || *end == 'm') {
+        scale = 1024 * 1024;
+    }
+    if (scale != 1) {
+        end++;
+        if (strcmp(end, "iB") == 0 || strcmp(end, "B") == 0) {
+            end += strlen(end);
+        }
+    }
+    *value = (uint64_t)v * scale;
+    return *end == '\0';
+}
+
+// field [op number]
+static bool ParseTerm(FilterParser* p)
+{
+    size_t len = ScanWord(p);
+    const char* name = p->expr + p->pos;
+    int f = 0;
+    while (f < FILTER_FIELD_COUNT
+        && (strlen(FilterFieldNames[f]) != len || strncmp(name, FilterFieldNames[f], len) != 0)
+    ) {
+        f++;
+    }
+    if (f == FILTER_FIELD_COUNT) {
+        SetError(p, len != 0 ? "unknown field" : "expected a field");
+        return false;
+    }
+    p->pos += len;
+    p->fields |= 1u << f;
+
+    // Longest operators first
+    static const struct { const char* tok; FilterCmp cmp; } ops[] = {
+        { "==", FILTER_EQ }, { "!=", FILTER_NE }, { "<=", FILTER_LE }, { ">=", FILTER_GE },
+        { "=", FILTER_EQ }, { "<", FILTER_LT }, { ">", FILTER_GT }
+    };
+    size_t i = 0;
+    while (i < sizeof(ops) / sizeof(ops[0]) && !Accept(p, ops[i].tok)) {
+        i++;
+    }
+    if (i == sizeof(ops) / sizeof(ops[0])) {
+        return Emit(p, FILTER_OP_TEST, (uint8_t)f, FILTER_NE, 0);
+    }
+
+    uint64_t value;
+    len = ScanWord(p);
+    if (!ParseNumber(p->expr + p->pos, len, &value)) {
+        SetError(p, "expected a number");
+        return false;
+    }
+    p->pos += len;
+    return Emit(p, FILTER_OP_TEST, (uint8_t)f, (uint8_t)ops[i].cmp, value);
+}
+
+// !unary | ( or ) | term
+static bool ParseUnary(FilterParser* p)
+{
+    if (++p->depth > FILTER_MAX_DEPTH) {
+        SetError(p, "expression is nested too deeply");
+        return false;
+    }
+    bool ok;
+    SkipSpaces(p);
+    if (p->expr[p->pos] == '!' && p->expr[p->pos + 1] != '=') {
+        p->pos++;
+        size_t start = p->count;
+        ok = ParseUnary(p);
+        if (ok && p->count == start + 1 && p->code[start].op == FILTER_OP_TEST) {
+            // EQ <-> NE, LT <-> GE, LE <-> GT
+            static const uint8_t negated[] = { FILTER_NE, FILTER_EQ, FILTER_GE, FILTER_GT, FILTER_LE, FILTER_LT };
+            p->code[start].cmp = negated[p->code[start].cmp];
+        }
+        else if (ok) {
+            ok = Emit(p, FILTER_OP_NOT, 0, 0, 0);
+        }
+    }
+    else if (Accept(p, "(")) {
+        ok = ParseOr(p);
+        if (ok && !Accept(p, ")")) {
+            SetError(p, "expected ')'");
+            ok = false;
+        }
+    }
+    else {
+        ok = ParseTerm(p);
+    }
+    p->depth--;
+    return ok;
+}
+
+// operand (tok operand)*, with a jump to the end after each operand but the last
+static bool ParseChain(FilterParser* p, const char* tok, FilterOp jump, bool (*operand)(FilterParser*))
+{
+    size_t first_jump = p->count;
+    if (!operand(p)) {
+        return false;
+    }
+    bool is_chain = false;
+    while (Accept(p, tok)) {
+        // The jumps are linked through their targets until the end is known
+        if (!Emit(p, jump, 0, 0, 0)) {
+            return false;
+        }
+        p->code[p->count - 1].target = is_chain ? (uint32_t)first_jump : UINT32_MAX;
+        first_jump = p->count - 1;
+        is_chain = true;
+        if (!operand(p)) {
+            return false;
+        }
+    }
+    if (is_chain) {
+        uint32_t end = (uint32_t)p->count;
+        size_t i = first_jump;
+        while (i != UINT32_MAX) {
+            size_t next = p->code[i].target;
+            p->code[i].target = end;
+            i = next;
+        }
+    }
+    return true;
+}
+
+static bool ParseAnd(FilterParser* p)
+{
+    return ParseChain(p, "&&", FILTER_OP_JFALSE, ParseUnary);
+}
+
+static bool ParseOr(FilterParser* p)
+{
+    return ParseChain(p, "||", FILTER_OP_JTRUE, ParseAnd);
+}
+
+bool FilterCompile(const char* expr, FilterProgram* prog, char* error, size_t error_size)
+{
+    FilterParser p;
+    memset(&p, 0, sizeof(p));
+    p.expr = expr;
+    p.error = error;
+    p.errorSize = error_size;
+
+    bool ok = ParseOr(&p);
+    SkipSpaces(&p);
+    if (ok && p.expr[p.pos] != '\0') {
+        SetError(&p, "unexpected input");
+        ok = false;
+    }
+    if (ok) {
+        ok = Emit(&p, FILTER_OP_END, 0, 0, 0);
+    }
+    if (!ok) {
+        free(p.code);
+        return false;
+    }
+    prog->code = p.code;
+    prog->count = p.count;
+    prog->fields = p.fields;
+    return true;
+}
+
+void FilterFree(FilterProgram* prog)
+{
+    free(prog->code);
+    prog->code = NULL;
+    prog->count = 0;
+    prog->fields = 0;
+}
+
+void FilterGetValues(const NESInfo* info, size_t file_size, const NintendoHeader* nh,
+    uint64_t values[FILTER_FIELD_COUNT])
+{
+    values[FILTER_MAPPER] = info->mapper;
+    values[FILTER_SUBMAPPER] = info->submapper;
+    values[FILTER_PRG] = info->PRGSize;
+    values[FILTER_CHR] = info->CHRSize;
+    values[FILTER_SIZE] = file_size;
+    values[FILTER_CONSOLE] = info->consoleType1;
+    values[FILTER_TIMING] = info->frameTiming;
+    values[FILTER_EXPANSION] = info->expansion;
+    values[FILTER_BATTERY] = info->isBattery;
+    values[FILTER_TRAINER] = info->isTrainer;
+    values[FILTER_4SCREEN] = info->is4Screen;
+    values[FILTER_VERTICAL] = info->isVertMirroring;
+    values[FILTER_NES20] = info->isExtended;
+    values[FILTER_PRGRAM] = info->isExtended ? info->PRGRAMSize : info->PRGRAMSize8K_iNES * 8192u;
+    values[FILTER_PRGNVRAM] = info->PRGSaveRAMSize;
+    values[FILTER_CHRRAM] = info->CHRRAMSize;
+    values[FILTER_CHRNVRAM] = info->CHRSaveRAMSize;
+    values[FILTER_MISC] = info->miscROMs;
+    values[FILTER_NH] = nh != NULL;
+    values[FILTER_MAKER] = nh != NULL ? nh->makerCode : 0;
+}
+
+bool FilterMatch(const FilterProgram* prog, const uint64_t values[FILTER_FIELD_COUNT])
+{
+    const FilterInsn* code = prog->code;
+    bool r = false;
+    for (size_t pc = 0; ; pc++) {
+        const FilterInsn* insn = &code[pc];
+        switch (insn->op) {
+        case FILTER_OP_TEST: {
+            uint64_t v = values[insn->field];
+            switch (insn->cmp) {
+            case FILTER_EQ: r = v == insn->value; break;
+            case FILTER_NE: r = v != insn->value; break;
+            case FILTER_LT: r = v < insn->value; break;
+            case FILTER_LE: r = v <= insn->value; break;
+            case FILTER_GT: r = v > insn->value; break;
+            default:        r = v >= insn->value; break;
+            }
+            break;
+        }
+        case FILTER_OP_NOT:
+            r = !r;
+            break;
+        case FILTER_OP_JFALSE:
+            if (!r) {
+                pc = insn->target - 1;
+            }
+            break;
+        case FILTER_OP_JTRUE:
+            if (r) {
+                pc = insn->target - 1;
+            }
+            break;
+        default:
+            return r;
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../nesinfo.h"
+
+// Header filter expressions (--filter), e.g.
+//   mapper == 4 && battery
+//   nes20 && submapper != 0
+//   prg >= 1MiB || (chr == 0 && !vertical)
+//
+// Terms are `field op number` (==, =, !=, <, <=, >, >=; numbers are decimal
+// or 0x hex with an optional K/KiB/M/MiB multiplier) or a bare field, which
+// means field != 0. Terms combine with !, && and || and parentheses.
+//
+// The expression is compiled once into a short program for a one-register
+// machine: every term is a single FILTER_OP_TEST instruction that sets the
+// register, && and || become conditional jumps over the right operand, so a
+// file is rejected after the first failing term of a conjunction.
+
+typedef enum {
+    FILTER_MAPPER,
+    FILTER_SUBMAPPER,
+    FILTER_PRG,
+    FILTER_CHR,
+    FILTER_SIZE,            // File size
+    FILTER_CONSOLE,         // consoleType1
+    FILTER_TIMING,
+    FILTER_EXPANSION,
+    FILTER_BATTERY,
+    FILTER_TRAINER,
+    FILTER_4SCREEN,
+    FILTER_VERTICAL,
+    FILTER_NES20,
+    FILTER_PRGRAM,
+    FILTER_PRGNVRAM,
+    FILTER_CHRRAM,
+    FILTER_CHRNVRAM,
+    FILTER_MISC,            // miscROMs
+    FILTER_NH,              // Valid Nintendo header
+    FILTER_MAKER,           // Its maker's code
+    FILTER_FIELD_COUNT
+} FilterField;
+
+// Fields that need the Nintendo header bytes near the end of PRG
+#define FILTER_NH_FIELDS ((1u << FILTER_NH) | (1u << FILTER_MAKER))
+
+typedef enum {
+    FILTER_OP_TEST,         // r = values[field] cmp value
+    FILTER_OP_NOT,          // r = !r
+    FILTER_OP_JFALSE,       // if !r goto target
+    FILTER_OP_JTRUE,        // if r goto target
+    FILTER_OP_END           // return r
+} FilterOp;
+
+typedef enum { FILTER_EQ, FILTER_NE, FILTER_LT, FILTER_LE, FILTER_GT, FILTER_GE } FilterCmp;
+
+typedef struct {
+    uint8_t op;             // FilterOp
+    uint8_t field;          // FilterField
+    uint8_t cmp;            // FilterCmp
+    uint8_t reserved;
+    uint32_t target;        // Jumps
+    uint64_t value;
+} FilterInsn;
+
+typedef struct {
+    FilterInsn* code;
+    size_t count;
+    uint32_t fields;        // 1 << FilterField of every field used
+} FilterProgram;
+
+// error gets a message with the offset of the bad token
+bool FilterCompile(const char* expr, FilterProgram* prog, char* error, size_t error_size);
+void FilterFree(FilterProgram* prog);
+
+// nh: the Nintendo header, NULL if there's none (or it wasn't read)
+void FilterGetValues(const NESInfo* info, size_t file_size, const NintendoHeader* nh,
+    uint64_t values[FILTER_FIELD_COUNT]);
+bool FilterMatch(const FilterProgram* prog, const uint64_t values[FILTER_FIELD_COUNT]);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Continue a CRC-32 over more data; start with previousCrc32 = 0.
+uint32_t CRC32Update(uint32_t previousCrc32, const uint8_t* data, size_t length);
+uint32_t CRC32(const uint8_t* data, size_t length);
+
+// CRC-32 of A followed by B, from CRC32(A), CRC32(B) and the length of B
+// (as zlib's crc32_combine). Also gives CRC32(B) = CRC32(AB) ^ CRC32Combine(CRC32(A), 0, lengthB).
+uint32_t CRC32Combine(uint32_t crcA, uint32_t crcB, uint64_t lengthB);
@@ -0,0 +1,95 @@
+/*
+ * XXH64
+ * https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+ *
+ * Straight from the specification: four 64-bit lanes over 32-byte stripes,
+ * then the tail and the final avalanche. Input is read little-endian.
+ */
+
+#include "xxh64.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t RotL64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Read64(const uint8_t* p)
+{
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24
+        | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static inline uint32_t Read32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t Round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = RotL64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t MergeRound(uint64_t acc, uint64_t val)
+{
+    acc ^= Round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t XXH64(const void* data, size_t length, uint64_t seed)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + length;
+    uint64_t h;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        do {
+            v1 = Round(v1, Read64(p));
+            v2 = Round(v2, Read64(p + 8));
+            v3 = Round(v3, Read64(p + 16));
+            v4 = Round(v4, Read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+        h = RotL64(v1, 1) + RotL64(v2, 7) + RotL64(v3, 12) + RotL64(v4, 18);
+        h = MergeRound(h, v1);
+        h = MergeRound(h, v2);
+        h = MergeRound(h, v3);
+        h = MergeRound(h, v4);
+    }
+    else {
+        h = seed + PRIME64_5;
+    }
+    h += (uint64_t)length;
+
+    for (; end - p >= 8; p += 8) {
+        h ^= Round(0, Read64(p));
+        h = RotL64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t)Read32(p) * PRIME64_1;
+        h = RotL64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * PRIME64_5;
+        h = RotL64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XXH64, non-cryptographic 64-bit hash (bank fingerprints)
+uint64_t XXH64(const void* data, size_t length, uint64_t seed);
@@ -0,0 +1,280 @@
+/*
+ * On-disk index files.
+ *
+ * Every index is rewritten as a whole and swapped in with rename(), so
+ * readers only ever see a complete file and may map it for as long as they
+ * like. The fanout table is filled from the bucket counts seen while the
+ * sorted records stream out, then written over its placeholder.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "indexfile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define INDEX_FILE_MMAP
+#endif
+
+static bool ReadWholeFile(IndexFile* file, const char* path)
+{
+#ifdef INDEX_FILE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    file->data = p;
+    file->size = (size_t)st.st_size;
+    file->isMapped = true;
+    return true;
+#else
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    bool ok = false;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        long size = ftell(fp);
+        file->data = size > 0 ? malloc((size_t)size) : NULL;
+        file->size = size > 0 ? (size_t)size : 0;
+        ok = file->data != NULL && fseek(fp, 0, SEEK_SET) == 0
+            && fread(file->data, 1, file->size, fp) == file->size;
+    }
+    fclose(fp);
+    return ok;
+#endif
+}
+
+bool IndexFileOpen(IndexFile* file, const char* path, bool is_missing_ok)
+{
+    memset(file, 0, sizeof(*file));
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return is_missing_ok && errno == ENOENT;
+    }
+    fclose(fp);
+    if (!ReadWholeFile(file, path)) {
+        IndexFileClose(file);
+        return false;
+    }
+    return true;
+}
+
+void IndexFileClose(IndexFile* file)
+{
+#ifdef INDEX_FILE_MMAP
+    if (file->isMapped) {
+        munmap(file->data, file->size);
+    }
+    else {
+        free(file->data);
+    }
+#else
+    free(file->data);
+#endif
+    memset(file, 0, sizeof(*file));
+}
+
+bool FanoutIsValid(const uint64_t* fanout, uint64_t count)
+{
+    for (size_t i = 0; i < INDEX_FANOUT; i++) {
+        if (fanout[i] > fanout[i + 1]) {
+            return false;
+        }
+    }
+    return fanout[INDEX_FANOUT] == count;
+}
+
+static uint64_t RecordKey(const void* records, size_t record_size, size_t i)
+{
+    uint64_t key;
+    memcpy(&key, (const uint8_t*)records + i * record_size, sizeof(key));
+    return key;
+}
+
+size_t FanoutFind(const uint64_t* fanout, const void* records, size_t record_size, size_t count, uint64_t key,
+    size_t* first)
+{
+    *first = 0;
+    if (count == 0) {
+        return 0;
+    }
+    size_t bucket = (size_t)(key >> 48);
+    size_t lo = (size_t)fanout[bucket];
+    size_t hi = (size_t)fanout[bucket + 1];
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (RecordKey(records, record_size, mid) < key) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    size_t end = lo;
+    while (end < count && RecordKey(records, record_size, end) == key) {
+        end++;
+    }
+    *first = lo;
+    return end - lo;
+}
+
+bool ReadPathTable(const char* data, size_t size, size_t count, const char*** paths)
+{
+    *paths = (const char**)malloc((count ? count : 1) * sizeof(char*));
+    if (*paths == NULL) {
+        return false;
+    }
+    const char* s = data;
+    const char* end = data + size;
+    for (size_t i = 0; i < count; i++) {
+        const char* nul = (const char*)memchr(s, '\0', (size_t)(end - s));
+        if (nul == NULL) {
+            free((void*)*paths);
+            *paths = NULL;
+            return false;
+        }
+        (*paths)[i] = s;
+        s = nul + 1;
+    }
+    return true;
+}
+
+static int ComparePaths(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+bool FindReplacedPaths(const char* const* old_paths, size_t old_count, const char* const* paths, size_t count,
+    bool* is_replaced)
+{
+    const char** sorted = (const char**)malloc((count ? count : 1) * sizeof(char*));
+    if (sorted == NULL) {
+        return false;
+    }
+    memcpy((void*)sorted, paths, count * sizeof(char*));
+    qsort((void*)sorted, count, sizeof(char*), ComparePaths);
+    for (size_t i = 0; i < old_count; i++) {
+        is_replaced[i] = bsearch(&old_paths[i], sorted, count, sizeof(char*), ComparePaths) != NULL;
+    }
+    free((void*)sorted);
+    return true;
+}
+
+typedef struct {
+    const char* path;
+    size_t index;
+} PathRef;
+
+static int ComparePathRefs(const void* a, const void* b)
+{
+    const PathRef* x = (const PathRef*)a;
+    const PathRef* y = (const PathRef*)b;
+    int c = strcmp(x->path, y->path);
+    return c != 0 ? c : (x->index > y->index) - (x->index < y->index);
+}
+
+bool FindRepeatedPaths(const char* const* paths, size_t count, bool* is_repeated)
+{
+    PathRef* refs = (PathRef*)malloc((count ? count : 1) * sizeof(PathRef));
+    if (refs == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        refs[i].path = paths[i];
+        refs[i].index = i;
+    }
+    qsort(refs, count, sizeof(PathRef), ComparePathRefs);
+    for (size_t i = 0; i < count; i++) {
+        is_repeated[refs[i].index] = i + 1 < count && strcmp(refs[i].path, refs[i + 1].path) == 0;
+    }
+    free(refs);
+    return true;
+}
+
+bool IndexWriterOpen(IndexWriter* w, const char* path, size_t header_size, bool has_fanout)
+{
+    memset(w, 0, sizeof(*w));
+    w->headerSize = header_size;
+    w->tmpPath = (char*)malloc(strlen(path) + 5);
+    w->fanout = has_fanout ? (uint64_t*)calloc(INDEX_FANOUT + 1, sizeof(uint64_t)) : NULL;
+    if (w->tmpPath == NULL || (has_fanout && w->fanout == NULL)) {
+        free(w->tmpPath);
+        free(w->fanout);
+        return false;
+    }
+    strcpy(w->tmpPath, path);
+    strcat(w->tmpPath, ".tmp");
+    w->fp = fopen(w->tmpPath, "wb");
+    if (w->fp == NULL) {
+        free(w->tmpPath);
+        free(w->fanout);
+        return false;
+    }
+    setvbuf(w->fp, NULL, _IOFBF, 1 << 20);
+
+    // Placeholders, written over by IndexWriterCommit()
+    w->ok = true;
+    for (size_t i = 0; i < header_size; i++) {
+        w->ok &= fputc(0, w->fp) != EOF;
+    }
+    if (has_fanout) {
+        IndexWriterWrite(w, w->fanout, INDEX_FANOUT_SIZE);
+    }
+    return true;
+}
+
+void IndexWriterWrite(IndexWriter* w, const void* data, size_t size)
+{
+    w->ok &= size == 0 || fwrite(data, 1, size, w->fp) == size;
+}
+
+void IndexWriterAddRecord(IndexWriter* w, const void* record, size_t size, uint64_t key)
+{
+    w->fanout[key >> 48]++;
+    IndexWriterWrite(w, record, size);
+}
+
+bool IndexWriterCommit(IndexWriter* w, const void* header, const char* path)
+{
+    bool ok = w->ok && fseek(w->fp, 0, SEEK_SET) == 0 && fwrite(header, w->headerSize, 1, w->fp) == 1;
+    if (ok && w->fanout != NULL) {
+        uint64_t sum = 0;
+        for (size_t k = 0; k <= INDEX_FANOUT; k++) {
+            uint64_t n = w->fanout[k];
+            w->fanout[k] = sum;
+            sum += n;
+        }
+        ok = fwrite(w->fanout, INDEX_FANOUT_SIZE, 1, w->fp) == 1;
+    }
+    ok &= fclose(w->fp) == 0;
+
+#ifdef _WIN32
+    if (ok) {
+        remove(path);
+    }
+#endif
+    ok = ok && rename(w->tmpPath, path) == 0;
+    if (!ok) {
+        remove(w->tmpPath);
+    }
+    free(w->tmpPath);
+    free(w->fanout);
+    memset(w, 0, sizeof(*w));
+    return ok;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Pieces shared by the on-disk indexes (bank index, similarity catalog, scan
+// catalogue): the whole file read through one mapping, the fanout table of
+// the sorted record files, their path tables, and the rewrite via path.tmp
+// and rename().
+//
+// A fanout file keeps its records sorted by a leading uint64_t key, after
+// the header and a table of INDEX_FANOUT + 1 record numbers: fanout[i] is the
+// first record whose key >> 48 is >= i.
+
+#define INDEX_FANOUT        65536
+#define INDEX_FANOUT_SIZE   ((INDEX_FANOUT + 1) * sizeof(uint64_t))
+
+typedef struct {
+    void* data;
+    size_t size;
+    bool isMapped;          // mmap()'ed, else malloc()'ed
+} IndexFile;
+
+// mmap() where available, else read into memory. A missing file opens empty
+// (size 0) if is_missing_ok; an empty one fails.
+bool IndexFileOpen(IndexFile* file, const char* path, bool is_missing_ok);
+void IndexFileClose(IndexFile* file);
+
+// fanout[INDEX_FANOUT + 1] is non-decreasing and ends at count
+bool FanoutIsValid(const uint64_t* fanout, uint64_t count);
+// records[count] of record_size bytes each; returns the number with key and
+// the first of them in *first
+size_t FanoutFind(const uint64_t* fanout, const void* records, size_t record_size, size_t count, uint64_t key,
+    size_t* first);
+
+// paths[count] (malloc()'ed) point into data[size], count NUL-terminated strings
+bool ReadPathTable(const char* data, size_t size, size_t count, const char*** paths);
+// is_replaced[i] = old_paths[i] is among paths[count]
+bool FindReplacedPaths(const char* const* old_paths, size_t old_count, const char* const* paths, size_t count,
+    bool* is_replaced);
+// is_repeated[i] = paths[i] comes again later in paths[count], so the last
+// scan of a path given twice wins
+bool FindRepeatedPaths(const char* const* paths, size_t count, bool* is_repeated);
+
+typedef struct {
+    FILE* fp;
+    char* tmpPath;
+    size_t headerSize;
+    uint64_t* fanout;       // Record counts per bucket while writing; NULL: no fanout
+    bool ok;                // No write has failed
+} IndexWriter;
+
+// Creates path.tmp and leaves room for the header (and the fanout table)
+bool IndexWriterOpen(IndexWriter* w, const char* path, size_t header_size, bool has_fanout);
+void IndexWriterWrite(IndexWriter* w, const void* data, size_t size);
+// A sorted record, counted in the fanout table under key
+void IndexWriterAddRecord(IndexWriter* w, const void* record, size_t size, uint64_t key);
+// Writes the header (and the fanout table) and renames path.tmp to path if
+// every write succeeded; removes path.tmp otherwise
+bool IndexWriterCommit(IndexWriter* w, const void* header, const char* path);
@@ -0,0 +1,587 @@
+/*
+ * Read-ahead I/O engine for batch runs.
+ *
+ * File i is read into slot i % depth once the file depth places earlier has
+ * been released, so at most depth files are buffered and the buffers are
+ * reused. io_uring is driven with raw syscalls (no liburing): one thread
+ * opens files, queues IORING_OP_READ and reaps completions. The fallback is
+ * a small pool of threads doing pread(). Both can use O_DIRECT to keep cold
+ * scans out of the page cache.
+ */
+
+#if defined(__unix__) && !defined(__EMSCRIPTEN__)
+#define IO_ENGINE_POSIX
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // O_DIRECT
+#endif
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ioengine.h"
+
+#ifdef IO_ENGINE_POSIX
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define IO_ENGINE_URING_SUPPORTED
+#endif
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+#define IO_ALIGN        4096
+#define IO_MAX_DEPTH    64
+#define IO_POOL_THREADS 4
+
+enum {
+    SLOT_FREE,
+    SLOT_PENDING,
+    SLOT_DONE,
+    SLOT_TAKEN
+};
+
+typedef struct {
+    IOBuffer buf;           // First, so IOBuffer* converts back
+    int state;
+    int fd;
+    bool isDirect;
+    size_t done;            // Bytes read so far
+} IOSlot;
+
+#ifdef IO_ENGINE_URING_SUPPORTED
+typedef struct {
+    int fd;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned toSubmit;
+    unsigned inflight;
+} Uring;
+#endif
+
+struct IOEngine {
+    IOEngineType type;
+    const char* const* paths;
+    size_t count;
+    size_t depth;
+    bool direct;
+
+    IOSlot* slots;
+    size_t nextSubmit;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t threads[IO_POOL_THREADS];
+    size_t threadCount;
+#ifdef IO_ENGINE_URING_SUPPORTED
+    Uring ring;
+#endif
+};
+
+const char* IOEngineName(IOEngineType type)
+{
+    static const char* Names[] = { "sync", "pool", "uring", "auto" };
+    return Names[type];
+}
+
+IOEngineType IOEngineGetType(const IOEngine* io)
+{
+    return io->type;
+}
+
+// Opens the file and makes the slot's buffer large enough; no read yet
+static int PrepareSlot(IOEngine* io, IOSlot* slot, const char* path)
+{
+    slot->fd = -1;
+    slot->done = 0;
+    slot->buf.size = 0;
+    slot->isDirect = false;
+    if (io->direct) {
+        slot->fd = open(path, O_RDONLY | O_DIRECT);
+        slot->isDirect = slot->fd != -1;
+    }
+    if (slot->fd == -1) {
+        // Also for file systems that refuse O_DIRECT (tmpfs)
+        slot->fd = open(path, O_RDONLY);
+    }
+    if (slot->fd == -1) {
+        return IO_ERR_OPEN;
+    }
+    struct stat st;
+    if (fstat(slot->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return IO_ERR_SIZE;
+    }
+    slot->buf.size = (size_t)st.st_size;
+
+    // O_DIRECT reads whole aligned blocks, also past the end of the file
+    size_t need = (slot->buf.size + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+    if (need == 0) {
+        need = IO_ALIGN;
+    }
+    if (need > slot->buf.cap) {
+        void* p = NULL;
+        free(slot->buf.data);
+        slot->buf.data = NULL;
+        slot->buf.cap = 0;
+        if (posix_memalign(&p, IO_ALIGN, need) != 0) {
+            return IO_ERR_MEM;
+        }
+        slot->buf.data = (uint8_t*)p;
+        slot->buf.cap = need;
+    }
+    return IO_OK;
+}
+
+static size_t ReadLength(const IOSlot* slot)
+{
+    size_t left = slot->buf.size - slot->done;
+    if (slot->isDirect) {
+        left = (left + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+    }
+    return left;
+}
+
+static void FinishSlot(IOEngine* io, IOSlot* slot, int error)
+{
+    if (slot->fd != -1) {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    pthread_mutex_lock(&io->lock);
+    slot->buf.error = error;
+    slot->state = SLOT_DONE;
+    pthread_cond_broadcast(&io->cond);
+    pthread_mutex_unlock(&io->lock);
+}
+
+// Next index whose slot is free, or NULL; called with the lock held
+static IOSlot* ClaimSlot(IOEngine* io)
+{
+    if (io->stop || io->nextSubmit >= io->count) {
+        return NULL;
+    }
+    IOSlot* slot = &io->slots[io->nextSubmit % io->depth];
+    if (slot->state != SLOT_FREE) {
+        return NULL;
+    }
+    slot->buf.index = io->nextSubmit++;
+    slot->state = SLOT_PENDING;
+    return slot;
+}
+
+
+// pread() pool
+
+// O_DIRECT refused at read time: reopen buffered; false if that fails
+static bool ReopenBuffered(IOEngine* io, IOSlot* slot)
+{
+    close(slot->fd);
+    slot->fd = open(io->paths[slot->buf.index], O_RDONLY);
+    slot->isDirect = false;
+    return slot->fd != -1;
+}
+
+static void ReadSlot(IOEngine* io, IOSlot* slot)
+{
+    int error = PrepareSlot(io, slot, io->paths[slot->buf.index]);
+    while (error == IO_OK && slot->done < slot->buf.size) {
+        ssize_t n = pread(slot->fd, slot->buf.data + slot->done, ReadLength(slot), (off_t)slot->done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EINVAL && slot->isDirect) {
+            if (!ReopenBuffered(io, slot)) {
+                error = IO_ERR_OPEN;
+            }
+            continue;
+        }
+        if (n <= 0) {
+            error = IO_ERR_READ;
+            break;
+        }
+        slot->done += (size_t)n;
+    }
+    FinishSlot(io, slot, error);
+}
+
+static void* PoolThread(void* arg)
+{
+    IOEngine* io = (IOEngine*)arg;
+    pthread_mutex_lock(&io->lock);
+    for (;;) {
+        IOSlot* slot = ClaimSlot(io);
+        if (slot == NULL) {
+            if (io->stop || io->nextSubmit >= io->count) {
+                break;
+            }
+            pthread_cond_wait(&io->cond, &io->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&io->lock);
+        ReadSlot(io, slot);
+        pthread_mutex_lock(&io->lock);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+}
+
+
+// io_uring
+
+#ifdef IO_ENGINE_URING_SUPPORTED
+static bool UringSetup(Uring* r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        return false;
+    }
+
+    r->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool is_single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (is_single && r->cqRingSize > r->sqRingSize) {
+        r->sqRingSize = r->cqRingSize;
+    }
+    r->sqRing = mmap(NULL, r->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        r->fd, IORING_OFF_SQ_RING);
+    if (r->sqRing == MAP_FAILED) {
+        close(r->fd);
+        return false;
+    }
+    r->cqRing = r->sqRing;
+    if (!is_single) {
+        r->cqRing = mmap(NULL, r->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            r->fd, IORING_OFF_CQ_RING);
+        if (r->cqRing == MAP_FAILED) {
+            munmap(r->sqRing, r->sqRingSize);
+            close(r->fd);
+            return false;
+        }
+    }
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*)mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        if (!is_single) {
+            munmap(r->cqRing, r->cqRingSize);
+        }
+        munmap(r->sqRing, r->sqRingSize);
+        close(r->fd);
+        return false;
+    }
+
+    uint8_t* sq = (uint8_t*)r->sqRing;
+    uint8_t* cq = (uint8_t*)r->cqRing;
+    r->sqHead = (unsigned*)(sq + p.sq_off.head);
+    r->sqTail = (unsigned*)(sq + p.sq_off.tail);
+    r->sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    r->sqArray = (unsigned*)(sq + p.sq_off.array);
+    r->cqHead = (unsigned*)(cq + p.cq_off.head);
+    r->cqTail = (unsigned*)(cq + p.cq_off.tail);
+    r->cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+static void UringClose(Uring* r)
+{
+    munmap(r->sqes, r->sqesSize);
+    if (r->cqRing != r->sqRing) {
+        munmap(r->cqRing, r->cqRingSize);
+    }
+    munmap(r->sqRing, r->sqRingSize);
+    close(r->fd);
+}
+
+// At most depth reads are in flight, and the SQ has depth entries
+static void UringQueueRead(Uring* r, IOSlot* slot)
+{
+    unsigned tail = *r->sqTail;
+    unsigned index = tail & r->sqMask;
+    struct io_uring_sqe* sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(slot->buf.data + slot->done);
+    sqe->len = (uint32_t)(ReadLength(slot) < 0x40000000 ? ReadLength(slot) : 0x40000000);
+    sqe->off = slot->done;
+    sqe->user_data = (uint64_t)(uintptr_t)slot;
+    r->sqArray[index] = index;
+    __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+    r->toSubmit++;
+    r->inflight++;
+}
+
+static void UringReap(IOEngine* io)
+{
+    Uring* r = &io->ring;
+    unsigned head = *r->cqHead;
+    unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe* cqe = &r->cqes[head & r->cqMask];
+        IOSlot* slot = (IOSlot*)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        r->inflight--;
+
+        if (res == -EINVAL && slot->isDirect) {
+            if (ReopenBuffered(io, slot)) {
+                UringQueueRead(r, slot);
+                continue;
+            }
+            FinishSlot(io, slot, IO_ERR_OPEN);
+            continue;
+        }
+        if (res == -EINTR || res == -EAGAIN) {
+            UringQueueRead(r, slot);
+            continue;
+        }
+        if (res <= 0) {
+            FinishSlot(io, slot, IO_ERR_READ);
+            continue;
+        }
+        slot->done += (size_t)res;
+        if (slot->done < slot->buf.size) {
+            UringQueueRead(r, slot);
+        }
+        else {
+            FinishSlot(io, slot, IO_OK);
+        }
+    }
+    __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+}
+
+// io_uring_enter() failed for good. Reads still queued in the kernel may yet
+// land in their buffers, so those are left to it (leaked) and the files are
+// read again with pread(); the thread then goes on as a pread() thread.
+static void* UringFallBack(IOEngine* io)
+{
+    Uring* r = &io->ring;
+    for (size_t i = 0; i < io->depth; i++) {
+        IOSlot* slot = &io->slots[i];
+        pthread_mutex_lock(&io->lock);
+        bool is_queued = slot->state == SLOT_PENDING;
+        pthread_mutex_unlock(&io->lock);
+        if (is_queued) {
+            close(slot->fd);
+            slot->fd = -1;
+            slot->buf.data = NULL;
+            slot->buf.cap = 0;
+            ReadSlot(io, slot);
+        }
+    }
+    r->inflight = 0;
+    r->toSubmit = 0;
+    return PoolThread(io);
+}
+
+static void* UringThread(void* arg)
+{
+    IOEngine* io = (IOEngine*)arg;
+    Uring* r = &io->ring;
+    for (;;) {
+        pthread_mutex_lock(&io->lock);
+        IOSlot* slot;
+        while ((slot = ClaimSlot(io)) != NULL) {
+            pthread_mutex_unlock(&io->lock);
+            int error = PrepareSlot(io, slot, io->paths[slot->buf.index]);
+            if (error != IO_OK || slot->buf.size == 0) {
+                FinishSlot(io, slot, error);
+            }
+            else {
+                UringQueueRead(r, slot);
+            }
+            pthread_mutex_lock(&io->lock);
+        }
+        if (r->inflight == 0) {
+            if (io->stop || io->nextSubmit >= io->count) {
+                pthread_mutex_unlock(&io->lock);
+                break;
+            }
+            // Wait for a worker to release a slot
+            pthread_cond_wait(&io->cond, &io->lock);
+            pthread_mutex_unlock(&io->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&io->lock);
+
+        int ret = (int)syscall(__NR_io_uring_enter, r->fd, r->toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret >= 0) {
+            r->toSubmit -= (unsigned)ret < r->toSubmit ? (unsigned)ret : r->toSubmit;
+        }
+        else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return UringFallBack(io);
+        }
+        UringReap(io);
+    }
+    return NULL;
+}
+#endif
+
+
+IOEngine* IOEngineCreate(IOEngineType type, const char* const* paths, size_t count, int depth, bool direct)
+{
+    if (type == IO_ENGINE_SYNC || count == 0) {
+        return NULL;
+    }
+    IOEngine* io = (IOEngine*)calloc(1, sizeof(IOEngine));
+    if (io == NULL) {
+        return NULL;
+    }
+    io->paths = paths;
+    io->count = count;
+    io->depth = depth < 1 ? 1 : depth > IO_MAX_DEPTH ? IO_MAX_DEPTH : (size_t)depth;
+    io->direct = direct && O_DIRECT != 0;
+    io->slots = (IOSlot*)calloc(io->depth, sizeof(IOSlot));
+    if (io->slots == NULL) {
+        free(io);
+        return NULL;
+    }
+    for (size_t i = 0; i < io->depth; i++) {
+        io->slots[i].fd = -1;
+    }
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->cond, NULL);
+
+#ifdef IO_ENGINE_URING_SUPPORTED
+    if ((type == IO_ENGINE_URING || type == IO_ENGINE_AUTO) && UringSetup(&io->ring, (unsigned)io->depth)) {
+        io->type = IO_ENGINE_URING;
+        if (pthread_create(&io->threads[0], NULL, UringThread, io) == 0) {
+            io->threadCount = 1;
+            return io;
+        }
+        UringClose(&io->ring);
+    }
+#endif
+    if (type == IO_ENGINE_URING) {
+        // Asked for explicitly and not available
+        IOEngineDestroy(io);
+        return NULL;
+    }
+    io->type = IO_ENGINE_POOL;
+    size_t threads = io->depth < IO_POOL_THREADS ? io->depth : IO_POOL_THREADS;
+    for (; io->threadCount < threads; io->threadCount++) {
+        if (pthread_create(&io->threads[io->threadCount], NULL, PoolThread, io) != 0) {
+            break;
+        }
+    }
+    if (io->threadCount == 0) {
+        IOEngineDestroy(io);
+        return NULL;
+    }
+    return io;
+}
+
+IOBuffer* IOEngineGet(IOEngine* io, size_t index)
+{
+    IOSlot* slot = &io->slots[index % io->depth];
+    pthread_mutex_lock(&io->lock);
+    while (slot->state != SLOT_DONE || slot->buf.index != index) {
+        pthread_cond_wait(&io->cond, &io->lock);
+    }
+    slot->state = SLOT_TAKEN;
+    pthread_mutex_unlock(&io->lock);
+    return &slot->buf;
+}
+
+void IOEngineRelease(IOEngine* io, IOBuffer* buf)
+{
+    IOSlot* slot = (IOSlot*)buf;
+    pthread_mutex_lock(&io->lock);
+    slot->state = SLOT_FREE;
+    pthread_cond_broadcast(&io->cond);
+    pthread_mutex_unlock(&io->lock);
+}
+
+void IOEngineDestroy(IOEngine* io)
+{
+    if (io == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&io->lock);
+    io->stop = true;
+    pthread_cond_broadcast(&io->cond);
+    pthread_mutex_unlock(&io->lock);
+    for (size_t i = 0; i < io->threadCount; i++) {
+        pthread_join(io->threads[i], NULL);
+    }
+#ifdef IO_ENGINE_URING_SUPPORTED
+    if (io->type == IO_ENGINE_URING && io->threadCount != 0) {
+        UringClose(&io->ring);
+    }
+#endif
+    for (size_t i = 0; i < io->depth; i++) {
+        if (io->slots[i].fd != -1) {
+            close(io->slots[i].fd);
+        }
+        free(io->slots[i].buf.data);
+    }
+    pthread_mutex_destroy(&io->lock);
+    pthread_cond_destroy(&io->cond);
+    free(io->slots);
+    free(io);
+}
+
+#else
+
+// No engine on this platform; workers read synchronously
+
+const char* IOEngineName(IOEngineType type)
+{
+    static const char* Names[] = { "sync", "pool", "uring", "auto" };
+    return Names[type];
+}
+
+IOEngineType IOEngineGetType(const IOEngine* io)
+{
+    (void)io;
+    return IO_ENGINE_SYNC;
+}
+
+IOEngine* IOEngineCreate(IOEngineType type, const char* const* paths, size_t count, int depth, bool direct)
+{
+    (void)type; (void)paths; (void)count; (void)depth; (void)direct;
+    return NULL;
+}
+
+IOBuffer* IOEngineGet(IOEngine* io, size_t index)
+{
+    (void)io; (void)index;
+    return NULL;
+}
+
+void IOEngineRelease(IOEngine* io, IOBuffer* buf)
+{
+    (void)io; (void)buf;
+}
+
+void IOEngineDestroy(IOEngine* io)
+{
+    (void)io;
+}
+
+#endif
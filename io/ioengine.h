@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Reads whole files ahead of the workers into a ring of reusable buffers,
+// so the read of file N+1.. overlaps the hashing of file N.
+
+typedef enum {
+    IO_ENGINE_SYNC,         // No engine: fread() in the worker
+    IO_ENGINE_POOL,         // pread() thread pool
+    IO_ENGINE_URING,        // io_uring, one submit/reap thread
+    IO_ENGINE_AUTO          // io_uring if the kernel allows it, else the pool
+} IOEngineType;
+
+enum {
+    IO_OK,
+    IO_ERR_OPEN,
+    IO_ERR_SIZE,
+    IO_ERR_MEM,
+    IO_ERR_READ
+};
+
+typedef struct {
+    size_t index;           // Position in the path list
+    uint8_t* data;
+    size_t size;            // File size
+    size_t cap;             // Buffer capacity, kept for the next file in this slot
+    int error;              // IO_*
+} IOBuffer;
+
+typedef struct IOEngine IOEngine;
+
+// depth: files read ahead; direct: O_DIRECT (falls back per file if refused).
+// NULL if the engine can't be started; the caller then reads synchronously.
+IOEngine* IOEngineCreate(IOEngineType type, const char* const* paths, size_t count, int depth, bool direct);
+IOEngineType IOEngineGetType(const IOEngine* io);
+const char* IOEngineName(IOEngineType type);
+
+// Waits for the file at index; each index must be taken once, roughly in order
+IOBuffer* IOEngineGet(IOEngine* io, size_t index);
+// Hands the buffer back for a later file
+void IOEngineRelease(IOEngine* io, IOBuffer* buf);
+void IOEngineDestroy(IOEngine* io);
@@ -0,0 +1,173 @@
+/*
+ * Per-thread buffer pool.
+ *
+ * Requests are rounded up to a power of two between 4 KiB and 64 MiB. A
+ * released block goes back to its class, up to POOL_CLASS_BLOCKS per class
+ * and POOL_FREE_MAX bytes over all classes (the largest free blocks give way
+ * first), so a batch of similar ROMs settles on a few blocks per thread. With huge
+ * pages enabled, blocks of 2 MiB and up are mmap()'ed with MAP_HUGETLB, or
+ * madvise(MADV_HUGEPAGE)'d for transparent huge pages when none are reserved.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // MAP_HUGETLB, MADV_HUGEPAGE
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bufpool.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#define POOL_MMAP
+#endif
+
+static int GetClass(size_t size)
+{
+    int shift = POOL_MIN_SHIFT;
+    while (shift <= POOL_MAX_SHIFT && ((size_t)1 << shift) < size) {
+        shift++;
+    }
+    return shift - POOL_MIN_SHIFT;
+}
+
+static bool NewBlock(BufferPool* pool, size_t cap, PoolBlock* block)
+{
+    block->cap = cap;
+    block->isMapped = false;
+#ifdef POOL_MMAP
+    if (pool->useHugePages && cap >= POOL_HUGE_MIN) {
+        void* p = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            p = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, cap, MADV_HUGEPAGE);
+            }
+        }
+        if (p != MAP_FAILED) {
+            block->data = p;
+            block->isMapped = true;
+            pool->stats.hugeBlocks++;
+            return true;
+        }
+    }
+#endif
+    block->data = malloc(cap);
+    return block->data != NULL;
+}
+
+static void DeleteBlock(BufferPool* pool, PoolBlock* block)
+{
+#ifdef POOL_MMAP
+    if (block->isMapped) {
+        munmap(block->data, block->cap);
+    }
+    else {
+        free(block->data);
+    }
+#else
+    free(block->data);
+#endif
+    pool->stats.bytes -= block->cap;
+}
+
+// Releases free blocks, largest first, until room more bytes fit under POOL_FREE_MAX
+static void TrimFree(BufferPool* pool, size_t room)
+{
+    for (int c = POOL_CLASS_COUNT - 1; c >= 0 && pool->freeBytes + room > POOL_FREE_MAX; c--) {
+        while (pool->freeCount[c] != 0 && pool->freeBytes + room > POOL_FREE_MAX) {
+            PoolBlock* block = &pool->free[c][--pool->freeCount[c]];
+            pool->freeBytes -= block->cap;
+            DeleteBlock(pool, block);
+        }
+    }
+}
+
+void PoolInit(BufferPool* pool, bool use_huge_pages)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->useHugePages = use_huge_pages;
+}
+
+void* PoolAlloc(BufferPool* pool, size_t size)
+{
+    if (pool == NULL) {
+        return malloc(size ? size : 1);
+    }
+    pool->stats.allocs++;
+    if (pool->usedCount == POOL_MAX_USED) {
+        return NULL;
+    }
+
+    PoolBlock block;
+    int c = GetClass(size);
+    if (c < POOL_CLASS_COUNT && pool->freeCount[c] != 0) {
+        block = pool->free[c][--pool->freeCount[c]];
+        pool->freeBytes -= block.cap;
+        pool->stats.hits++;
+    }
+    else {
+        size_t cap = c < POOL_CLASS_COUNT ? (size_t)1 << (c + POOL_MIN_SHIFT) : size;
+        if (c == POOL_CLASS_COUNT) {
+            pool->stats.oversize++;
+        }
+        if (!NewBlock(pool, cap, &block)) {
+            return NULL;
+        }
+        pool->stats.bytes += cap;
+        if (pool->stats.bytes > pool->stats.peakBytes) {
+            pool->stats.peakBytes = pool->stats.bytes;
+        }
+    }
+    pool->used[pool->usedCount++] = block;
+    return block.data;
+}
+
+void PoolFree(BufferPool* pool, void* p)
+{
+    if (pool == NULL) {
+        free(p);
+        return;
+    }
+    if (p == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < pool->usedCount; i++) {
+        if (pool->used[i].data != p) {
+            continue;
+        }
+        PoolBlock block = pool->used[i];
+        pool->used[i] = pool->used[--pool->usedCount];
+
+        int c = GetClass(block.cap);
+        if (c < POOL_CLASS_COUNT && pool->freeCount[c] < POOL_CLASS_BLOCKS && block.cap <= POOL_FREE_MAX) {
+            TrimFree(pool, block.cap);
+            pool->free[c][pool->freeCount[c]++] = block;
+            pool->freeBytes += block.cap;
+        }
+        else {
+            DeleteBlock(pool, &block);
+        }
+        return;
+    }
+    // Not handed out by this pool: a caller bug
+    assert(!"PoolFree: block not from this pool");
+    free(p);
+}
+
+void PoolDestroy(BufferPool* pool)
+{
+    for (int c = 0; c < POOL_CLASS_COUNT; c++) {
+        for (int i = 0; i < pool->freeCount[c]; i++) {
+            DeleteBlock(pool, &pool->free[c][i]);
+        }
+        pool->freeCount[c] = 0;
+    }
+    pool->freeBytes = 0;
+    for (size_t i = 0; i < pool->usedCount; i++) {
+        DeleteBlock(pool, &pool->used[i]);
+    }
+    pool->usedCount = 0;
+}
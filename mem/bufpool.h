@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Size-classed buffer pool, one per worker thread, so per-file buffers (ROM
+// data, inflate state, --identify tables) are reused instead of going through
+// malloc()/free() for every file. Not thread-safe by design.
+
+#define POOL_MIN_SHIFT      12      // 4 KiB
+#define POOL_MAX_SHIFT      26      // 64 MiB, the largest archive member
+#define POOL_CLASS_COUNT    (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_CLASS_BLOCKS   2       // Free blocks kept per class
+#define POOL_FREE_MAX       ((size_t)64 << 20)  // Free bytes kept per pool
+#define POOL_MAX_USED       16      // Blocks handed out at the same time
+#define POOL_HUGE_MIN       (2 * 1024 * 1024)
+
+typedef struct {
+    void* data;
+    size_t cap;
+    bool isMapped;          // mmap()'ed, else malloc()'ed
+} PoolBlock;
+
+typedef struct {
+    uint64_t allocs;        // PoolAlloc() calls
+    uint64_t hits;          // Served from a free block
+    uint64_t bytes;         // Currently reserved, free and in use
+    uint64_t peakBytes;
+    uint64_t hugeBlocks;    // Blocks on MAP_HUGETLB or madvise(MADV_HUGEPAGE) memory
+    uint64_t oversize;      // Larger than the biggest class, not kept
+} PoolStats;
+
+typedef struct {
+    PoolBlock free[POOL_CLASS_COUNT][POOL_CLASS_BLOCKS];
+    int freeCount[POOL_CLASS_COUNT];
+    size_t freeBytes;
+    PoolBlock used[POOL_MAX_USED];
+    size_t usedCount;
+    bool useHugePages;      // Blocks >= POOL_HUGE_MIN
+    PoolStats stats;
+} BufferPool;
+
+void PoolInit(BufferPool* pool, bool use_huge_pages);
+// pool may be NULL: plain malloc()/free()
+void* PoolAlloc(BufferPool* pool, size_t size);
+// p must come from PoolAlloc() on the same pool
+void PoolFree(BufferPool* pool, void* p);
+void PoolDestroy(BufferPool* pool);
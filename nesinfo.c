@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <inttypes.h>
@@ -16,8 +18,55 @@
 #include <emscripten.h>
 #endif
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Worker threads for batch runs; the web build stays single-threaded
+#if !defined(__EMSCRIPTEN__) && !defined(NESINFO_NO_THREADS)
+#define NESINFO_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define NESINFO_JOURNAL
+#endif
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#endif
+
+#include "archive/archive.h"
+#include "catalog/catalog.h"
+#include "dedup/bankindex.h"
+#include "dedup/minhash.h"
+#include "filter/filter.h"
+#include "hash/crc32.h"
 #include "hash/md5.h"
 #include "hash/sha1.h"
+#include "hash/xxh64.h"
+#include "io/ioengine.h"
+#include "mem/bufpool.h"
+#include "nesinfo.h"
+#include "probes.h"
 
 
 #define NES_HEADER_INFO_VER "1.0"
@@ -27,44 +76,23 @@
 
 uint8_t* g_nes20db = NULL;
 size_t g_nes20db_size = 0;
-
-void OpenNES20DB(void);
-void CloseNES20DB(void);
-void PrintNES20DB(const char* hash);
-uint8_t* bytes_find(
-    const uint8_t* data,
-    size_t data_len,
-    const uint8_t* sub,
-    size_t sub_len);
-uint8_t* bytes_rfind(
-    const uint8_t* data,
-    size_t data_len,
-    const uint8_t* sub,
-    size_t sub_len);
+NES20DBIndex g_db = {0};
 
 // Misc.
 
 long GetFILESize(FILE* file);
-void CRC32Init(void);
-uint32_t CRC32(const uint8_t* message, size_t count);
-void SHA1_to_hex(const uint8_t hash[20], char str[41]);
 
 #ifdef __EMSCRIPTEN__
 EM_JS(void, Print, (const char* str), {
     romInfoElement.textContent += UTF8ToString(str);
 })
 #else
-#define Print(str) printf("%s", str)
+void PrintOut(const char* str);
+#define Print(str) PrintOut(str)
 #endif
 
 // Const
 
-#define HEADER_SIZE     16
-#define TRAINER_SIZE    512
-#define MIN_FILE_SIZE   HEADER_SIZE
-#define EXPANSION_COUNT 54
-#define MAPPER_COUNT    256
-
 const char* FrameTiming[] = {
     "NTSC", "PAL", "Multiple-region", "Dendy"
 };
@@ -671,30 +699,6 @@ const char* MakerNames[256] = {
 };
 
 
-typedef struct {
-    uint32_t mapper;
-    uint32_t submapper;
-    uint64_t PRGSize;
-    uint64_t CHRSize;
-    bool isBattery;
-    bool isTrainer;
-    bool is4Screen;
-    bool isVertMirroring;
-    bool isExtended;
-    bool isPAL_iNES;
-    uint32_t PRGRAMSize8K_iNES;
-    uint32_t PRGRAMSize;
-    uint32_t CHRRAMSize;
-    uint32_t PRGSaveRAMSize;
-    uint32_t CHRSaveRAMSize;
-    uint32_t frameTiming;
-    uint32_t consoleType1;
-    uint32_t consoleType2;
-    uint32_t consoleType3;
-    uint32_t miscROMs;
-    uint32_t expansion;
-} NESInfo;
-
 NESInfo GetNESInfo(const uint8_t* header)
 {
     NESInfo info;
@@ -780,24 +784,137 @@ NESInfo GetNESInfo(const uint8_t* header)
     return info;
 }
 
+// NES 2.0 size: LSB byte, MSB nibble; `unit` = 16 KiB (PRG) or 8 KiB (CHR)
+static inline uint64_t GetROMSize(uint8_t lsb, uint8_t msb, bool isExtended, uint64_t unit)
+{
+    if (!isExtended) {
+        return lsb * unit;
+    }
+    if (msb != 0x0F) {
+        return (lsb + ((uint64_t)msb << 8)) * unit;
+    }
+    uint8_t E = lsb >> 2;
+    if (E > 0x3D) { // >= 2 EiB (exbibyte)
+        return 0;
+    }
+    return ((uint64_t)1 << E) * ((lsb & 3) * 2 + 1);
+}
 
-// https://wiki.nesdev.org/w/index.php?title=Nintendo_header
-typedef struct {
-    char title[16 + 1];    // $FFE0-$FFEF. ASCII (0x20 - 0x5A).
-    uint16_t PRGChecksum;  // $FFF0-$FFF1.
-    uint16_t CHRChecksum;  // $FFF2-$FFF3.
-    uint32_t PRGSize;      // $FFF4. D7-D4: PRG size.
-    uint32_t CHRSize;      //        D2-D0: CHR size.
-    bool isCHRRAM;         //        D3: 0 = CHR ROM, 1 = CHR RAM.
-    bool isVertMirroring;  // $FFF5. D7: 0 = Vertical, 1 = Horizontal.
-    uint8_t mapper;        //        D6-D0: 0 = NROM, 1 = CNROM, 2 = UNROM, 3 = GNROM, 4 = MMC (any).
-    uint8_t titleEncoding; // $FFF6. 0 = No title entered, 1 = ASCII, 2 = Another encoding.
-    uint8_t titleLen;      // $FFF7. Valid Title Length - 1. 0 if no title entered.
-    uint8_t makerCode;     // $FFF8. The same used for the FDS, GB, GBC and SNES headers:
-                           //        1 = Nintendo, 2-254 = everyone else. 255 must be reserved.
-    uint8_t validation;    // $FFF9. Header Validation Byte. 8-bit checksum of $FFF2-$FFF9 should = 0.
-} NintendoHeader;
+static void GetNESInfoBatchScalar(const uint8_t* headers, size_t first, size_t count,
+                                  NESInfoColumns* cols)
+{
+    for (size_t i = first; i < count; i++) {
+        const uint8_t* header = headers + i * HEADER_SIZE;
+        bool ext = (header[7] & 0x0C) == 0x08;
+        cols->mapper[i] = ((header[6] & 0xF0) >> 4) | (header[7] & 0xF0)
+                        | (ext ? (header[8] & 0x0F) << 8 : 0);
+        cols->submapper[i] = ext ? header[8] >> 4 : 0;
+        cols->flags[i] = (header[6] & 0x0F)
+                       | (ext ? NESINFO_F_EXTENDED | (header[14] & 3) << NESINFO_F_MISC_SHIFT
+                              : (header[9] & 1) * NESINFO_F_PAL_INES);
+        cols->frameTiming[i] = ext ? header[12] & 3 : 0;
+        cols->consoleType[i] = header[7] & 3;
+        cols->consoleExt[i] = ext ? header[13] : 0;
+        cols->expansion[i] = ext ? (header[15] > EXPANSION_COUNT ? EXPANSION_COUNT + 1 : header[15]) : 0;
+        cols->PRGSize[i] = GetROMSize(header[4], header[9] & 0x0F, ext, 0x4000);
+        cols->CHRSize[i] = GetROMSize(header[5], header[9] >> 4, ext, 0x2000);
+    }
+}
+
+#ifdef __SSE2__
+// Transposes 16 headers so that row[k] holds byte k of every header
+static void TransposeHeaders16(const uint8_t* headers, __m128i row[16])
+{
+    __m128i a[16], s1[8][2], s2[4][4], s3[2][8];
+    for (int i = 0; i < 16; i++) {
+        a[i] = _mm_loadu_si128((const __m128i*)(headers + i * HEADER_SIZE));
+    }
+    // Pairs of headers; s1[p][h]: bytes 8h..8h+7
+    for (int p = 0; p < 8; p++) {
+        s1[p][0] = _mm_unpacklo_epi8(a[2 * p], a[2 * p + 1]);
+        s1[p][1] = _mm_unpackhi_epi8(a[2 * p], a[2 * p + 1]);
+    }
+    // Quads; s2[q][k]: bytes 4k..4k+3
+    for (int q = 0; q < 4; q++) {
+        for (int h = 0; h < 2; h++) {
+            s2[q][2 * h]     = _mm_unpacklo_epi16(s1[2 * q][h], s1[2 * q + 1][h]);
+            s2[q][2 * h + 1] = _mm_unpackhi_epi16(s1[2 * q][h], s1[2 * q + 1][h]);
+        }
+    }
+    // Octets; s3[o][m]: bytes 2m, 2m+1
+    for (int o = 0; o < 2; o++) {
+        for (int k = 0; k < 4; k++) {
+            s3[o][2 * k]     = _mm_unpacklo_epi32(s2[2 * o][k], s2[2 * o + 1][k]);
+            s3[o][2 * k + 1] = _mm_unpackhi_epi32(s2[2 * o][k], s2[2 * o + 1][k]);
+        }
+    }
+    for (int m = 0; m < 8; m++) {
+        row[2 * m]     = _mm_unpacklo_epi64(s3[0][m], s3[1][m]);
+        row[2 * m + 1] = _mm_unpackhi_epi64(s3[0][m], s3[1][m]);
+    }
+}
+#endif
+
+// Decodes `count` consecutive 16-byte headers into columns.
+// Field for field the same as GetNESInfo().
+void GetNESInfoBatch(const uint8_t* headers, size_t count, NESInfoColumns* cols)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i lo_nibble = _mm_set1_epi8(0x0F);
+    const __m128i hi_nibble = _mm_set1_epi8((char)0xF0);
+    const __m128i three = _mm_set1_epi8(3);
+    uint8_t b4[16], b5[16], b9[16], ext_lanes[16];
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i r[16];
+        TransposeHeaders16(headers + i * HEADER_SIZE, r);
+
+        __m128i ext = _mm_cmpeq_epi8(_mm_and_si128(r[7], _mm_set1_epi8(0x0C)), _mm_set1_epi8(0x08));
+        __m128i b6_hi = _mm_and_si128(_mm_srli_epi16(r[6], 4), lo_nibble);
+        __m128i mapper_lo = _mm_or_si128(b6_hi, _mm_and_si128(r[7], hi_nibble));
+        __m128i mapper_hi = _mm_and_si128(ext, _mm_and_si128(r[8], lo_nibble));
+        __m128i submapper = _mm_and_si128(ext, _mm_and_si128(_mm_srli_epi16(r[8], 4), lo_nibble));
 
+        __m128i misc = _mm_slli_epi16(_mm_and_si128(r[14], three), NESINFO_F_MISC_SHIFT);
+        __m128i flags_ext = _mm_or_si128(_mm_set1_epi8(NESINFO_F_EXTENDED), misc);
+        __m128i flags_ines = _mm_slli_epi16(_mm_and_si128(r[9], _mm_set1_epi8(1)), 5);
+        __m128i flags = _mm_or_si128(_mm_and_si128(r[6], lo_nibble),
+            _mm_or_si128(_mm_and_si128(ext, flags_ext), _mm_andnot_si128(ext, flags_ines)));
+
+        __m128i timing = _mm_and_si128(ext, _mm_and_si128(r[12], three));
+        __m128i console = _mm_and_si128(r[7], three);
+        __m128i console_ext = _mm_and_si128(ext, r[13]);
+        __m128i expansion = _mm_and_si128(ext, _mm_min_epu8(r[15], _mm_set1_epi8(EXPANSION_COUNT + 1)));
+
+        // 8-bit columns
+        _mm_storeu_si128((__m128i*)(cols->submapper + i), submapper);
+        _mm_storeu_si128((__m128i*)(cols->frameTiming + i), timing);
+        _mm_storeu_si128((__m128i*)(cols->consoleType + i), console);
+        _mm_storeu_si128((__m128i*)(cols->consoleExt + i), console_ext);
+        _mm_storeu_si128((__m128i*)(cols->expansion + i), expansion);
+        // 16-bit columns: interleave low and high bytes
+        _mm_storeu_si128((__m128i*)(cols->mapper + i), _mm_unpacklo_epi8(mapper_lo, mapper_hi));
+        _mm_storeu_si128((__m128i*)(cols->mapper + i + 8), _mm_unpackhi_epi8(mapper_lo, mapper_hi));
+        _mm_storeu_si128((__m128i*)(cols->flags + i), _mm_unpacklo_epi8(flags, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i*)(cols->flags + i + 8), _mm_unpackhi_epi8(flags, _mm_setzero_si128()));
+
+        // 64-bit sizes: exponent-multiplier form needs a shift per lane
+        _mm_storeu_si128((__m128i*)b4, r[4]);
+        _mm_storeu_si128((__m128i*)b5, r[5]);
+        _mm_storeu_si128((__m128i*)b9, r[9]);
+        _mm_storeu_si128((__m128i*)ext_lanes, ext);
+        for (size_t k = 0; k < 16; k++) {
+            cols->PRGSize[i + k] = GetROMSize(b4[k], b9[k] & 0x0F, ext_lanes[k] != 0, 0x4000);
+            cols->CHRSize[i + k] = GetROMSize(b5[k], b9[k] >> 4, ext_lanes[k] != 0, 0x2000);
+        }
+    }
+#endif
+    GetNESInfoBatchScalar(headers, i, count, cols);
+}
+
+
+// https://wiki.nesdev.org/w/index.php?title=Nintendo_header
 bool GetNintendoHeader(const uint8_t* header, NintendoHeader* nh)
 {
     uint8_t checksum = 0;
@@ -873,300 +990,5152 @@ bool GetNintendoHeader(const uint8_t* header, NintendoHeader* nh)
 }
 
 
-void PrintHash(const uint8_t* src, size_t size, const char* name)
-{
-    char buf[128 + 1] = {0};
-
-    if (src == NULL || size == 0) {
-        snprintf(buf, sizeof(buf), "\n%s CRC32: N/A", name);
-        Print(buf);
-        Print("\n        MD5  : N/A");
-        Print("\n        SHA-1: N/A");
-        return;
-    }
+const char* RegionNames[REGION_COUNT] = {
+    "File   ", "ROM    ", "Trainer", "PRG ROM", "CHR ROM", "Misc   "
+};
 
-    uint32_t crc = 0;
-    uint8_t sha1_val[21];
-    char hash_str[41] = {0};
+// Option names for --regions
+const char* RegionKeys[REGION_COUNT] = {
+    "file", "rom", "trainer", "prg", "chr", "misc"
+};
 
-    crc = CRC32(src, size);
-    snprintf(buf, sizeof(buf), "\n%s CRC32: %08X | Size: %" PRIuPTR, name, crc, size);
-    Print(buf);
 
-    md5BytesAsStr(src, size, hash_str);
-    snprintf(buf, sizeof(buf), "\n        MD5  : %s", hash_str);
-    Print(buf);
+ROMLayout GetROMLayout(const NESInfo* info, size_t file_size)
+{
+    ROMLayout layout = {0};
 
-    SHA1(src, size, sha1_val);
-    SHA1_to_hex(sha1_val, hash_str);
-    snprintf(buf, sizeof(buf), "\n        SHA-1: %s", hash_str);
-    Print(buf);
+    layout.isShown[REGION_FILE] = true;
+    layout.isPresent[REGION_FILE] = true;
+    layout.size[REGION_FILE] = file_size;
 
-    if (g_nes20db != NULL) {
-        PrintNES20DB(hash_str);
+    layout.isShown[REGION_ROM] = true;
+    if (file_size > HEADER_SIZE) {
+        layout.isPresent[REGION_ROM] = true;
+        layout.offset[REGION_ROM] = HEADER_SIZE;
+        layout.size[REGION_ROM] = file_size - HEADER_SIZE;
     }
-}
-
-void PrintNESInfo(const uint8_t* source, size_t file_size)
-{
-    char buf[256] = {0};
-    const char* NoYesStr[] = {"No", "Yes"};
-    const char* MirroringStr[] = {"Horizontal", "Vertical"};
 
-    NESInfo info = GetNESInfo(source);
-    Print("-------------*-----------------------------------------");
-    if (info.isExtended) {
-        Print("\n              NES 2.0");
-    }
-    else {
-        Print("\n              iNES");
-    }
-    Print("\n ");
-    for (size_t i = 0; i < HEADER_SIZE; i++) {
-        snprintf(buf + i * 3, sizeof(buf) - i * 3, "%02X ", source[i]);
-    }
-    Print(buf);
-    Print("\n-------------*-----------------------------------------");
-    snprintf(buf, sizeof(buf), "\nMapper Number: %u", info.mapper);
-    Print(buf);
-    if (info.mapper < MAPPER_COUNT) {
-        Print(" = ");
-        Print(MapperNames[info.mapper]);
-    }
-    snprintf(buf, sizeof(buf), "\nPRG ROM  Size: %5" PRIu64 " KiB = %8" PRIu64 " B",
-        info.PRGSize / 1024, info.PRGSize);
-    Print(buf);
-    snprintf(buf, sizeof(buf), "\nCHR ROM  Size: %5" PRIu64 " KiB = %8" PRIu64 " B",
-        info.CHRSize / 1024, info.CHRSize);
-    Print(buf);
-    Print("\nMirroring    : "); Print(MirroringStr[(int)info.isVertMirroring]);
-    Print("\n4-screen VRAM: "); Print(NoYesStr[(int)info.is4Screen]);
-    Print("\nBattery      : "); Print(NoYesStr[(int)info.isBattery]);
-    Print("\nTrainer      : "); Print(NoYesStr[(int)info.isTrainer]);
-    Print("\nConsole Type : ");
-    snprintf(buf, sizeof(buf), "%s (#%u)", ConsoleType1[info.consoleType1], info.consoleType1);
-    Print(buf);
-    if (!info.isExtended) {
-        Print("\nTV system    : ");
-        snprintf(buf, sizeof(buf), "%s (#%d)", FrameTiming[(int)info.isPAL_iNES], (int)info.isPAL_iNES);
-        Print(buf);
-        if (info.PRGRAMSize8K_iNES == 0) {
-            Print("\nPRG RAM  Size: 0 or 8192 B (#0)");
+    bool prev_exists = true;
+    size_t src_pos = HEADER_SIZE;
+    const uint64_t sizes[] = { TRAINER_SIZE, info->PRGSize, info->CHRSize };
+    const bool shown[] = { info->isTrainer, info->PRGSize != 0, info->CHRSize != 0 };
+    for (int r = REGION_TRAINER; r <= REGION_CHR; r++) {
+        int i = r - REGION_TRAINER;
+        if (!shown[i]) {
+            continue;
+        }
+        layout.isShown[r] = true;
+        if (prev_exists && file_size - src_pos >= sizes[i]) {
+            layout.isPresent[r] = true;
+            layout.offset[r] = src_pos;
+            layout.size[r] = (size_t)sizes[i];
+            src_pos += (size_t)sizes[i];
         }
         else {
-            uint32_t prgRamSize = info.PRGRAMSize8K_iNES * 0x2000;
-            Print("\nPRG RAM  Size: ");
-            snprintf(buf, sizeof(buf), "%5u KiB = %8u B (#%u)",
-                prgRamSize / 1024, prgRamSize, info.PRGRAMSize8K_iNES);
-            Print(buf);
+            prev_exists = false;
         }
     }
-    else {
-        Print("\nTV system    : N/A");
-        Print("\nPRG RAM  Size: N/A");
-    }
 
-    if (info.isExtended) {
-        Print("\n-------------*-----------------------------------------");
-        snprintf(buf, sizeof(buf), "\nSubmapper    : %u", info.submapper);
-        Print(buf);
-        snprintf(buf, sizeof(buf), "\nPRG RAM  Size: %5u KiB = %8u B",
-            info.PRGRAMSize / 1024, info.PRGRAMSize);
-        Print(buf);
-        snprintf(buf, sizeof(buf), "\nCHR RAM  Size: %5u KiB = %8u B",
-            info.CHRRAMSize / 1024, info.CHRRAMSize);
-        Print(buf);
-        snprintf(buf, sizeof(buf), "\nPRG Save Size: %5u KiB = %8u B",
-            info.PRGSaveRAMSize / 1024, info.PRGSaveRAMSize);
-        Print(buf);
-        snprintf(buf, sizeof(buf), "\nCHR Save Size: %5u KiB = %8u B",
-            info.CHRSaveRAMSize / 1024, info.CHRSaveRAMSize);
-        Print(buf);
-        snprintf(buf, sizeof(buf), "\nFrame Timing : %s (#%u)",
-            FrameTiming[info.frameTiming], info.frameTiming);
-        Print(buf);
-        if (info.consoleType1 == 0x03) {
-            Print("\nConsole Ext. : ");
-            snprintf(buf, sizeof(buf), "%s (#%u)", ConsoleType2[info.consoleType2], info.consoleType2);
-            Print(buf);
-        }
-        else {
-            Print("\nConsole Ext. : N/A");
-        }
-        if (info.consoleType1 == 0x01) {
-            Print("\nVS PPU       : ");
-            snprintf(buf, sizeof(buf), "%s (#%u)", VSPPUs[info.consoleType2], info.consoleType2);
-            Print(buf);
-            Print("\nVS Type      : ");
-            snprintf(buf, sizeof(buf), "%s (#%u)", VSFlags[info.consoleType3], info.consoleType3);
-            Print(buf);
-        }
-        else {
-            Print("\nVS PPU       : N/A");
-            Print("\nVS Type      : N/A");
-        }
-        Print("\nMisc ROMs    : ");
-        snprintf(buf, sizeof(buf), "%u", info.miscROMs);
-        Print(buf);
-        Print("\nExpansion    : ");
-        snprintf(buf, sizeof(buf), "%s (#%u)", ExpansionDevices[info.expansion], info.expansion);
-        Print(buf);
+    if (prev_exists && file_size > src_pos) {
+        layout.isShown[REGION_MISC] = true;
+        layout.isPresent[REGION_MISC] = true;
+        layout.offset[REGION_MISC] = src_pos;
+        layout.size[REGION_MISC] = file_size - src_pos;
+    }
+    else if (info->isExtended && info->miscROMs != 0) {
+        layout.isShown[REGION_MISC] = true;
     }
+    return layout;
+}
 
 
-    CRC32Init();
+#define REGION_ALL ((1u << REGION_COUNT) - 1)
 
-    Print("\n-------------*-----------------------------------------");
-    PrintHash(source, file_size, "File   ");
+typedef struct {
+    bool headerOnly;
+    bool tiered;            // CRC32 first, other hashes on DB hit only
+    bool isHashesExplicit;  // --hash given
+    unsigned hashes;        // HASH_* bits
+    unsigned regions;       // 1 << REGION_* bits
+    bool trustZipCRC;       // Stored zip members: File CRC32 from the directory
+    int jobs;               // Worker threads
+    bool identify;          // Match header/trainer/split candidates against the DB
+    bool stats;             // Per-phase timing to stderr
+    bool perfCounters;      // Hardware counters per phase, implies stats
+    IOEngineType io;        // Read-ahead for batches of plain files
+    int ioDepth;            // Files read ahead
+    bool direct;            // O_DIRECT reads
+    bool hugePages;         // Huge pages for large pooled buffers
+    bool summary;           // Collection aggregates after the batch
+    bool summaryOnly;       // ... instead of the per-file reports
+    const char* bankIndex;  // Bank fingerprint index file, or NULL
+    bool diff;              // Compare two ROMs instead of reporting
+    const char* similar;    // MinHash catalog file, or NULL
+    bool watch;             // Report files as they are written to a directory
+    const char* catalog;    // Scan catalogue file, or NULL
+    const char* filter;     // Header filter expression, or NULL
+    bool unordered;         // --jobs > 1: reports in completion order, not input order
+    uint32_t shardIndex;    // --shard i/N: 1..N
+    uint32_t shardCount;    // 0: all files
+    const char* shardRoot;  // Shard paths are relative to it, NULL: current directory
+    const char* journal;    // Checkpoint journal file, or NULL
+    bool resume;            // Skip the files in the journal, append to the output
+} Options;
 
-    const uint8_t* src = NULL;
-    size_t src_pos = 0;
+Options g_opt = {
+    .hashes = HASH_ALL,
+    .regions = REGION_ALL,
+    .jobs = 1,
+    .io = IO_ENGINE_AUTO,
+    .ioDepth = 4
+};
 
-    Print("\n-------------*-----------------------------------------");
-    if (file_size > HEADER_SIZE) {
-        src = source + HEADER_SIZE;
-        size_t rom_size = file_size - HEADER_SIZE;
-        PrintHash(src, rom_size, "ROM    ");
-    }
-    else {
-        PrintHash(NULL, 0, "ROM    ");
-    }
+// Compiled --filter; code is NULL without one
+static FilterProgram g_filter = {0};
 
-    bool prev_exists = true;
-    bool prg_exists = false;
+// Per-file buffers of the current worker; NULL outside batches (plain malloc)
+static _Thread_local BufferPool* t_pool = NULL;
 
-    src_pos = HEADER_SIZE;
 
-    if (info.isTrainer) {
-        Print("\n-------------*-----------------------------------------");
-        if (file_size - src_pos >= TRAINER_SIZE) {
-            src = source + src_pos;
-            PrintHash(src, TRAINER_SIZE, "Trainer");
-            src_pos += TRAINER_SIZE;
-        }
-        else {
-            PrintHash(NULL, 0, "Trainer");
-            prev_exists = false;
+// Statistics (--stats)
+
+enum {
+    PHASE_OPEN,             // fopen() + GetFILESize()
+    PHASE_READ,             // fread(), archive member read and inflate
+    PHASE_CRC32,
+    PHASE_MD5,
+    PHASE_SHA1,
+    PHASE_SUM16,
+    PHASE_BANKS,            // --bank-index fingerprints
+    PHASE_DB,               // nes20db.xml lookups and game names
+    PHASE_IDENTIFY,
+    PHASE_OUTPUT,           // Writing the report to stdout
+    PHASE_JOURNAL,          // --journal: stat(), records and syncs
+    PHASE_COUNT
+};
+
+const char* PhaseNames[PHASE_COUNT] = {
+    "open", "read", "crc32", "md5", "sha1", "sum16", "banks", "db", "identify", "output", "journal"
+};
+
+// Hardware counters of --perf-counters, one perf_event_open group per thread
+enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNT
+};
+
+const char* PerfNames[PERF_COUNT] = { "cycles", "instructions", "LLC-misses", "branch-misses" };
+
+// One per worker thread, merged at the end
+typedef struct {
+    uint64_t ns[PHASE_COUNT];
+    uint64_t bytes[PHASE_COUNT];
+    uint64_t counters[PHASE_COUNT][PERF_COUNT];
+    uint64_t busyNs;        // Inside jobs
+    uint64_t* fileNs;       // Per job
+    size_t fileCount;
+    size_t fileCap;
+} Stats;
+
+static _Thread_local Stats* t_stats = NULL;
+
+// Clock and counter values at the start of a phase
+typedef struct {
+    uint64_t ns;
+    uint64_t counters[PERF_COUNT];
+} StatsMark;
+
+typedef struct {
+    int leader;             // -1 if the group could not be opened
+    int count;              // Events in the group
+    int fd[PERF_COUNT];
+    int index[PERF_COUNT];  // Position in the group read, -1 if not available
+} PerfGroup;
+
+static _Thread_local PerfGroup* t_perf = NULL;
+
+#ifdef __linux__
+static int OpenPerfEvent(uint32_t type, uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd == -1;
+    attr.exclude_kernel = 1;    // Allowed with perf_event_paranoid <= 2
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+// Counts this thread; false, with the reason in *error, if the kernel or container says no
+bool OpenPerfGroup(PerfGroup* group, const char** error)
+{
+    group->leader = -1;
+    group->count = 0;
+    for (int i = 0; i < PERF_COUNT; i++) {
+        group->fd[i] = -1;
+        group->index[i] = -1;
+    }
+#ifdef __linux__
+    static const uint64_t Configs[PERF_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+    group->leader = OpenPerfEvent(PERF_TYPE_HARDWARE, Configs[0], -1);
+    if (group->leader == -1) {
+        *error = strerror(errno);
+        return false;
+    }
+    group->fd[0] = group->leader;
+    group->index[0] = group->count++;
+    // Members the PMU lacks (e.g. in VMs) are left out
+    for (int i = 1; i < PERF_COUNT; i++) {
+        group->fd[i] = OpenPerfEvent(PERF_TYPE_HARDWARE, Configs[i], group->leader);
+        if (group->fd[i] != -1) {
+            group->index[i] = group->count++;
         }
     }
+    ioctl(group->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+#else
+    *error = "not supported on this platform";
+    return false;
+#endif
+}
 
-    if (info.PRGSize != 0) {
-        Print("\n-------------*-----------------------------------------");
-        if (prev_exists
-            && file_size - src_pos >= info.PRGSize
-        ) {
-            src = source + src_pos;
-            PrintHash(src, info.PRGSize, "PRG ROM");
-            src_pos += info.PRGSize;
-            prg_exists = true;
-        }
-        else {
-            PrintHash(NULL, 0, "PRG ROM");
-            prev_exists = false;
+void ClosePerfGroup(PerfGroup* group)
+{
+    for (int i = PERF_COUNT - 1; i >= 0; i--) {
+#ifdef __linux__
+        if (group->fd[i] != -1) {
+            close(group->fd[i]);
         }
+#endif
+        group->fd[i] = -1;
     }
+    group->leader = -1;
+}
 
-    if (info.CHRSize != 0) {
-        Print("\n-------------*-----------------------------------------");
-        if (prev_exists
-            && file_size - src_pos >= info.CHRSize
-        ) {
-            src = source + src_pos;
-            PrintHash(src, info.CHRSize, "CHR ROM");
-            src_pos += info.CHRSize;
-        }
-        else {
-            PrintHash(NULL, 0, "CHR ROM");
-            prev_exists = false;
+static void ReadPerfGroup(uint64_t counters[PERF_COUNT])
+{
+#ifdef __linux__
+    uint64_t values[1 + PERF_COUNT];
+    if (t_perf != NULL && t_perf->leader != -1
+        && read(t_perf->leader, values, sizeof(values)) >= (ssize_t)sizeof(uint64_t)
+    ) {
+        for (int i = 0; i < PERF_COUNT; i++) {
+            int index = t_perf->index[i];
+            counters[i] = index >= 0 && (uint64_t)index < values[0] ? values[1 + index] : 0;
         }
+        return;
     }
+#endif
+    memset(counters, 0, PERF_COUNT * sizeof(uint64_t));
+}
 
-    if (prev_exists && file_size > src_pos) {
-        Print("\n-------------*-----------------------------------------");
-        src = source + src_pos;
-        size_t misc_size = file_size - src_pos;
-        PrintHash(src, misc_size, "Misc   ");
-    }
-    else if (info.isExtended && info.miscROMs != 0) {
-        Print("\n-------------*-----------------------------------------");
-        PrintHash(NULL, 0, "Misc   ");
+uint64_t StatsNow(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
     }
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#elif defined(__unix__) || defined(__APPLE__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
 
-    if (prg_exists && info.PRGSize >= 0x20) {
-        src_pos = HEADER_SIZE + info.PRGSize - 0x20;
-        if (info.isTrainer) {
-            src_pos += TRAINER_SIZE;
+// Start of a timed phase; no clock or counter read when --stats is off
+static inline StatsMark StatsStart(void)
+{
+    StatsMark mark;
+    mark.ns = 0;
+    if (t_stats != NULL) {
+        if (t_perf != NULL) {
+            ReadPerfGroup(mark.counters);
         }
-        src = source + src_pos;
+        mark.ns = StatsNow();
+    }
+    return mark;
+}
 
-        NintendoHeader nh;
-        if (GetNintendoHeader(src, &nh)) {
-            Print("\n-------------*-----------------------------------------");
-            Print("\n              Nintendo Header");
-            Print("\n ");
-            for (size_t i = 0x00; i < 0x10; i++) {
-                snprintf(buf + i * 3, sizeof(buf) - i * 3, "%02X ", src[i]);
-            }
-            Print(buf);
-            Print("\n ");
-            for (size_t i = 0x10, j = 0; i < 0x1A; i++, j++) {
-                snprintf(buf + j * 3, sizeof(buf) - j * 3, "%02X ", src[i]);
+// Charges the time and counts since *t to phase and restarts *t
+static inline void StatsLap(int phase, StatsMark* t, uint64_t bytes)
+{
+    if (t_stats != NULL) {
+        uint64_t now = StatsNow();
+        t_stats->ns[phase] += now - t->ns;
+        t_stats->bytes[phase] += bytes;
+        t->ns = now;
+        if (t_perf != NULL) {
+            uint64_t counters[PERF_COUNT];
+            ReadPerfGroup(counters);
+            for (int i = 0; i < PERF_COUNT; i++) {
+                t_stats->counters[phase][i] += counters[i] - t->counters[i];
+                t->counters[i] = counters[i];
             }
+        }
+    }
+}
+
+
+// Collection summary (--summary)
+
+#define SUMMARY_MAPPERS     4096    // NES 2.0: 12 bits
+#define SUMMARY_CONSOLES    (3 + 16)  // consoleType1 0-2, then Extended by consoleType2
+#define SUMMARY_EXPANSIONS  64
+
+// Fixed-size counters, one set per worker, added up at the end
+typedef struct {
+    uint64_t files;         // With an iNES header
+    uint64_t extended;      // NES 2.0
+    uint64_t headerless;    // --identify
+    uint64_t errors;
+    uint64_t filteredOut;   // --filter
+    uint64_t bytes;
+    uint64_t mappers[SUMMARY_MAPPERS];
+    uint64_t consoles[SUMMARY_CONSOLES];
+    uint64_t expansions[SUMMARY_EXPANSIONS];
+    uint64_t nintendoHeaders;
+    uint64_t makers[256];
+    uint64_t dbFiles;       // Looked up in nes20db.xml
+    uint64_t dbHits;        // At least one region matched
+    bool isDBHit;           // Current file
+} Summary;
+
+static _Thread_local Summary* t_summary = NULL;
+
+static void SummarizeROM(const NESInfo* info, size_t file_size)
+{
+    if (t_summary == NULL) {
+        return;
+    }
+    Summary* sm = t_summary;
+    sm->files++;
+    sm->bytes += file_size;
+    sm->mappers[info->mapper % SUMMARY_MAPPERS]++;
+    if (info->consoleType1 == 0x03) {
+        sm->consoles[3 + info->consoleType2]++;
+    }
+    else {
+        sm->consoles[info->consoleType1]++;
+    }
+    if (info->isExtended) {
+        sm->extended++;
+        sm->expansions[info->expansion % SUMMARY_EXPANSIONS]++;
+    }
+}
+
+void AddSummary(Summary* total, const Summary* sm)
+{
+    total->files += sm->files;
+    total->extended += sm->extended;
+    total->headerless += sm->headerless;
+    total->errors += sm->errors;
+    total->filteredOut += sm->filteredOut;
+    total->bytes += sm->bytes;
+    for (int i = 0; i < SUMMARY_MAPPERS; i++) {
+        total->mappers[i] += sm->mappers[i];
+    }
+    for (int i = 0; i < SUMMARY_CONSOLES; i++) {
+        total->consoles[i] += sm->consoles[i];
+    }
+    for (int i = 0; i < SUMMARY_EXPANSIONS; i++) {
+        total->expansions[i] += sm->expansions[i];
+    }
+    total->nintendoHeaders += sm->nintendoHeaders;
+    for (int i = 0; i < 256; i++) {
+        total->makers[i] += sm->makers[i];
+    }
+    total->dbFiles += sm->dbFiles;
+    total->dbHits += sm->dbHits;
+}
+
+
+// Bank fingerprints (--bank-index)
+
+// Banks of the files one worker processed; file ids are local until the merge
+typedef struct {
+    BankRecord* records;
+    size_t count;
+    size_t cap;
+    char** paths;
+    size_t* jobIndex;       // For the report order
+    size_t fileCount;
+    size_t fileCap;
+    size_t fileStart;       // First record of the current file
+    bool isFileOpen;        // Records go to the last file
+    bool isFailed;          // Out of memory: banks are missing, the index isn't updated
+} BankList;
+
+static _Thread_local BankList* t_banks = NULL;
+
+bool BeginBankFile(BankList* list, const char* path, size_t job_index)
+{
+    if (list->fileCount == list->fileCap) {
+        size_t cap = list->fileCap ? list->fileCap * 2 : 64;
+        char** paths = (char**)realloc(list->paths, cap * sizeof(char*));
+        if (paths != NULL) {
+            list->paths = paths;
+        }
+        size_t* jobs = (size_t*)realloc(list->jobIndex, cap * sizeof(size_t));
+        if (jobs != NULL) {
+            list->jobIndex = jobs;
+        }
+        if (paths == NULL || jobs == NULL) {
+            list->isFailed = true;
+            return false;
+        }
+        list->fileCap = cap;
+    }
+    size_t len = strlen(path) + 1;
+    char* copy = (char*)malloc(len);
+    if (copy == NULL) {
+        list->isFailed = true;
+        return false;
+    }
+    memcpy(copy, path, len);
+    list->paths[list->fileCount] = copy;
+    list->jobIndex[list->fileCount] = job_index;
+    list->fileCount++;
+    list->fileStart = list->count;
+    list->isFileOpen = true;
+    return true;
+}
+
+// A failed file leaves no trace, so it doesn't replace an earlier scan of it
+void EndBankFile(BankList* list, bool ok)
+{
+    if (list->isFileOpen && !ok) {
+        list->count = list->fileStart;
+        free(list->paths[--list->fileCount]);
+    }
+    list->isFileOpen = false;
+}
+
+static void AddBankRecords(const uint64_t* fps, size_t count, uint8_t kind)
+{
+    BankList* list = t_banks;
+    if (!list->isFileOpen) {
+        return;
+    }
+    if (list->count + count > list->cap) {
+        size_t cap = list->cap ? list->cap : 4096;
+        while (cap < list->count + count) {
+            cap *= 2;
+        }
+        BankRecord* p = (BankRecord*)realloc(list->records, cap * sizeof(BankRecord));
+        if (p == NULL) {
+            list->isFailed = true;
+            return;
+        }
+        list->records = p;
+        list->cap = cap;
+    }
+    for (size_t i = 0; i < count; i++) {
+        BankRecord* r = &list->records[list->count++];
+        r->fp = fps[i];
+        r->file = (uint32_t)(list->fileCount - 1);
+        r->bank = (uint16_t)i;
+        r->kind = kind;
+        r->reserved = 0;
+    }
+}
+
+void FreeBankList(BankList* list)
+{
+    for (size_t i = 0; i < list->fileCount; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    free(list->jobIndex);
+    free(list->records);
+    memset(list, 0, sizeof(*list));
+}
+
+
+// Similarity sketches (--similar)
+
+// Sketches of the files one worker processed, in its processing order
+typedef struct {
+    MinHashSketch* sketches;
+    char** paths;
+    size_t* jobIndex;       // For the report order
+    size_t count;
+    size_t cap;
+    bool isFileOpen;        // Shingles go to the last sketch
+    bool isFailed;          // Out of memory: sketches are missing, the catalog isn't updated
+} SketchList;
+
+static _Thread_local SketchList* t_sketches = NULL;
+
+bool BeginSketchFile(SketchList* list, const char* path, size_t job_index)
+{
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        MinHashSketch* sketches = (MinHashSketch*)realloc(list->sketches, cap * sizeof(MinHashSketch));
+        if (sketches != NULL) {
+            list->sketches = sketches;
+        }
+        char** paths = (char**)realloc(list->paths, cap * sizeof(char*));
+        if (paths != NULL) {
+            list->paths = paths;
+        }
+        size_t* jobs = (size_t*)realloc(list->jobIndex, cap * sizeof(size_t));
+        if (jobs != NULL) {
+            list->jobIndex = jobs;
+        }
+        if (sketches == NULL || paths == NULL || jobs == NULL) {
+            list->isFailed = true;
+            return false;
+        }
+        list->cap = cap;
+    }
+    size_t len = strlen(path) + 1;
+    char* copy = (char*)malloc(len);
+    if (copy == NULL) {
+        list->isFailed = true;
+        return false;
+    }
+    memcpy(copy, path, len);
+    MinHashInit(&list->sketches[list->count]);
+    list->paths[list->count] = copy;
+    list->jobIndex[list->count] = job_index;
+    list->count++;
+    list->isFileOpen = true;
+    return true;
+}
+
+// A failed file is dropped, as in EndBankFile()
+void EndSketchFile(SketchList* list, bool ok)
+{
+    if (list->isFileOpen && !ok) {
+        free(list->paths[--list->count]);
+    }
+    list->isFileOpen = false;
+}
+
+static void AddSketchShingles(const uint64_t* fps, size_t count)
+{
+    SketchList* list = t_sketches;
+    if (list->isFileOpen) {
+        MinHashAdd(&list->sketches[list->count - 1], fps, count);
+    }
+}
+
+void FreeSketchList(SketchList* list)
+{
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->sketches);
+    free(list->paths);
+    free(list->jobIndex);
+    memset(list, 0, sizeof(*list));
+}
+
+
+// Scan catalogue (--catalog)
+
+// Rows of the files one worker processed; only files with an iNES header count
+typedef struct {
+    CatalogEntry* entries;
+    char** paths;
+    size_t* jobIndex;       // For the row order
+    size_t count;
+    size_t cap;
+    bool isFileOpen;        // The last entry is being filled
+    bool hasHeader;         // ... and SetCatalogHeader() was called
+    bool isFailed;          // Out of memory: rows are missing, the catalogue isn't updated
+} CatalogList;
+
+static _Thread_local CatalogList* t_catalog = NULL;
+
+bool BeginCatalogFile(CatalogList* list, const char* path, size_t job_index)
+{
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        CatalogEntry* entries = (CatalogEntry*)realloc(list->entries, cap * sizeof(CatalogEntry));
+        if (entries != NULL) {
+            list->entries = entries;
+        }
+        char** paths = (char**)realloc(list->paths, cap * sizeof(char*));
+        if (paths != NULL) {
+            list->paths = paths;
+        }
+        size_t* jobs = (size_t*)realloc(list->jobIndex, cap * sizeof(size_t));
+        if (jobs != NULL) {
+            list->jobIndex = jobs;
+        }
+        if (entries == NULL || paths == NULL || jobs == NULL) {
+            list->isFailed = true;
+            return false;
+        }
+        list->cap = cap;
+    }
+    size_t len = strlen(path) + 1;
+    char* copy = (char*)malloc(len);
+    if (copy == NULL) {
+        list->isFailed = true;
+        return false;
+    }
+    memcpy(copy, path, len);
+    memset(&list->entries[list->count], 0, sizeof(CatalogEntry));
+    list->paths[list->count] = copy;
+    list->jobIndex[list->count] = job_index;
+    list->count++;
+    list->isFileOpen = true;
+    list->hasHeader = false;
+    return true;
+}
+
+// Failed and headerless files get no row
+void EndCatalogFile(CatalogList* list, bool ok)
+{
+    if (list->isFileOpen && (!ok || !list->hasHeader)) {
+        free(list->paths[--list->count]);
+    }
+    list->isFileOpen = false;
+}
+
+static void SetCatalogHeader(const uint8_t* header, size_t file_size)
+{
+    CatalogList* list = t_catalog;
+    if (list != NULL && list->isFileOpen) {
+        CatalogEntry* e = &list->entries[list->count - 1];
+        memcpy(e->header, header, HEADER_SIZE);
+        e->fileSize = file_size;
+        list->hasHeader = true;
+    }
+}
+
+static void AddCatalogDigests(bool is_rom, unsigned hashes, const HashResult* hr)
+{
+    CatalogList* list = t_catalog;
+    if (!list->isFileOpen) {
+        return;
+    }
+    CatalogEntry* e = &list->entries[list->count - 1];
+    if ((hashes & HASH_CRC32) && is_rom) {
+        e->digests |= CATALOG_D_ROM_CRC32;
+        e->romCRC32 = hr->crc;
+    }
+    else if (hashes & HASH_CRC32) {
+        e->digests |= CATALOG_D_FILE_CRC32;
+        e->fileCRC32 = hr->crc;
+    }
+    if (hashes & HASH_SHA1) {
+        e->digests |= is_rom ? CATALOG_D_ROM_SHA1 : CATALOG_D_FILE_SHA1;
+        memcpy(is_rom ? e->romSHA1 : e->fileSHA1, hr->sha1, 20);
+    }
+}
+
+void FreeCatalogList(CatalogList* list)
+{
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->entries);
+    free(list->paths);
+    free(list->jobIndex);
+    memset(list, 0, sizeof(*list));
+}
+
+// CRC32 of a whole zip member, as recorded in the central directory
+typedef struct {
+    uint32_t crc32;
+    bool isTrusted;         // Use it instead of hashing
+    const char* path;       // For the mismatch warning
+} ZipCRC;
+
+// Option names for --hash, in HASH_* bit order
+const char* HashKeys[] = { "crc32", "md5", "sha1" };
+
+
+// All selected algorithms are fed the same chunk while it is in cache
+#define HASH_CHUNK_SIZE (64 * 1024)
+
+// Sum of all bytes, for the Nintendo header checksums (and nes20db sum16)
+uint64_t ByteSum(uint64_t sum, const uint8_t* data, size_t size)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    // psadbw against zero: two 64-bit lane sums of 8 bytes each
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero;
+    __m128i acc1 = zero;
+    for (; i + 64 <= size; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(data + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(data + i + 48));
+        acc0 = _mm_add_epi64(acc0, _mm_add_epi64(_mm_sad_epu8(a, zero), _mm_sad_epu8(b, zero)));
+        acc1 = _mm_add_epi64(acc1, _mm_add_epi64(_mm_sad_epu8(c, zero), _mm_sad_epu8(d, zero)));
+    }
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(a, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(acc0, acc1));
+    sum += lanes[0] + lanes[1];
+#endif
+    for (; i < size; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+// Banks within src[pos, pos + len); chunks start on 8 KiB boundaries
+static void HashBanks(BankHashes* bh, const uint8_t* src, size_t pos, size_t len)
+{
+    for (size_t b = pos; b + BANK_SIZE <= pos + len && b / BANK_SIZE < bh->count; b += BANK_SIZE) {
+        bh->banks[b / BANK_SIZE] = XXH64(src + b, BANK_SIZE, 0);
+    }
+    if (bh->smallBanks == NULL) {
+        return;
+    }
+    for (size_t b = pos; b + SMALL_BANK_SIZE <= pos + len && b / SMALL_BANK_SIZE < bh->smallCount;
+        b += SMALL_BANK_SIZE
+    ) {
+        bh->smallBanks[b / SMALL_BANK_SIZE] = XXH64(src + b, SMALL_BANK_SIZE, 0);
+    }
+}
+
+void ComputeHashes(const uint8_t* src, size_t size, unsigned hashes, HashResult* result)
+{
+    uint32_t crc = 0;
+    uint64_t sum = 0;
+    MD5Context md5;
+    SHA1_CTX sha1;
+
+    if (hashes & HASH_MD5) {
+        md5Init(&md5);
+    }
+    if (hashes & HASH_SHA1) {
+        SHA1Init(&sha1);
+    }
+    StatsMark t = StatsStart();
+    for (size_t pos = 0; pos < size; pos += HASH_CHUNK_SIZE) {
+        size_t len = size - pos < HASH_CHUNK_SIZE ? size - pos : HASH_CHUNK_SIZE;
+        if (hashes & HASH_CRC32) {
+            crc = CRC32Update(crc, src + pos, len);
+            StatsLap(PHASE_CRC32, &t, len);
+        }
+        if (hashes & HASH_MD5) {
+            md5Update(&md5, src + pos, len);
+            StatsLap(PHASE_MD5, &t, len);
+        }
+        if (hashes & HASH_SHA1) {
+            SHA1Update(&sha1, src + pos, (uint32_t)len);
+            StatsLap(PHASE_SHA1, &t, len);
+        }
+        if (hashes & HASH_SUM16) {
+            sum = ByteSum(sum, src + pos, len);
+            StatsLap(PHASE_SUM16, &t, len);
+        }
+        if (hashes & HASH_BANKS) {
+            HashBanks(result->banks, src, pos, len);
+            StatsLap(PHASE_BANKS, &t, len);
+        }
+    }
+    if (hashes & HASH_SUM16) {
+        result->sum16 = (uint16_t)sum;
+    }
+    if (hashes & HASH_CRC32) {
+        result->crc = crc;
+    }
+    if (hashes & HASH_MD5) {
+        md5Finalize(&md5);
+        memcpy(result->md5, md5.digest, sizeof(result->md5));
+        StatsLap(PHASE_MD5, &t, 0);
+    }
+    if (hashes & HASH_SHA1) {
+        SHA1Final(result->sha1, &sha1);
+        StatsLap(PHASE_SHA1, &t, 0);
+    }
+}
+
+// ComputeHashes() that takes a trusted zip CRC32 as is and cross-checks any other
+static void ComputeFileHashes(
+    const uint8_t* src, size_t size, unsigned hashes, const ZipCRC* zip_crc, HashResult* result)
+{
+    if (zip_crc != NULL && zip_crc->isTrusted && (hashes & HASH_CRC32)) {
+        ComputeHashes(src, size, hashes & ~HASH_CRC32, result);
+        result->crc = zip_crc->crc32;
+        return;
+    }
+    ComputeHashes(src, size, hashes, result);
+    if (zip_crc != NULL && (hashes & HASH_CRC32) && result->crc != zip_crc->crc32) {
+        fprintf(stderr, "Warning: CRC32 %08X does not match the zip directory (%08X): %s\n",
+            result->crc, zip_crc->crc32, zip_crc->path);
+    }
+}
+
+// sum16, if not NULL, gets the byte sum from the same pass; banks likewise the bank fingerprints.
+// Returns the HASH_* bits computed into result (may be NULL).
+unsigned PrintHash(const uint8_t* src, size_t size, const char* name, unsigned hashes, const ZipCRC* zip_crc,
+    uint16_t* sum16, BankHashes* banks, HashResult* result)
+{
+    char buf[128 + 1] = {0};
+    const char* prefix = name;
+    const char* indent = "       ";
+
+    if (src == NULL || size == 0) {
+        if (sum16 != NULL) {
+            *sum16 = 0;
+        }
+        if (hashes & HASH_CRC32) {
+            snprintf(buf, sizeof(buf), "\n%s CRC32: N/A", prefix);
+            Print(buf);
+            prefix = indent;
+        }
+        if (hashes & HASH_MD5) {
+            snprintf(buf, sizeof(buf), "\n%s MD5  : N/A", prefix);
+            Print(buf);
+            prefix = indent;
+        }
+        if (hashes & HASH_SHA1) {
+            snprintf(buf, sizeof(buf), "\n%s SHA-1: N/A", prefix);
             Print(buf);
-            Print("\n-------------*-----------------------------------------");
-            snprintf(buf, sizeof(buf), "\nTitle        : {%s}", nh.title);
-            Print(buf);
-            const char* MapperNintendo[] = {
-                "NROM", "CNROM", "UNROM", "GNROM", "MMC"
-            };
-            Print("\nMapper       : ");
-            if (nh.mapper < sizeof(MapperNintendo)/sizeof(MapperNintendo[0])) {
-                snprintf(buf, sizeof(buf), "%s (#%u)", MapperNintendo[nh.mapper], nh.mapper);
+        }
+        return 0;
+    }
+
+    HashResult hr;
+    char hash_str[41] = {0};
+    bool is_tier_miss = false;
+    unsigned extra = (sum16 ? HASH_SUM16 : 0) | (banks ? HASH_BANKS : 0);
+    hr.banks = banks;
+
+    if (g_opt.tiered) {
+        // CRC32 first; SHA-1 only to confirm a CRC32 + size hit in the DB
+        unsigned first = HASH_CRC32 | (g_opt.isHashesExplicit ? hashes : 0);
+        PROBE_HASH_START(name, size);
+        ComputeFileHashes(src, size, first | extra, zip_crc, &hr);
+        PROBE_HASH_END(name, size);
+        hashes = first;
+        if (g_nes20db != NULL && !(hashes & HASH_SHA1)) {
+            StatsMark t = StatsStart();
+            PROBE_DB_LOOKUP_START("crc32");
+            bool is_hit = FindDBEntryCRC(hr.crc, size) != NULL;
+            PROBE_DB_LOOKUP_END("crc32", is_hit);
+            StatsLap(PHASE_DB, &t, 0);
+            if (is_hit) {
+                PROBE_HASH_START(name, size);
+                ComputeHashes(src, size, HASH_SHA1, &hr);
+                PROBE_HASH_END(name, size);
+                hashes |= HASH_SHA1;
             }
             else {
-                snprintf(buf, sizeof(buf), "Unknown (#%u)", nh.mapper);
+                is_tier_miss = true;
             }
-            Print(buf);
-            snprintf(buf, sizeof(buf), "\nPRG ROM  Size: %3u KiB = %6u B",
-                nh.PRGSize / 1024, nh.PRGSize);
-            Print(buf);
-            if (nh.PRGSize == 8 * 1024) {
-                Print(" (or 64 KiB)");
+        }
+    }
+    else {
+        PROBE_HASH_START(name, size);
+        ComputeFileHashes(src, size, hashes | extra, zip_crc, &hr);
+        PROBE_HASH_END(name, size);
+    }
+    if (sum16 != NULL) {
+        *sum16 = hr.sum16;
+    }
+
+    if (hashes & HASH_CRC32) {
+        snprintf(buf, sizeof(buf), "\n%s CRC32: %08X | Size: %" PRIuPTR, prefix, hr.crc, size);
+        Print(buf);
+        prefix = indent;
+    }
+
+    if (hashes & HASH_MD5) {
+        for (size_t i = 0; i < 16; i++) {
+            snprintf(hash_str + i * 2, 3, "%02X", hr.md5[i]);
+        }
+        if (prefix == name) {
+            snprintf(buf, sizeof(buf), "\n%s MD5  : %s | Size: %" PRIuPTR, prefix, hash_str, size);
+        }
+        else {
+            snprintf(buf, sizeof(buf), "\n%s MD5  : %s", prefix, hash_str);
+        }
+        Print(buf);
+        prefix = indent;
+    }
+
+    if (hashes & HASH_SHA1) {
+        SHA1_to_hex(hr.sha1, hash_str);
+        if (prefix == name) {
+            snprintf(buf, sizeof(buf), "\n%s SHA-1: %s | Size: %" PRIuPTR, prefix, hash_str, size);
+        }
+        else {
+            snprintf(buf, sizeof(buf), "\n%s SHA-1: %s", prefix, hash_str);
+        }
+        Print(buf);
+
+        if (g_nes20db != NULL) {
+            StatsMark t = StatsStart();
+            PROBE_DB_LOOKUP_START("sha1");
+            size_t game_count = PrintNES20DB(hr.sha1);
+            PROBE_DB_LOOKUP_END("sha1", game_count != 0);
+            StatsLap(PHASE_DB, &t, 0);
+            if (t_summary != NULL && game_count != 0) {
+                t_summary->isDBHit = true;
             }
-            else if (nh.PRGSize == 64 * 1024) {
-                Print(" (or  8 KiB)");
+        }
+    }
+    else if (is_tier_miss) {
+        Print("\n        SHA-1: - (no CRC32 match in nes20db.xml)");
+    }
+    if (result != NULL) {
+        *result = hr;
+    }
+    return hashes;
+}
+
+const char* NoYesStr[] = {"No", "Yes"};
+const char* MirroringStr[] = {"Horizontal", "Vertical"};
+
+void PrintNESHeader(const uint8_t* source, const NESInfo* pinfo)
+{
+    char buf[256] = {0};
+    const NESInfo info = *pinfo;
+
+    Print("-------------*-----------------------------------------");
+    if (info.isExtended) {
+        Print("\n              NES 2.0");
+    }
+    else {
+        Print("\n              iNES");
+    }
+    Print("\n ");
+    for (size_t i = 0; i < HEADER_SIZE; i++) {
+        snprintf(buf + i * 3, sizeof(buf) - i * 3, "%02X ", source[i]);
+    }
+    Print(buf);
+    Print("\n-------------*-----------------------------------------");
+    snprintf(buf, sizeof(buf), "\nMapper Number: %u", info.mapper);
+    Print(buf);
+    if (info.mapper < MAPPER_COUNT) {
+        Print(" = ");
+        Print(MapperNames[info.mapper]);
+    }
+    snprintf(buf, sizeof(buf), "\nPRG ROM  Size: %5" PRIu64 " KiB = %8" PRIu64 " B",
+        info.PRGSize / 1024, info.PRGSize);
+    Print(buf);
+    snprintf(buf, sizeof(buf), "\nCHR ROM  Size: %5" PRIu64 " KiB = %8" PRIu64 " B",
+        info.CHRSize / 1024, info.CHRSize);
+    Print(buf);
+    Print("\nMirroring    : "); Print(MirroringStr[(int)info.isVertMirroring]);
+    Print("\n4-screen VRAM: "); Print(NoYesStr[(int)info.is4Screen]);
+    Print("\nBattery      : "); Print(NoYesStr[(int)info.isBattery]);
+    Print("\nTrainer      : "); Print(NoYesStr[(int)info.isTrainer]);
+    Print("\nConsole Type : ");
+    snprintf(buf, sizeof(buf), "%s (#%u)", ConsoleType1[info.consoleType1], info.consoleType1);
+    Print(buf);
+    if (!info.isExtended) {
+        Print("\nTV system    : ");
+        snprintf(buf, sizeof(buf), "%s (#%d)", FrameTiming[(int)info.isPAL_iNES], (int)info.isPAL_iNES);
+        Print(buf);
+        if (info.PRGRAMSize8K_iNES == 0) {
+            Print("\nPRG RAM  Size: 0 or 8192 B (#0)");
+        }
+        else {
+            uint32_t prgRamSize = info.PRGRAMSize8K_iNES * 0x2000;
+            Print("\nPRG RAM  Size: ");
+            snprintf(buf, sizeof(buf), "%5u KiB = %8u B (#%u)",
+                prgRamSize / 1024, prgRamSize, info.PRGRAMSize8K_iNES);
+            Print(buf);
+        }
+    }
+    else {
+        Print("\nTV system    : N/A");
+        Print("\nPRG RAM  Size: N/A");
+    }
+
+    if (info.isExtended) {
+        Print("\n-------------*-----------------------------------------");
+        snprintf(buf, sizeof(buf), "\nSubmapper    : %u", info.submapper);
+        Print(buf);
+        snprintf(buf, sizeof(buf), "\nPRG RAM  Size: %5u KiB = %8u B",
+            info.PRGRAMSize / 1024, info.PRGRAMSize);
+        Print(buf);
+        snprintf(buf, sizeof(buf), "\nCHR RAM  Size: %5u KiB = %8u B",
+            info.CHRRAMSize / 1024, info.CHRRAMSize);
+        Print(buf);
+        snprintf(buf, sizeof(buf), "\nPRG Save Size: %5u KiB = %8u B",
+            info.PRGSaveRAMSize / 1024, info.PRGSaveRAMSize);
+        Print(buf);
+        snprintf(buf, sizeof(buf), "\nCHR Save Size: %5u KiB = %8u B",
+            info.CHRSaveRAMSize / 1024, info.CHRSaveRAMSize);
+        Print(buf);
+        snprintf(buf, sizeof(buf), "\nFrame Timing : %s (#%u)",
+            FrameTiming[info.frameTiming], info.frameTiming);
+        Print(buf);
+        if (info.consoleType1 == 0x03) {
+            Print("\nConsole Ext. : ");
+            snprintf(buf, sizeof(buf), "%s (#%u)", ConsoleType2[info.consoleType2], info.consoleType2);
+            Print(buf);
+        }
+        else {
+            Print("\nConsole Ext. : N/A");
+        }
+        if (info.consoleType1 == 0x01) {
+            Print("\nVS PPU       : ");
+            snprintf(buf, sizeof(buf), "%s (#%u)", VSPPUs[info.consoleType2], info.consoleType2);
+            Print(buf);
+            Print("\nVS Type      : ");
+            snprintf(buf, sizeof(buf), "%s (#%u)", VSFlags[info.consoleType3], info.consoleType3);
+            Print(buf);
+        }
+        else {
+            Print("\nVS PPU       : N/A");
+            Print("\nVS Type      : N/A");
+        }
+        Print("\nMisc ROMs    : ");
+        snprintf(buf, sizeof(buf), "%u", info.miscROMs);
+        Print(buf);
+        Print("\nExpansion    : ");
+        snprintf(buf, sizeof(buf), "%s (#%u)", ExpansionDevices[info.expansion], info.expansion);
+        Print(buf);
+    }
+}
+
+// Offset of the last 32 bytes of PRG ROM (Nintendo header, $FFE0-$FFFF).
+// Returns 0 if PRG ROM is too small or is not entirely in the file.
+size_t GetNintendoHeaderOffset(const NESInfo* info, size_t file_size)
+{
+    size_t prg_end = HEADER_SIZE;
+    if (info->isTrainer) {
+        prg_end += TRAINER_SIZE;
+    }
+    if (info->PRGSize < 0x20 || file_size < prg_end
+        || file_size - prg_end < info->PRGSize
+    ) {
+        return 0;
+    }
+    return prg_end + info->PRGSize - 0x20;
+}
+
+// sums, if not NULL, are checked against the PRG/CHR checksums
+void PrintNintendoHeader(const uint8_t* src, const NintendoSums* sums)
+{
+    char buf[256] = {0};
+
+    NintendoHeader nh;
+    if (!GetNintendoHeader(src, &nh)) {
+        return;
+    }
+    if (t_summary != NULL) {
+        t_summary->nintendoHeaders++;
+        t_summary->makers[nh.makerCode]++;
+    }
+    Print("\n-------------*-----------------------------------------");
+    Print("\n              Nintendo Header");
+    Print("\n ");
+    for (size_t i = 0x00; i < 0x10; i++) {
+        snprintf(buf + i * 3, sizeof(buf) - i * 3, "%02X ", src[i]);
+    }
+    Print(buf);
+    Print("\n ");
+    for (size_t i = 0x10, j = 0; i < 0x1A; i++, j++) {
+        snprintf(buf + j * 3, sizeof(buf) - j * 3, "%02X ", src[i]);
+    }
+    Print(buf);
+    Print("\n-------------*-----------------------------------------");
+    snprintf(buf, sizeof(buf), "\nTitle        : {%s}", nh.title);
+    Print(buf);
+    const char* MapperNintendo[] = {
+        "NROM", "CNROM", "UNROM", "GNROM", "MMC"
+    };
+    Print("\nMapper       : ");
+    if (nh.mapper < sizeof(MapperNintendo)/sizeof(MapperNintendo[0])) {
+        snprintf(buf, sizeof(buf), "%s (#%u)", MapperNintendo[nh.mapper], nh.mapper);
+    }
+    else {
+        snprintf(buf, sizeof(buf), "Unknown (#%u)", nh.mapper);
+    }
+    Print(buf);
+    snprintf(buf, sizeof(buf), "\nPRG ROM  Size: %3u KiB = %6u B",
+        nh.PRGSize / 1024, nh.PRGSize);
+    Print(buf);
+    if (nh.PRGSize == 8 * 1024) {
+        Print(" (or 64 KiB)");
+    }
+    else if (nh.PRGSize == 64 * 1024) {
+        Print(" (or  8 KiB)");
+    }
+    snprintf(buf, sizeof(buf), "\nCHR      Size: %3u KiB = %6u B",
+        nh.CHRSize / 1024, nh.CHRSize);
+    Print(buf);
+    if (nh.CHRSize == 8 * 1024) {
+        Print(" (or 64 KiB)");
+    }
+    else if (nh.CHRSize == 64 * 1024) {
+        Print(" (or  8 KiB)");
+    }
+    Print("\nCHR RAM      : "); Print(NoYesStr[(int)nh.isCHRRAM]);
+    Print("\nMirroring    : "); Print(MirroringStr[(int)nh.isVertMirroring]);
+    snprintf(buf, sizeof(buf), "\nMaker's Code : 0x%02X = ", nh.makerCode);
+    Print(buf);
+    Print(MakerNames[nh.makerCode]);
+    snprintf(buf, sizeof(buf), "\nChecksum     : PRG = %04X, CHR = %04X, Validation = %02X",
+        nh.PRGChecksum, nh.CHRChecksum, nh.validation);
+    Print(buf);
+    if (sums == NULL) {
+        return;
+    }
+    Print("\nVerified     : PRG = ");
+    if (sums->PRGSum == nh.PRGChecksum) {
+        Print("OK");
+    }
+    else {
+        snprintf(buf, sizeof(buf), "Mismatch (%04X)", sums->PRGSum);
+        Print(buf);
+    }
+    Print(", CHR = ");
+    if (!sums->hasCHR) {
+        Print("N/A");
+    }
+    else if (sums->CHRSum == nh.CHRChecksum) {
+        Print("OK");
+    }
+    else {
+        snprintf(buf, sizeof(buf), "Mismatch (%04X)", sums->CHRSum);
+        Print(buf);
+    }
+}
+
+// zip_crc applies to the File region only, may be NULL
+void PrintNESInfoEx(const uint8_t* source, size_t file_size, const ZipCRC* zip_crc)
+{
+    NESInfo info = GetNESInfo(source);
+    PrintNESHeader(source, &info);
+    SummarizeROM(&info, file_size);
+    SetCatalogHeader(source, file_size);
+    if (t_summary != NULL) {
+        t_summary->isDBHit = false;
+    }
+
+    ROMLayout layout = GetROMLayout(&info, file_size);
+    size_t nh_pos = GetNintendoHeaderOffset(&info, file_size);
+    NintendoHeader nh;
+    bool has_nh = layout.isPresent[REGION_PRG] && nh_pos != 0 && GetNintendoHeader(source + nh_pos, &nh);
+
+    // PRG/CHR byte sums for the Nintendo header ride along with the region hashes,
+    // and so do the bank fingerprints (1 KiB PRG banks too as --similar shingles)
+    uint16_t sums[REGION_COUNT] = {0};
+    unsigned summed = 0;
+    BankHashes banks[REGION_COUNT];
+    memset(banks, 0, sizeof(banks));
+    if (t_banks != NULL || t_sketches != NULL) {
+        for (int r = REGION_PRG; r <= REGION_CHR; r++) {
+            if (!layout.isPresent[r]) {
+                continue;
+            }
+            size_t count = layout.size[r] / BANK_SIZE;
+            bool is_small = r == REGION_CHR || t_sketches != NULL;
+            size_t small_count = is_small ? layout.size[r] / SMALL_BANK_SIZE : 0;
+            banks[r].count = count < BANK_MAX_BANKS ? count : BANK_MAX_BANKS;
+            banks[r].smallCount = small_count < BANK_MAX_BANKS ? small_count : BANK_MAX_BANKS;
+            size_t fp_count = banks[r].count + banks[r].smallCount + 1;
+            banks[r].banks = (uint64_t*)PoolAlloc(t_pool, fp_count * sizeof(uint64_t));
+            if (banks[r].banks == NULL) {
+                banks[r].count = 0;
+                banks[r].smallCount = 0;
+            }
+            else if (is_small) {
+                banks[r].smallBanks = banks[r].banks + banks[r].count;
+            }
+        }
+    }
+    unsigned banked = 0;
+    for (int r = 0; r < REGION_COUNT; r++) {
+        if (!layout.isShown[r] || !(g_opt.regions & (1u << r))) {
+            continue;
+        }
+        bool is_summed = has_nh && (r == REGION_PRG || r == REGION_CHR);
+        BankHashes* bh = banks[r].banks != NULL ? &banks[r] : NULL;
+        Print("\n-------------*-----------------------------------------");
+        if (layout.isPresent[r]) {
+            HashResult hr;
+            unsigned computed = PrintHash(source + layout.offset[r], layout.size[r], RegionNames[r], g_opt.hashes,
+                r == REGION_FILE ? zip_crc : NULL, is_summed ? &sums[r] : NULL, bh, &hr);
+            if (t_catalog != NULL && (r == REGION_FILE || r == REGION_ROM)) {
+                AddCatalogDigests(r == REGION_ROM, computed, &hr);
+            }
+            banked |= bh != NULL ? 1u << r : 0;
+        }
+        else {
+            PrintHash(NULL, 0, RegionNames[r], g_opt.hashes, NULL, is_summed ? &sums[r] : NULL, NULL, NULL);
+        }
+        if (is_summed) {
+            summed |= 1u << r;
+        }
+    }
+    for (int r = REGION_PRG; r <= REGION_CHR; r++) {
+        if (banks[r].banks == NULL) {
+            continue;
+        }
+        if (!(banked & (1u << r))) {
+            // Region left out by --regions
+            HashResult hr;
+            hr.banks = &banks[r];
+            ComputeHashes(source + layout.offset[r], layout.size[r], HASH_BANKS, &hr);
+        }
+        if (t_banks != NULL) {
+            AddBankRecords(banks[r].banks, banks[r].count, r == REGION_PRG ? BANK_KIND_PRG : BANK_KIND_CHR);
+            if (r == REGION_CHR) {
+                AddBankRecords(banks[r].smallBanks, banks[r].smallCount, BANK_KIND_CHR1K);
+            }
+        }
+        if (t_sketches != NULL) {
+            AddSketchShingles(banks[r].smallBanks, banks[r].smallCount);
+        }
+        PoolFree(t_pool, banks[r].banks);
+    }
+
+    if (layout.isPresent[REGION_PRG] && nh_pos != 0) {
+        NintendoSums nh_sums;
+        for (int r = REGION_PRG; has_nh && r <= REGION_CHR; r++) {
+            if (!(summed & (1u << r)) && layout.isPresent[r]) {
+                sums[r] = (uint16_t)ByteSum(0, source + layout.offset[r], layout.size[r]);
+            }
+        }
+        // The PRG checksum does not cover its own two bytes
+        nh_sums.PRGSum = (uint16_t)(sums[REGION_PRG] - source[nh_pos + 0x10] - source[nh_pos + 0x11]);
+        nh_sums.CHRSum = sums[REGION_CHR];
+        nh_sums.hasCHR = layout.isPresent[REGION_CHR];
+        PrintNintendoHeader(source + nh_pos, has_nh ? &nh_sums : NULL);
+    }
+
+    if (t_summary != NULL && g_nes20db != NULL) {
+        t_summary->dbFiles++;
+        t_summary->dbHits += t_summary->isDBHit;
+    }
+
+    if (g_opt.identify) {
+        StatsMark t = StatsStart();
+        PrintIdentify(source, file_size);
+        StatsLap(PHASE_IDENTIFY, &t, file_size);
+    }
+}
+
+void PrintNESInfo(const uint8_t* source, size_t file_size)
+{
+    PrintNESInfoEx(source, file_size, NULL);
+}
+
+
+// Dump identification (--identify)
+
+// Candidate PRG/CHR boundaries are tried on 8 KiB steps
+#define IDENTIFY_BANK_SIZE (8 * 1024)
+#define IDENTIFY_MAX_HITS  16
+
+typedef struct {
+    size_t start;           // File offset of the ROM data
+    uint32_t game;
+    unsigned kinds;         // 1 << DB_KIND_* that matched
+} IdentifyHit;
+
+typedef struct {
+    IdentifyHit hits[IDENTIFY_MAX_HITS];
+    size_t count;
+    size_t candidates;
+} IdentifyResult;
+
+// Every DB entry with this CRC32 and size whose SHA-1 matches as well
+static void MatchIdentifyEntries(
+    const DBEntry* e, uint32_t crc, uint64_t size, const uint8_t sha1[20], size_t start, IdentifyResult* r)
+{
+    const DBEntry* end = g_db.entries + g_db.entryCount;
+    for (; e < end && e->hasCRC32 && e->crc32 == crc && e->size == size; e++) {
+        if (e->hasSHA1 && memcmp(e->sha1, sha1, 20) != 0) {
+            continue;
+        }
+        size_t i;
+        for (i = 0; i < r->count; i++) {
+            if (r->hits[i].start == start && r->hits[i].game == e->game) {
+                break;
+            }
+        }
+        if (i == r->count) {
+            if (r->count == IDENTIFY_MAX_HITS) {
+                continue;
+            }
+            r->hits[i].start = start;
+            r->hits[i].game = e->game;
+            r->hits[i].kinds = 0;
+            r->count++;
+        }
+        r->hits[i].kinds |= 1u << e->kind;
+    }
+}
+
+// Tries every 8 KiB prefix of the data at start (rom, prgrom) and every 8 KiB
+// multiple of CHR after each 16 KiB PRG boundary, plus CHR to the end (chrrom). Prefix CRC32s come from one
+// pass, range CRC32s are derived from them with CRC32Combine(). SHA-1 is only
+// computed to confirm a CRC32 hit: one running context is advanced up to the
+// hit and cloned, so hits on a longer prefix continue from it.
+static void IdentifyAt(const uint8_t* file, size_t file_size, size_t start, IdentifyResult* r)
+{
+    const uint8_t* data = file + start;
+    size_t size = file_size - start;
+    size_t banks = size / IDENTIFY_BANK_SIZE;
+    uint32_t* prefix = (uint32_t*)PoolAlloc(t_pool, (banks + 1) * sizeof(uint32_t));
+    if (prefix == NULL) {
+        return;
+    }
+
+    SHA1_CTX sha1;
+    size_t sha1_pos = 0;
+    uint8_t digest[20];
+    uint32_t crc = 0;
+    SHA1Init(&sha1);
+    prefix[0] = 0;
+    for (size_t pos = 0; pos < size; ) {
+        size_t len = size - pos < IDENTIFY_BANK_SIZE ? size - pos : IDENTIFY_BANK_SIZE;
+        crc = CRC32Update(crc, data + pos, len);
+        pos += len;
+        if (len == IDENTIFY_BANK_SIZE) {
+            prefix[pos / IDENTIFY_BANK_SIZE] = crc;
+        }
+        r->candidates++;
+
+        const DBEntry* e = FindDBEntryCRC(crc, pos);
+        if (e != NULL) {
+            SHA1_CTX clone;
+            SHA1Update(&sha1, data + sha1_pos, (uint32_t)(pos - sha1_pos));
+            sha1_pos = pos;
+            clone = sha1;
+            SHA1Final(digest, &clone);
+            MatchIdentifyEntries(e, crc, pos, digest, start, r);
+        }
+    }
+
+    // CRC32(B) = CRC32(AB) ^ CRC32Combine(CRC32(A), 0, |B|). CRC32(A) shifted
+    // over |B| zero bytes is carried from one 8 KiB CHR step to the next.
+    for (size_t a = 2 * IDENTIFY_BANK_SIZE; a < size; a += 2 * IDENTIFY_BANK_SIZE) {
+        uint32_t prg_crc = prefix[a / IDENTIFY_BANK_SIZE];
+        uint32_t shifted = prg_crc;
+        for (size_t b = a + IDENTIFY_BANK_SIZE; ; b += IDENTIFY_BANK_SIZE) {
+            uint32_t chr_crc;
+            if (b < size && b - a <= g_db.maxCHRSize) {
+                shifted = CRC32Combine(shifted, 0, IDENTIFY_BANK_SIZE);
+                chr_crc = prefix[b / IDENTIFY_BANK_SIZE] ^ shifted;
+            }
+            else {
+                // CHR to the end of the file, not necessarily a whole bank;
+                // longer CHR than any in the DB can't match before that
+                b = size;
+                chr_crc = crc ^ CRC32Combine(prg_crc, 0, b - a);
+            }
+            r->candidates++;
+
+            const DBEntry* e = FindDBEntryCRC(chr_crc, b - a);
+            if (e != NULL) {
+                SHA1_CTX ctx;
+                SHA1Init(&ctx);
+                SHA1Update(&ctx, data + a, (uint32_t)(b - a));
+                SHA1Final(digest, &ctx);
+                MatchIdentifyEntries(e, chr_crc, b - a, digest, start, r);
+            }
+            if (b == size) {
+                break;
+            }
+        }
+    }
+    PoolFree(t_pool, prefix);
+}
+
+void PrintIdentify(const uint8_t* source, size_t file_size)
+{
+    char buf[256];
+
+    Print("\n-------------*-----------------------------------------");
+    if (g_nes20db == NULL) {
+        Print("\nIdentify     : nes20db.xml is not found");
+        return;
+    }
+
+    // Header with and without a trainer, or no header at all
+    IdentifyResult r;
+    r.count = 0;
+    r.candidates = 0;
+    bool has_header = memcmp(source, "NES\x1A", 4) == 0;
+    if (has_header) {
+        IdentifyAt(source, file_size, HEADER_SIZE, &r);
+        if (file_size > HEADER_SIZE + TRAINER_SIZE) {
+            IdentifyAt(source, file_size, HEADER_SIZE + TRAINER_SIZE, &r);
+        }
+    }
+    else {
+        IdentifyAt(source, file_size, 0, &r);
+    }
+
+    snprintf(buf, sizeof(buf), "\nIdentify     : %" PRIuPTR " match(es) in nes20db.xml, %" PRIuPTR " candidates",
+        r.count, r.candidates);
+    Print(buf);
+
+    static const char* KindNames[] = { "other", "rom", "prgrom", "chrrom", "trainer", "miscrom" };
+    for (size_t i = 0; i < r.count; i++) {
+        const IdentifyHit* hit = &r.hits[i];
+        const DBGame* game = &g_db.games[hit->game];
+        uint64_t prg_size = GetDBGameValue(game, "prgrom", "size", 0);
+        uint64_t chr_size = GetDBGameValue(game, "chrrom", "size", 0);
+        uint64_t rom_size = GetDBGameValue(game, "rom", "size", prg_size + chr_size);
+
+        Print("\n-------------*-----------------------------------------");
+        PrintDBGameName(game);
+        snprintf(buf, sizeof(buf), "\nLayout       : %s, PRG %" PRIu64 " KiB, CHR %" PRIu64 " KiB, data at 0x%" PRIXPTR,
+            hit->start == 0 ? "headerless" : hit->start == HEADER_SIZE ? "header" : "header + trainer",
+            prg_size / 1024, chr_size / 1024, hit->start);
+        Print(buf);
+        size_t data_size = file_size - hit->start;
+        if (data_size > rom_size) {
+            snprintf(buf, sizeof(buf), "\nExtra data   : %" PRIu64 " B after ROM", data_size - rom_size);
+            Print(buf);
+        }
+        Print("\nMatched      :");
+        for (int k = 0; k <= DB_KIND_MISC; k++) {
+            if (hit->kinds & (1u << k)) {
+                Print(" ");
+                Print(KindNames[k]);
+            }
+        }
+
+        uint8_t header[HEADER_SIZE];
+        if (GetDBGameHeader(game, header)) {
+            bool is_same = has_header && memcmp(source + 4, header + 4, HEADER_SIZE - 4) == 0;
+            Print(is_same ? "\nHeader       : OK" : "\nHeader       : corrected");
+            Print("\n");
+            NESInfo info = GetNESInfo(header);
+            PrintNESHeader(header, &info);
+        }
+        else {
+            Print("\nHeader       : the PRG/CHR size has no NES 2.0 encoding");
+        }
+    }
+}
+
+// Report output
+
+// A report is collected per file and written in one piece, so reports from
+// parallel workers never interleave
+typedef struct {
+    char* data;
+    size_t size;
+    size_t cap;
+} OutBuf;
+
+static _Thread_local OutBuf* t_out = NULL;
+
+#ifdef NESINFO_THREADS
+static pthread_mutex_t g_outLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void WriteOut(const char* data, size_t size)
+{
+#ifdef WINDOWS_ENCODING
+    // Reports are UTF-8 (paths, game names); the console takes UTF-16
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode;
+    if (size != 0 && GetConsoleMode(console, &mode)) {
+        int len = MultiByteToWideChar(CP_UTF8, 0, data, (int)size, NULL, 0);
+        wchar_t* w_data = len > 0 ? (wchar_t*)malloc(len * sizeof(wchar_t)) : NULL;
+        if (w_data != NULL && MultiByteToWideChar(CP_UTF8, 0, data, (int)size, w_data, len) == len) {
+            fflush(stdout);
+            WriteConsoleW(console, w_data, len, NULL, NULL);
+            free(w_data);
+            return;
+        }
+        free(w_data);
+    }
+#endif
+    fwrite(data, sizeof(char), size, stdout);
+}
+
+#ifndef __EMSCRIPTEN__
+void PrintOut(const char* str)
+{
+    size_t len = strlen(str);
+    OutBuf* out = t_out;
+    if (out == NULL) {
+        WriteOut(str, len);
+        return;
+    }
+    if (out->size + len > out->cap) {
+        size_t cap = out->cap ? out->cap : 4096;
+        while (cap < out->size + len) {
+            cap *= 2;
+        }
+        char* p = (char*)realloc(out->data, cap);
+        if (p == NULL) {
+            WriteOut(str, len);
+            return;
+        }
+        out->data = p;
+        out->cap = cap;
+    }
+    memcpy(out->data + out->size, str, len);
+    out->size += len;
+}
+#endif
+
+FILE* OpenROMFile(const char* path)
+{
+#ifdef WINDOWS_ENCODING
+    wchar_t w_path[MAX_PATH + 1] = {0};
+    if (MultiByteToWideChar(CP_UTF8, 0, path, -1, w_path, MAX_PATH) == 0) {
+        return NULL;
+    }
+    return _wfopen(w_path, L"rb");
+#else
+    return fopen(path, "rb");
+#endif
+}
+
+// Set by the Process* functions for a file that --filter rejects: it gets no report
+static _Thread_local bool t_isFilteredOut = false;
+
+// --filter on the 16-byte header. The Nintendo header is only looked at when
+// the filter uses its fields: from data if the whole file is in memory, else
+// read from fp. Files without an iNES header never match.
+static bool MatchFilter(const uint8_t* header, size_t file_size, const uint8_t* data, FILE* fp)
+{
+    if (memcmp(header, "NES\x1A", 4)) {
+        return false;
+    }
+    NESInfo info = GetNESInfo(header);
+    NintendoHeader nh;
+    bool is_nh = false;
+    if (g_filter.fields & FILTER_NH_FIELDS) {
+        uint8_t nh_buf[0x20];
+        const uint8_t* nh_src = NULL;
+        size_t nh_pos = GetNintendoHeaderOffset(&info, file_size);
+        if (nh_pos != 0 && data != NULL) {
+            nh_src = data + nh_pos;
+        }
+        else if (nh_pos != 0 && fp != NULL
+            && fseek(fp, (long)nh_pos, SEEK_SET) == 0
+            && fread(nh_buf, sizeof(uint8_t), sizeof(nh_buf), fp) == sizeof(nh_buf)
+        ) {
+            nh_src = nh_buf;
+        }
+        is_nh = nh_src != NULL && GetNintendoHeader(nh_src, &nh);
+    }
+
+    uint64_t values[FILTER_FIELD_COUNT];
+    FilterGetValues(&info, file_size, is_nh ? &nh : NULL, values);
+    return FilterMatch(&g_filter, values);
+}
+
+// Reads only the 16-byte header and the 32-byte Nintendo header window.
+// fp is unbuffered (see ProcessFile()): each fread() is exactly one small read.
+bool ProcessFileHeaderOnly(FILE* fp, size_t file_size, const char* path)
+{
+    uint8_t header[HEADER_SIZE];
+    uint8_t nh_src[0x20];
+
+    StatsMark t = StatsStart();
+    if (fread(header, sizeof(uint8_t), HEADER_SIZE, fp) != HEADER_SIZE) {
+        fprintf(stderr, "Can't read: %s\n", path);
+        return false;
+    }
+    StatsLap(PHASE_READ, &t, HEADER_SIZE);
+    if (g_filter.code != NULL && !MatchFilter(header, file_size, NULL, fp)) {
+        t_isFilteredOut = true;
+        return true;
+    }
+    if (memcmp(header, "NES\x1A", 4)) {
+        fprintf(stderr, "Error: file is not an iNES ROM image: %s\n", path);
+        return false;
+    }
+
+    NESInfo info = GetNESInfo(header);
+    PrintNESHeader(header, &info);
+    SummarizeROM(&info, file_size);
+    SetCatalogHeader(header, file_size);
+
+    size_t nh_pos = GetNintendoHeaderOffset(&info, file_size);
+    if (nh_pos != 0
+        && fseek(fp, (long)nh_pos, SEEK_SET) == 0
+        && fread(nh_src, sizeof(uint8_t), sizeof(nh_src), fp) == sizeof(nh_src)
+    ) {
+        StatsLap(PHASE_READ, &t, sizeof(nh_src));
+        PrintNintendoHeader(nh_src, NULL);
+    }
+    return true;
+}
+
+// Whole file in memory: headerless (--identify) or iNES
+bool ProcessROMData(const uint8_t* source, size_t file_size, const char* path)
+{
+    if (memcmp(source, "NES\x1A", 4) && g_opt.identify) {
+        // Headerless dump
+        Print("-------------*-----------------------------------------");
+        Print("\n              No iNES header");
+        if (t_summary != NULL) {
+            t_summary->headerless++;
+        }
+        PrintIdentify(source, file_size);
+        return true;
+    }
+    if (memcmp(source, "NES\x1A", 4)) {
+        fprintf(stderr, "Error: file is not an iNES ROM image: %s\n", path);
+        return false;
+    }
+
+    PrintNESInfo(source, file_size);
+    return true;
+}
+
+bool ProcessFile(const char* path)
+{
+    StatsMark t = StatsStart();
+    FILE* fp = OpenROMFile(path);
+    if (fp == NULL) {
+        fprintf(stderr, "Can't open: %s\n", path);
+        return false;
+    }
+    if (g_opt.headerOnly) {
+        // Before any other operation on the stream
+        setvbuf(fp, NULL, _IONBF, 0);
+    }
+    size_t file_size = GetFILESize(fp);
+    if (file_size == (size_t)-1) {
+        fprintf(stderr, "Error: GetFileSize(): %s\n", path);
+        fclose(fp);
+        return false;
+    }
+    if (file_size < MIN_FILE_SIZE) {
+        fprintf(stderr, "Error: file size is too small: %s\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    StatsLap(PHASE_OPEN, &t, 0);
+
+    if (g_opt.headerOnly) {
+        bool ok = ProcessFileHeaderOnly(fp, file_size, path);
+        fclose(fp);
+        return ok;
+    }
+
+    if (g_filter.code != NULL) {
+        // Header first: a rejected file is never read in full
+        uint8_t header[HEADER_SIZE];
+        bool is_match = fread(header, sizeof(uint8_t), HEADER_SIZE, fp) != HEADER_SIZE
+            || MatchFilter(header, file_size, NULL, fp);
+        StatsLap(PHASE_READ, &t, HEADER_SIZE);
+        if (!is_match) {
+            fclose(fp);
+            t_isFilteredOut = true;
+            return true;
+        }
+        fseek(fp, 0, SEEK_SET);
+    }
+
+    uint8_t* source = (uint8_t*)PoolAlloc(t_pool, file_size);
+    if (source == NULL) {
+        fprintf(stderr, "Error: malloc(): %s\n", path);
+        fclose(fp);
+        return false;
+    }
+    size_t read_bytes = fread(source, sizeof(uint8_t), file_size, fp);
+    if (read_bytes != file_size) {
+        fprintf(stderr, "Can't read: %s\n", path);
+        fclose(fp);
+        PoolFree(t_pool, source);
+        return false;
+    }
+    fclose(fp);
+    StatsLap(PHASE_READ, &t, file_size);
+
+    bool ok = ProcessROMData(source, file_size, path);
+    PoolFree(t_pool, source);
+    return ok;
+}
+
+// A file already read by the I/O engine; same errors as ProcessFile()
+bool ProcessBufferedFile(IOEngine* io, size_t index, const char* path)
+{
+    StatsMark t = StatsStart();
+    IOBuffer* buf = IOEngineGet(io, index);
+    StatsLap(PHASE_READ, &t, buf->error == IO_OK ? buf->size : 0);
+
+    bool ok = false;
+    if (buf->error == IO_ERR_OPEN) {
+        fprintf(stderr, "Can't open: %s\n", path);
+    }
+    else if (buf->error == IO_ERR_SIZE) {
+        fprintf(stderr, "Error: GetFileSize(): %s\n", path);
+    }
+    else if (buf->size < MIN_FILE_SIZE) {
+        fprintf(stderr, "Error: file size is too small: %s\n", path);
+    }
+    else if (buf->error == IO_ERR_MEM) {
+        fprintf(stderr, "Error: malloc(): %s\n", path);
+    }
+    else if (buf->error != IO_OK) {
+        fprintf(stderr, "Can't read: %s\n", path);
+    }
+    else if (g_filter.code != NULL && !MatchFilter(buf->data, buf->size, buf->data, NULL)) {
+        t_isFilteredOut = true;
+        ok = true;
+    }
+    else {
+        ok = ProcessROMData(buf->data, buf->size, path);
+    }
+    IOEngineRelease(io, buf);
+    return ok;
+}
+
+// The member is read or inflated into memory, never written to disk
+bool ProcessArchiveMember(FILE* fp, const ArchiveIndex* archive, const ArchiveMember* member, const char* path)
+{
+    if (member->size < MIN_FILE_SIZE) {
+        fprintf(stderr, "Error: file size is too small: %s\n", path);
+        return false;
+    }
+    if (member->size > ARCHIVE_MAX_MEMBER_SIZE) {
+        fprintf(stderr, "Error: archive member is too large: %s\n", path);
+        return false;
+    }
+    size_t file_size = (size_t)member->size;
+    uint8_t* source = (uint8_t*)PoolAlloc(t_pool, file_size);
+    if (source == NULL) {
+        fprintf(stderr, "Error: malloc(): %s\n", path);
+        return false;
+    }
+    StatsMark t = StatsStart();
+    void* scratch = member->method == 8 ? PoolAlloc(t_pool, ARCHIVE_SCRATCH_SIZE) : NULL;
+    bool is_read = ReadArchiveMember(fp, archive->type, member, source, scratch);
+    PoolFree(t_pool, scratch);
+    StatsLap(PHASE_READ, &t, member->size);
+    if (!is_read) {
+        fprintf(stderr, "Can't read: %s\n", path);
+        PoolFree(t_pool, source);
+        return false;
+    }
+    // Members are always extracted whole; a rejected one still skips the hashing
+    if (g_filter.code != NULL && !MatchFilter(source, file_size, source, NULL)) {
+        PoolFree(t_pool, source);
+        t_isFilteredOut = true;
+        return true;
+    }
+    if (memcmp(source, "NES\x1A", 4) && g_opt.identify && !g_opt.headerOnly) {
+        Print("-------------*-----------------------------------------");
+        Print("\n              No iNES header");
+        if (t_summary != NULL) {
+            t_summary->headerless++;
+        }
+        PrintIdentify(source, file_size);
+        PoolFree(t_pool, source);
+        return true;
+    }
+    if (memcmp(source, "NES\x1A", 4)) {
+        fprintf(stderr, "Error: file is not an iNES ROM image: %s\n", path);
+        PoolFree(t_pool, source);
+        return false;
+    }
+
+    if (g_opt.headerOnly) {
+        NESInfo info = GetNESInfo(source);
+        PrintNESHeader(source, &info);
+        SummarizeROM(&info, file_size);
+        SetCatalogHeader(source, file_size);
+        size_t nh_pos = GetNintendoHeaderOffset(&info, file_size);
+        if (nh_pos != 0) {
+            PrintNintendoHeader(source + nh_pos, NULL);
+        }
+    }
+    else if (archive->type == ARCHIVE_ZIP) {
+        // Only a stored member's CRC32 is taken as is; inflate output is always checked
+        ZipCRC zip_crc = { member->crc32, g_opt.trustZipCRC && member->method == 0, path };
+        PrintNESInfoEx(source, file_size, &zip_crc);
+    }
+    else {
+        PrintNESInfo(source, file_size);
+    }
+
+    PoolFree(t_pool, source);
+    return true;
+}
+
+
+// ROM diff (--diff)
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    bool isMapped;
+} ROMFile;
+
+// mmap() where available, so a diff streams straight from the page cache
+bool MapROMFile(ROMFile* rf, const char* path)
+{
+    memset(rf, 0, sizeof(*rf));
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Can't open: %s\n", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: fstat() failed: %s\n", path);
+        close(fd);
+        return false;
+    }
+    if ((size_t)st.st_size < MIN_FILE_SIZE) {
+        fprintf(stderr, "Error: file size is too small: %s\n", path);
+        close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Can't read: %s\n", path);
+        return false;
+    }
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+    rf->data = (const uint8_t*)p;
+    rf->size = (size_t)st.st_size;
+    rf->isMapped = true;
+    return true;
+#else
+    FILE* fp = OpenROMFile(path);
+    if (fp == NULL) {
+        fprintf(stderr, "Can't open: %s\n", path);
+        return false;
+    }
+    size_t file_size = GetFILESize(fp);
+    if (file_size == (size_t)-1 || file_size < MIN_FILE_SIZE) {
+        fprintf(stderr, "Error: file size is too small: %s\n", path);
+        fclose(fp);
+        return false;
+    }
+    uint8_t* data = (uint8_t*)malloc(file_size);
+    if (data == NULL || fread(data, 1, file_size, fp) != file_size) {
+        fprintf(stderr, "Can't read: %s\n", path);
+        free(data);
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    rf->data = data;
+    rf->size = file_size;
+    return true;
+#endif
+}
+
+void UnmapROMFile(ROMFile* rf)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    if (rf->isMapped) {
+        munmap((void*)rf->data, rf->size);
+    }
+#else
+    free((void*)rf->data);
+#endif
+    memset(rf, 0, sizeof(*rf));
+}
+
+static inline unsigned CountTrailingZeros(unsigned x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctz(x);
+#else
+    unsigned n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// First offset >= pos where a and b differ (is_equal = false), or are equal
+// again (is_equal = true); size if there is none
+static size_t FindByteRun(const uint8_t* a, const uint8_t* b, size_t pos, size_t size, bool is_equal)
+{
+#ifdef __SSE2__
+    // Equal lanes give 0xFFFF; the run goes on while every lane keeps its state
+    unsigned same = is_equal ? 0x0000 : 0xFFFF;
+    if (!is_equal) {
+        // Whole 64-byte blocks first: the common case of identical data
+        for (; pos + 64 <= size; pos += 64) {
+            __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + pos)),
+                _mm_loadu_si128((const __m128i*)(b + pos)));
+            __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + pos + 16)),
+                _mm_loadu_si128((const __m128i*)(b + pos + 16)));
+            __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + pos + 32)),
+                _mm_loadu_si128((const __m128i*)(b + pos + 32)));
+            __m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + pos + 48)),
+                _mm_loadu_si128((const __m128i*)(b + pos + 48)));
+            __m128i e = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+            if ((unsigned)_mm_movemask_epi8(e) != 0xFFFF) {
+                break;
+            }
+        }
+    }
+    for (; pos + 16 <= size; pos += 16) {
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + pos)),
+            _mm_loadu_si128((const __m128i*)(b + pos))));
+        if (m != same) {
+            return pos + CountTrailingZeros((m ^ same) & 0xFFFF);
+        }
+    }
+#endif
+    for (; pos < size && (a[pos] == b[pos]) != is_equal; pos++) {
+    }
+    return pos;
+}
+
+#define DIFF_MAX_RANGES 8   // Byte ranges listed per bank
+
+typedef struct {
+    size_t banks;           // Compared banks that differ
+    size_t bytes;
+    size_t ranges;
+} DiffCount;
+
+// One bank (or trainer, misc ROM): the differing byte ranges, relative to the bank
+static bool DiffBank(const uint8_t* a, const uint8_t* b, size_t size, const char* label, DiffCount* dc)
+{
+    char buf[128];
+    size_t pos = FindByteRun(a, b, 0, size, false);
+    if (pos == size) {
+        return false;
+    }
+    size_t shown = 0;
+    Print("\n");
+    Print(label);
+    while (pos < size) {
+        size_t end = FindByteRun(a, b, pos, size, true);
+        dc->bytes += end - pos;
+        dc->ranges++;
+        if (shown < DIFF_MAX_RANGES) {
+            snprintf(buf, sizeof(buf), "%s$%04" PRIXPTR "-$%04" PRIXPTR, shown ? ", " : "", pos, end - 1);
+            Print(buf);
+        }
+        else if (shown == DIFF_MAX_RANGES) {
+            Print(", ...");
+        }
+        shown++;
+        pos = end < size ? FindByteRun(a, b, end, size, false) : size;
+    }
+    if (shown > DIFF_MAX_RANGES) {
+        snprintf(buf, sizeof(buf), " (%" PRIuPTR " ranges)", shown);
+        Print(buf);
+    }
+    dc->banks++;
+    return true;
+}
+
+static void DiffField(const char* name, uint64_t a, uint64_t b, int* differ)
+{
+    char buf[128];
+    if (a != b) {
+        snprintf(buf, sizeof(buf), "\n%-13s: %" PRIu64 " | %" PRIu64, name, a, b);
+        Print(buf);
+        (*differ)++;
+    }
+}
+
+// Returns 0 if the ROMs are identical, 1 if they differ, 2 on errors (as cmp)
+int DiffROMs(const char* path_a, const char* path_b)
+{
+    char buf[256];
+    ROMFile fa, fb;
+    if (!MapROMFile(&fa, path_a)) {
+        return 2;
+    }
+    if (!MapROMFile(&fb, path_b)) {
+        UnmapROMFile(&fa);
+        return 2;
+    }
+    if (memcmp(fa.data, "NES\x1A", 4) || memcmp(fb.data, "NES\x1A", 4)) {
+        fprintf(stderr, "Error: file is not an iNES ROM image: %s\n", memcmp(fa.data, "NES\x1A", 4) ? path_a : path_b);
+        UnmapROMFile(&fa);
+        UnmapROMFile(&fb);
+        return 2;
+    }
+
+    NESInfo ia = GetNESInfo(fa.data);
+    NESInfo ib = GetNESInfo(fb.data);
+    Print("-------------*-----------------------------------------");
+    Print("\n              Diff");
+    Print("\n< ");
+    Print(path_a);
+    Print("\n> ");
+    Print(path_b);
+    Print("\n-------------*-----------------------------------------");
+    int differ = 0;
+    DiffField("NES 2.0", ia.isExtended, ib.isExtended, &differ);
+    DiffField("Mapper Number", ia.mapper, ib.mapper, &differ);
+    DiffField("Submapper", ia.submapper, ib.submapper, &differ);
+    DiffField("PRG ROM  Size", ia.PRGSize, ib.PRGSize, &differ);
+    DiffField("CHR ROM  Size", ia.CHRSize, ib.CHRSize, &differ);
+    DiffField("Mirroring", ia.isVertMirroring, ib.isVertMirroring, &differ);
+    DiffField("4-screen VRAM", ia.is4Screen, ib.is4Screen, &differ);
+    DiffField("Battery", ia.isBattery, ib.isBattery, &differ);
+    DiffField("Trainer flag", ia.isTrainer, ib.isTrainer, &differ);
+    DiffField("Console Type", ia.consoleType1, ib.consoleType1, &differ);
+    DiffField("TV system", ia.isPAL_iNES, ib.isPAL_iNES, &differ);
+    DiffField("PRG RAM (8K)", ia.PRGRAMSize8K_iNES, ib.PRGRAMSize8K_iNES, &differ);
+    DiffField("PRG RAM  Size", ia.PRGRAMSize, ib.PRGRAMSize, &differ);
+    DiffField("CHR RAM  Size", ia.CHRRAMSize, ib.CHRRAMSize, &differ);
+    DiffField("PRG Save Size", ia.PRGSaveRAMSize, ib.PRGSaveRAMSize, &differ);
+    DiffField("CHR Save Size", ia.CHRSaveRAMSize, ib.CHRSaveRAMSize, &differ);
+    DiffField("Frame Timing", ia.frameTiming, ib.frameTiming, &differ);
+    DiffField("Console Ext.", ia.consoleType2, ib.consoleType2, &differ);
+    DiffField("VS Type", ia.consoleType3, ib.consoleType3, &differ);
+    DiffField("Misc ROMs", ia.miscROMs, ib.miscROMs, &differ);
+    DiffField("Expansion", ia.expansion, ib.expansion, &differ);
+    if (differ == 0) {
+        Print("\nHeader       : identical");
+    }
+
+    // PRG and CHR bank by bank; trainer and misc ROM as one block each
+    ROMLayout la = GetROMLayout(&ia, fa.size);
+    ROMLayout lb = GetROMLayout(&ib, fb.size);
+    static const int Regions[] = { REGION_TRAINER, REGION_PRG, REGION_CHR, REGION_MISC };
+    for (size_t i = 0; i < sizeof(Regions) / sizeof(Regions[0]); i++) {
+        int r = Regions[i];
+        if (!la.isPresent[r] && !lb.isPresent[r]) {
+            continue;
+        }
+        Print("\n-------------*-----------------------------------------");
+        if (!la.isPresent[r] || !lb.isPresent[r]) {
+            snprintf(buf, sizeof(buf), "\n%-13s: only in %s", RegionNames[r], la.isPresent[r] ? "<" : ">");
+            Print(buf);
+            differ++;
+            continue;
+        }
+        const uint8_t* a = fa.data + la.offset[r];
+        const uint8_t* b = fb.data + lb.offset[r];
+        size_t size = la.size[r] < lb.size[r] ? la.size[r] : lb.size[r];
+        bool is_banked = r == REGION_PRG || r == REGION_CHR;
+        size_t bank_size = is_banked ? BANK_SIZE : size;
+        size_t bank_count = (size + bank_size - 1) / bank_size;
+        DiffCount dc = {0};
+        for (size_t k = 0; k < bank_count; k++) {
+            size_t len = size - k * bank_size < bank_size ? size - k * bank_size : bank_size;
+            if (is_banked) {
+                snprintf(buf, sizeof(buf), "  Bank %4" PRIuPTR "  : ", k);
+            }
+            else {
+                snprintf(buf, sizeof(buf), "  Bytes      : ");
+            }
+            DiffBank(a + k * bank_size, b + k * bank_size, len, buf, &dc);
+        }
+        if (dc.banks == 0 && la.size[r] == lb.size[r]) {
+            snprintf(buf, sizeof(buf), "\n%-13s: identical", RegionNames[r]);
+        }
+        else if (is_banked) {
+            snprintf(buf, sizeof(buf), "\n%-13s: %" PRIuPTR " of %" PRIuPTR " banks differ, %" PRIuPTR
+                " bytes in %" PRIuPTR " ranges", RegionNames[r], dc.banks, bank_count, dc.bytes, dc.ranges);
+        }
+        else {
+            snprintf(buf, sizeof(buf), "\n%-13s: %" PRIuPTR " bytes differ in %" PRIuPTR " ranges",
+                RegionNames[r], dc.bytes, dc.ranges);
+        }
+        Print(buf);
+        if (la.size[r] != lb.size[r]) {
+            snprintf(buf, sizeof(buf), "\n  Size       : %" PRIuPTR " | %" PRIuPTR " B, compared the first %"
+                PRIuPTR " B", la.size[r], lb.size[r], size);
+            Print(buf);
+        }
+        differ += dc.banks != 0 || la.size[r] != lb.size[r];
+    }
+    Print("\n");
+
+    UnmapROMFile(&fa);
+    UnmapROMFile(&fb);
+    return differ != 0 ? 1 : 0;
+}
+
+// "crc32,sha1" -> bit mask by index in keys[]
+bool ParseKeyList(const char* list, const char* keys[], int key_count, unsigned* mask)
+{
+    *mask = 0;
+    while (*list != '\0') {
+        size_t len = strcspn(list, ",");
+        int i;
+        for (i = 0; i < key_count; i++) {
+            if (strlen(keys[i]) == len && strncmp(list, keys[i], len) == 0) {
+                *mask |= 1u << i;
+                break;
+            }
+        }
+        if (i == key_count) {
+            return false;
+        }
+        list += len;
+        if (*list == ',') {
+            list++;
+        }
+    }
+    return *mask != 0;
+}
+
+typedef struct {
+    const char** paths;
+    size_t count;
+    size_t cap;
+    char* listData;     // --files-from content, paths may point into it
+} FileList;
+
+bool AddFile(FileList* list, const char* path)
+{
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        const char** p = (const char**)realloc((void*)list->paths, cap * sizeof(char*));
+        if (p == NULL) {
+            return false;
+        }
+        list->paths = p;
+        list->cap = cap;
+    }
+    list->paths[list->count++] = path;
+    return true;
+}
+
+// One path per line; "-" reads the list from stdin
+bool ReadFileList(FileList* list, const char* list_path)
+{
+    FILE* fp = strcmp(list_path, "-") == 0 ? stdin : fopen(list_path, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    size_t size = 0;
+    size_t cap = 1 << 16;
+    char* data = (char*)malloc(cap);
+    for (;;) {
+        if (data == NULL) {
+            break;
+        }
+        size += fread(data + size, 1, cap - size - 1, fp);
+        if (size < cap - 1) {
+            break;
+        }
+        cap *= 2;
+        char* p = (char*)realloc(data, cap);
+        if (p == NULL) {
+            free(data);
+        }
+        data = p;
+    }
+    // A read error would leave a silently truncated list
+    bool is_read_error = ferror(fp) != 0;
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    if (data == NULL || is_read_error) {
+        free(data);
+        return false;
+    }
+    data[size] = '\0';
+    list->listData = data;
+
+    for (char* line = data; *line != '\0'; ) {
+        char* next = line + strcspn(line, "\n");
+        char* end = next;
+        if (*next != '\0') {
+            next++;
+        }
+        if (end > line && end[-1] == '\r') {
+            end--;
+        }
+        *end = '\0';
+        if (*line != '\0' && !AddFile(list, line)) {
+            return false;
+        }
+        line = next;
+    }
+    return true;
+}
+
+void FreeFileList(FileList* list)
+{
+    free((void*)list->paths);
+    free(list->listData);
+    memset(list, 0, sizeof(*list));
+}
+
+// Statistics report
+
+void AddStatsFile(Stats* stats, uint64_t ns)
+{
+    stats->busyNs += ns;
+    if (stats->fileCount == stats->fileCap) {
+        size_t cap = stats->fileCap ? stats->fileCap * 2 : 256;
+        uint64_t* p = (uint64_t*)realloc(stats->fileNs, cap * sizeof(uint64_t));
+        if (p == NULL) {
+            return;
+        }
+        stats->fileNs = p;
+        stats->fileCap = cap;
+    }
+    stats->fileNs[stats->fileCount++] = ns;
+}
+
+static int CompareNs(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Peak resident set size in KiB, 0 if unknown
+uint64_t GetPeakRSS(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+#ifdef __APPLE__
+        return (uint64_t)ru.ru_maxrss / 1024;
+#else
+        return (uint64_t)ru.ru_maxrss;
+#endif
+    }
+#endif
+    return 0;
+}
+
+// Batch processing
+
+// A plain file, or one .nes member of a zip or tar archive
+typedef struct {
+    const char* path;
+    const char* name;               // Path in the catalogue: under --shard, relative to the shard root
+    const ArchiveIndex* archive;    // NULL for plain files
+    size_t member;
+    size_t fileIndex;               // Plain files: I/O engine index
+} Job;
+
+typedef struct {
+    Job* items;
+    size_t count;
+    size_t cap;
+    ArchiveIndex* archives;
+    size_t archiveCount;
+    size_t fileCount;       // Plain files
+    size_t resumed;         // --resume: files skipped, reported by an earlier run
+    char** names;           // --shard: Job.name of each input path, or NULL
+    size_t nameCount;
+    bool hasErrors;         // An archive could not be listed
+} JobList;
+
+bool AddJob(JobList* jobs, const char* path, const ArchiveIndex* archive, size_t member)
+{
+    if (jobs->count == jobs->cap) {
+        size_t cap = jobs->cap ? jobs->cap * 2 : 64;
+        Job* p = (Job*)realloc(jobs->items, cap * sizeof(Job));
+        if (p == NULL) {
+            return false;
+        }
+        jobs->items = p;
+        jobs->cap = cap;
+    }
+    Job* job = &jobs->items[jobs->count++];
+    job->path = path;
+    job->name = path;
+    job->archive = archive;
+    job->member = member;
+    job->fileIndex = archive == NULL ? jobs->fileCount++ : 0;
+    return true;
+}
+
+// Checkpoint journal (--journal, --resume)
+//
+// One text line per file whose report has been written, in output order:
+//   <output offset after the report> TAB <size> TAB <mtime> TAB <path> LF
+// The first line after the magic has an empty path: the output offset where
+// the first run started.
+// Records are gathered in memory by the writer of the reports and written out
+// every JOURNAL_SYNC_RECORDS records or JOURNAL_SYNC_NS, after stdout has been
+// flushed and synced: the journal never runs ahead of the output (nor of the
+// --catalog/--bank-index/--similar files, which are written after the batch:
+// with those the records wait for the end of the batch). --resume
+// cuts the output (if it is a file) back to the last recorded offset, so the
+// reports written after the last sync are written again, not twice, and skips
+// the recorded files whose size and mtime are unchanged.
+
+#define JOURNAL_MAGIC        "# nesinfo journal 1\n"
+#define JOURNAL_SYNC_RECORDS 4096
+#define JOURNAL_SYNC_NS      1000000000ull
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime;
+} FileIdentity;
+
+typedef struct {
+    const char* path;
+    FileIdentity id;
+    size_t line;            // Later lines win
+} JournalEntry;
+
+typedef struct {
+    bool isOpen;
+    int fd;
+    char* buf;              // Records not written yet
+    size_t size;
+    size_t cap;
+    size_t pending;         // Records in buf
+    uint64_t lastSync;
+    uint64_t outOffset;     // End of the output so far
+    bool isOutFile;         // stdout is a regular file
+    bool isHeld;            // Records wait for the indexes written after the batch
+    bool isFailed;          // Out of memory while held: no more records, --resume redoes the rest
+    const JobList* jobs;    // Current batch
+    FileIdentity* ids;      // Per job, taken by its worker before processing
+    JournalEntry* done;     // --resume: files already reported, by path
+    size_t doneCount;
+    char* doneData;         // The journal as read
+} Journal;
+
+static Journal g_journal = {0};
+
+bool GetFileIdentity(const char* path, FileIdentity* id)
+{
+#ifdef NESINFO_JOURNAL
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+    id->size = (uint64_t)st.st_size;
+    id->mtime = (int64_t)st.st_mtime;
+    return true;
+#else
+    (void)path;
+    memset(id, 0, sizeof(*id));
+    return false;
+#endif
+}
+
+static int CompareJournalPaths(const void* a, const void* b)
+{
+    return strcmp(((const JournalEntry*)a)->path, ((const JournalEntry*)b)->path);
+}
+
+static int CompareJournalEntries(const void* a, const void* b)
+{
+    int c = CompareJournalPaths(a, b);
+    if (c != 0) {
+        return c;
+    }
+    size_t x = ((const JournalEntry*)a)->line;
+    size_t y = ((const JournalEntry*)b)->line;
+    return (x > y) - (x < y);
+}
+
+#ifdef NESINFO_JOURNAL
+// A decimal number followed by a tab; returns what follows the tab, or NULL
+static char* ParseJournalNumber(char* p, bool is_signed, uint64_t* value)
+{
+    bool is_negative = is_signed && *p == '-';
+    p += is_negative;
+    if (*p < '0' || *p > '9') {
+        return NULL;
+    }
+    char* end;
+    errno = 0;
+    unsigned long long v = strtoull(p, &end, 10);
+    if (errno != 0 || *end != '\t') {
+        return NULL;
+    }
+    *value = is_negative ? 0 - (uint64_t)v : (uint64_t)v;
+    return end + 1;
+}
+
+// Reads the complete records of the journal; *end is where the last one ends
+// (0 if there is none), *out_offset its output offset
+static bool ReadJournal(Journal* j, const char* path, size_t* end, uint64_t* out_offset)
+{
+    *end = 0;
+    *out_offset = 0;
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return errno == ENOENT;
+    }
+    long size = GetFILESize(fp);
+    char* data = size >= 0 ? (char*)malloc((size_t)size + 1) : NULL;
+    bool ok = data != NULL && fread(data, 1, (size_t)size, fp) == (size_t)size;
+    fclose(fp);
+    if (!ok) {
+        free(data);
+        return false;
+    }
+    data[size] = '\0';
+    j->doneData = data;
+    if ((size_t)size < strlen(JOURNAL_MAGIC) || memcmp(data, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC)) != 0) {
+        return size == 0;
+    }
+
+    size_t lines = 0;
+    for (long i = 0; i < size; i++) {
+        lines += data[i] == '\n';
+    }
+    j->done = (JournalEntry*)malloc((lines ? lines : 1) * sizeof(JournalEntry));
+    if (j->done == NULL) {
+        return false;
+    }
+    size_t pos = strlen(JOURNAL_MAGIC);
+    while (pos < (size_t)size) {
+        char* line = data + pos;
+        char* lf = strchr(line, '\n');
+        if (lf == NULL) {
+            break;      // Cut short by the crash
+        }
+        *lf = '\0';
+        // The path is the rest of the line, as is: it may start with blanks
+        uint64_t offset, file_size, mtime;
+        char* p = ParseJournalNumber(line, false, &offset);
+        p = p != NULL ? ParseJournalNumber(p, false, &file_size) : NULL;
+        p = p != NULL ? ParseJournalNumber(p, true, &mtime) : NULL;
+        if (p == NULL) {
+            break;
+        }
+        if (*p != '\0') {
+            JournalEntry* e = &j->done[j->doneCount];
+            e->path = p;
+            e->id.size = file_size;
+            e->id.mtime = (int64_t)mtime;
+            e->line = j->doneCount++;
+        }
+        *out_offset = offset;
+        pos = (size_t)(lf - data) + 1;
+        *end = pos;
+    }
+    // One entry per path, the last line of it
+    qsort(j->done, j->doneCount, sizeof(JournalEntry), CompareJournalEntries);
+    size_t n = 0;
+    for (size_t i = 0; i < j->doneCount; i++) {
+        if (n != 0 && strcmp(j->done[n - 1].path, j->done[i].path) == 0) {
+            n--;
+        }
+        j->done[n++] = j->done[i];
+    }
+    j->doneCount = n;
+    return true;
+}
+#endif
+
+// Opens the journal before the first report; with is_resume the recorded
+// files are loaded and the output is cut back to the last record
+bool OpenJournal(const char* path, bool is_resume)
+{
+#ifdef NESINFO_JOURNAL
+    Journal* j = &g_journal;
+    fflush(stdout);
+    size_t end = 0;
+    uint64_t out_offset = 0;
+    if (is_resume && !ReadJournal(j, path, &end, &out_offset)) {
+        fprintf(stderr, "Error: can't read journal: %s\n", path);
+        return false;
+    }
+    j->fd = open(path, O_WRONLY | O_CREAT | (is_resume ? 0 : O_TRUNC), 0644);
+    if (j->fd == -1) {
+        fprintf(stderr, "Error: can't open journal: %s\n", path);
+        return false;
+    }
+    j->isOpen = true;
+    struct stat st;
+    j->isOutFile = fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode);
+    j->outOffset = j->isOutFile ? (uint64_t)st.st_size : 0;
+    if (end == 0) {
+        char start[128];
+        int len = snprintf(start, sizeof(start), JOURNAL_MAGIC "%" PRIu64 "\t0\t0\t\n", j->outOffset);
+        bool ok = ftruncate(j->fd, 0) == 0 && write(j->fd, start, (size_t)len) == (ssize_t)len
+            && fsync(j->fd) == 0;
+        if (!ok) {
+            fprintf(stderr, "Error: can't write journal: %s\n", path);
+            return false;
+        }
+    }
+    else {
+        // Drops a record cut short, then appends after the last complete one
+        if (ftruncate(j->fd, (off_t)end) != 0 || lseek(j->fd, (off_t)end, SEEK_SET) == -1) {
+            fprintf(stderr, "Error: can't write journal: %s\n", path);
+            return false;
+        }
+        if (j->isOutFile && j->outOffset >= out_offset) {
+            if (ftruncate(STDOUT_FILENO, (off_t)out_offset) != 0
+                || lseek(STDOUT_FILENO, (off_t)out_offset, SEEK_SET) == -1
+            ) {
+                fprintf(stderr, "Warning: --resume: can't cut the output back to %" PRIu64 " B\n", out_offset);
+            }
+            else {
+                j->outOffset = out_offset;
+            }
+        }
+        else if (j->isOutFile) {
+            fprintf(stderr, "Warning: --resume: the output is shorter than the journal says, left as is\n");
+        }
+    }
+    j->lastSync = StatsNow();
+    return true;
+#else
+    (void)is_resume;
+    fprintf(stderr, "Error: --journal needs a POSIX system: %s\n", path);
+    return false;
+#endif
+}
+
+static void WriteJournal(Journal* j, const char* data, size_t size)
+{
+#ifdef NESINFO_JOURNAL
+    size_t pos = 0;
+    while (pos < size) {
+        ssize_t n = write(j->fd, data + pos, size - pos);
+        if (n <= 0) {
+            fprintf(stderr, "Warning: can't write journal: %s\n", strerror(errno));
+            break;
+        }
+        pos += (size_t)n;
+    }
+#else
+    (void)j;
+    (void)data;
+    (void)size;
+#endif
+}
+
+// Output first, then the records that describe it
+static void SyncJournal(Journal* j)
+{
+#ifdef NESINFO_JOURNAL
+    fflush(stdout);
+    if (j->isOutFile) {
+        fsync(STDOUT_FILENO);
+    }
+    WriteJournal(j, j->buf, j->size);
+    fsync(j->fd);
+#endif
+    j->size = 0;
+    j->pending = 0;
+    j->lastSync = StatsNow();
+}
+
+// Output offsets are taken from the file again: other reports (--summary, ...)
+// may have been written since the last batch
+bool BeginJournalBatch(const JobList* jobs)
+{
+    Journal* j = &g_journal;
+    j->jobs = jobs;
+    j->isHeld = g_opt.bankIndex != NULL || g_opt.similar != NULL || g_opt.catalog != NULL;
+    j->ids = (FileIdentity*)calloc(jobs->count ? jobs->count : 1, sizeof(FileIdentity));
+    if (j->ids == NULL) {
+        return false;
+    }
+#ifdef NESINFO_JOURNAL
+    struct stat st;
+    fflush(stdout);
+    if (j->isOutFile && fstat(STDOUT_FILENO, &st) == 0) {
+        j->outOffset = (uint64_t)st.st_size;
+    }
+#endif
+    return true;
+}
+
+// false if records were lost. Held records go out only if is_indexed (the
+// indexes were written); otherwise --resume must scan their files again.
+bool EndJournalBatch(bool is_indexed)
+{
+    Journal* j = &g_journal;
+    if (j->isHeld && !is_indexed && j->pending != 0) {
+        fprintf(stderr, "Warning: indexes not updated, the batch isn't journaled: %s\n", g_opt.journal);
+        j->size = 0;
+        j->pending = 0;
+    }
+    SyncJournal(j);
+    free(j->ids);
+    j->ids = NULL;
+    j->jobs = NULL;
+    bool ok = !j->isFailed;
+    j->isFailed = false;
+    return ok;
+}
+
+// Called by the writer of the reports right after the one of job. A failed
+// job gets no record, so --resume tries it again.
+static void AddJournalRecord(Journal* j, size_t job, size_t out_size, bool ok)
+{
+    j->outOffset += out_size;
+    if (j->isFailed || !ok) {
+        return;
+    }
+    const Job* jb = &j->jobs->items[job];
+    const char* member = jb->archive != NULL ? jb->archive->members[jb->member].name : NULL;
+    const FileIdentity* id = &j->ids[job];
+    char head[80];
+    size_t head_len = (size_t)snprintf(head, sizeof(head), "%" PRIu64 "\t%" PRIu64 "\t%" PRId64 "\t",
+        j->outOffset, id->size, id->mtime);
+    size_t path_len = strlen(jb->path);
+    size_t member_len = member != NULL ? strlen(member) : 0;
+    size_t need = head_len + path_len + (member != NULL ? member_len + 1 : 0) + 1;
+    if (j->size + need > j->cap) {
+        size_t cap = j->cap ? j->cap : 65536;
+        while (cap < j->size + need) {
+            cap *= 2;
+        }
+        char* p = (char*)realloc(j->buf, cap);
+        if (p == NULL && j->isHeld) {
+            // Held records can't go out before the indexes: the journal ends
+            // at the last sync and --resume does the rest again
+            fprintf(stderr, "Error: realloc() - journal, no more records: %s\n", g_opt.journal);
+            j->isFailed = true;
+            return;
+        }
+        if (p == NULL) {
+            // The output of this record is written: sync and write it directly
+            SyncJournal(j);
+            WriteJournal(j, head, head_len);
+            WriteJournal(j, jb->path, path_len);
+            if (member != NULL) {
+                WriteJournal(j, "/", 1);
+                WriteJournal(j, member, member_len);
+            }
+            WriteJournal(j, "\n", 1);
+#ifdef NESINFO_JOURNAL
+            fsync(j->fd);
+#endif
+            return;
+        }
+        j->buf = p;
+        j->cap = cap;
+    }
+    char* dst = j->buf + j->size;
+    memcpy(dst, head, head_len);
+    dst += head_len;
+    memcpy(dst, jb->path, path_len);
+    dst += path_len;
+    if (member != NULL) {
+        *dst++ = '/';
+        memcpy(dst, member, member_len);
+        dst += member_len;
+    }
+    *dst++ = '\n';
+    j->size += need;
+    j->pending++;
+    if (!j->isHeld && (j->pending >= JOURNAL_SYNC_RECORDS || StatsNow() - j->lastSync >= JOURNAL_SYNC_NS)) {
+        SyncJournal(j);
+    }
+}
+
+// --resume: the file was reported by an earlier run and has not changed since
+bool IsJournaled(const char* path, const char* member, const FileIdentity* id)
+{
+    const Journal* j = &g_journal;
+    char member_path[4096];
+    if (member != NULL) {
+        snprintf(member_path, sizeof(member_path), "%s/%s", path, member);
+        path = member_path;
+    }
+    JournalEntry key = { path, { 0, 0 }, 0 };
+    const JournalEntry* e = (const JournalEntry*)bsearch(&key, j->done, j->doneCount, sizeof(JournalEntry),
+        CompareJournalPaths);
+    return e != NULL && e->id.size == id->size && e->id.mtime == id->mtime;
+}
+
+void CloseJournal(void)
+{
+    Journal* j = &g_journal;
+#ifdef NESINFO_JOURNAL
+    if (j->isOpen) {
+        SyncJournal(j);
+        close(j->fd);
+    }
+#endif
+    free(j->buf);
+    free(j->done);
+    free(j->doneData);
+    memset(j, 0, sizeof(*j));
+}
+
+// Sharding (--shard i/N)
+
+// Absolute, lexically normalized --shard-root and current directory: every
+// host hashes the paths relative to its own copy of the collection
+static char g_shardRoot[4096];
+static char g_shardCwd[4096];
+// Last component of g_shardRoot, kept in the catalogue; "" without --shard
+static char g_shardRootName[CATALOG_ROOT_SIZE];
+
+// path (relative to base unless absolute) as an absolute path without ".",
+// ".." or repeated slashes. Symbolic links are not followed: the same tree
+// may be mounted differently on each host.
+static bool NormalizePath(const char* base, const char* path, char* out, size_t size)
+{
+    size_t len = 0;
+    for (int part = path[0] == '/' ? 1 : 0; part < 2; part++) {
+        const char* p = part == 0 ? base : path;
+        while (*p != '\0') {
+            while (*p == '/') {
+                p++;
+            }
+            size_t n = strcspn(p, "/");
+            if (n == 0 || (n == 1 && p[0] == '.')) {
+                // Nothing to add
+            }
+            else if (n == 2 && p[0] == '.' && p[1] == '.') {
+                while (len > 0 && out[--len] != '/') {
+                }
+            }
+            else {
+                if (len + 1 + n + 1 > size) {
+                    return false;
+                }
+                out[len++] = '/';
+                memcpy(out + len, p, n);
+                len += n;
+            }
+            p += n;
+        }
+    }
+    if (len == 0) {
+        if (size < 2) {
+            return false;
+        }
+        out[len++] = '/';
+    }
+    out[len] = '\0';
+    return true;
+}
+
+// Absolute --shard-root, or the current directory
+bool InitShardRoot(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    if (getcwd(g_shardCwd, sizeof(g_shardCwd)) == NULL) {
+        fprintf(stderr, "Error: --shard: can't get the current directory\n");
+        return false;
+    }
+    const char* root = g_opt.shardRoot != NULL ? g_opt.shardRoot : ".";
+    if (!NormalizePath(g_shardCwd, root, g_shardRoot, sizeof(g_shardRoot))) {
+        fprintf(stderr, "Error: --shard-root is too long\n");
+        return false;
+    }
+    const char* name = strcmp(g_shardRoot, "/") == 0 ? g_shardRoot : strrchr(g_shardRoot, '/') + 1;
+    size_t len = strlen(name) < sizeof(g_shardRootName) ? strlen(name) : sizeof(g_shardRootName) - 1;
+    memcpy(g_shardRootName, name, len);
+    g_shardRootName[len] = '\0';
+    return true;
+#else
+    // NormalizePath() knows only '/' paths: no drive letters or '\\'
+    fprintf(stderr, "Error: --shard isn't supported on this platform\n");
+    return false;
+#endif
+}
+
+// path relative to the shard root into buf, or NULL if it's outside of it
+const char* GetShardName(const char* path, char* buf, size_t size)
+{
+    char full[4096];
+    if (!NormalizePath(g_shardCwd, path, full, sizeof(full))) {
+        return NULL;
+    }
+    size_t root_len = strcmp(g_shardRoot, "/") == 0 ? 0 : strlen(g_shardRoot);
+    if (strncmp(full, g_shardRoot, root_len) != 0 || full[root_len] != '/' || full[root_len + 1] == '\0') {
+        return NULL;
+    }
+    snprintf(buf, size, "%s", full + root_len + 1);
+    return buf;
+}
+
+// Shard 1..shard_count of a file: XXH64 of its path relative to the shard
+// root (GetShardName), so every host computes the same split whatever its
+// mount point. An archive member goes with its archive: only the path up to
+// "x.zip" counts.
+uint32_t GetPathShard(const char* path, uint32_t shard_count)
+{
+    size_t len = strlen(path);
+    char prefix[4096];
+    for (size_t i = 0; i < len && i < sizeof(prefix); i++) {
+        if (path[i] == '/') {
+            memcpy(prefix, path, i);
+            prefix[i] = '\0';
+            if (GetArchiveType(prefix) != ARCHIVE_NONE) {
+                len = i;
+                break;
+            }
+        }
+    }
+    return (uint32_t)(XXH64(path, len, 0) % shard_count) + 1;
+}
+
+// "shard i/N", or "all files" for 0/0
+const char* FormatShard(uint32_t index, uint32_t count, char* buf, size_t size)
+{
+    if (count == 0) {
+        return "all files";
+    }
+    snprintf(buf, size, "shard %u/%u", index, count);
+    return buf;
+}
+
+// "i/N" with 1 <= i <= N
+bool ParseShard(const char* str)
+{
+    char* end;
+    unsigned long index = strtoul(str, &end, 10);
+    if (end == str || *end != '/') {
+        return false;
+    }
+    const char* count_str = end + 1;
+    unsigned long count = strtoul(count_str, &end, 10);
+    if (end == count_str || *end != '\0' || count < 1 || count > 65536 || index < 1 || index > count) {
+        return false;
+    }
+    g_opt.shardIndex = (uint32_t)index;
+    g_opt.shardCount = (uint32_t)count;
+    return true;
+}
+
+// Archives are expanded into one job per member; only their directories are read here
+bool BuildJobList(JobList* jobs, const FileList* files)
+{
+    jobs->archives = (ArchiveIndex*)calloc(files->count, sizeof(ArchiveIndex));
+    if (jobs->archives == NULL) {
+        return false;
+    }
+    if (g_opt.shardCount != 0) {
+        jobs->names = (char**)calloc(files->count, sizeof(char*));
+        if (jobs->names == NULL) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < files->count; i++) {
+        const char* path = files->paths[i];
+        const char* name = path;
+        if (g_opt.shardCount != 0) {
+            char buf[4096];
+            if (GetShardName(path, buf, sizeof(buf)) == NULL) {
+                fprintf(stderr, "Error: --shard: not under the shard root %s: %s\n", g_shardRoot, path);
+                jobs->hasErrors = true;
+                continue;
+            }
+            if (GetPathShard(buf, g_opt.shardCount) != g_opt.shardIndex) {
+                continue;
+            }
+            size_t len = strlen(buf) + 1;
+            char* copy = (char*)malloc(len);
+            if (copy == NULL) {
+                return false;
+            }
+            memcpy(copy, buf, len);
+            jobs->names[jobs->nameCount++] = copy;
+            name = copy;
+        }
+        size_t first_job = jobs->count;
+        FileIdentity id;
+        bool is_resumed = g_journal.doneCount != 0 && GetFileIdentity(path, &id);
+        ArchiveType type = GetArchiveType(path);
+        if (type == ARCHIVE_NONE) {
+            if (is_resumed && IsJournaled(path, NULL, &id)) {
+                jobs->resumed++;
+            }
+            else if (!AddJob(jobs, path, NULL, 0)) {
+                return false;
+            }
+            else {
+                jobs->items[jobs->count - 1].name = name;
+            }
+            continue;
+        }
+
+        ArchiveIndex* archive = &jobs->archives[jobs->archiveCount];
+        FILE* fp = OpenROMFile(path);
+        if (fp == NULL) {
+            fprintf(stderr, "Can't open: %s\n", path);
+            jobs->hasErrors = true;
+            continue;
+        }
+        bool ok = ReadArchiveIndex(fp, type, archive);
+        fclose(fp);
+        if (!ok) {
+            fprintf(stderr, "Error: can't read archive: %s\n", path);
+            jobs->hasErrors = true;
+            continue;
+        }
+        jobs->archiveCount++;
+        for (size_t m = 0; m < archive->count; m++) {
+            if (is_resumed && IsJournaled(path, archive->members[m].name, &id)) {
+                jobs->resumed++;
+            }
+            else if (!AddJob(jobs, path, archive, m)) {
+                return false;
+            }
+        }
+        for (size_t j = first_job; j < jobs->count; j++) {
+            jobs->items[j].name = name;
+        }
+    }
+    return true;
+}
+
+void FreeJobList(JobList* jobs)
+{
+    for (size_t i = 0; i < jobs->archiveCount; i++) {
+        FreeArchiveIndex(&jobs->archives[i]);
+    }
+    for (size_t i = 0; i < jobs->nameCount; i++) {
+        free(jobs->names[i]);
+    }
+    free(jobs->names);
+    free(jobs->archives);
+    free(jobs->items);
+    memset(jobs, 0, sizeof(*jobs));
+}
+
+struct Worker;
+
+#ifdef NESINFO_THREADS
+// Reorder buffer between the workers and stdout, so parallel runs print in
+// input order. The report of job i is published in slot i % count; whichever
+// worker then finds the head slot filled becomes the writer and writes the run
+// of consecutive reports. A worker whose slot is still taken waits: while a
+// slow file holds the head, at most count reports are held.
+#define REORDER_SLOTS_PER_WORKER 4
+#define REORDER_EMPTY SIZE_MAX
+
+typedef struct {
+    _Atomic size_t job;     // Job whose report is in out, REORDER_EMPTY if none
+    OutBuf out;
+    bool ok;                // The job succeeded
+} ReorderSlot;
+
+typedef struct {
+    ReorderSlot* slots;
+    size_t count;
+    _Atomic size_t head;    // Next job to write
+    _Atomic bool isWriting;
+    _Atomic int waiters;    // Workers waiting for their slot
+    pthread_mutex_t lock;
+    pthread_cond_t isFree;
+} ReorderBuffer;
+
+bool InitReorderBuffer(ReorderBuffer* rb, size_t workers)
+{
+    rb->count = workers * REORDER_SLOTS_PER_WORKER;
+    rb->slots = (ReorderSlot*)calloc(rb->count, sizeof(ReorderSlot));
+    if (rb->slots == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < rb->count; i++) {
+        rb->slots[i].job = REORDER_EMPTY;
+    }
+    rb->head = 0;
+    rb->isWriting = false;
+    rb->waiters = 0;
+    pthread_mutex_init(&rb->lock, NULL);
+    pthread_cond_init(&rb->isFree, NULL);
+    return true;
+}
+
+void FreeReorderBuffer(ReorderBuffer* rb)
+{
+    for (size_t i = 0; i < rb->count; i++) {
+        free(rb->slots[i].out.data);
+    }
+    free(rb->slots);
+    pthread_mutex_destroy(&rb->lock);
+    pthread_cond_destroy(&rb->isFree);
+}
+
+// Writes the filled slots from the head on unless another worker is at it;
+// returns the output time
+static uint64_t DrainReorderBuffer(ReorderBuffer* rb)
+{
+    StatsMark t = StatsStart();
+    uint64_t out_start = t.ns;
+    while (!atomic_exchange(&rb->isWriting, true)) {
+        size_t head = rb->head;
+        ReorderSlot* slot = &rb->slots[head % rb->count];
+        bool is_written = false;
+        while (slot->job == head) {
+            PROBE_OUTPUT_FLUSH(slot->out.size);
+            WriteOut(slot->out.data, slot->out.size);
+            StatsLap(PHASE_OUTPUT, &t, slot->out.size);
+            if (g_journal.isOpen) {
+                AddJournalRecord(&g_journal, head, slot->out.size, slot->ok);
+                StatsLap(PHASE_JOURNAL, &t, 0);
+            }
+            slot->out.size = 0;
+            slot->job = REORDER_EMPTY;
+            rb->head = ++head;
+            slot = &rb->slots[head % rb->count];
+            is_written = true;
+        }
+        if (is_written && rb->waiters != 0) {
+            pthread_mutex_lock(&rb->lock);
+            pthread_cond_broadcast(&rb->isFree);
+            pthread_mutex_unlock(&rb->lock);
+        }
+        rb->isWriting = false;
+        // A report published after the check above found the writer still
+        // busy; whoever sees it first takes over
+        if (slot->job != head) {
+            break;
+        }
+    }
+    return t.ns - out_start;
+}
+
+// Hands the report over to the slot of job (the buffers are swapped, not
+// copied) and writes whatever is ready; returns the output time
+static uint64_t PublishReport(ReorderBuffer* rb, size_t job, OutBuf* out, bool ok)
+{
+    // Waiting for the slot is idle time, not busy time
+    if (job >= rb->head + rb->count) {
+        rb->waiters++;
+        pthread_mutex_lock(&rb->lock);
+        while (job >= rb->head + rb->count) {
+            pthread_cond_wait(&rb->isFree, &rb->lock);
+        }
+        pthread_mutex_unlock(&rb->lock);
+        rb->waiters--;
+    }
+    ReorderSlot* slot = &rb->slots[job % rb->count];
+    OutBuf tmp = slot->out;
+    slot->out = *out;
+    *out = tmp;
+    slot->ok = ok;
+    slot->job = job;
+    return DrainReorderBuffer(rb);
+}
+#endif
+
+// Writes the report of job right away (--jobs=1, --unordered); returns the output time
+static uint64_t WriteReport(size_t job, OutBuf* out, bool ok)
+{
+    // Waiting for the lock is idle time, not busy time
+#ifdef NESINFO_THREADS
+    pthread_mutex_lock(&g_outLock);
+#endif
+    StatsMark t = StatsStart();
+    uint64_t out_start = t.ns;
+    PROBE_OUTPUT_FLUSH(out->size);
+    WriteOut(out->data, out->size);
+    StatsLap(PHASE_OUTPUT, &t, out->size);
+    if (g_journal.isOpen) {
+        AddJournalRecord(&g_journal, job, out->size, ok);
+        StatsLap(PHASE_JOURNAL, &t, 0);
+    }
+#ifdef NESINFO_THREADS
+    pthread_mutex_unlock(&g_outLock);
+#endif
+    return t.ns - out_start;
+}
+
+typedef struct {
+    const JobList* jobs;
+    IOEngine* io;           // NULL: workers read plain files themselves
+#ifdef NESINFO_THREADS
+    ReorderBuffer* reorder; // NULL: reports are written as the jobs complete
+#endif
+    bool isPathShown;
+    _Atomic size_t next;
+    _Atomic int result;
+} Batch;
+
+// Per-worker state, reused across jobs (and batches, in a kept WorkerPool)
+typedef struct Worker {
+    Batch* batch;
+    struct WorkerPool* owner;
+    OutBuf out;
+    FILE* archiveFp;
+    const char* archivePath;
+    Stats stats;
+    PerfGroup perf;
+    BufferPool pool;
+    Summary summary;
+    BankList banks;
+    SketchList sketches;
+    CatalogList catalog;
+} Worker;
+
+void RunJob(Worker* w, const Job* job)
+{
+    uint64_t job_start = t_stats != NULL ? StatsNow() : 0;
+    char member_path[4096];
+    const char* path = job->path;
+    const ArchiveMember* member = NULL;
+    if (job->archive != NULL) {
+        member = &job->archive->members[job->member];
+        snprintf(member_path, sizeof(member_path), "%s/%s", job->path, member->name);
+        path = member_path;
+    }
+
+    size_t job_index = (size_t)(job - w->batch->jobs->items);
+    PROBE_FILE_START(path);
+    if (g_journal.isOpen) {
+        // Before the file is read: a change while it is processed shows on --resume
+        StatsMark t = StatsStart();
+        GetFileIdentity(job->path, &g_journal.ids[job_index]);
+        StatsLap(PHASE_JOURNAL, &t, 0);
+    }
+    if (t_banks != NULL) {
+        BeginBankFile(t_banks, path, job_index);
+    }
+    if (t_sketches != NULL) {
+        BeginSketchFile(t_sketches, path, job_index);
+    }
+    if (t_catalog != NULL) {
+        char name[4096];
+        if (member != NULL) {
+            snprintf(name, sizeof(name), "%s/%s", job->name, member->name);
+        }
+        BeginCatalogFile(t_catalog, member != NULL ? name : job->name, job_index);
+    }
+    w->out.size = 0;
+    t_out = &w->out;
+    t_isFilteredOut = false;
+    if (w->batch->isPathShown && !g_opt.summaryOnly) {
+        Print(path);
+        Print("\n");
+    }
+
+    bool ok;
+    if (member == NULL && w->batch->io != NULL) {
+        ok = ProcessBufferedFile(w->batch->io, job->fileIndex, path);
+    }
+    else if (member == NULL) {
+        ok = ProcessFile(path);
+    }
+    else {
+        // Members of one archive share a handle
+        if (w->archivePath != job->path) {
+            StatsMark t = StatsStart();
+            if (w->archiveFp != NULL) {
+                fclose(w->archiveFp);
+            }
+            w->archiveFp = OpenROMFile(job->path);
+            w->archivePath = job->path;
+            StatsLap(PHASE_OPEN, &t, 0);
+        }
+        if (w->archiveFp == NULL) {
+            fprintf(stderr, "Can't open: %s\n", job->path);
+            ok = false;
+        }
+        else {
+            ok = ProcessArchiveMember(w->archiveFp, job->archive, member, path);
+        }
+    }
+
+    if (w->batch->isPathShown) {
+        Print("\n\n");
+    }
+    t_out = NULL;
+    if (g_opt.summaryOnly || t_isFilteredOut) {
+        // Reports are still built: the nes20db.xml hits come from them.
+        // A file rejected by --filter has only its path line to drop.
+        w->out.size = 0;
+    }
+    if (!ok && t_summary != NULL) {
+        t_summary->errors++;
+    }
+    if (t_isFilteredOut && t_summary != NULL) {
+        t_summary->filteredOut++;
+    }
+    // A rejected file is left out of the indexes like a failed one
+    bool is_kept = ok && !t_isFilteredOut;
+    if (t_banks != NULL) {
+        EndBankFile(t_banks, is_kept);
+    }
+    if (t_sketches != NULL) {
+        EndSketchFile(t_sketches, is_kept);
+    }
+    if (t_catalog != NULL) {
+        EndCatalogFile(t_catalog, is_kept);
+    }
+    uint64_t job_ns = t_stats != NULL ? StatsNow() - job_start : 0;
+
+    uint64_t out_ns;
+#ifdef NESINFO_THREADS
+    if (w->batch->reorder != NULL) {
+        out_ns = PublishReport(w->batch->reorder, job_index, &w->out, ok);
+    }
+    else {
+        out_ns = WriteReport(job_index, &w->out, ok);
+    }
+#else
+    out_ns = WriteReport(job_index, &w->out, ok);
+#endif
+    if (!ok) {
+        w->batch->result = 1;
+    }
+    PROBE_FILE_END(path, ok);
+
+    if (t_stats != NULL) {
+        AddStatsFile(t_stats, job_ns + out_ns);
+    }
+}
+
+// Per thread, for as long as its pool lives
+static void StartWorker(Worker* w, bool is_first)
+{
+    PoolInit(&w->pool, g_opt.hugePages);
+    t_pool = &w->pool;
+    if (g_opt.perfCounters) {
+        const char* error = NULL;
+        if (OpenPerfGroup(&w->perf, &error)) {
+            t_perf = &w->perf;
+        }
+        else if (is_first) {
+            fprintf(stderr, "Warning: --perf-counters: perf_event_open(): %s\n", error);
+        }
+    }
+}
+
+static void StopWorker(Worker* w)
+{
+    free(w->out.data);
+    w->out.data = NULL;
+    PoolDestroy(&w->pool);
+    t_pool = NULL;
+    if (t_perf != NULL) {
+        ClosePerfGroup(t_perf);
+        t_perf = NULL;
+    }
+}
+
+// Takes jobs of w->batch until there are none left
+static void RunWorkerJobs(Worker* w)
+{
+    t_stats = g_opt.stats ? &w->stats : NULL;
+    t_summary = g_opt.summary ? &w->summary : NULL;
+    t_banks = g_opt.bankIndex != NULL ? &w->banks : NULL;
+    t_sketches = g_opt.similar != NULL ? &w->sketches : NULL;
+    t_catalog = g_opt.catalog != NULL ? &w->catalog : NULL;
+    for (;;) {
+        size_t i = w->batch->next++;
+        if (i >= w->batch->jobs->count) {
+            break;
+        }
+        RunJob(w, &w->batch->jobs->items[i]);
+    }
+    if (w->archiveFp != NULL) {
+        fclose(w->archiveFp);
+        w->archiveFp = NULL;
+        w->archivePath = NULL;
+    }
+    t_summary = NULL;
+    t_banks = NULL;
+    t_sketches = NULL;
+    t_catalog = NULL;
+    t_stats = NULL;
+}
+
+// Workers for RunBatch(). workers[0] is the calling thread; the others wait
+// for the next batch, so --watch doesn't start threads for every one.
+typedef struct WorkerPool {
+    Worker* workers;
+    size_t count;
+#ifdef NESINFO_THREADS
+    pthread_t* threads;     // [1..count)
+    pthread_mutex_t lock;
+    pthread_cond_t isReady; // A new batch, or stop
+    pthread_cond_t isDone;  // A thread is through with its batch
+    uint64_t generation;    // Batches handed out
+    size_t running;         // Threads still in the current batch
+    bool stop;
+#endif
+} WorkerPool;
+
+#ifdef NESINFO_THREADS
+void* WorkerMain(void* arg)
+{
+    Worker* w = (Worker*)arg;
+    WorkerPool* pool = w->owner;
+    StartWorker(w, false);
+    uint64_t generation = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->generation == generation) {
+            pthread_cond_wait(&pool->isReady, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        RunWorkerJobs(w);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->isDone);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    StopWorker(w);
+    return NULL;
+}
+#endif
+
+// count workers, fewer if threads can't be started
+bool InitWorkerPool(WorkerPool* pool, size_t count)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->workers = (Worker*)calloc(count, sizeof(Worker));
+    if (pool->workers == NULL) {
+        return false;
+    }
+    pool->count = 1;
+    pool->workers[0].owner = pool;
+    StartWorker(&pool->workers[0], true);
+#ifdef NESINFO_THREADS
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->isReady, NULL);
+    pthread_cond_init(&pool->isDone, NULL);
+    pool->threads = count > 1 ? (pthread_t*)calloc(count, sizeof(pthread_t)) : NULL;
+    for (; pool->threads != NULL && pool->count < count; pool->count++) {
+        Worker* w = &pool->workers[pool->count];
+        w->owner = pool;
+        if (pthread_create(&pool->threads[pool->count], NULL, WorkerMain, w) != 0) {
+            break;
+        }
+    }
+#endif
+    return true;
+}
+
+void FreeWorkerPool(WorkerPool* pool)
+{
+#ifdef NESINFO_THREADS
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->isReady);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 1; i < pool->count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->isReady);
+    pthread_cond_destroy(&pool->isDone);
+#endif
+    StopWorker(&pool->workers[0]);
+    free(pool->workers);
+    memset(pool, 0, sizeof(*pool));
+}
+
+// Runs batch on every worker of the pool and returns when all are through
+static void RunPoolBatch(WorkerPool* pool, Batch* batch)
+{
+    for (size_t i = 0; i < pool->count; i++) {
+        pool->workers[i].batch = batch;
+    }
+#ifdef NESINFO_THREADS
+    pthread_mutex_lock(&pool->lock);
+    pool->running = pool->count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->isReady);
+    pthread_mutex_unlock(&pool->lock);
+#endif
+    RunWorkerJobs(&pool->workers[0]);
+#ifdef NESINFO_THREADS
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running != 0) {
+        pthread_cond_wait(&pool->isDone, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+// Goes to stderr, so the reports on stdout stay unchanged
+void PrintStats(const Worker* workers, size_t count, uint64_t wall_ns)
+{
+    Stats total = {0};
+    size_t file_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        const Stats* st = &workers[i].stats;
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            total.ns[p] += st->ns[p];
+            total.bytes[p] += st->bytes[p];
+            for (int c = 0; c < PERF_COUNT; c++) {
+                total.counters[p][c] += st->counters[p][c];
+            }
+        }
+        total.busyNs += st->busyNs;
+        file_count += st->fileCount;
+    }
+    uint64_t* file_ns = (uint64_t*)malloc((file_count ? file_count : 1) * sizeof(uint64_t));
+    if (file_ns == NULL) {
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(file_ns + n, workers[i].stats.fileNs, workers[i].stats.fileCount * sizeof(uint64_t));
+        n += workers[i].stats.fileCount;
+    }
+    qsort(file_ns, n, sizeof(uint64_t), CompareNs);
+
+    fprintf(stderr, "\n--stats: %" PRIuPTR " files, %u thread(s), %.3f s wall\n",
+        n, (unsigned)count, wall_ns / 1e9);
+    fprintf(stderr, "phase        total ms   share       MB     MB/s\n");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        double ms = total.ns[p] / 1e6;
+        double share = total.busyNs ? 100.0 * total.ns[p] / total.busyNs : 0.0;
+        fprintf(stderr, "%-10s %10.3f %6.1f%%", PhaseNames[p], ms, share);
+        if (total.bytes[p] != 0) {
+            double mb = total.bytes[p] / 1048576.0;
+            fprintf(stderr, " %8.1f %8.1f", mb, total.ns[p] ? mb / (total.ns[p] / 1e9) : 0.0);
+        }
+        fprintf(stderr, "\n");
+    }
+    if (n != 0) {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += file_ns[i];
+        }
+        size_t p99 = (n * 99 + 99) / 100;
+        fprintf(stderr, "per file: mean %.3f ms, p50 %.3f ms, p99 %.3f ms\n",
+            sum / 1e6 / n, file_ns[(n - 1) / 2] / 1e6, file_ns[(p99 ? p99 : 1) - 1] / 1e6);
+    }
+    free(file_ns);
+
+    bool has_counters = false;
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        has_counters |= total.counters[p][PERF_CYCLES] != 0;
+    }
+    if (has_counters) {
+        fprintf(stderr, "phase        Mcycles     Minstr    IPC cycles/B  LLC-miss   br-miss\n");
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            const uint64_t* c = total.counters[p];
+            if (c[PERF_CYCLES] == 0) {
+                continue;
+            }
+            fprintf(stderr, "%-10s %10.3f %10.3f %6.2f", PhaseNames[p], c[PERF_CYCLES] / 1e6,
+                c[PERF_INSTRUCTIONS] / 1e6, (double)c[PERF_INSTRUCTIONS] / c[PERF_CYCLES]);
+            if (total.bytes[p] != 0) {
+                fprintf(stderr, " %8.3f", (double)c[PERF_CYCLES] / total.bytes[p]);
+            }
+            else {
+                fprintf(stderr, " %8s", "-");
+            }
+            fprintf(stderr, " %9" PRIu64 " %9" PRIu64 "\n", c[PERF_LLC_MISSES], c[PERF_BRANCH_MISSES]);
+        }
+    }
+
+    // Idle = not inside a job: waiting for work, for the output lock, or for the other threads
+    if (count > 1) {
+        fprintf(stderr, "thread  files    busy ms    idle ms    read ms    hash ms  output ms\n");
+        for (size_t i = 0; i < count; i++) {
+            const Stats* st = &workers[i].stats;
+            uint64_t hash_ns = st->ns[PHASE_CRC32] + st->ns[PHASE_MD5] + st->ns[PHASE_SHA1] + st->ns[PHASE_SUM16]
+                + st->ns[PHASE_BANKS];
+            uint64_t idle_ns = wall_ns > st->busyNs ? wall_ns - st->busyNs : 0;
+            fprintf(stderr, "%6u %6" PRIuPTR " %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+                (unsigned)i, st->fileCount, st->busyNs / 1e6, idle_ns / 1e6,
+                (st->ns[PHASE_OPEN] + st->ns[PHASE_READ]) / 1e6, hash_ns / 1e6, st->ns[PHASE_OUTPUT] / 1e6);
+        }
+    }
+
+    PoolStats pool = {0};
+    for (size_t i = 0; i < count; i++) {
+        const PoolStats* ps = &workers[i].pool.stats;
+        pool.allocs += ps->allocs;
+        pool.hits += ps->hits;
+        pool.peakBytes += ps->peakBytes;
+        pool.hugeBlocks += ps->hugeBlocks;
+        pool.oversize += ps->oversize;
+    }
+    fprintf(stderr, "buffer pool: %" PRIu64 " allocs, %" PRIu64 " reused (%.1f%%), peak %" PRIu64 " KiB, "
+        "%" PRIu64 " huge-page blocks, %" PRIu64 " oversize\n",
+        pool.allocs, pool.hits, pool.allocs ? 100.0 * pool.hits / pool.allocs : 0.0,
+        pool.peakBytes / 1024, pool.hugeBlocks, pool.oversize);
+    uint64_t rss = GetPeakRSS();
+    if (rss != 0) {
+        fprintf(stderr, "peak RSS: %" PRIu64 " KiB\n", rss);
+    }
+    else {
+        fprintf(stderr, "peak RSS: N/A\n");
+    }
+}
+
+static void PrintSummaryCount(const char* label, uint64_t count, uint64_t total)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "\n%-34s: %8" PRIu64 " (%5.1f%%)", label, count, total ? 100.0 * count / total : 0.0);
+    Print(buf);
+}
+
+void PrintSummary(const Summary* sm)
+{
+    char buf[256];
+    char label[128];
+
+    Print("-------------*-----------------------------------------");
+    Print("\n              Summary");
+    Print("\n-------------*-----------------------------------------");
+    snprintf(buf, sizeof(buf), "\nFiles        : %" PRIu64 " (iNES %" PRIu64 ", NES 2.0 %" PRIu64
+        ", headerless %" PRIu64 ", errors %" PRIu64 ")",
+        sm->files + sm->headerless, sm->files - sm->extended, sm->extended, sm->headerless, sm->errors);
+    Print(buf);
+    if (sm->filteredOut != 0) {
+        snprintf(buf, sizeof(buf), "\nFiltered out : %" PRIu64, sm->filteredOut);
+        Print(buf);
+    }
+    snprintf(buf, sizeof(buf), "\nTotal Size   : %" PRIu64 " KiB = %" PRIu64 " B", sm->bytes / 1024, sm->bytes);
+    Print(buf);
+    if (sm->dbFiles != 0) {
+        snprintf(buf, sizeof(buf), "\nnes20db.xml  : %" PRIu64 " of %" PRIu64 " files matched (%.1f%%)",
+            sm->dbHits, sm->dbFiles, 100.0 * sm->dbHits / sm->dbFiles);
+        Print(buf);
+    }
+
+    Print("\n-------------*-----------------------------------------");
+    Print("\nMapper");
+    for (int i = 0; i < SUMMARY_MAPPERS; i++) {
+        if (sm->mappers[i] != 0) {
+            snprintf(label, sizeof(label), "%4d = %s", i, i < MAPPER_COUNT ? MapperNames[i] : "");
+            PrintSummaryCount(label, sm->mappers[i], sm->files);
+        }
+    }
+
+    Print("\n-------------*-----------------------------------------");
+    Print("\nConsole Type");
+    for (int i = 0; i < SUMMARY_CONSOLES; i++) {
+        if (sm->consoles[i] != 0) {
+            if (i < 3) {
+                snprintf(label, sizeof(label), "%s (#%d)", ConsoleType1[i], i);
+            }
+            else {
+                snprintf(label, sizeof(label), "Ext. %s (#%d)", ConsoleType2[i - 3], i - 3);
+            }
+            PrintSummaryCount(label, sm->consoles[i], sm->files);
+        }
+    }
+
+    if (sm->extended != 0) {
+        Print("\n-------------*-----------------------------------------");
+        Print("\nExpansion (NES 2.0)");
+        for (int i = 0; i < SUMMARY_EXPANSIONS; i++) {
+            if (sm->expansions[i] != 0) {
+                const char* name = i <= EXPANSION_COUNT ? ExpansionDevices[i] : "Unknown";
+                snprintf(label, sizeof(label), "%s (#%d)", name, i);
+                PrintSummaryCount(label, sm->expansions[i], sm->extended);
+            }
+        }
+    }
+
+    if (sm->nintendoHeaders != 0) {
+        Print("\n-------------*-----------------------------------------");
+        snprintf(buf, sizeof(buf), "\nMaker's Code (%" PRIu64 " Nintendo headers)", sm->nintendoHeaders);
+        Print(buf);
+        for (int i = 0; i < 256; i++) {
+            if (sm->makers[i] != 0) {
+                snprintf(label, sizeof(label), "0x%02X = %s", i, MakerNames[i]);
+                PrintSummaryCount(label, sm->makers[i], sm->nintendoHeaders);
+            }
+        }
+    }
+    Print("\n");
+}
+
+#define BANK_PARTNER_MAX    64      // Larger groups (blank or filler banks) are counted, not listed
+#define BANK_PARTNER_SHOWN  3
+#define BANK_PARTNER_NEW    0x80000000u
+
+static const char* BankKindNames[BANK_KIND_COUNT] = { "PRG 8 KiB", "CHR 8 KiB", "CHR 1 KiB" };
+static const size_t BankKindSizes[BANK_KIND_COUNT] = { BANK_SIZE, BANK_SIZE, SMALL_BANK_SIZE };
+
+typedef struct {
+    size_t job;
+    size_t file;            // Position across all workers
+} BankFileRef;
+
+static int CompareBankFileRefs(const void* a, const void* b)
+{
+    size_t x = ((const BankFileRef*)a)->job;
+    size_t y = ((const BankFileRef*)b)->job;
+    return (x > y) - (x < y);
+}
+
+static int CompareU64Keys(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// old[k] is the first record of a kept old file among the records of one
+// fingerprint of this kind
+static bool IsSharingOldFile(const BankRecord* old, size_t k, uint8_t kind, const bool* is_replaced)
+{
+    return old[k].kind == kind && !is_replaced[old[k].file]
+        && (k == 0 || old[k - 1].kind != kind || old[k - 1].file != old[k].file);
+}
+
+// Which banks of each new file occur elsewhere (earlier scans or this batch),
+// and the files it shares the most banks with
+static void PrintBankSharing(const BankIndex* old, const bool* is_replaced,
+    const BankRecord* records, size_t count, const char* const* paths, size_t file_count)
+{
+    char buf[512];
+    uint32_t* banks = (uint32_t*)calloc(file_count * BANK_KIND_COUNT * 2, sizeof(uint32_t));
+    uint32_t* shared = banks + file_count * BANK_KIND_COUNT;
+    uint64_t* pairs = NULL;
+    size_t pair_count = 0;
+    size_t pair_cap = 0;
+    if (banks == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; ) {
+        size_t j = i;
+        while (j < count && records[j].fp == records[i].fp && records[j].kind == records[i].kind) {
+            j++;
+        }
+        // Files, not records: a bank repeated inside one ROM (blank or filler
+        // banks) is not shared. Records of a file are adjacent in both lists.
+        const BankRecord* old_first = NULL;
+        size_t old_count = BankIndexFind(old, records[i].fp, &old_first);
+        size_t members = 0;
+        for (size_t q = i; q < j; q++) {
+            members += q == i || records[q].file != records[q - 1].file;
+        }
+        for (size_t k = 0; k < old_count; k++) {
+            members += IsSharingOldFile(old_first, k, records[i].kind, is_replaced);
+        }
+        for (size_t r = i; r < j && members > 1; r++) {
+            uint32_t file = records[r].file;
+            shared[file * BANK_KIND_COUNT + records[r].kind]++;
+            // One pair per file and partner, however often the bank repeats in either
+            if (members > BANK_PARTNER_MAX || (r != i && file == records[r - 1].file)) {
+                continue;
+            }
+            if (pair_count + members > pair_cap) {
+                size_t cap = pair_cap ? pair_cap * 2 : 4096;
+                while (cap < pair_count + members) {
+                    cap *= 2;
+                }
+                uint64_t* p = (uint64_t*)realloc(pairs, cap * sizeof(uint64_t));
+                if (p == NULL) {
+                    continue;
+                }
+                pairs = p;
+                pair_cap = cap;
+            }
+            for (size_t q = i; q < j; q++) {
+                if (records[q].file != file && (q == i || records[q].file != records[q - 1].file)) {
+                    pairs[pair_count++] = (uint64_t)file << 32 | BANK_PARTNER_NEW | records[q].file;
+                }
+            }
+            for (size_t k = 0; k < old_count; k++) {
+                if (IsSharingOldFile(old_first, k, records[i].kind, is_replaced)) {
+                    pairs[pair_count++] = (uint64_t)file << 32 | old_first[k].file;
+                }
+            }
+        }
+        for (size_t r = i; r < j; r++) {
+            banks[records[r].file * BANK_KIND_COUNT + records[r].kind]++;
+        }
+        i = j;
+    }
+    qsort(pairs, pair_count, sizeof(uint64_t), CompareU64Keys);
+
+    size_t p = 0;
+    for (size_t f = 0; f < file_count; f++) {
+        const uint32_t* fb = banks + f * BANK_KIND_COUNT;
+        const uint32_t* fs = shared + f * BANK_KIND_COUNT;
+        if (fs[BANK_KIND_PRG] + fs[BANK_KIND_CHR] + fs[BANK_KIND_CHR1K] == 0) {
+            while (p < pair_count && pairs[p] >> 32 == f) {
+                p++;
+            }
+            continue;
+        }
+        Print("\n");
+        Print(paths[f]);
+        snprintf(buf, sizeof(buf), "\n  Shared     : PRG %u/%u, CHR %u/%u, CHR 1 KiB %u/%u",
+            fs[BANK_KIND_PRG], fb[BANK_KIND_PRG], fs[BANK_KIND_CHR], fb[BANK_KIND_CHR],
+            fs[BANK_KIND_CHR1K], fb[BANK_KIND_CHR1K]);
+        Print(buf);
+
+        // Partners of f by shared bank count
+        uint32_t top[BANK_PARTNER_SHOWN] = {0};
+        uint32_t top_count[BANK_PARTNER_SHOWN] = {0};
+        while (p < pair_count && pairs[p] >> 32 == f) {
+            uint32_t partner = (uint32_t)pairs[p];
+            uint32_t n = 0;
+            for (; p < pair_count && pairs[p] == ((uint64_t)f << 32 | partner); p++) {
+                n++;
+            }
+            for (int t = 0; t < BANK_PARTNER_SHOWN; t++) {
+                if (n > top_count[t]) {
+                    memmove(top + t + 1, top + t, (BANK_PARTNER_SHOWN - 1 - t) * sizeof(uint32_t));
+                    memmove(top_count + t + 1, top_count + t, (BANK_PARTNER_SHOWN - 1 - t) * sizeof(uint32_t));
+                    top[t] = partner;
+                    top_count[t] = n;
+                    break;
+                }
+            }
+        }
+        for (int t = 0; t < BANK_PARTNER_SHOWN && top_count[t] != 0; t++) {
+            const char* name = top[t] & BANK_PARTNER_NEW
+                ? paths[top[t] & ~BANK_PARTNER_NEW] : old->paths[top[t]];
+            snprintf(buf, sizeof(buf), "%s%u banks with ", t == 0 ? "\n  With       : " : "\n               ",
+                top_count[t]);
+            Print(buf);
+            Print(name);
+        }
+    }
+    free(pairs);
+    free(banks);
+}
+
+// Merges the workers' banks, reports sharing and rewrites the index file
+bool UpdateBankIndex(Worker* workers, size_t count)
+{
+    size_t file_count = 0;
+    size_t record_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (workers[i].banks.isFailed) {
+            fprintf(stderr, "Error: malloc() - bank index, not updated: %s\n", g_opt.bankIndex);
+            return false;
+        }
+        file_count += workers[i].banks.fileCount;
+        record_count += workers[i].banks.count;
+    }
+    BankFileRef* refs = (BankFileRef*)malloc((file_count ? file_count : 1) * sizeof(BankFileRef));
+    uint32_t* ids = (uint32_t*)malloc((file_count ? file_count : 1) * sizeof(uint32_t));
+    const char** paths = (const char**)malloc((file_count ? file_count : 1) * sizeof(char*));
+    BankRecord* records = (BankRecord*)malloc((record_count ? record_count : 1) * sizeof(BankRecord));
+    bool ok = refs != NULL && ids != NULL && paths != NULL && records != NULL;
+
+    // File ids in job order, so the report follows the command line
+    for (size_t i = 0, n = 0; ok && i < count; i++) {
+        for (size_t f = 0; f < workers[i].banks.fileCount; f++, n++) {
+            refs[n].job = workers[i].banks.jobIndex[f];
+            refs[n].file = n;
+        }
+    }
+    if (ok) {
+        qsort(refs, file_count, sizeof(BankFileRef), CompareBankFileRefs);
+        for (size_t n = 0; n < file_count; n++) {
+            ids[refs[n].file] = (uint32_t)n;
+        }
+    }
+    for (size_t i = 0, base = 0, r = 0; ok && i < count; i++) {
+        const BankList* list = &workers[i].banks;
+        for (size_t f = 0; f < list->fileCount; f++) {
+            paths[ids[base + f]] = list->paths[f];
+        }
+        for (size_t k = 0; k < list->count; k++, r++) {
+            records[r] = list->records[k];
+            records[r].file = ids[base + list->records[k].file];
+        }
+        base += list->fileCount;
+    }
+
+    // A path given twice keeps its last scan only
+    bool* is_repeated = ok ? (bool*)malloc((file_count ? file_count : 1) * sizeof(bool)) : NULL;
+    ok = is_repeated != NULL && FindRepeatedPaths(paths, file_count, is_repeated);
+    if (ok) {
+        size_t kept = 0;
+        for (size_t n = 0; n < file_count; n++) {
+            ids[n] = is_repeated[n] ? UINT32_MAX : (uint32_t)kept;
+            if (!is_repeated[n]) {
+                paths[kept++] = paths[n];
+            }
+        }
+        file_count = kept;
+        size_t r = 0;
+        for (size_t k = 0; k < record_count; k++) {
+            if (ids[records[k].file] != UINT32_MAX) {
+                records[r] = records[k];
+                records[r++].file = ids[records[k].file];
+            }
+        }
+        record_count = r;
+    }
+    free(is_repeated);
+    if (!ok) {
+        fprintf(stderr, "Error: malloc() - bank index\n");
+    }
+    else {
+        qsort(records, record_count, sizeof(BankRecord), CompareBankRecords);
+    }
+
+    BankIndex old;
+    if (ok && !BankIndexOpen(&old, g_opt.bankIndex)) {
+        fprintf(stderr, "Error: can't read bank index: %s\n", g_opt.bankIndex);
+        ok = false;
+    }
+    else if (ok) {
+        BankIndexTotals totals;
+        bool* is_replaced = (bool*)malloc((old.fileCount ? old.fileCount : 1) * sizeof(bool));
+        if (is_replaced == NULL || !BankIndexFindReplaced(&old, paths, file_count, is_replaced)
+            || !BankIndexWrite(&old, is_replaced, records, record_count, paths, file_count, g_opt.bankIndex,
+                &totals)
+        ) {
+            fprintf(stderr, "Error: can't write bank index: %s\n", g_opt.bankIndex);
+            ok = false;
+        }
+        else {
+            char buf[256];
+            Print("-------------*-----------------------------------------");
+            Print("\n              Bank Index");
+            Print("\n-------------*-----------------------------------------");
+            snprintf(buf, sizeof(buf), "\nIndex        : %" PRIu64 " files, %" PRIuPTR " scanned now",
+                totals.files, file_count);
+            Print(buf);
+            for (int k = 0; k < BANK_KIND_COUNT; k++) {
+                uint64_t saving = (totals.banks[k] - totals.unique[k]) * BankKindSizes[k];
+                uint64_t size = totals.banks[k] * BankKindSizes[k];
+                snprintf(buf, sizeof(buf), "\n%-13s: %10" PRIu64 " banks, %10" PRIu64 " unique, dedup saves %"
+                    PRIu64 " KiB (%.1f%%)", BankKindNames[k], totals.banks[k], totals.unique[k],
+                    saving / 1024, size ? 100.0 * saving / size : 0.0);
+                Print(buf);
+            }
+            Print("\n-------------*-----------------------------------------");
+            PrintBankSharing(&old, is_replaced, records, record_count, paths, file_count);
+            Print("\n");
+        }
+        free(is_replaced);
+        BankIndexClose(&old);
+    }
+
+    free(refs);
+    free(ids);
+    free((void*)paths);
+    free(records);
+    return ok;
+}
+
+#define SIMILAR_MIN         0.3     // Estimated similarity to list a catalog file
+#define SIMILAR_SHOWN       3
+#define SIMILAR_BUCKET_MAX  256     // Files looked at per band, so floods of equal ROMs stay cheap
+#define SIMILAR_NEW         0x80000000u
+
+typedef struct {
+    uint32_t file;          // SIMILAR_NEW | batch file, or catalog file
+    double similarity;
+} SimilarMatch;
+
+static int CompareU32Keys(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void AddSimilarMatch(SimilarMatch* top, uint32_t file, double similarity)
+{
+    for (int t = 0; t < SIMILAR_SHOWN; t++) {
+        if (similarity > top[t].similarity) {
+            memmove(top + t + 1, top + t, (SIMILAR_SHOWN - 1 - t) * sizeof(SimilarMatch));
+            top[t].file = file;
+            top[t].similarity = similarity;
+            return;
+        }
+    }
+}
+
+// The nearest files of each new one: LSH band buckets of the old catalog and
+// of this batch give the candidates, their full sketches the similarity
+static void PrintSimilarFiles(const SketchCatalog* old, const bool* is_replaced,
+    const MinHashSketch* sketches, const char* const* paths, size_t file_count)
+{
+    char buf[512];
+    SketchRecord* records = (SketchRecord*)malloc((file_count ? file_count : 1) * MINHASH_BANDS
+        * sizeof(SketchRecord));
+    uint32_t* candidates = (uint32_t*)malloc(MINHASH_BANDS * SIMILAR_BUCKET_MAX * 2 * sizeof(uint32_t));
+    if (records == NULL || candidates == NULL) {
+        free(records);
+        free(candidates);
+        return;
+    }
+    size_t record_count = 0;
+    for (size_t f = 0; f < file_count; f++) {
+        if (MinHashIsEmpty(&sketches[f])) {
+            continue;
+        }
+        uint64_t keys[MINHASH_BANDS];
+        MinHashBandKeys(&sketches[f], keys);
+        for (int b = 0; b < MINHASH_BANDS; b++) {
+            records[record_count].key = keys[b];
+            records[record_count].file = (uint32_t)f;
+            records[record_count].reserved = 0;
+            record_count++;
+        }
+    }
+    qsort(records, record_count, sizeof(SketchRecord), CompareSketchRecords);
+
+    uint64_t query_ns = 0;
+    size_t query_count = 0;
+    for (size_t f = 0; f < file_count; f++) {
+        if (MinHashIsEmpty(&sketches[f])) {
+            continue;
+        }
+        uint64_t start = StatsNow();
+        uint64_t keys[MINHASH_BANDS];
+        MinHashBandKeys(&sketches[f], keys);
+        size_t n = 0;
+        for (int b = 0; b < MINHASH_BANDS; b++) {
+            const SketchRecord* first = NULL;
+            size_t count = SketchCatalogFind(old, keys[b], &first);
+            for (size_t k = 0; k < count && k < SIMILAR_BUCKET_MAX; k++) {
+                if (!is_replaced[first[k].file]) {
+                    candidates[n++] = first[k].file;
+                }
+            }
+            // The batch's own records: first one of the key, then the run
+            SketchRecord probe = { keys[b], 0, 0 };
+            size_t lo = 0, hi = record_count;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (CompareSketchRecords(&records[mid], &probe) < 0) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+            for (size_t k = lo; k < record_count && k - lo < SIMILAR_BUCKET_MAX && records[k].key == keys[b]; k++) {
+                if (records[k].file != f) {
+                    candidates[n++] = SIMILAR_NEW | records[k].file;
+                }
+            }
+        }
+        qsort(candidates, n, sizeof(uint32_t), CompareU32Keys);
+
+        SimilarMatch top[SIMILAR_SHOWN];
+        memset(top, 0, sizeof(top));
+        for (size_t k = 0; k < n; k++) {
+            if (k != 0 && candidates[k] == candidates[k - 1]) {
+                continue;
+            }
+            uint32_t c = candidates[k];
+            const MinHashSketch* other = c & SIMILAR_NEW ? &sketches[c & ~SIMILAR_NEW] : &old->sketches[c];
+            double similarity = MinHashSimilarity(&sketches[f], other);
+            if (similarity >= SIMILAR_MIN) {
+                AddSimilarMatch(top, c, similarity);
+            }
+        }
+        query_ns += StatsNow() - start;
+        query_count++;
+
+        if (top[0].similarity == 0.0) {
+            continue;
+        }
+        Print("\n");
+        Print(paths[f]);
+        for (int t = 0; t < SIMILAR_SHOWN && top[t].similarity != 0.0; t++) {
+            const char* name = top[t].file & SIMILAR_NEW
+                ? paths[top[t].file & ~SIMILAR_NEW] : old->paths[top[t].file];
+            snprintf(buf, sizeof(buf), "%s%5.1f%% ", t == 0 ? "\n  Similar    : " : "\n               ",
+                100.0 * top[t].similarity);
+            Print(buf);
+            Print(name);
+        }
+    }
+    if (g_opt.stats && query_count != 0) {
+        fprintf(stderr, "similar: %" PRIuPTR " lookups, %.1f us each\n", query_count,
+            query_ns / 1e3 / query_count);
+    }
+    free(records);
+    free(candidates);
+}
+
+// Merges the workers' sketches, reports the nearest files and rewrites the catalog
+bool UpdateSketchCatalog(Worker* workers, size_t count)
+{
+    size_t file_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (workers[i].sketches.isFailed) {
+            fprintf(stderr, "Error: malloc() - similarity catalog, not updated: %s\n", g_opt.similar);
+            return false;
+        }
+        file_count += workers[i].sketches.count;
+    }
+    BankFileRef* refs = (BankFileRef*)malloc((file_count ? file_count : 1) * sizeof(BankFileRef));
+    MinHashSketch* sketches = (MinHashSketch*)malloc((file_count ? file_count : 1) * sizeof(MinHashSketch));
+    const char** paths = (const char**)malloc((file_count ? file_count : 1) * sizeof(char*));
+    bool ok = refs != NULL && sketches != NULL && paths != NULL;
+
+    // Job order, so the report follows the command line
+    for (size_t i = 0, n = 0; ok && i < count; i++) {
+        for (size_t f = 0; f < workers[i].sketches.count; f++, n++) {
+            refs[n].job = workers[i].sketches.jobIndex[f];
+            refs[n].file = n;
+        }
+    }
+    if (ok) {
+        qsort(refs, file_count, sizeof(BankFileRef), CompareBankFileRefs);
+        for (size_t n = 0; n < file_count; n++) {
+            size_t f = refs[n].file;
+            size_t i = 0;
+            while (f >= workers[i].sketches.count) {
+                f -= workers[i++].sketches.count;
+            }
+            sketches[n] = workers[i].sketches.sketches[f];
+            paths[n] = workers[i].sketches.paths[f];
+        }
+    }
+
+    // A path given twice keeps its last scan only
+    bool* is_repeated = ok ? (bool*)malloc((file_count ? file_count : 1) * sizeof(bool)) : NULL;
+    ok = is_repeated != NULL && FindRepeatedPaths(paths, file_count, is_repeated);
+    if (ok) {
+        size_t kept = 0;
+        for (size_t n = 0; n < file_count; n++) {
+            if (!is_repeated[n]) {
+                sketches[kept] = sketches[n];
+                paths[kept++] = paths[n];
+            }
+        }
+        file_count = kept;
+    }
+    free(is_repeated);
+    if (!ok) {
+        fprintf(stderr, "Error: malloc() - similarity catalog\n");
+    }
+
+    SketchCatalog old;
+    if (ok && !SketchCatalogOpen(&old, g_opt.similar)) {
+        fprintf(stderr, "Error: can't read similarity catalog: %s\n", g_opt.similar);
+        ok = false;
+    }
+    else if (ok) {
+        bool* is_replaced = (bool*)malloc((old.fileCount ? old.fileCount : 1) * sizeof(bool));
+        if (is_replaced == NULL || !SketchCatalogFindReplaced(&old, paths, file_count, is_replaced)) {
+            fprintf(stderr, "Error: malloc() - similarity catalog\n");
+            ok = false;
+        }
+        else {
+            char buf[256];
+            size_t kept = 0;
+            for (size_t f = 0; f < old.fileCount; f++) {
+                kept += !is_replaced[f];
+            }
+            Print("-------------*-----------------------------------------");
+            Print("\n              Similar ROMs");
+            Print("\n-------------*-----------------------------------------");
+            snprintf(buf, sizeof(buf), "\nCatalog      : %" PRIuPTR " files, %" PRIuPTR " scanned now",
+                kept + file_count, file_count);
+            Print(buf);
+            Print("\n-------------*-----------------------------------------");
+            PrintSimilarFiles(&old, is_replaced, sketches, paths, file_count);
+            Print("\n");
+        }
+        if (ok && !SketchCatalogWrite(&old, is_replaced, sketches, paths, file_count, g_opt.similar)) {
+            fprintf(stderr, "Error: can't write similarity catalog: %s\n", g_opt.similar);
+            ok = false;
+        }
+        free(is_replaced);
+        SketchCatalogClose(&old);
+    }
+
+    free(refs);
+    free(sketches);
+    free((void*)paths);
+    return ok;
+}
+
+// Merges the workers' rows into the catalogue file
+bool UpdateCatalog(Worker* workers, size_t count)
+{
+    size_t file_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (workers[i].catalog.isFailed) {
+            fprintf(stderr, "Error: malloc() - catalogue, not updated: %s\n", g_opt.catalog);
+            return false;
+        }
+        file_count += workers[i].catalog.count;
+    }
+    BankFileRef* refs = (BankFileRef*)malloc((file_count ? file_count : 1) * sizeof(BankFileRef));
+    CatalogEntry* entries = (CatalogEntry*)malloc((file_count ? file_count : 1) * sizeof(CatalogEntry));
+    const char** paths = (const char**)malloc((file_count ? file_count : 1) * sizeof(char*));
+    bool ok = refs != NULL && entries != NULL && paths != NULL;
+
+    // Rows in job order, so a catalogue follows the command line
+    for (size_t i = 0, n = 0; ok && i < count; i++) {
+        for (size_t f = 0; f < workers[i].catalog.count; f++, n++) {
+            refs[n].job = workers[i].catalog.jobIndex[f];
+            refs[n].file = n;
+        }
+    }
+    if (ok) {
+        qsort(refs, file_count, sizeof(BankFileRef), CompareBankFileRefs);
+        for (size_t n = 0; n < file_count; n++) {
+            size_t f = refs[n].file;
+            size_t i = 0;
+            while (f >= workers[i].catalog.count) {
+                f -= workers[i++].catalog.count;
+            }
+            entries[n] = workers[i].catalog.entries[f];
+            paths[n] = workers[i].catalog.paths[f];
+        }
+    }
+    else {
+        fprintf(stderr, "Error: malloc() - catalogue\n");
+    }
+
+    Catalog old;
+    if (ok && !CatalogOpen(&old, g_opt.catalog, true)) {
+        fprintf(stderr, "Error: can't read catalogue: %s\n", g_opt.catalog);
+        ok = false;
+    }
+    else if (ok) {
+        // A catalogue holds one shard (or all files) of one root throughout
+        if (old.rowCount != 0 && (old.shardIndex != g_opt.shardIndex || old.shardCount != g_opt.shardCount)) {
+            char a[32], b[32];
+            fprintf(stderr, "Error: catalogue holds %s, the scan covers %s: %s\n",
+                FormatShard(old.shardIndex, old.shardCount, a, sizeof(a)),
+                FormatShard(g_opt.shardIndex, g_opt.shardCount, b, sizeof(b)), g_opt.catalog);
+            ok = false;
+        }
+        else if (old.rowCount != 0 && strcmp(old.shardRoot, g_shardRootName) != 0) {
+            fprintf(stderr, "Error: catalogue paths are relative to the shard root \"%s\", the scan's to \"%s\": %s\n",
+                old.shardRoot, g_shardRootName, g_opt.catalog);
+            ok = false;
+        }
+        else if (!CatalogWrite(&old, entries, paths, file_count, g_opt.shardIndex, g_opt.shardCount,
+            g_shardRootName, g_opt.catalog)
+        ) {
+            fprintf(stderr, "Error: can't write catalogue: %s\n", g_opt.catalog);
+            ok = false;
+        }
+        CatalogClose(&old);
+    }
+
+    free(refs);
+    free(entries);
+    free((void*)paths);
+    return ok;
+}
+
+// Returns 0 if every job succeeded; reports come in input order, or in
+// completion order with --jobs > 1 and --unordered. Runs on pool, or on
+// workers started for this batch alone if NULL.
+int RunBatch(const JobList* jobs, bool is_path_shown, WorkerPool* pool)
+{
+    Batch batch;
+    batch.jobs = jobs;
+    batch.isPathShown = is_path_shown;
+    batch.io = NULL;
+#ifdef NESINFO_THREADS
+    batch.reorder = NULL;
+#endif
+    batch.next = 0;
+    batch.result = 0;
+
+    WorkerPool own_pool;
+    bool is_own_pool = pool == NULL;
+    if (is_own_pool) {
+        size_t count = g_opt.jobs > 1 && jobs->count > 1 ? (size_t)g_opt.jobs : 1;
+        if (count > jobs->count) {
+            count = jobs->count;
+        }
+        if (!InitWorkerPool(&own_pool, count)) {
+            fprintf(stderr, "Error: calloc()\n");
+            return 1;
+        }
+        pool = &own_pool;
+    }
+    Worker* workers = pool->workers;
+    size_t count = pool->count;
+    if (g_journal.isOpen && !BeginJournalBatch(jobs)) {
+        fprintf(stderr, "Error: calloc()\n");
+        if (is_own_pool) {
+            FreeWorkerPool(pool);
+        }
+        return 1;
+    }
+    IOEngineType io_type = IO_ENGINE_SYNC;
+    uint64_t start = StatsNow();
+
+#ifdef NESINFO_THREADS
+    // Plain files are read ahead while the workers hash; header-only reads are too small,
+    // and with --filter most files may never be read in full (unless --io is explicit)
+    const char** paths = NULL;
+    if (g_opt.io != IO_ENGINE_SYNC && !g_opt.headerOnly && jobs->fileCount > 1
+        && (g_filter.code == NULL || g_opt.io != IO_ENGINE_AUTO)
+    ) {
+        paths = (const char**)malloc(jobs->fileCount * sizeof(const char*));
+    }
+    if (paths != NULL) {
+        for (size_t i = 0; i < jobs->count; i++) {
+            if (jobs->items[i].archive == NULL) {
+                paths[jobs->items[i].fileIndex] = jobs->items[i].path;
+            }
+        }
+        batch.io = IOEngineCreate(g_opt.io, paths, jobs->fileCount, g_opt.ioDepth, g_opt.direct);
+        if (batch.io != NULL) {
+            io_type = IOEngineGetType(batch.io);
+        }
+        else if (g_opt.io == IO_ENGINE_URING) {
+            fprintf(stderr, "Warning: io_uring is not available, reading synchronously\n");
+        }
+    }
+
+    // Without a reorder buffer (no memory either) reports come in completion order
+    ReorderBuffer reorder;
+    if (count > 1 && !g_opt.unordered && InitReorderBuffer(&reorder, count)) {
+        batch.reorder = &reorder;
+    }
+
+    RunPoolBatch(pool, &batch);
+    if (batch.reorder != NULL) {
+        FreeReorderBuffer(batch.reorder);
+    }
+    IOEngineDestroy(batch.io);
+    free(paths);
+#else
+    RunPoolBatch(pool, &batch);
+#endif
+
+    if (g_opt.summary) {
+        // Per-worker counters are merged here, after all reports are out
+        Summary* total = (Summary*)calloc(1, sizeof(Summary));
+        OutBuf out = {0};
+        for (size_t i = 0; total != NULL && i < count; i++) {
+            AddSummary(total, &workers[i].summary);
+        }
+        if (total != NULL) {
+            t_out = &out;
+            if (!g_opt.summaryOnly && !is_path_shown) {
+                Print("\n\n");
+            }
+            PrintSummary(total);
+            t_out = NULL;
+            WriteOut(out.data, out.size);
+        }
+        free(out.data);
+        free(total);
+    }
+    bool is_indexed = true;
+    if (g_opt.bankIndex != NULL) {
+        OutBuf out = {0};
+        t_out = &out;
+        if (!g_opt.summaryOnly && !is_path_shown) {
+            Print("\n\n");
+        }
+        if (!UpdateBankIndex(workers, count)) {
+            batch.result = 1;
+            is_indexed = false;
+        }
+        t_out = NULL;
+        WriteOut(out.data, out.size);
+        free(out.data);
+    }
+    if (g_opt.similar != NULL) {
+        OutBuf out = {0};
+        t_out = &out;
+        if (!g_opt.summaryOnly && !is_path_shown && g_opt.bankIndex == NULL) {
+            Print("\n\n");
+        }
+        if (!UpdateSketchCatalog(workers, count)) {
+            batch.result = 1;
+            is_indexed = false;
+        }
+        t_out = NULL;
+        WriteOut(out.data, out.size);
+        free(out.data);
+    }
+    if (g_opt.catalog != NULL && !UpdateCatalog(workers, count)) {
+        batch.result = 1;
+        is_indexed = false;
+    }
+    if (g_journal.isOpen && !EndJournalBatch(is_indexed)) {
+        batch.result = 1;
+    }
+    if (g_opt.stats) {
+        PrintStats(workers, count, StatsNow() - start);
+        fprintf(stderr, "I/O engine: %s\n", IOEngineName(io_type));
+    }
+    // A kept pool starts the next batch from zero
+    for (size_t i = 0; i < count; i++) {
+        free(workers[i].stats.fileNs);
+        memset(&workers[i].stats, 0, sizeof(Stats));
+        memset(&workers[i].summary, 0, sizeof(Summary));
+        FreeBankList(&workers[i].banks);
+        FreeSketchList(&workers[i].sketches);
+        FreeCatalogList(&workers[i].catalog);
+        workers[i].batch = NULL;
+    }
+    if (is_own_pool) {
+        FreeWorkerPool(pool);
+    }
+    return batch.result;
+}
+
+
+// Watch mode (--watch)
+
+#define WATCH_DEBOUNCE_MS   5       // Quiet time after the last event before a batch starts
+#define WATCH_MAX_DELAY_MS  100     // ... but no longer than this after the first one
+
+// Files the watch picks up: ROMs and the archives BuildJobList() expands
+static bool IsWatchedName(const char* name)
+{
+    size_t len = strlen(name);
+    if (GetArchiveType(name) != ARCHIVE_NONE) {
+        return true;
+    }
+    if (len < 4 || name[len - 4] != '.') {
+        return false;
+    }
+    char ext[4];
+    for (int i = 0; i < 3; i++) {
+        char c = name[len - 3 + i];
+        ext[i] = c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+    }
+    ext[3] = '\0';
+    return strcmp(ext, "nes") == 0;
+}
+
+static int RunWatchBatch(char** pending, size_t count, WorkerPool* pool)
+{
+    FileList files = {0};
+    JobList jobs = {0};
+    int result = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!AddFile(&files, pending[i])) {
+            result = 1;
+        }
+    }
+    if (result == 0 && !BuildJobList(&jobs, &files)) {
+        fprintf(stderr, "Error: malloc()\n");
+        result = 1;
+    }
+    else if (result == 0 && jobs.count != 0) {
+        result = RunBatch(&jobs, true, pool);
+    }
+    fflush(stdout);
+    FreeJobList(&jobs);
+    FreeFileList(&files);
+    return result;
+}
+
+#ifdef __linux__
+// Files for the next watch batch
+typedef struct {
+    char** paths;
+    size_t count;
+    size_t cap;
+    uint64_t firstNs;       // First and last event that queued or touched one
+    uint64_t lastNs;
+} WatchQueue;
+
+// Queues dir/name; a file written twice in one batch is reported once
+static void QueueWatchFile(WatchQueue* q, const char* dir, const char* name)
+{
+    size_t path_len = strlen(dir) + 1 + strlen(name) + 1;
+    char* path = (char*)malloc(path_len);
+    if (path == NULL) {
+        return;
+    }
+    snprintf(path, path_len, "%s/%s", dir, name);
+    bool is_queued = false;
+    for (size_t i = 0; i < q->count && !is_queued; i++) {
+        is_queued = strcmp(q->paths[i], path) == 0;
+    }
+    if (is_queued) {
+        free(path);
+        q->lastNs = StatsNow();
+        return;
+    }
+    if (q->count == q->cap) {
+        size_t new_cap = q->cap ? q->cap * 2 : 64;
+        char** p = (char**)realloc(q->paths, new_cap * sizeof(char*));
+        if (p == NULL) {
+            free(path);
+            return;
+        }
+        q->paths = p;
+        q->cap = new_cap;
+    }
+    q->paths[q->count++] = path;
+    q->lastNs = StatsNow();
+    if (q->count == 1) {
+        q->firstNs = q->lastNs;
+    }
+}
+
+static bool IsTimeBefore(struct timespec a, struct timespec b)
+{
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+// After a queue overflow: queues the files written (mtime) or moved in
+// (ctime) since the last batch started, as their events may be lost
+static void RescanWatchDirectory(WatchQueue* q, const char* dir, struct timespec since)
+{
+    DIR* d = opendir(dir);
+    if (d == NULL) {
+        fprintf(stderr, "Warning: --watch: can't rescan: %s: %s\n", dir, strerror(errno));
+        return;
+    }
+    char path[4096];
+    const struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (!IsWatchedName(entry->d_name)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)
+            || (IsTimeBefore(st.st_mtim, since) && IsTimeBefore(st.st_ctim, since))
+        ) {
+            continue;
+        }
+        QueueWatchFile(q, dir, entry->d_name);
+    }
+    closedir(d);
+}
+#endif
+
+// Reports every ROM created in or moved into dir once it is closed after
+// writing; events are debounced into batches for the worker pool, which is
+// kept for the whole watch. Runs until the directory goes away or an error
+// occurs.
+int WatchDirectory(const char* dir)
+{
+#ifdef __linux__
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "Error: inotify_init1(): %s\n", strerror(errno));
+        return 1;
+    }
+    if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) == -1) {
+        fprintf(stderr, "Error: can't watch: %s: %s\n", dir, strerror(errno));
+        close(fd);
+        return 1;
+    }
+    WorkerPool pool;
+    if (!InitWorkerPool(&pool, g_opt.jobs > 1 ? (size_t)g_opt.jobs : 1)) {
+        fprintf(stderr, "Error: calloc()\n");
+        close(fd);
+        return 1;
+    }
+
+    union {
+        struct inotify_event event;     // Alignment
+        char data[64 * 1024];
+    } buf;
+    WatchQueue queue = {0};
+    // Files changed from here on may not have been reported yet
+    struct timespec batch_start;
+    clock_gettime(CLOCK_REALTIME, &batch_start);
+    int result = 0;
+    bool is_done = false;
+    while (!is_done) {
+        // Idle: block until the next event
+        int timeout = -1;
+        if (queue.count != 0) {
+            uint64_t now = StatsNow();
+            uint64_t quiet = queue.lastNs + WATCH_DEBOUNCE_MS * 1000000ull;
+            uint64_t latest = queue.firstNs + WATCH_MAX_DELAY_MS * 1000000ull;
+            uint64_t deadline = quiet < latest ? quiet : latest;
+            timeout = deadline > now ? (int)((deadline - now + 999999) / 1000000) : 0;
+        }
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int n = poll(&pfd, 1, timeout);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            fprintf(stderr, "Error: poll(): %s\n", strerror(errno));
+            result = 1;
+            break;
+        }
+        if (n == 0) {
+            clock_gettime(CLOCK_REALTIME, &batch_start);
+            if (RunWatchBatch(queue.paths, queue.count, &pool) != 0) {
+                result = 1;
+            }
+            for (size_t i = 0; i < queue.count; i++) {
+                free(queue.paths[i]);
+            }
+            queue.count = 0;
+            continue;
+        }
+
+        ssize_t len = read(fd, buf.data, sizeof(buf.data));
+        if (len <= 0) {
+            if (len == -1 && errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error: read(): inotify\n");
+            result = 1;
+            break;
+        }
+        for (ssize_t pos = 0; pos < len; ) {
+            const struct inotify_event* ev = (const struct inotify_event*)(buf.data + pos);
+            pos += (ssize_t)(sizeof(struct inotify_event) + ev->len);
+            if (ev->mask & IN_Q_OVERFLOW) {
+                fprintf(stderr, "Warning: --watch: event queue overflow, rescanning %s\n", dir);
+                RescanWatchDirectory(&queue, dir, batch_start);
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                // The directory was removed or unmounted
+                is_done = true;
+                continue;
+            }
+            if (ev->len == 0 || (ev->mask & IN_ISDIR) || !IsWatchedName(ev->name)) {
+                continue;
+            }
+            QueueWatchFile(&queue, dir, ev->name);
+        }
+    }
+
+    if (queue.count != 0 && RunWatchBatch(queue.paths, queue.count, &pool) != 0) {
+        result = 1;
+    }
+    for (size_t i = 0; i < queue.count; i++) {
+        free(queue.paths[i]);
+    }
+    free(queue.paths);
+    FreeWorkerPool(&pool);
+    close(fd);
+    return result;
+#else
+    fprintf(stderr, "Error: --watch needs inotify (Linux): %s\n", dir);
+    return 1;
+#endif
+}
+
+
+// Catalogue queries (nesinfo query)
+
+typedef enum {
+    QUERY_MAPPER,
+    QUERY_SUBMAPPER,
+    QUERY_PRG,
+    QUERY_CHR,
+    QUERY_SIZE,
+    QUERY_CONSOLE,
+    QUERY_TIMING,
+    QUERY_EXPANSION,
+    QUERY_BATTERY,
+    QUERY_TRAINER,
+    QUERY_4SCREEN,
+    QUERY_VERTICAL,
+    QUERY_NES20,
+    QUERY_CRC32,            // File or ROM
+    QUERY_SHA1,             // File or ROM
+    QUERY_FIELD_COUNT
+} QueryField;
+
+// In QueryField order; flags are the fields from "battery" on
+static const char* QueryFieldNames[QUERY_FIELD_COUNT] = {
+    "mapper", "submapper", "prg", "chr", "size", "console", "timing", "expansion",
+    "battery", "trainer", "4screen", "vertical", "nes20", "crc32", "sha1"
+};
+
+typedef enum { QUERY_EQ, QUERY_NE, QUERY_LT, QUERY_LE, QUERY_GT, QUERY_GE } QueryOp;
+
+typedef struct {
+    QueryField field;
+    QueryOp op;
+    uint64_t value;
+    uint8_t sha1[20];
+} QueryTerm;
+
+static bool IsQueryFlag(QueryField field)
+{
+    return field >= QUERY_BATTERY && field <= QUERY_NES20;
+}
+
+// Decimal or 0x hex, with an optional K/KiB/M/MiB multiplier
+static bool ParseQueryNumber(const char* str, uint64_t* value)
+{
+    // strtoull() would take "-1" as UINT64_MAX
+    if (*str < '0' || *str > '9') {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    unsigned long long v = strtoull(str, &end, 0);
+    if (end == str || errno != 0) {
+        return false;
+    }
+    uint64_t scale = 1;
+    if (*end == 'K' || *end == 'k') {
+        scale = 1024;
+    }
+    else if (*end == 'M' || *end == 'm') {
+        scale = 1024 * 1024;
+    }
+    if (scale != 1) {
+        end++;
+        if (strcmp(end, "iB") == 0 || strcmp(end, "B") == 0) {
+            end += strlen(end);
+        }
+    }
+    if (v > UINT64_MAX / scale) {
+        return false;
+    }
+    *value = (uint64_t)v * scale;
+    return *end == '\0';
+}
+
+// "mapper=4", "prg>=512K", "battery", "!trainer", "sha1=<40 hex digits>"
+bool ParseQueryTerm(const char* str, QueryTerm* term)
+{
+    memset(term, 0, sizeof(*term));
+    bool is_negated = *str == '!';
+    const char* name = str + is_negated;
+    size_t name_len = strcspn(name, "=!<>");
+    int f = 0;
+    while (f < QUERY_FIELD_COUNT
+        && (strlen(QueryFieldNames[f]) != name_len || strncmp(name, QueryFieldNames[f], name_len) != 0)
+    ) {
+        f++;
+    }
+    if (f == QUERY_FIELD_COUNT) {
+        return false;
+    }
+    term->field = (QueryField)f;
+    const char* op = name + name_len;
+    if (*op == '\0') {
+        // A bare flag
+        term->op = is_negated ? QUERY_EQ : QUERY_NE;
+        return IsQueryFlag(term->field);
+    }
+    if (is_negated) {
+        return false;
+    }
+    static const struct { const char* str; QueryOp op; } Ops[] = {
+        { "==", QUERY_EQ }, { "!=", QUERY_NE }, { "<=", QUERY_LE }, { ">=", QUERY_GE },
+        { "=", QUERY_EQ }, { "<", QUERY_LT }, { ">", QUERY_GT }
+    };
+    size_t k = 0;
+    while (strncmp(op, Ops[k].str, strlen(Ops[k].str)) != 0) {
+        if (++k == sizeof(Ops) / sizeof(Ops[0])) {
+            return false;
+        }
+    }
+    term->op = Ops[k].op;
+    const char* value = op + strlen(Ops[k].str);
+    if (term->field == QUERY_SHA1) {
+        return (term->op == QUERY_EQ || term->op == QUERY_NE) && strlen(value) == 40
+            && ParseHex((const uint8_t*)value, 40, term->sha1);
+    }
+    if (term->field == QUERY_CRC32) {
+        uint8_t crc[4];
+        if ((term->op != QUERY_EQ && term->op != QUERY_NE) || strlen(value) != 8
+            || !ParseHex((const uint8_t*)value, 8, crc)
+        ) {
+            return false;
+        }
+        term->value = (uint64_t)crc[0] << 24 | crc[1] << 16 | crc[2] << 8 | crc[3];
+        return true;
+    }
+    return ParseQueryNumber(value, &term->value);
+}
+
+static bool CompareQueryValue(uint64_t a, QueryOp op, uint64_t b)
+{
+    switch (op) {
+    case QUERY_EQ: return a == b;
+    case QUERY_NE: return a != b;
+    case QUERY_LT: return a < b;
+    case QUERY_LE: return a <= b;
+    case QUERY_GT: return a > b;
+    default:       return a >= b;
+    }
+}
+
+static bool MatchQueryTerm(const Catalog* cat, size_t row, const QueryTerm* term)
+{
+    const NESInfoColumns* c = &cat->cols;
+    uint8_t d = cat->digests[row];
+    uint64_t v;
+    switch (term->field) {
+    case QUERY_MAPPER:    v = c->mapper[row]; break;
+    case QUERY_SUBMAPPER: v = c->submapper[row]; break;
+    case QUERY_PRG:       v = c->PRGSize[row]; break;
+    case QUERY_CHR:       v = c->CHRSize[row]; break;
+    case QUERY_SIZE:      v = cat->fileSize[row]; break;
+    case QUERY_CONSOLE:   v = c->consoleType[row]; break;
+    case QUERY_TIMING:    v = c->frameTiming[row]; break;
+    case QUERY_EXPANSION: v = c->expansion[row]; break;
+    case QUERY_BATTERY:   v = (c->flags[row] & NESINFO_F_BATTERY) != 0; break;
+    case QUERY_TRAINER:   v = (c->flags[row] & NESINFO_F_TRAINER) != 0; break;
+    case QUERY_4SCREEN:   v = (c->flags[row] & NESINFO_F_4SCREEN) != 0; break;
+    case QUERY_VERTICAL:  v = (c->flags[row] & NESINFO_F_VERT_MIRRORING) != 0; break;
+    case QUERY_NES20:     v = (c->flags[row] & NESINFO_F_EXTENDED) != 0; break;
+    case QUERY_CRC32: {
+        bool is_equal = ((d & CATALOG_D_FILE_CRC32) && cat->fileCRC32[row] == term->value)
+            || ((d & CATALOG_D_ROM_CRC32) && cat->romCRC32[row] == term->value);
+        return is_equal == (term->op == QUERY_EQ);
+    }
+    default: {
+        bool is_equal = ((d & CATALOG_D_FILE_SHA1) && memcmp(cat->fileSHA1 + row * 20, term->sha1, 20) == 0)
+            || ((d & CATALOG_D_ROM_SHA1) && memcmp(cat->romSHA1 + row * 20, term->sha1, 20) == 0);
+        return is_equal == (term->op == QUERY_EQ);
+    }
+    }
+    return CompareQueryValue(v, term->op, term->value);
+}
+
+// Key range of an index for one term; false if the term can't use one
+static bool GetQueryRange(const QueryTerm* term, const QueryTerm* terms, size_t count,
+    CatalogIndexType* type, uint64_t* lo, uint64_t* hi)
+{
+    if (term->op == QUERY_NE || IsQueryFlag(term->field)) {
+        return false;
+    }
+    uint64_t v = term->value;
+    uint64_t vlo = 0, vhi = UINT64_MAX;
+    switch (term->op) {
+    case QUERY_EQ: vlo = v; vhi = v; break;
+    case QUERY_LT: if (v == 0) { vlo = 1; vhi = 0; } else { vhi = v - 1; } break;
+    case QUERY_LE: vhi = v; break;
+    case QUERY_GT: if (v == UINT64_MAX) { vlo = 1; vhi = 0; } else { vlo = v + 1; } break;
+    default:       vlo = v; break;
+    }
+    switch (term->field) {
+    case QUERY_MAPPER:
+        *type = CATALOG_INDEX_MAPPER;
+        vlo = vlo > 0xFFFF ? 0xFFFF + 1 : vlo;
+        vhi = vhi > 0xFFFF ? 0xFFFF : vhi;
+        *lo = vlo << 8;
+        *hi = vhi << 8 | 0xFF;
+        // mapper=M submapper=S: one key
+        for (size_t i = 0; term->op == QUERY_EQ && i < count; i++) {
+            if (terms[i].field == QUERY_SUBMAPPER && terms[i].op == QUERY_EQ && terms[i].value <= 0xFF) {
+                *lo = vlo << 8 | terms[i].value;
+                *hi = *lo;
+            }
+        }
+        return true;
+    case QUERY_SUBMAPPER:
+        *type = CATALOG_INDEX_SUBMAPPER;
+        vlo = vlo > 0xFF ? 0xFF + 1 : vlo;
+        vhi = vhi > 0xFF ? 0xFF : vhi;
+        *lo = vlo << 16;
+        *hi = vhi << 16 | 0xFFFF;
+        return true;
+    case QUERY_PRG:
+    case QUERY_CHR:
+        *type = term->field == QUERY_PRG ? CATALOG_INDEX_PRG : CATALOG_INDEX_CHR;
+        *lo = vlo;
+        *hi = vhi;
+        return true;
+    case QUERY_CRC32:
+        *type = CATALOG_INDEX_CRC32;
+        *lo = v;
+        *hi = v;
+        return true;
+    case QUERY_SHA1:
+        *type = CATALOG_INDEX_SHA1;
+        *lo = 0;
+        for (int i = 0; i < 8; i++) {
+            *lo = *lo << 8 | term->sha1[i];
+        }
+        *hi = *lo;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int CompareRows(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static const char* CatalogIndexNames[CATALOG_INDEX_COUNT] = {
+    "mapper", "submapper", "PRG size", "CHR size", "CRC32", "SHA-1"
+};
+
+// nesinfo query CATALOG [CONDITION ...]: all conditions must hold. The most
+// selective indexed condition picks the candidate rows; the others are checked
+// on the columns. Returns 0 if rows match, 1 if none do, 2 on errors.
+int RunQuery(int argc, char* argv[])
+{
+    if (argc < 1) {
+        fprintf(stderr, "Error: query needs a catalogue file\n");
+        return 2;
+    }
+    QueryTerm* terms = (QueryTerm*)malloc((argc > 1 ? argc - 1 : 1) * sizeof(QueryTerm));
+    if (terms == NULL) {
+        fprintf(stderr, "Error: malloc()\n");
+        return 2;
+    }
+    size_t count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!ParseQueryTerm(argv[i], &terms[count++])) {
+            fprintf(stderr, "Bad condition: %s\n", argv[i]);
+            free(terms);
+            return 2;
+        }
+    }
+    Catalog cat;
+    if (!CatalogOpen(&cat, argv[0], false)) {
+        fprintf(stderr, "Error: can't read catalogue: %s\n", argv[0]);
+        free(terms);
+        return 2;
+    }
+
+    uint64_t start = StatsNow();
+    const CatalogIndexEntry* best = NULL;
+    size_t best_count = cat.rowCount;
+    int best_type = -1;
+    for (size_t i = 0; i < count; i++) {
+        CatalogIndexType type;
+        uint64_t lo, hi;
+        if (!GetQueryRange(&terms[i], terms, count, &type, &lo, &hi)) {
+            continue;
+        }
+        const CatalogIndexEntry* first = NULL;
+        size_t n = lo <= hi ? CatalogFindRange(&cat, type, lo, hi, &first) : 0;
+        if (n < best_count || best_type == -1) {
+            best = first;
+            best_count = n;
+            best_type = type;
+        }
+    }
+
+    // Candidate rows in catalogue order; CRC32/SHA-1 may list a row twice
+    uint32_t* rows = (uint32_t*)malloc((best_count ? best_count : 1) * sizeof(uint32_t));
+    if (rows == NULL) {
+        fprintf(stderr, "Error: malloc()\n");
+        CatalogClose(&cat);
+        free(terms);
+        return 2;
+    }
+    for (size_t k = 0; k < best_count; k++) {
+        rows[k] = best_type == -1 ? (uint32_t)k : best[k].row;
+    }
+    if (best_type != -1) {
+        qsort(rows, best_count, sizeof(uint32_t), CompareRows);
+    }
+    size_t match_count = 0;
+    for (size_t k = 0; k < best_count; k++) {
+        if (k != 0 && rows[k] == rows[k - 1]) {
+            continue;
+        }
+        bool is_match = true;
+        for (size_t i = 0; is_match && i < count; i++) {
+            is_match = MatchQueryTerm(&cat, rows[k], &terms[i]);
+        }
+        if (is_match) {
+            rows[match_count++] = rows[k];
+        }
+    }
+    double ms = (StatsNow() - start) / 1e6;
+
+    char buf[256];
+    Print("-------------*-----------------------------------------");
+    Print("\n              Query");
+    Print("\n-------------*-----------------------------------------");
+    Print("\nMapper  PRG KiB  CHR KiB  Flags  ROM CRC32  Path");
+    for (size_t k = 0; k < match_count; k++) {
+        uint32_t r = rows[k];
+        uint16_t flags = cat.cols.flags[r];
+        char crc[9] = "--------";
+        if (cat.digests[r] & CATALOG_D_ROM_CRC32) {
+            snprintf(crc, sizeof(crc), "%08X", cat.romCRC32[r]);
+        }
+        snprintf(buf, sizeof(buf), "\n%4u.%-2u %8" PRIu64 " %8" PRIu64 "  %c%c%c%c   %s  ",
+            cat.cols.mapper[r], cat.cols.submapper[r], cat.cols.PRGSize[r] / 1024, cat.cols.CHRSize[r] / 1024,
+            flags & NESINFO_F_BATTERY ? 'B' : '-', flags & NESINFO_F_TRAINER ? 'T' : '-',
+            flags & NESINFO_F_4SCREEN ? '4' : flags & NESINFO_F_VERT_MIRRORING ? 'V' : 'H',
+            flags & NESINFO_F_EXTENDED ? '2' : '-', crc);
+        Print(buf);
+        Print(CatalogPath(&cat, r));
+    }
+    Print("\n-------------*-----------------------------------------");
+    snprintf(buf, sizeof(buf), "\nMatches      : %" PRIuPTR " of %" PRIuPTR " files (%s%s, %.3f ms)\n",
+        match_count, cat.rowCount, best_type == -1 ? "full scan" : CatalogIndexNames[best_type],
+        best_type == -1 ? "" : " index", ms);
+    Print(buf);
+
+    free(rows);
+    CatalogClose(&cat);
+    free(terms);
+    return match_count != 0 ? 0 : 1;
+}
+
+
+// Catalogue merge (nesinfo merge)
+
+typedef struct {
+    const char* path;
+    uint32_t catalog;
+    uint32_t row;
+} MergeRow;
+
+// By path, then in command line order
+static int CompareMergeRows(const void* a, const void* b)
+{
+    const MergeRow* x = (const MergeRow*)a;
+    const MergeRow* y = (const MergeRow*)b;
+    int c = strcmp(x->path, y->path);
+    if (c != 0) {
+        return c;
+    }
+    if (x->catalog != y->catalog) {
+        return x->catalog < y->catalog ? -1 : 1;
+    }
+    return (x->row > y->row) - (x->row < y->row);
+}
+
+static bool IsSameEntry(const CatalogEntry* a, const CatalogEntry* b)
+{
+    return memcmp(a->header, b->header, HEADER_SIZE) == 0
+        && a->fileSize == b->fileSize
+        && a->digests == b->digests
+        && a->fileCRC32 == b->fileCRC32
+        && a->romCRC32 == b->romCRC32
+        && memcmp(a->fileSHA1, b->fileSHA1, 20) == 0
+        && memcmp(a->romSHA1, b->romSHA1, 20) == 0;
+}
+
+// Checks that the shard catalogues are all of the same split and root, each
+// shard given once and every row in the shard its path hashes to; returns the
+// problems found
+static size_t CheckShardCoverage(const Catalog* cats, char* const* names, size_t count)
+{
+    size_t problems = 0;
+    uint32_t shard_count = cats[0].shardCount;
+    bool* is_seen = (bool*)calloc((size_t)shard_count + 1, sizeof(bool));
+    if (is_seen == NULL) {
+        fprintf(stderr, "Error: calloc()\n");
+        return 1;
+    }
+    for (size_t c = 0; c < count; c++) {
+        const Catalog* cat = &cats[c];
+        if (cat->shardCount != shard_count) {
+            char a[32], b[32];
+            fprintf(stderr, "Error: %s holds %s, %s holds %s\n",
+                names[c], FormatShard(cat->shardIndex, cat->shardCount, a, sizeof(a)),
+                names[0], FormatShard(cats[0].shardIndex, shard_count, b, sizeof(b)));
+            problems++;
+            continue;
+        }
+        if (shard_count == 0) {
+            continue;
+        }
+        // The same root, or the relative paths (and so the split) don't match up
+        if (strcmp(cat->shardRoot, cats[0].shardRoot) != 0) {
+            fprintf(stderr, "Error: %s is of the shard root \"%s\", %s of \"%s\"\n",
+                names[c], cat->shardRoot, names[0], cats[0].shardRoot);
+            problems++;
+            continue;
+        }
+        if (is_seen[cat->shardIndex]) {
+            fprintf(stderr, "Error: shard %u/%u is given twice: %s\n", cat->shardIndex, shard_count, names[c]);
+            problems++;
+        }
+        is_seen[cat->shardIndex] = true;
+        for (size_t r = 0; r < cat->rowCount; r++) {
+            const char* path = CatalogPath(cat, r);
+            if (GetPathShard(path, shard_count) != cat->shardIndex) {
+                fprintf(stderr, "Error: %s is not in shard %u/%u: %s\n", path, cat->shardIndex, shard_count, names[c]);
+                problems++;
             }
-            snprintf(buf, sizeof(buf), "\nCHR      Size: %3u KiB = %6u B",
-                nh.CHRSize / 1024, nh.CHRSize);
-            Print(buf);
-            if (nh.CHRSize == 8 * 1024) {
-                Print(" (or 64 KiB)");
+        }
+    }
+    for (uint32_t i = 1; i <= shard_count; i++) {
+        if (!is_seen[i]) {
+            fprintf(stderr, "Error: shard %u/%u is missing\n", i, shard_count);
+            problems++;
+        }
+    }
+    free(is_seen);
+    return problems;
+}
+
+// nesinfo merge OUT CATALOG ...: one catalogue of the union, rows sorted by
+// path, a path given by several catalogues kept once. Exit code 0 = written,
+// 1 = shards missing, repeated or mixed (nothing written), 2 = error.
+int RunMerge(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Error: merge needs an output file and catalogues\n");
+        return 2;
+    }
+    const char* out_path = argv[0];
+    char** names = argv + 1;
+    size_t count = (size_t)argc - 1;
+    Catalog* cats = (Catalog*)calloc(count, sizeof(Catalog));
+    if (cats == NULL) {
+        fprintf(stderr, "Error: calloc()\n");
+        return 2;
+    }
+    size_t opened = 0;
+    size_t row_count = 0;
+    for (; opened < count; opened++) {
+        if (!CatalogOpen(&cats[opened], names[opened], false)) {
+            fprintf(stderr, "Error: can't read catalogue: %s\n", names[opened]);
+            break;
+        }
+        row_count += cats[opened].rowCount;
+    }
+
+    int result = 0;
+    MergeRow* rows = NULL;
+    CatalogEntry* entries = NULL;
+    const char** paths = NULL;
+    if (opened != count) {
+        result = 2;
+    }
+    else if (CheckShardCoverage(cats, names, count) != 0) {
+        result = 1;
+    }
+    else {
+        rows = (MergeRow*)malloc((row_count ? row_count : 1) * sizeof(MergeRow));
+        entries = (CatalogEntry*)malloc((row_count ? row_count : 1) * sizeof(CatalogEntry));
+        paths = (const char**)malloc((row_count ? row_count : 1) * sizeof(char*));
+        if (rows == NULL || entries == NULL || paths == NULL) {
+            fprintf(stderr, "Error: malloc()\n");
+            result = 2;
+        }
+    }
+
+    size_t n = 0;
+    size_t duplicates = 0;
+    size_t conflicts = 0;
+    if (result == 0) {
+        size_t k = 0;
+        for (size_t c = 0; c < count; c++) {
+            for (size_t r = 0; r < cats[c].rowCount; r++, k++) {
+                rows[k].path = CatalogPath(&cats[c], r);
+                rows[k].catalog = (uint32_t)c;
+                rows[k].row = (uint32_t)r;
             }
-            else if (nh.CHRSize == 64 * 1024) {
-                Print(" (or  8 KiB)");
+        }
+        qsort(rows, row_count, sizeof(MergeRow), CompareMergeRows);
+        for (k = 0; k < row_count; k++) {
+            CatalogEntry e;
+            CatalogGetEntry(&cats[rows[k].catalog], rows[k].row, &e);
+            if (n != 0 && strcmp(rows[k].path, paths[n - 1]) == 0) {
+                // The first one is kept
+                duplicates++;
+                if (!IsSameEntry(&e, &entries[n - 1])) {
+                    fprintf(stderr, "Warning: %s differs in %s, kept the first\n", rows[k].path,
+                        names[rows[k].catalog]);
+                    conflicts++;
+                }
+                continue;
             }
-            Print("\nCHR RAM      : "); Print(NoYesStr[(int)nh.isCHRRAM]);
-            Print("\nMirroring    : "); Print(MirroringStr[(int)nh.isVertMirroring]);
-            snprintf(buf, sizeof(buf), "\nMaker's Code : 0x%02X = ", nh.makerCode);
-            Print(buf);
-            Print(MakerNames[nh.makerCode]);
-            snprintf(buf, sizeof(buf), "\nChecksum     : PRG = %04X, CHR = %04X, Validation = %02X",
-                nh.PRGChecksum, nh.CHRChecksum, nh.validation);
-            Print(buf);
+            entries[n] = e;
+            paths[n++] = rows[k].path;
+        }
+
+        Catalog empty;
+        memset(&empty, 0, sizeof(empty));
+        if (!CatalogWrite(&empty, entries, paths, n, 0, 0, "", out_path)) {
+            fprintf(stderr, "Error: can't write catalogue: %s\n", out_path);
+            result = 2;
         }
     }
+
+    if (result == 0) {
+        char buf[256];
+        Print("-------------*-----------------------------------------");
+        Print("\n              Merge");
+        Print("\n-------------*-----------------------------------------");
+        if (cats[0].shardCount != 0) {
+            snprintf(buf, sizeof(buf), "\nCatalogues   : %" PRIuPTR " (shards 1-%u of %u, complete)",
+                count, cats[0].shardCount, cats[0].shardCount);
+        }
+        else {
+            snprintf(buf, sizeof(buf), "\nCatalogues   : %" PRIuPTR, count);
+        }
+        Print(buf);
+        snprintf(buf, sizeof(buf), "\nFiles        : %" PRIuPTR " (%" PRIuPTR " duplicates dropped, %" PRIuPTR
+            " differing)", n, duplicates, conflicts);
+        Print(buf);
+        Print("\nOutput       : ");
+        Print(out_path);
+        Print("\n");
+    }
+
+    free(rows);
+    free(entries);
+    free((void*)paths);
+    for (size_t c = 0; c < opened; c++) {
+        CatalogClose(&cats[c]);
+    }
+    free(cats);
+    return result;
 }
 
+void PrintUsage(const char* exe)
+{
+    printf("NES Header Info v" NES_HEADER_INFO_VER "\n");
+    printf("usage: %s [options] rom.nes [rom2.nes ...]\n", exe);
+    printf("       %s query CATALOG [CONDITION ...]\n", exe);
+    printf("       %s merge OUT CATALOG ...\n", exe);
+    printf("options:\n");
+    printf("  --header-only  decode iNES/NES 2.0 and Nintendo headers only, no hashes\n");
+    printf("  --hash=LIST    crc32,md5,sha1 (default: all)\n");
+    printf("  --regions=LIST file,rom,trainer,prg,chr,misc (default: all)\n");
+    printf("  --tiered       CRC32 only; SHA-1 just to confirm a nes20db.xml CRC32 hit\n");
+    printf("  --files-from=LIST  read more file paths from LIST, one per line (- = stdin)\n");
+    printf("  --jobs=N       process N files or archive members in parallel\n");
+    printf("  --shard i/N    only the files of shard i of N, split by a hash of the path relative to\n");
+    printf("                 the shard root, which is also the path kept in the catalogue; see merge\n");
+    printf("  --shard-root=DIR  root of the collection for --shard (default: current directory)\n");
+    printf("  --journal=FILE record every file reported without errors in FILE, synced about once a second\n");
+    printf("  --resume       with --journal, skip the files reported by the interrupted run and cut the\n");
+    printf("                 output back to its last record (append with >> to keep the earlier reports)\n");
+    printf("  --unordered    with --jobs, print reports as they complete instead of in input order\n");
+    printf("  --trust-zip-crc  take the File CRC32 of stored zip members from the archive\n");
+    printf("  --identify     find the layout of misheadered or headerless dumps in nes20db.xml\n");
+    printf("  --stats        per-phase timing, throughput, buffer pool and peak RSS to stderr\n");
+    printf("  --perf-counters  --stats plus cycles, instructions, LLC and branch misses per phase (Linux)\n");
+    printf("  --io=ENGINE    read-ahead of plain files: auto, uring, pool, sync (default: auto)\n");
+    printf("  --io-depth=N   files read ahead (default: 4)\n");
+    printf("  --direct       O_DIRECT reads, bypassing the page cache\n");
+    printf("  --huge-pages   back file buffers of 2 MiB and more with huge pages (Linux)\n");
+    printf("  --summary      collection totals after the reports: mappers, consoles, expansion devices,\n");
+    printf("                 maker codes, NES 2.0 share, size and nes20db.xml hit rate\n");
+    printf("  --summary-only the totals without the per-file reports\n");
+    printf("  --bank-index=FILE  add 8 KiB PRG/CHR and 1 KiB CHR bank fingerprints to FILE and report\n");
+    printf("                 the banks shared with earlier scans and the dedup saving\n");
+    printf("  --similar=FILE add MinHash sketches of the PRG/CHR 1 KiB blocks to FILE and list the\n");
+    printf("                 nearest ROMs of each file (hacks, translations, bad dumps) via LSH buckets\n");
+    printf("  --catalog=FILE keep the header fields, File/ROM CRC32 and SHA-1 and path of every file in FILE\n");
+    printf("  --filter=EXPR  only report files whose header matches EXPR, e.g. \"mapper==4 && battery\";\n");
+    printf("                 the others are rejected after the header read, before any hashing\n");
+    printf("  --watch DIR    report every .nes, .zip or .tar file written to DIR until it is removed (Linux)\n");
+    printf("  --diff a.nes b.nes  compare the headers field by field and PRG/CHR bank by bank;\n");
+    printf("                 exit code 0 = identical, 1 = different, 2 = error\n");
+    printf(".zip (stored, deflate) and .tar archives: every .nes member is processed\n");
+    printf("query conditions: FIELD=N, !=, <, <=, >, >= (N: 123, 0x7B, 512K, 1M) or a flag, !flag to negate\n");
+    printf("  fields: mapper, submapper, prg, chr, size, console, timing, expansion, crc32, sha1\n");
+    printf("  flags: battery, trainer, 4screen, vertical, nes20\n");
+    printf("merge: combines --catalog files of the shards 1/N..N/N (or any catalogues) into OUT,\n");
+    printf("  keeping each path once; exit code 0 = written, 1 = shards missing, repeated or of\n");
+    printf("  other shard roots, 2 = error\n");
+    printf("filter expressions: the query conditions but crc32/sha1, joined by &&, ||, ! and ( )\n");
+    printf("  more fields: prgram, prgnvram, chrram, chrnvram, misc, maker; flag: nh (Nintendo header)\n");
+    printf("optional: nes20db.xml in the current directory");
+}
 
+// Benchmarks link this file without main()
+#ifndef NESINFO_NO_MAIN
 int main(int argc, char* argv[])
 {
-    if (argc != 2) {
-        printf("NES Header Info v" NES_HEADER_INFO_VER "\n");
-        printf("usage: %s rom.nes\n", argv[0]);
-        printf("optional: nes20db.xml in the current directory");
-        return 1;
-    }
-
 #ifdef WINDOWS_ENCODING
     LPWSTR* w_argv;
     int w_argc;
@@ -1176,63 +6145,272 @@ int main(int argc, char* argv[])
         fprintf(stderr, "Error: CommandLineToArgvW()\n");
         return 1;
     }
-    // Debug
-    //for (int i = 0; i < w_argc; i++) {
-    //    // Bad: wprintf(L"%d: %ls\n", i, w_argv[i]);
-    //    printf("%d: ", i);
-    //    WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), w_argv[i], lstrlenW(w_argv[i]), NULL, NULL);
-    //    printf("\n");
-    //}
-
-    FILE* fp = _wfopen(w_argv[1], L"rb");
+    // Paths are kept in UTF-8, see OpenROMFile()
+    char** u_argv = (char**)calloc(w_argc + 1, sizeof(char*));
+    for (int i = 0; u_argv != NULL && i < w_argc; i++) {
+        int len = WideCharToMultiByte(CP_UTF8, 0, w_argv[i], -1, NULL, 0, NULL, NULL);
+        u_argv[i] = (char*)malloc(len > 0 ? len : 1);
+        if (u_argv[i] == NULL || len <= 0
+            || !WideCharToMultiByte(CP_UTF8, 0, w_argv[i], -1, u_argv[i], len, NULL, NULL)
+        ) {
+            fprintf(stderr, "Error: WideCharToMultiByte()\n");
+            return 1;
+        }
+    }
     LocalFree(w_argv);
-#else
-    FILE* fp = fopen(argv[1], "rb");
+    if (u_argv == NULL) {
+        fprintf(stderr, "Error: calloc()\n");
+        return 1;
+    }
+    argc = w_argc;
+    argv = u_argv;
 #endif
-    if (fp == NULL) {
-        fprintf(stderr, "Can't open: %s", argv[1]);
+
+    if (argc >= 2 && strcmp(argv[1], "query") == 0) {
+        return RunQuery(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "merge") == 0) {
+        return RunMerge(argc - 2, argv + 2);
+    }
+
+    FileList files = {0};
+    bool options_done = false;
+    for (int i = 1; i < argc; i++) {
+        bool ok = true;
+        if (options_done || strncmp(argv[i], "--", 2) != 0) {
+            ok = AddFile(&files, argv[i]);
+        }
+        else if (strcmp(argv[i], "--") == 0) {
+            options_done = true;
+        }
+        else if (strcmp(argv[i], "--header-only") == 0) {
+            g_opt.headerOnly = true;
+        }
+        else if (strncmp(argv[i], "--hash=", 7) == 0) {
+            ok = ParseKeyList(argv[i] + 7, HashKeys, 3, &g_opt.hashes);
+            g_opt.isHashesExplicit = true;
+        }
+        else if (strcmp(argv[i], "--tiered") == 0) {
+            g_opt.tiered = true;
+        }
+        else if (strncmp(argv[i], "--regions=", 10) == 0) {
+            ok = ParseKeyList(argv[i] + 10, RegionKeys, REGION_COUNT, &g_opt.regions);
+        }
+        else if (strncmp(argv[i], "--files-from=", 13) == 0) {
+            ok = files.listData == NULL && ReadFileList(&files, argv[i] + 13);
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            char* end;
+            long jobs = strtol(argv[i] + 7, &end, 10);
+            ok = *end == '\0' && jobs >= 1 && jobs <= 256;
+            g_opt.jobs = (int)jobs;
+        }
+        else if (strncmp(argv[i], "--shard=", 8) == 0) {
+            ok = ParseShard(argv[i] + 8);
+        }
+        else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            ok = ParseShard(argv[++i]);
+        }
+        else if (strncmp(argv[i], "--shard-root=", 13) == 0) {
+            g_opt.shardRoot = argv[i] + 13;
+            ok = *g_opt.shardRoot != '\0';
+        }
+        else if (strncmp(argv[i], "--journal=", 10) == 0) {
+            g_opt.journal = argv[i] + 10;
+            ok = *g_opt.journal != '\0';
+        }
+        else if (strcmp(argv[i], "--resume") == 0) {
+            g_opt.resume = true;
+        }
+        else if (strcmp(argv[i], "--unordered") == 0) {
+            g_opt.unordered = true;
+        }
+        else if (strcmp(argv[i], "--trust-zip-crc") == 0) {
+            g_opt.trustZipCRC = true;
+        }
+        else if (strcmp(argv[i], "--identify") == 0) {
+            g_opt.identify = true;
+        }
+        else if (strcmp(argv[i], "--stats") == 0) {
+            g_opt.stats = true;
+        }
+        else if (strcmp(argv[i], "--perf-counters") == 0) {
+            g_opt.perfCounters = true;
+            g_opt.stats = true;
+        }
+        else if (strncmp(argv[i], "--io=", 5) == 0) {
+            const char* name = argv[i] + 5;
+            ok = false;
+            for (int e = IO_ENGINE_SYNC; e <= IO_ENGINE_AUTO; e++) {
+                if (strcmp(name, IOEngineName((IOEngineType)e)) == 0) {
+                    g_opt.io = (IOEngineType)e;
+                    ok = true;
+                }
+            }
+        }
+        else if (strncmp(argv[i], "--io-depth=", 11) == 0) {
+            char* end;
+            long depth = strtol(argv[i] + 11, &end, 10);
+            ok = *end == '\0' && depth >= 1 && depth <= 64;
+            g_opt.ioDepth = (int)depth;
+        }
+        else if (strcmp(argv[i], "--direct") == 0) {
+            g_opt.direct = true;
+        }
+        else if (strcmp(argv[i], "--huge-pages") == 0) {
+            g_opt.hugePages = true;
+        }
+        else if (strcmp(argv[i], "--summary") == 0) {
+            g_opt.summary = true;
+        }
+        else if (strncmp(argv[i], "--bank-index=", 13) == 0) {
+            g_opt.bankIndex = argv[i] + 13;
+            ok = *g_opt.bankIndex != '\0';
+        }
+        else if (strcmp(argv[i], "--summary-only") == 0) {
+            g_opt.summary = true;
+            g_opt.summaryOnly = true;
+        }
+        else if (strncmp(argv[i], "--similar=", 10) == 0) {
+            g_opt.similar = argv[i] + 10;
+            ok = *g_opt.similar != '\0';
+        }
+        else if (strncmp(argv[i], "--catalog=", 10) == 0) {
+            g_opt.catalog = argv[i] + 10;
+            ok = *g_opt.catalog != '\0';
+        }
+        else if (strncmp(argv[i], "--filter=", 9) == 0) {
+            g_opt.filter = argv[i] + 9;
+            ok = *g_opt.filter != '\0';
+        }
+        else if (strcmp(argv[i], "--watch") == 0) {
+            g_opt.watch = true;
+        }
+        else if (strcmp(argv[i], "--diff") == 0) {
+            g_opt.diff = true;
+        }
+        else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            FreeFileList(&files);
+            return 1;
+        }
+        if (!ok) {
+            fprintf(stderr, "Bad argument: %s\n", argv[i]);
+            FreeFileList(&files);
+            return 1;
+        }
+    }
+    if (files.count == 0) {
+        PrintUsage(argv[0]);
+        FreeFileList(&files);
         return 1;
     }
-    size_t file_size = GetFILESize(fp);
-    if (file_size == (size_t)-1) {
-        fprintf(stderr, "Error: GetFileSize()");
-        fclose(fp);
+
+    if (g_opt.headerOnly && g_opt.bankIndex != NULL) {
+        fprintf(stderr, "Error: --bank-index needs the ROM data, not --header-only\n");
+        FreeFileList(&files);
         return 1;
     }
-    if (file_size < MIN_FILE_SIZE) {
-        fprintf(stderr, "Error: file size is too small");
-        fclose(fp);
+    if (g_opt.headerOnly && g_opt.similar != NULL) {
+        fprintf(stderr, "Error: --similar needs the ROM data, not --header-only\n");
+        FreeFileList(&files);
         return 1;
     }
-    uint8_t* source = (uint8_t*)malloc(file_size);
-    if (source == NULL) {
-        fprintf(stderr, "Error: malloc()");
-        fclose(fp);
+
+    if (g_opt.shardRoot != NULL && g_opt.shardCount == 0) {
+        fprintf(stderr, "Error: --shard-root needs --shard i/N\n");
+        FreeFileList(&files);
         return 1;
     }
-    size_t read_bytes = fread(source, sizeof(uint8_t), file_size, fp);
-    if (read_bytes != file_size) {
-        fprintf(stderr, "Can't read: %s", argv[1]);
-        fclose(fp);
-        free(source);
+    if (g_opt.shardCount != 0 && !InitShardRoot()) {
+        FreeFileList(&files);
         return 1;
     }
-    fclose(fp);
 
-    if (memcmp(source, "NES\x1A", 4)) {
-        fprintf(stderr, "Error: file is not an iNES ROM image");
-        free(source);
+    if (g_opt.diff) {
+        int result = 2;
+        if (files.count != 2) {
+            fprintf(stderr, "Error: --diff needs two ROM files\n");
+        }
+        else {
+            result = DiffROMs(files.paths[0], files.paths[1]);
+        }
+        FreeFileList(&files);
+        return result;
+    }
+
+    if (g_opt.filter != NULL) {
+        char error[128];
+        if (!FilterCompile(g_opt.filter, &g_filter, error, sizeof(error))) {
+            fprintf(stderr, "Error: --filter: %s: %s\n", error, g_opt.filter);
+            FreeFileList(&files);
+            return 1;
+        }
+    }
+
+    // Before anything is printed: --resume may cut the output back
+    if (g_opt.resume && g_opt.journal == NULL) {
+        fprintf(stderr, "Error: --resume needs --journal=FILE\n");
+        FreeFileList(&files);
+        FilterFree(&g_filter);
+        return 1;
+    }
+    if (g_opt.journal != NULL && !OpenJournal(g_opt.journal, g_opt.resume)) {
+        FreeFileList(&files);
+        FilterFree(&g_filter);
+        CloseJournal();
         return 1;
     }
 
-    OpenNES20DB();
+    // The database is searched by SHA-1, or by CRC32 first in tiered mode
+    if (!g_opt.headerOnly && ((g_opt.hashes & HASH_SHA1) || g_opt.tiered || g_opt.identify)) {
+        OpenNES20DB();
+    }
 
-    PrintNESInfo(source, file_size);
+    if (g_opt.watch) {
+        int result = 1;
+        if (files.count != 1) {
+            fprintf(stderr, "Error: --watch needs one directory\n");
+        }
+        else {
+            fflush(stdout);
+            result = WatchDirectory(files.paths[0]);
+        }
+        FreeFileList(&files);
+        CloseNES20DB();
+        FilterFree(&g_filter);
+        CloseJournal();
+        return result;
+    }
 
+    JobList jobs = {0};
+    int result = 0;
+    if (!BuildJobList(&jobs, &files)) {
+        fprintf(stderr, "Error: malloc()\n");
+        result = 1;
+    }
+    else {
+        if (jobs.resumed != 0) {
+            fprintf(stderr, "--resume: %" PRIuPTR " files already reported, %" PRIuPTR " to go\n",
+                jobs.resumed, jobs.count);
+        }
+        if (jobs.count != 0) {
+            fflush(stdout);
+            result = RunBatch(&jobs, files.count > 1 || jobs.archiveCount != 0, NULL);
+        }
+    }
+    if (jobs.hasErrors) {
+        result = 1;
+    }
+
+    FreeJobList(&jobs);
+    FreeFileList(&files);
     CloseNES20DB();
-    free(source);
-    return 0;
+    FilterFree(&g_filter);
+    CloseJournal();
+    return result;
 }
+#endif
 
 
 // NES 2.0 XML Database
@@ -1268,7 +6446,15 @@ void OpenNES20DB(void)
     }
     g_nes20db = source;
     g_nes20db_size = file_size;
-    printf("nes20db.xml is found\n");
+    if (!BuildNES20DBIndex()) {
+        fprintf(stderr, "Error: malloc() - nes20db.xml index");
+        CloseNES20DB();
+        return;
+    }
+    // A resumed run continues after the first run's reports
+    if (g_journal.doneCount == 0) {
+        printf("nes20db.xml is found\n");
+    }
 }
 
 void CloseNES20DB(void)
@@ -1276,59 +6462,389 @@ void CloseNES20DB(void)
     free(g_nes20db);
     g_nes20db = NULL;
     g_nes20db_size = 0;
+    free(g_db.entries);
+    free(g_db.bySHA1);
+    free(g_db.games);
+    memset(&g_db, 0, sizeof(g_db));
+}
+
+// Value of attribute `name` inside the element [el, el + el_len)
+const uint8_t* XMLAttr(const uint8_t* el, size_t el_len, const char* name, size_t* value_len)
+{
+    char key[32];
+    size_t key_len = (size_t)snprintf(key, sizeof(key), " %s=\"", name);
+    const uint8_t* f = bytes_find(el, el_len, (const uint8_t*)key, key_len);
+    if (f == NULL) {
+        return NULL;
+    }
+    f += key_len;
+    const uint8_t* fend = memchr(f, '"', el_len - (f - el));
+    if (fend == NULL) {
+        return NULL;
+    }
+    *value_len = fend - f;
+    return f;
+}
+
+// Upper or lower case hex, exactly `len` digits
+bool ParseHex(const uint8_t* s, size_t len, uint8_t* out)
+{
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = s[i];
+        uint8_t v;
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+        else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else return false;
+        if (i & 1) out[i / 2] |= v;
+        else       out[i / 2] = v << 4;
+    }
+    return true;
+}
+
+// Entries without a CRC32 (kept as 0) come after the real ones of that CRC32,
+// so they can't hide an entry whose CRC32 is 00000000
+int CompareDBEntryCRC(const void* a, const void* b)
+{
+    const DBEntry* x = (const DBEntry*)a;
+    const DBEntry* y = (const DBEntry*)b;
+    if (x->crc32 != y->crc32) return x->crc32 < y->crc32 ? -1 : 1;
+    if (x->hasCRC32 != y->hasCRC32) return x->hasCRC32 ? -1 : 1;
+    if (x->size != y->size) return x->size < y->size ? -1 : 1;
+    return x->game < y->game ? -1 : (x->game > y->game);
+}
+
+int CompareDBEntrySHA1(const void* a, const void* b)
+{
+    const DBEntry* x = &g_db.entries[*(const uint32_t*)a];
+    const DBEntry* y = &g_db.entries[*(const uint32_t*)b];
+    // Entries without a SHA-1 go last
+    if (x->hasSHA1 != y->hasSHA1) return x->hasSHA1 ? -1 : 1;
+    int c = memcmp(x->sha1, y->sha1, sizeof(x->sha1));
+    if (c != 0) return c;
+    return x->game < y->game ? -1 : (x->game > y->game);
+}
+
+// One pass over the XML: every <game> with its name comment and every
+// element inside it that has a crc32 or sha1 attribute.
+// "<prgrom size=..." -> DB_KIND_PRG
+uint8_t GetDBKind(const uint8_t* tag, size_t len)
+{
+    static const char* Tags[] = { "rom", "prgrom", "chrrom", "trainer", "miscrom" };
+    for (size_t i = 0; i < sizeof(Tags) / sizeof(Tags[0]); i++) {
+        size_t n = strlen(Tags[i]);
+        if (len > n && memcmp(tag, Tags[i], n) == 0 && (tag[n] == ' ' || tag[n] == '/')) {
+            return (uint8_t)(DB_KIND_ROM + i);
+        }
+    }
+    return DB_KIND_OTHER;
 }
 
-void PrintNES20DB(const char* hash)
+bool BuildNES20DBIndex(void)
 {
+    const uint8_t* end = g_nes20db + g_nes20db_size;
     const uint8_t* pos = g_nes20db;
-    const size_t hash_len = strlen(hash); // SHA-1: 40
+    size_t entries_cap = 0;
+    size_t games_cap = 0;
+
     for (;;) {
-        const uint8_t* f = bytes_find(pos, g_nes20db_size - (pos - g_nes20db),
-                                      (const uint8_t*)hash, hash_len);
-        if (f == NULL) {
-            return;
+        const uint8_t* game = bytes_find(pos, end - pos, (const uint8_t*)"<game>", 6);
+        if (game == NULL) {
+            break;
         }
-        pos = f + hash_len;
-        pos = bytes_find(pos, g_nes20db_size - (pos - g_nes20db),
-                         (const uint8_t*)"</game>", 7);
-        if (pos == NULL) {
-            return;
+        const uint8_t* game_end = bytes_find(game, end - game, (const uint8_t*)"</game>", 7);
+        if (game_end == NULL) {
+            break;
         }
-        pos += 7;
+        pos = game_end + 7;
 
-        f = bytes_rfind(g_nes20db, (f - g_nes20db),
-                        (const uint8_t*)"<!-- ", 5);
-        if (f == NULL) {
-            return;
+        if (g_db.gameCount == games_cap) {
+            games_cap = games_cap ? games_cap * 2 : 1024;
+            DBGame* p = (DBGame*)realloc(g_db.games, games_cap * sizeof(DBGame));
+            if (p == NULL) {
+                return false;
+            }
+            g_db.games = p;
         }
-        f += 5;
-        const uint8_t* fend = bytes_find(f, g_nes20db_size - (f - g_nes20db),
-                                         (const uint8_t*)" -->", 4);
-        if (fend == NULL) {
-            return;
+        DBGame* g = &g_db.games[g_db.gameCount];
+        g->name = NULL;
+        g->nameLen = 0;
+        g->xml = game;
+        g->xmlLen = (uint32_t)(game_end + 7 - game);
+        const uint8_t* f = bytes_find(game, game_end - game, (const uint8_t*)"<!-- ", 5);
+        if (f != NULL) {
+            f += 5;
+            const uint8_t* fend = bytes_find(f, game_end - f, (const uint8_t*)" -->", 4);
+            if (fend != NULL) {
+                g->name = f;
+                g->nameLen = (uint32_t)(fend - f);
+            }
         }
 
-        size_t name_len = fend - f;
-#ifdef WINDOWS_ENCODING
-        wchar_t bufw[256 + 1] = {0};
-        int convertResult = MultiByteToWideChar(CP_UTF8, 0, (const char*)f, name_len, bufw, 256);
-        if (convertResult > 0 && name_len != 0) {
-            printf("\n");
-            WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), bufw, lstrlenW(bufw), NULL, NULL);
+        for (const uint8_t* el = game + 6; ; ) {
+            el = memchr(el, '<', game_end - el);
+            if (el == NULL || el >= game_end) {
+                break;
+            }
+            const uint8_t* el_end = memchr(el, '>', game_end - el);
+            if (el_end == NULL) {
+                break;
+            }
+            size_t el_len = el_end - el;
+            size_t crc_len = 0, sha1_len = 0, size_len = 0;
+            const uint8_t* crc = XMLAttr(el, el_len, "crc32", &crc_len);
+            const uint8_t* sha1 = XMLAttr(el, el_len, "sha1", &sha1_len);
+            const uint8_t* size = XMLAttr(el, el_len, "size", &size_len);
+            uint8_t kind = GetDBKind(el + 1, el_len - 1);
+            el = el_end;
+            if (crc == NULL && sha1 == NULL) {
+                continue;
+            }
+
+            if (g_db.entryCount == entries_cap) {
+                entries_cap = entries_cap ? entries_cap * 2 : 4096;
+                DBEntry* p = (DBEntry*)realloc(g_db.entries, entries_cap * sizeof(DBEntry));
+                if (p == NULL) {
+                    return false;
+                }
+                g_db.entries = p;
+            }
+            DBEntry* e = &g_db.entries[g_db.entryCount];
+            memset(e, 0, sizeof(*e));
+            e->game = (uint32_t)g_db.gameCount;
+            e->kind = kind;
+            uint8_t crc_bytes[4];
+            if (crc != NULL && crc_len == 8 && ParseHex(crc, 8, crc_bytes)) {
+                e->crc32 = ((uint32_t)crc_bytes[0] << 24) | (crc_bytes[1] << 16)
+                         | (crc_bytes[2] << 8) | crc_bytes[3];
+                e->hasCRC32 = true;
+            }
+            if (sha1 != NULL && sha1_len == 40 && ParseHex(sha1, 40, e->sha1)) {
+                e->hasSHA1 = true;
+            }
+            for (size_t i = 0; size != NULL && i < size_len && size[i] >= '0' && size[i] <= '9'; i++) {
+                e->size = e->size * 10 + (size[i] - '0');
+            }
+            if (e->hasCRC32 || e->hasSHA1) {
+                g_db.entryCount++;
+                if (kind == DB_KIND_CHR && e->size > g_db.maxCHRSize) {
+                    g_db.maxCHRSize = e->size;
+                }
+            }
+        }
+        g_db.gameCount++;
+    }
+
+    qsort(g_db.entries, g_db.entryCount, sizeof(DBEntry), CompareDBEntryCRC);
+    g_db.bySHA1 = (uint32_t*)malloc((g_db.entryCount + 1) * sizeof(uint32_t));
+    if (g_db.bySHA1 == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < g_db.entryCount; i++) {
+        g_db.bySHA1[i] = (uint32_t)i;
+    }
+    qsort(g_db.bySHA1, g_db.entryCount, sizeof(uint32_t), CompareDBEntrySHA1);
+    return true;
+}
+
+// First entry with this CRC32 and size (size 0 = any), or NULL.
+// Matches are adjacent: iterate while hasCRC32, crc32 and size still match.
+const DBEntry* FindDBEntryCRC(uint32_t crc32, uint64_t size)
+{
+    size_t lo = 0, hi = g_db.entryCount;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const DBEntry* e = &g_db.entries[mid];
+        if (e->crc32 < crc32 || (e->crc32 == crc32 && e->hasCRC32 && size != 0 && e->size < size)) {
+            lo = mid + 1;
         }
         else {
-            printf("\nError: MultiByteToWideChar()");
+            hi = mid;
         }
-#else
-        char buf[256 + 1] = {0};
-        if (name_len + 1 > sizeof(buf)) {
-            name_len = sizeof(buf) - 1;
+    }
+    if (lo < g_db.entryCount) {
+        const DBEntry* e = &g_db.entries[lo];
+        if (e->hasCRC32 && e->crc32 == crc32 && (size == 0 || e->size == size)) {
+            return e;
         }
-        memcpy(buf, f, name_len);
-        buf[name_len] = '\0';
-        printf("\n%s", buf);
-#endif
     }
+    return NULL;
+}
+
+// Position in g_db.bySHA1 of the first entry with this SHA-1, or entryCount
+size_t FindDBEntrySHA1(const uint8_t sha1[20])
+{
+    size_t lo = 0, hi = g_db.entryCount;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const DBEntry* e = &g_db.entries[g_db.bySHA1[mid]];
+        if (e->hasSHA1 && memcmp(e->sha1, sha1, 20) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if (lo < g_db.entryCount && g_db.entries[g_db.bySHA1[lo]].hasSHA1
+        && memcmp(g_db.entries[g_db.bySHA1[lo]].sha1, sha1, 20) == 0
+    ) {
+        return lo;
+    }
+    return g_db.entryCount;
+}
+
+// Attribute of the first <element ...> in the game block
+const uint8_t* GetDBGameAttr(const DBGame* game, const char* element, const char* attr, size_t* value_len)
+{
+    char tag[32];
+    size_t tag_len = (size_t)snprintf(tag, sizeof(tag), "<%s ", element);
+    const uint8_t* el = bytes_find(game->xml, game->xmlLen, (const uint8_t*)tag, tag_len);
+    if (el == NULL) {
+        return NULL;
+    }
+    const uint8_t* el_end = memchr(el, '>', game->xmlLen - (el - game->xml));
+    if (el_end == NULL) {
+        return NULL;
+    }
+    return XMLAttr(el, el_end - el, attr, value_len);
+}
+
+uint64_t GetDBGameValue(const DBGame* game, const char* element, const char* attr, uint64_t def)
+{
+    size_t len = 0;
+    const uint8_t* f = GetDBGameAttr(game, element, attr, &len);
+    if (f == NULL || len == 0) {
+        return def;
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < len && f[i] >= '0' && f[i] <= '9'; i++) {
+        value = value * 10 + (f[i] - '0');
+    }
+    return value;
+}
+
+// NES 2.0 ROM size: units in lsb + msb nibble, else the exponent-multiplier form
+// Units, or else 2^E * (MM * 2 + 1) bytes: false if the odd part is over 7
+static bool SetHeaderROMSize(uint8_t* lsb, uint8_t* byte9, int shift, uint64_t size, uint64_t unit)
+{
+    if (size % unit == 0 && size / unit < 0xF00) {
+        *lsb = (uint8_t)(size / unit);
+        *byte9 |= (uint8_t)((size / unit >> 8) << shift);
+        return true;
+    }
+    uint8_t e = 0;
+    while (size % 2 == 0 && e < 63) {
+        size /= 2;
+        e++;
+    }
+    if (size > 7) {
+        return false;
+    }
+    *lsb = (uint8_t)((e << 2) | (size / 2));
+    *byte9 |= (uint8_t)(0x0F << shift);
+    return true;
+}
+
+// 64 << shift bytes; 0 = none
+static uint8_t GetRAMShift(uint64_t size)
+{
+    uint8_t shift = 0;
+    while (size > ((uint64_t)64 << shift) && shift < 15) {
+        shift++;
+    }
+    return size != 0 ? shift : 0;
+}
+
+// NES 2.0 header rebuilt from the game's pcb, console, prgrom, ... elements;
+// false if a ROM size has no NES 2.0 encoding
+bool GetDBGameHeader(const DBGame* game, uint8_t header[HEADER_SIZE])
+{
+    if (game->xml == NULL) {
+        return false;
+    }
+    memset(header, 0, HEADER_SIZE);
+    memcpy(header, "NES\x1A", 4);
+
+    uint64_t mapper = GetDBGameValue(game, "pcb", "mapper", 0);
+    uint64_t submapper = GetDBGameValue(game, "pcb", "submapper", 0);
+    size_t mirroring_len = 0;
+    const uint8_t* mirroring = GetDBGameAttr(game, "pcb", "mirroring", &mirroring_len);
+    char mirroring_char = mirroring != NULL && mirroring_len != 0 ? (char)mirroring[0] : 'H';
+
+    if (!SetHeaderROMSize(&header[4], &header[9], 0, GetDBGameValue(game, "prgrom", "size", 0), 16 * 1024)
+        || !SetHeaderROMSize(&header[5], &header[9], 4, GetDBGameValue(game, "chrrom", "size", 0), 8 * 1024)
+    ) {
+        return false;
+    }
+    header[6] = (uint8_t)((mapper & 0x0F) << 4);
+    if (mirroring_char == 'V') {
+        header[6] |= NESINFO_F_VERT_MIRRORING;
+    }
+    else if (mirroring_char == '4') {
+        header[6] |= NESINFO_F_4SCREEN;
+    }
+    if (GetDBGameValue(game, "pcb", "battery", 0) != 0) {
+        header[6] |= NESINFO_F_BATTERY;
+    }
+    if (GetDBGameValue(game, "trainer", "size", 0) != 0) {
+        header[6] |= NESINFO_F_TRAINER;
+    }
+
+    uint64_t console = GetDBGameValue(game, "console", "type", 0);
+    header[7] = (uint8_t)((mapper & 0xF0) | 0x08 | (console < 3 ? console : 3));
+    header[8] = (uint8_t)(((mapper >> 8) & 0x0F) | ((submapper & 0x0F) << 4));
+    header[10] = (uint8_t)(GetRAMShift(GetDBGameValue(game, "prgram", "size", 0))
+        | (GetRAMShift(GetDBGameValue(game, "prgnvram", "size", 0)) << 4));
+    header[11] = (uint8_t)(GetRAMShift(GetDBGameValue(game, "chrram", "size", 0))
+        | (GetRAMShift(GetDBGameValue(game, "chrnvram", "size", 0)) << 4));
+    header[12] = (uint8_t)(GetDBGameValue(game, "console", "region", 0) & 3);
+    if (console == 1) {
+        header[13] = (uint8_t)((GetDBGameValue(game, "vs", "ppu", 0) & 0x0F)
+            | ((GetDBGameValue(game, "vs", "hardware", 0) & 0x0F) << 4));
+    }
+    else if (console >= 3) {
+        header[13] = (uint8_t)(console & 0x0F);
+    }
+    header[14] = (uint8_t)(GetDBGameValue(game, "miscrom", "number", 0) & 3);
+    header[15] = (uint8_t)(GetDBGameValue(game, "expansion", "type", 0) & 0x3F);
+    return true;
+}
+
+void PrintDBGameName(const DBGame* game)
+{
+    if (game->name == NULL) {
+        return;
+    }
+    // UTF-8 as is; WriteOut() converts for the Windows console
+    char buf[256 + 1] = {0};
+    size_t name_len = game->nameLen;
+    if (name_len + 1 > sizeof(buf)) {
+        name_len = sizeof(buf) - 1;
+    }
+    memcpy(buf, game->name, name_len);
+    buf[name_len] = '\0';
+    Print("\n");
+    Print(buf);
+}
+
+// Prints the name of each game with this SHA-1 once; returns the game count
+size_t PrintNES20DB(const uint8_t sha1[20])
+{
+    size_t count = 0;
+    uint32_t prev_game = UINT32_MAX;
+    for (size_t i = FindDBEntrySHA1(sha1); i < g_db.entryCount; i++) {
+        const DBEntry* e = &g_db.entries[g_db.bySHA1[i]];
+        if (!e->hasSHA1 || memcmp(e->sha1, sha1, 20) != 0) {
+            break;
+        }
+        if (e->game == prev_game) {
+            continue;
+        }
+        prev_game = e->game;
+        PrintDBGameName(&g_db.games[e->game]);
+        count++;
+    }
+    return count;
 }
 
 uint8_t* bytes_find(
@@ -1384,66 +6900,6 @@ long GetFILESize(FILE* file)
     return size;
 }
 
-// https://create.stephan-brumme.com/crc32/
-static uint32_t Crc32Lookup[8][256];
-void CRC32Init(void)
-{
-    Crc32Lookup[0][0] = 0;
-    // compute each power of two (all numbers with exactly one bit set)
-    uint32_t crc = Crc32Lookup[0][0x80] = 0xEDB88320;
-    for (size_t next = 0x40; next != 0; next >>= 1) {
-        crc = (crc >> 1) ^ ((crc & 1) * 0xEDB88320);
-        Crc32Lookup[0][next] = crc;
-    }
-    // compute all values between two powers of two
-    // i.e. 3, 5,6,7, 9,10,11,12,13,14,15, 17,...
-    for (size_t powerOfTwo = 2; powerOfTwo <= 0x80; powerOfTwo <<= 1) {
-        uint32_t crcExtraBit = Crc32Lookup[0][powerOfTwo];
-        for (size_t i = 1; i < powerOfTwo; i++)
-            Crc32Lookup[0][i + powerOfTwo] = Crc32Lookup[0][i] ^ crcExtraBit;
-    }
-    for (size_t i = 0; i <= 0xFF; i++) {
-        // for Slicing-by-4 and Slicing-by-8
-        Crc32Lookup[1][i] = (Crc32Lookup[0][i] >> 8) ^ Crc32Lookup[0][Crc32Lookup[0][i] & 0xFF];
-        Crc32Lookup[2][i] = (Crc32Lookup[1][i] >> 8) ^ Crc32Lookup[0][Crc32Lookup[1][i] & 0xFF];
-        Crc32Lookup[3][i] = (Crc32Lookup[2][i] >> 8) ^ Crc32Lookup[0][Crc32Lookup[2][i] & 0xFF];
-        // only Slicing-by-8
-        Crc32Lookup[4][i] = (Crc32Lookup[3][i] >> 8) ^ Crc32Lookup[0][Crc32Lookup[3][i] & 0xFF];
-        Crc32Lookup[5][i] = (Crc32Lookup[4][i] >> 8) ^ Crc32Lookup[0][Crc32Lookup[4][i] & 0xFF];
-        Crc32Lookup[6][i] = (Crc32Lookup[5][i] >> 8) ^ Crc32Lookup[0][Crc32Lookup[5][i] & 0xFF];
-        Crc32Lookup[7][i] = (Crc32Lookup[6][i] >> 8) ^ Crc32Lookup[0][Crc32Lookup[6][i] & 0xFF];
-    }
-}
-
-// Endian-independent
-uint32_t CRC32(const uint8_t* data, size_t length)
-{
-    const uint8_t* current = data;
-    uint32_t crc = 0xFFFFFFFF; // ~previousCrc32;
-    // process eight bytes at once
-    while (length >= 8) {
-        uint32_t one = (current[0]      ) |
-                       (current[1] <<  8) |
-                       (current[2] << 16) |
-                       (current[3] << 24);
-        one ^= crc;
-        crc = Crc32Lookup[7][(one      ) & 0xFF] ^
-              Crc32Lookup[6][(one >>  8) & 0xFF] ^
-              Crc32Lookup[5][(one >> 16) & 0xFF] ^
-              Crc32Lookup[4][(one >> 24)       ] ^
-              Crc32Lookup[3][current[4]] ^
-              Crc32Lookup[2][current[5]] ^
-              Crc32Lookup[1][current[6]] ^
-              Crc32Lookup[0][current[7]];
-        current += 8;
-        length -= 8;
-    }
-    // remaining 1 to 7 bytes
-    while (length--)
-        crc = (crc >> 8) ^ Crc32Lookup[0][(crc & 0xFF) ^ *current++];
-    return ~crc;
-}
-
 void SHA1_to_hex(const uint8_t hash[20], char str[41])
 {
     for (size_t i = 0; i < 20; i++) {
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// Const
+
+#define HEADER_SIZE     16
+#define TRAINER_SIZE    512
+#define MIN_FILE_SIZE   HEADER_SIZE
+#define EXPANSION_COUNT 54
+#define MAPPER_COUNT    256
+
+
+// iNES / NES 2.0 header
+
+typedef struct {
+    uint32_t mapper;
+    uint32_t submapper;
+    uint64_t PRGSize;
+    uint64_t CHRSize;
+    bool isBattery;
+    bool isTrainer;
+    bool is4Screen;
+    bool isVertMirroring;
+    bool isExtended;
+    bool isPAL_iNES;
+    uint32_t PRGRAMSize8K_iNES;
+    uint32_t PRGRAMSize;
+    uint32_t CHRRAMSize;
+    uint32_t PRGSaveRAMSize;
+    uint32_t CHRSaveRAMSize;
+    uint32_t frameTiming;
+    uint32_t consoleType1;
+    uint32_t consoleType2;
+    uint32_t consoleType3;
+    uint32_t miscROMs;
+    uint32_t expansion;
+} NESInfo;
+
+NESInfo GetNESInfo(const uint8_t* header);
+
+// Structure-of-arrays form of NESInfo for many headers at once.
+// Each column has room for `count` values (see GetNESInfoBatch).
+enum {
+    NESINFO_F_VERT_MIRRORING = 1 << 0, // Header byte 6, bits 0-3
+    NESINFO_F_BATTERY        = 1 << 1,
+    NESINFO_F_TRAINER        = 1 << 2,
+    NESINFO_F_4SCREEN        = 1 << 3,
+    NESINFO_F_EXTENDED       = 1 << 4, // NES 2.0
+    NESINFO_F_PAL_INES       = 1 << 5, // iNES only
+    NESINFO_F_MISC_SHIFT     = 6       // NES 2.0 miscROMs, 2 bits
+};
+
+typedef struct {
+    uint16_t* mapper;
+    uint8_t* submapper;
+    uint64_t* PRGSize;
+    uint64_t* CHRSize;
+    uint16_t* flags;        // NESINFO_F_*
+    uint8_t* frameTiming;
+    uint8_t* consoleType;   // consoleType1
+    uint8_t* consoleExt;    // consoleType2 | consoleType3 << 4
+    uint8_t* expansion;
+} NESInfoColumns;
+
+void GetNESInfoBatch(const uint8_t* headers, size_t count, NESInfoColumns* cols);
+
+// https://wiki.nesdev.org/w/index.php?title=Nintendo_header
+typedef struct {
+    char title[16 + 1];    // $FFE0-$FFEF. ASCII (0x20 - 0x5A).
+    uint16_t PRGChecksum;  // $FFF0-$FFF1.
+    uint16_t CHRChecksum;  // $FFF2-$FFF3.
+    uint32_t PRGSize;      // $FFF4. D7-D4: PRG size.
+    uint32_t CHRSize;      //        D2-D0: CHR size.
+    bool isCHRRAM;         //        D3: 0 = CHR ROM, 1 = CHR RAM.
+    bool isVertMirroring;  // $FFF5. D7: 0 = Vertical, 1 = Horizontal.
+    uint8_t mapper;        //        D6-D0: 0 = NROM, 1 = CNROM, 2 = UNROM, 3 = GNROM, 4 = MMC (any).
+    uint8_t titleEncoding; // $FFF6. 0 = No title entered, 1 = ASCII, 2 = Another encoding.
+    uint8_t titleLen;      // $FFF7. Valid Title Length - 1. 0 if no title entered.
+    uint8_t makerCode;     // $FFF8. The same used for the FDS, GB, GBC and SNES headers:
+                           //        1 = Nintendo, 2-254 = everyone else. 255 must be reserved.
+    uint8_t validation;    // $FFF9. Header Validation Byte. 8-bit checksum of $FFF2-$FFF9 should = 0.
+} NintendoHeader;
+
+bool GetNintendoHeader(const uint8_t* header, NintendoHeader* nh);
+size_t GetNintendoHeaderOffset(const NESInfo* info, size_t file_size);
+
+// PRG/CHR byte sums to verify the Nintendo header checksums against
+typedef struct {
+    uint16_t PRGSum;        // Without the two PRG checksum bytes
+    uint16_t CHRSum;
+    bool hasCHR;
+} NintendoSums;
+
+
+// ROM regions
+
+enum {
+    REGION_FILE,
+    REGION_ROM,
+    REGION_TRAINER,
+    REGION_PRG,
+    REGION_CHR,
+    REGION_MISC,
+    REGION_COUNT
+};
+
+typedef struct {
+    bool isShown[REGION_COUNT];   // Region has a section in the report
+    bool isPresent[REGION_COUNT]; // Region data is entirely in the file
+    size_t offset[REGION_COUNT];
+    size_t size[REGION_COUNT];
+} ROMLayout;
+
+ROMLayout GetROMLayout(const NESInfo* info, size_t file_size);
+
+
+// Hashes
+
+enum {
+    HASH_CRC32 = 1 << 0,
+    HASH_MD5   = 1 << 1,
+    HASH_SHA1  = 1 << 2,
+    HASH_ALL   = HASH_CRC32 | HASH_MD5 | HASH_SHA1,
+    HASH_SUM16 = 1 << 3,    // Byte sum, not in HASH_ALL
+    HASH_BANKS = 1 << 4     // Per-bank fingerprints, not in HASH_ALL
+};
+
+#define BANK_SIZE       (8 * 1024)
+#define SMALL_BANK_SIZE (1 * 1024)
+
+// Per-bank XXH64 fingerprints of a PRG or CHR region (--bank-index).
+// The caller provides the arrays and sets the counts; only full banks count.
+typedef struct {
+    uint64_t* banks;        // Each 8 KiB bank
+    uint64_t* smallBanks;   // Each 1 KiB bank, NULL if not wanted
+    size_t count;
+    size_t smallCount;
+} BankHashes;
+
+typedef struct {
+    uint32_t crc;
+    uint8_t md5[16];
+    uint8_t sha1[20];
+    uint16_t sum16;
+    BankHashes* banks;      // HASH_BANKS: set by the caller, filled in place
+} HashResult;
+
+uint64_t ByteSum(uint64_t sum, const uint8_t* data, size_t size);
+void ComputeHashes(const uint8_t* src, size_t size, unsigned hashes, HashResult* result);
+void SHA1_to_hex(const uint8_t hash[20], char str[41]);
+
+
+// NES 2.0 XML Database
+
+extern uint8_t* g_nes20db;
+extern size_t g_nes20db_size;
+
+// Element an entry comes from
+enum {
+    DB_KIND_OTHER,
+    DB_KIND_ROM,         // PRG + CHR (+ misc), without header and trainer
+    DB_KIND_PRG,
+    DB_KIND_CHR,
+    DB_KIND_TRAINER,
+    DB_KIND_MISC,
+};
+
+// Index of all ROM parts (rom, prgrom, chrrom, ...) with a hash
+typedef struct {
+    uint32_t crc32;
+    uint32_t game;       // Index in NES20DBIndex.games
+    uint64_t size;
+    uint8_t sha1[20];
+    bool hasCRC32;
+    bool hasSHA1;
+    uint8_t kind;        // DB_KIND_*
+} DBEntry;
+
+typedef struct {
+    const uint8_t* name; // Points into g_nes20db, not terminated
+    uint32_t nameLen;
+    const uint8_t* xml;  // <game> ... </game>
+    uint32_t xmlLen;
+} DBGame;
+
+typedef struct {
+    DBEntry* entries;    // Sorted by CRC32, size
+    uint32_t* bySHA1;    // Entry indices sorted by SHA-1
+    size_t entryCount;
+    uint64_t maxCHRSize; // Largest chrrom entry
+    DBGame* games;
+    size_t gameCount;
+} NES20DBIndex;
+
+extern NES20DBIndex g_db;
+void OpenNES20DB(void);
+void CloseNES20DB(void);
+bool BuildNES20DBIndex(void);
+void PrintDBGameName(const DBGame* game);
+size_t PrintNES20DB(const uint8_t sha1[20]);
+void PrintIdentify(const uint8_t* source, size_t file_size);
+const DBEntry* FindDBEntryCRC(uint32_t crc32, uint64_t size);
+size_t FindDBEntrySHA1(const uint8_t sha1[20]);
+uint64_t GetDBGameValue(const DBGame* game, const char* element, const char* attr, uint64_t def);
+bool GetDBGameHeader(const DBGame* game, uint8_t header[HEADER_SIZE]);
+// Upper or lower case hex, exactly `len` digits
+bool ParseHex(const uint8_t* s, size_t len, uint8_t* out);
+uint8_t* bytes_find(
+    const uint8_t* data,
+    size_t data_len,
+    const uint8_t* sub,
+    size_t sub_len);
+uint8_t* bytes_rfind(
+    const uint8_t* data,
+    size_t data_len,
+    const uint8_t* sub,
+    size_t sub_len);
@@ -0,0 +1,41 @@
+#pragma once
+
+// USDT probes, provider "nesinfo", for bpftrace / perf / systemtap:
+//
+//   file_start(path)                 file_end(path, ok)
+//   hash_start(region, size)         hash_end(region, size)
+//   db_lookup_start(kind)            db_lookup_end(kind, hit)
+//   output_flush(size)
+//
+// region is the padded region name ("PRG ROM"), kind is "crc32" or "sha1".
+// With sys/sdt.h each probe is a single nop plus an ELF note; without it, or
+// with NESINFO_NO_PROBES, the macros expand to nothing.
+//
+//   bpftrace -e 'usdt:./nesinfo.exe:nesinfo:hash_start { @s[tid] = nsecs; }
+//       usdt:./nesinfo.exe:nesinfo:hash_end /@s[tid]/ { @ns = hist(nsecs - @s[tid]); }'
+
+#if !defined(NESINFO_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define NESINFO_PROBES
+#endif
+#endif
+
+#ifdef NESINFO_PROBES
+#define PROBE_FILE_START(path)              DTRACE_PROBE1(nesinfo, file_start, path)
+#define PROBE_FILE_END(path, ok)            DTRACE_PROBE2(nesinfo, file_end, path, ok)
+#define PROBE_HASH_START(region, size)      DTRACE_PROBE2(nesinfo, hash_start, region, size)
+#define PROBE_HASH_END(region, size)        DTRACE_PROBE2(nesinfo, hash_end, region, size)
+#define PROBE_DB_LOOKUP_START(kind)         DTRACE_PROBE1(nesinfo, db_lookup_start, kind)
+#define PROBE_DB_LOOKUP_END(kind, hit)      DTRACE_PROBE2(nesinfo, db_lookup_end, kind, hit)
+#define PROBE_OUTPUT_FLUSH(size)            DTRACE_PROBE1(nesinfo, output_flush, size)
+#else
+// Arguments are still "used", so values computed only for a probe don't warn
+#define PROBE_FILE_START(path)              ((void)(path))
+#define PROBE_FILE_END(path, ok)            ((void)(path), (void)(ok))
+#define PROBE_HASH_START(region, size)      ((void)(region), (void)(size))
+#define PROBE_HASH_END(region, size)        ((void)(region), (void)(size))
+#define PROBE_DB_LOOKUP_START(kind)         ((void)(kind))
+#define PROBE_DB_LOOKUP_END(kind, hit)      ((void)(kind), (void)(hit))
+#define PROBE_OUTPUT_FLUSH(size)            ((void)(size))
+#endif